@@ -5,6 +5,7 @@
 #include "cinder/TriMesh.h"
 #include <glm/gtx/intersect.hpp>
 #include "cinder/params/Params.h"
+#include "../../PT/include/ptTrace.h"
 
 using namespace ci;
 using namespace ci::app;
@@ -68,6 +69,9 @@ private:
 
 void LightFieldsClassics::setup()
 {
+    /* PT_TRACE=<file> writes the timeline of the light field load there */
+    pt::trace_enable_from_env();
+    
     mViewerPosition = vec3(0,0,1.2f);
     mViewerFOV = 45.0f;
     
@@ -107,10 +111,20 @@ void LightFieldsClassics::setup()
         
     });
     
-    auto img = loadImage(loadAsset("dragon-uv.jpg"));
-    mLightfieldTex = gl::Texture2d::create(img);
+    ImageSourceRef img;
+    {
+        pt::TraceScope span("load image", "io");
+        img = loadImage(loadAsset("dragon-uv.jpg"));
+    }
+    {
+        /* decoding may be deferred until the texture reads the pixels, then it lands here */
+        pt::TraceScope span("upload texture", "gl");
+        mLightfieldTex = gl::Texture2d::create(img);
+    }
     mLightfieldTex->setWrap(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
     
+    pt::trace_write_env();
+    
     gl::Fbo::Format format;
     format.setSamples(2);
     mFbo = gl::Fbo::create(getWindowHeight(), getWindowHeight(), format.depthTexture());
@@ -4,6 +4,7 @@
 #include "cinder/CameraUi.h"
 #include "cinder/TriMesh.h"
 #include <glm/gtx/intersect.hpp>
+#include "../../PT/include/ptTrace.h"
 
 using namespace ci;
 using namespace ci::app;
@@ -98,6 +99,9 @@ private:
 
 void LightFieldsVizApp::setup()
 {
+    /* PT_TRACE=<file> writes the timeline of the sample loads there */
+    pt::trace_enable_from_env();
+    
     lfd.st.x_samples = 16; lfd.st.y_samples = 16;
     lfd.uv.x_samples = 820; lfd.uv.y_samples = 820;
     lfd.st.scale = 2.0f; lfd.st.z = 0.0f;
@@ -143,8 +147,16 @@ void LightFieldsVizApp::setup()
             //ss << setfill('0') << setw(2) << f;
             ss << lfd.dir << lfd.basename << t << "_t_" << s << lfd.ext;
             std::string file = ss.str();
-            auto img = loadImage(loadAsset(file));
-            lfd.samples.push_back(gl::Texture2d::create(img));
+            ImageSourceRef img;
+            {
+                pt::TraceScope span("load image", "io", "sample", f);
+                img = loadImage(loadAsset(file));
+            }
+            {
+                /* decoding may be deferred until the texture reads the pixels, then it lands here */
+                pt::TraceScope span("upload texture", "gl", "sample", f);
+                lfd.samples.push_back(gl::Texture2d::create(img));
+            }
             f++;
             lfd.shouldRender.push_back(false);
         }
@@ -152,6 +164,8 @@ void LightFieldsVizApp::setup()
     
     shouldUpdate = true;
     
+    pt::trace_write_env();
+    
     updateSceneParams();
     
 }
@@ -0,0 +1,121 @@
+#ifndef MAX_PRIMITIVES
+#define MAX_PRIMITIVES 10
+#endif
+#ifndef MAX_RECURSION
+#define MAX_RECURSION 5
+#endif
+
+#include "random.cl"
+#include "utils.cl"
+#include "geometry.cl"
+#include "rendering.cl"
+
+/*
+ * Adaptive sampling
+ * Each pixel keeps a running mean of its color and the sum of squared differences (m2) of its
+ * luminance in stats (Welford), the number of samples taken is in sample_count.
+ * A pass traces only the pixels in active_pixels, the list is rebuilt after each pass by
+ * flagging the pixels still above the error threshold, scanning the flags (hillis_steele_scan.cl)
+ * and compacting their indices.
+ */
+
+inline float luminance(float3 c)
+{
+  return dot(c, (float3)(0.2126f, 0.7152f, 0.0722f));
+}
+
+inline void welford_add(float4* stats, uint* count, float3 sample)
+{
+  float delta = luminance(sample) - luminance(stats->xyz);
+  *count += 1;
+  stats->xyz += (sample - stats->xyz) / (float)(*count);
+  stats->w += delta * (luminance(sample) - luminance(stats->xyz));
+}
+
+/* standard error of the mean luminance, same as pixel_stats_error */
+inline float pixel_error(float4 stats, uint count)
+{
+  if(count < 2) return MAXFLOAT;
+  return sqrt(stats.w / (float)(count - 1) / (float)count);
+}
+
+__kernel
+void adaptive_path_tracing(__constant struct Camera* cam,
+                           __constant Sphere* primitive_list,
+                           __constant struct Material* material_list,
+                           __constant struct SkyMaterial* sky,
+                           uint primitive_list_size,
+                           __global const uint* active_pixels,
+                           uint active_count,
+                           __global float4* stats,
+                           __global uint* sample_count,
+                           uint width,
+                           uint height,
+                           uint samples,
+                           uint seed)
+{
+  uint gid = get_global_id(0);
+  if(gid >= active_count) return;
+
+  uint p = active_pixels[gid];
+  int2 coord = (int2)(p % width, p / width);
+
+  float4 s = stats[p];
+  uint n = sample_count[p];
+
+  /* continue the pixel's random stream across passes */
+  uint rng_state = hash2(hash2(coord.x, coord.y) + seed, n);
+
+  float2 xy = convert_float2(coord);
+  float2 wh = (float2)(width, height);
+
+  uint count = min(primitive_list_size, (uint)(MAX_PRIMITIVES));
+
+  Ray ray;
+
+  for(uint i = 0; i < samples; ++i)
+  {
+    ray = camera_ray(cam, (xy + sample_unit_2D(&rng_state)) / wh, &rng_state);
+    welford_add(&s, &n, radiance_iterative(&ray, primitive_list, material_list, count, &rng_state, sky));
+  }
+
+  stats[p] = s;
+  sample_count[p] = n;
+}
+
+/* flags must hold the pixel count rounded up to the work group size */
+__kernel
+void adaptive_flag(__global const float4* stats,
+                   __global const uint* sample_count,
+                   __global int* flags,
+                   uint pixel_count,
+                   float threshold)
+{
+  uint i = get_global_id(0);
+  flags[i] = (i < pixel_count && pixel_error(stats[i], sample_count[i]) > threshold) ? 1 : 0;
+}
+
+/* scan is the inclusive scan of the flags, so a flagged pixel goes to scan[i] - 1 */
+__kernel
+void adaptive_compact(__global const float4* stats,
+                      __global const uint* sample_count,
+                      __global const int* scan,
+                      __global uint* active_pixels,
+                      uint pixel_count,
+                      float threshold)
+{
+  uint i = get_global_id(0);
+
+  if(i < pixel_count && pixel_error(stats[i], sample_count[i]) > threshold)
+    active_pixels[scan[i] - 1] = i;
+}
+
+__kernel
+void adaptive_resolve(__global const float4* stats,
+                      write_only image2d_t out_buffer,
+                      uint width)
+{
+  int2 coord = (int2)(get_global_id(0), get_global_id(1));
+  float3 c = stats[coord.y * width + coord.x].xyz;
+  write_imagef(out_buffer, coord, (float4)(to32F_C1_gamma(c.x), to32F_C1_gamma(c.y), to32F_C1_gamma(c.z), 1.0f));
+}
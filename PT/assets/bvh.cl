@@ -0,0 +1,263 @@
+#ifndef __CL_BVH_H__
+#define __CL_BVH_H__
+
+#include "geometry.cl"
+#include "counters.cl"
+
+/* deepest path of BVH<T>::build is MaxDepth */
+#define BVH_STACK_SIZE 64
+
+/*
+ * The scene arrays of ptScene.h: spheres then triangles make one primitive index space,
+ * prim_indices is the leaf order of the BVH nodes and prim_materials the material of every primitive.
+ *
+ * With PT_INSTANCES the nodes from 0 are the top level BVH over instances, its leaves index instances through
+ * prim_indices, and the BVH of every instanced geometry follows with its own nodes and leaf order (scene_pack_instances).
+ */
+typedef struct SceneArrays
+{
+  __global const BVHNode*  nodes;
+  __global const uint*     prim_indices;
+  __global const Sphere*   spheres;
+  __global const Triangle* triangles;
+  __global const uint*     prim_materials;
+  __global const Instance* instances;
+  uint                     sphere_count;
+} SceneArrays;
+
+/* sphere_intersect for spheres in global memory, hits before t_far only */
+static bool scene_sphere_intersect(__global const Sphere* sphere, Ray* ray, float t_far, float* t_out)
+{
+  float3 sphere_to_o = ray->origin - sphere->xyz;
+  float a = dot(ray->dir, ray->dir);
+  float b = dot(sphere_to_o, ray->dir);
+  float c = dot(sphere_to_o, sphere_to_o) - sphere->w * sphere->w;
+  float det = b * b - a * c;
+
+  if(det > 0)
+  {
+    *t_out = (-b - sqrt(det)) / a;
+    if (*t_out > t_min && *t_out < t_far) return true;
+
+    *t_out = (-b + sqrt(det)) / a;
+    if (*t_out > t_min && *t_out < t_far) return true;
+  }
+
+  return false;
+}
+
+/* Moller-Trumbore, as Triangle<T>::intersect_simple */
+static bool scene_triangle_intersect(__global const Triangle* tri, Ray* ray, float t_far, float* t_out)
+{
+  float3 e1 = tri->e1.xyz;
+  float3 e2 = tri->e2.xyz;
+  float3 p = cross(ray->dir, e2);
+  float det = dot(e1, p);
+
+  if(fabs(det) < FLT_EPSILON) return false;
+
+  float inv_det = 1.0f / det;
+  float3 s = ray->origin - tri->v0.xyz;
+  float b1 = dot(s, p) * inv_det;
+  if(b1 < 0.0f || b1 > 1.0f) return false;
+
+  float3 q = cross(s, e1);
+  float b2 = dot(ray->dir, q) * inv_det;
+  if(b2 < 0.0f || b1 + b2 > 1.0f) return false;
+
+  *t_out = dot(e2, q) * inv_det;
+  return (*t_out > t_min && *t_out < t_far);
+}
+
+/* Entry distance of the ray in the box of node if it enters before t_far, -1 otherwise */
+static float bvh_node_entry(__global const BVHNode* node, float3 origin, float3 inv_dir, float t_far)
+{
+  float3 t0 = ((float3)(node->bmin[0], node->bmin[1], node->bmin[2]) - origin) * inv_dir;
+  float3 t1 = ((float3)(node->bmax[0], node->bmax[1], node->bmax[2]) - origin) * inv_dir;
+  float3 lo = fmin(t0, t1);
+  float3 hi = fmax(t0, t1);
+
+  float enter = fmax(t_min, fmax(lo.x, fmax(lo.y, lo.z)));
+  float leave = fmin(t_far, fmin(hi.x, fmin(hi.y, hi.z)));
+
+  return (enter <= leave) ? enter : -1.0f;
+}
+
+static bool scene_primitive_intersect(const SceneArrays* scene, uint prim, Ray* ray, float t_far, float* t_out)
+{
+  if(prim < scene->sphere_count)
+    return scene_sphere_intersect(&scene->spheres[prim], ray, t_far, t_out);
+
+  return scene_triangle_intersect(&scene->triangles[prim - scene->sphere_count], ray, t_far, t_out);
+}
+
+/*
+ * Closest hit in the BVH from node root, same traversal as BVH<T>::traverse: nearer child first,
+ * boxes behind the closest hit skipped. Hits before *t_far only, which is lowered to the hit.
+ */
+static bool bvh_intersect(const SceneArrays* scene, int root, Ray* ray, float* t_far, uint* idx_t, PathCounters* counters)
+{
+  bool has_hit = false;
+  float temp_t;
+  float3 inv_dir = 1.0f / ray->dir;
+
+  int stack[BVH_STACK_SIZE];
+  int top = 0;
+
+  if(bvh_node_entry(&scene->nodes[root], ray->origin, inv_dir, *t_far) >= 0.0f) stack[top++] = root;
+
+  while(top > 0)
+  {
+    __global const BVHNode* node = &scene->nodes[stack[--top]];
+
+    if(node->count > 0)
+    {
+      PT_COUNT(counters, PT_COUNTER_INTERSECTION_TESTS, node->count);
+
+      for(int i = node->left_first; i < node->left_first + node->count; ++i)
+      {
+        uint prim = scene->prim_indices[i];
+
+        if(scene_primitive_intersect(scene, prim, ray, *t_far, &temp_t))
+        {
+          has_hit = true;
+          *idx_t = prim;
+          *t_far = temp_t;
+        }
+      }
+
+      continue;
+    }
+
+    int left = node->left_first;
+    float enter_left = bvh_node_entry(&scene->nodes[left], ray->origin, inv_dir, *t_far);
+    float enter_right = bvh_node_entry(&scene->nodes[left + 1], ray->origin, inv_dir, *t_far);
+
+    if(enter_left >= 0.0f && enter_right >= 0.0f)
+    {
+      bool left_near = enter_left <= enter_right;
+      stack[top++] = left_near ? left + 1 : left;
+      stack[top++] = left_near ? left : left + 1;
+    }
+    else if(enter_left >= 0.0f) stack[top++] = left;
+    else if(enter_right >= 0.0f) stack[top++] = left + 1;
+  }
+
+  return has_hit;
+}
+
+#ifdef PT_INSTANCES
+
+static float3 instance_transform(__global const Instance* instance, float4 v)
+{
+  return (float3)(dot(instance->to_object[0], v), dot(instance->to_object[1], v), dot(instance->to_object[2], v));
+}
+
+/*
+ * Closest hit through the top level BVH, then the BVH of every instance entered with the ray in object space.
+ * The direction is not normalized so t is the same in both spaces, as Instance<T>::intersect
+ */
+static bool scene_intersect(const SceneArrays* scene, Ray* ray, float* t_out, uint* idx_t, uint* instance_t, PathCounters* counters)
+{
+  bool has_hit = false;
+  float t_far = t_max;
+  float3 inv_dir = 1.0f / ray->dir;
+
+  int stack[BVH_STACK_SIZE];
+  int top = 0;
+
+  if(bvh_node_entry(&scene->nodes[0], ray->origin, inv_dir, t_far) >= 0.0f) stack[top++] = 0;
+
+  while(top > 0)
+  {
+    __global const BVHNode* node = &scene->nodes[stack[--top]];
+
+    if(node->count > 0)
+    {
+      PT_COUNT(counters, PT_COUNTER_INTERSECTION_TESTS, node->count);
+
+      for(int i = node->left_first; i < node->left_first + node->count; ++i)
+      {
+        uint inst = scene->prim_indices[i];
+        __global const Instance* instance = &scene->instances[inst];
+
+        Ray local;
+        local.origin = instance_transform(instance, (float4)(ray->origin, 1.0f));
+        local.dir = instance_transform(instance, (float4)(ray->dir, 0.0f));
+
+        if(bvh_intersect(scene, (int)instance->root, &local, &t_far, idx_t, counters))
+        {
+          has_hit = true;
+          *instance_t = inst;
+        }
+      }
+
+      continue;
+    }
+
+    int left = node->left_first;
+    float enter_left = bvh_node_entry(&scene->nodes[left], ray->origin, inv_dir, t_far);
+    float enter_right = bvh_node_entry(&scene->nodes[left + 1], ray->origin, inv_dir, t_far);
+
+    if(enter_left >= 0.0f && enter_right >= 0.0f)
+    {
+      bool left_near = enter_left <= enter_right;
+      stack[top++] = left_near ? left + 1 : left;
+      stack[top++] = left_near ? left : left + 1;
+    }
+    else if(enter_left >= 0.0f) stack[top++] = left;
+    else if(enter_right >= 0.0f) stack[top++] = left + 1;
+  }
+
+  *t_out = t_far;
+  return has_hit;
+}
+
+#else
+
+/* Closest hit of the scene BVH, instance_t is left alone */
+static bool scene_intersect(const SceneArrays* scene, Ray* ray, float* t_out, uint* idx_t, uint* instance_t, PathCounters* counters)
+{
+  *t_out = t_max;
+  return bvh_intersect(scene, 0, ray, t_out, idx_t, counters);
+}
+
+#endif
+
+static float3 scene_primitive_normal(const SceneArrays* scene, uint prim, float3 point)
+{
+  if(prim < scene->sphere_count)
+  {
+    float4 sphere = scene->spheres[prim];
+    return normalize((point - sphere.xyz) / sphere.w);
+  }
+
+  __global const Triangle* tri = &scene->triangles[prim - scene->sphere_count];
+  return normalize(cross(tri->e1.xyz, tri->e2.xyz));
+}
+
+/* Normal of a hit of scene_intersect, in world space */
+static float3 scene_normal_at(const SceneArrays* scene, uint instance_idx, uint prim, float3 point)
+{
+#ifdef PT_INSTANCES
+  __global const Instance* instance = &scene->instances[instance_idx];
+  float3 n = scene_primitive_normal(scene, prim, instance_transform(instance, (float4)(point, 1.0f)));
+
+  /* through the transpose of the linear part of to_object, as Transform<T>::normalFromInverse */
+  return normalize(n.x * instance->to_object[0].xyz + n.y * instance->to_object[1].xyz + n.z * instance->to_object[2].xyz);
+#else
+  return scene_primitive_normal(scene, prim, point);
+#endif
+}
+
+/* Material index of a hit of scene_intersect */
+static uint scene_material_at(const SceneArrays* scene, uint instance_idx, uint prim)
+{
+#ifdef PT_INSTANCES
+  int material = scene->instances[instance_idx].material;
+  if(material >= 0) return (uint)material;
+#endif
+  return scene->prim_materials[prim];
+}
+
+#endif //__CL_BVH_H__
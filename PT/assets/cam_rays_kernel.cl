@@ -10,6 +10,7 @@
 #include "utils.cl"
 #include "geometry.cl"
 #include "rendering.cl"
+#include "packing.cl"
 
 /*
  * This kernel generates n rays and write them into a buffer
@@ -33,7 +34,7 @@
 __kernel
 void cam_rays_kernel(__global float3* out_ray_origin_buffer,
                      __global float3* out_ray_dir_buffer,
-                     __constant struct PinholeCamera* cam,
+                     __constant struct Camera* cam,
                      uint width,
                      uint height,
                      uint samples)
@@ -94,6 +95,85 @@ void path_tracing(__global float3* out_buffer,
   // out_buffer[i] = (float3)(to32F_C1_gamma(out_color.r), to32F_C1_gamma(out_color.g), to32F_C1_gamma(out_color.b));
 }
 
+/*
+ * One ray per pixel of any camera (camera_ray), its seed hash2(x, y) draws the jitter in x, then y, then the lens point:
+ * the ray of Camera<T>::getRay for an XORUniformRNG seeded the same way (test_camera_rays)
+ */
+__kernel
+void camera_rays(__global Ray* out_rays,
+                 __constant struct Camera* cam,
+                 uint width,
+                 uint height)
+{
+  uint i = get_global_id(0);
+  if(i >= width * height) return;
+
+  uint y = i / width;
+  uint x = i - y * width;
+
+  uint seed = hash2(x, y);
+
+  float2 uv;
+  uv.x = ((float)x + sample_unit_1D(&seed)) / (float)width;
+  uv.y = ((float)y + sample_unit_1D(&seed)) / (float)height;
+
+  out_rays[i] = camera_ray(cam, uv, &seed);
+}
+
+/*
+ * Same rays as cam_rays_kernel, in 4 bytes instead of 32: the octahedral encoded direction only,
+ * the origin is the camera one (see unpack_cam_ray), so pinhole cameras only
+ */
+__kernel
+void cam_rays_kernel_packed(__global uint* out_ray_dir_buffer,
+                            __constant struct Camera* cam,
+                            uint width,
+                            uint height,
+                            uint samples)
+{
+  uint i = get_global_id(0);
+  uint px_idx = i / samples;
+  uint y = px_idx / width;
+  uint x = px_idx - y * width;
+
+  uint seed = hash2(x, y);
+
+#ifdef INVERT
+  float2 uv = (float2)(((float)x + sample_unit_1D(&seed)) / (float)width, 1.0f - ((float)y + sample_unit_1D(&seed)) / (float)height);
+#else
+  float2 uv = (float2)(((float)x + sample_unit_1D(&seed)) / (float)width, ((float)y + sample_unit_1D(&seed)) / (float)height);
+#endif
+
+  float3 dir = cam->lower_left + uv.x * cam->hor + uv.y * cam->ver - cam->origin;
+
+  out_ray_dir_buffer[i] = oct_encode(dir);
+}
+
+/*
+ * path_tracing over packed camera rays, the radiance goes out as half4: 4 bytes in and 8 out per ray instead of 32 and 16
+ */
+__kernel
+void path_tracing_packed(__global half* out_buffer,
+  __global const uint* in_ray_dir_buffer,
+  __constant struct Camera* cam,
+  __constant struct Sphere* primitive_list,
+  __constant struct Material* material_list,
+  __constant struct SkyMaterial* sky,
+  uint primitive_list_size,
+  float weigth)
+{
+  int i = get_global_id(0);
+
+  Ray ray = unpack_cam_ray(cam, in_ray_dir_buffer[i]);
+
+  uint seed = hash(i);
+
+  uint count = min(primitive_list_size, (uint)(MAX_PRIMITIVES));
+  float3 out_color = weigth * radiance_iterative(&ray, primitive_list, material_list, count, &seed, sky);
+
+  store_half3(out_color, i, out_buffer);
+}
+
 // /*
 //  * Gather a width x height x samples buffer into a width x height image
 //  */
@@ -0,0 +1,44 @@
+#ifndef __CL_COUNTERS_H__
+#define __CL_COUNTERS_H__
+
+#include "pt_counters.h"
+
+/*
+ * Render counters of programs built with -D PT_COUNTERS. A work item counts in a private PathCounters
+ * and adds it once to the debug buffer with counters_flush, so the atomics run once per work item,
+ * not once per ray. The buffer holds two uints per counter, low word first (cl_read_counters in ptCL.h).
+ * Without PT_COUNTERS PT_COUNT is empty and the private counters are dead code.
+ */
+typedef struct PathCounters
+{
+  uint v[PT_COUNTER_COUNT];
+} PathCounters;
+
+#ifdef PT_COUNTERS
+#define PT_COUNT(counters, id, n) ((counters)->v[id] += (uint)(n))
+#define PT_COUNTERS_KERNEL_ARG , __global uint* debug_counters
+#else
+#define PT_COUNT(counters, id, n)
+#define PT_COUNTERS_KERNEL_ARG
+#endif
+
+static void counters_init(PathCounters* counters)
+{
+  for(int i = 0; i < PT_COUNTER_COUNT; ++i)
+    counters->v[i] = 0;
+}
+
+/* 64 bit add out of two 32 bit atomics: the old low word tells whether the add wrapped */
+static void counters_flush(PathCounters* counters, __global uint* buffer)
+{
+  for(int i = 0; i < PT_COUNTER_COUNT; ++i)
+  {
+    uint n = counters->v[i];
+    if(n == 0) continue;
+
+    uint lo = atomic_add(&buffer[2 * i], n);
+    if(lo + n < lo) atomic_inc(&buffer[2 * i + 1]);
+  }
+}
+
+#endif //__CL_COUNTERS_H__
@@ -4,40 +4,16 @@
 #define t_min 1e-4f
 #define t_max 0x1.fffffep+127f
 
-/*
- * A parametric line of the form P(t) = origin + t * dir
- */
-typedef struct Ray
-{
-  float3 origin;
-  float3 dir;
-} Ray;
-
-/*
- * All we need to model a simple pinhole camera
- */
-typedef struct PinholeCamera
-{
-  float3 origin;
-  float3 lower_left;
-  float3 hor;
-  float3 ver;
-} PinholeCamera;
-
-typedef float4 Sphere; //center radius
-
-// typedef struct Sphere
-// {
-//   float3 center;
-//   float radius;
-// } Sphere;
+#include "pt_types.h"
+#include "pt_optics.h"
+#include "random.cl"
 
 static float3 ray_pointat(Ray* ray, float t)
 {
   return ray->origin + t * ray->dir;
 }
 
-inline Ray pinhole_cam_ray(__constant PinholeCamera* cam, float2 uv)
+inline Ray pinhole_cam_ray(__constant Camera* cam, float2 uv)
 {
     Ray ray;
     ray.origin = cam->origin;
@@ -45,6 +21,47 @@ inline Ray pinhole_cam_ray(__constant PinholeCamera* cam, float2 uv)
     return ray;
 }
 
+/* Depth of field, as LensCamera<T>::getRay: the same seed gives the same lens point */
+inline Ray thin_lens_cam_ray(__constant Camera* cam, float2 uv, uint* seed)
+{
+    float2 rd = cam->lens_radius * sample_unit_disk(seed);
+    float3 offset = cam->u * rd.x + cam->v * rd.y;
+
+    Ray ray;
+    ray.origin = cam->origin + offset;
+    ray.dir    = normalize(cam->lower_left + uv.x * cam->hor + uv.y * cam->ver - cam->origin - offset);
+    return ray;
+}
+
+inline Ray equirect_cam_ray(__constant Camera* cam, float2 uv)
+{
+    float phi = (uv.x - 0.5f) * cam->longitude;
+    float theta = (uv.y - 0.5f) * cam->latitude;
+
+    Ray ray;
+    ray.origin = cam->origin;
+    ray.dir    = cos(theta) * (sin(phi) * cam->u - cos(phi) * cam->w) + sin(theta) * cam->v;
+    return ray;
+}
+
+/*
+ * Ray of cam through uv, in [0,1]^2 from the lower left corner of the image. Only the thin lens draws from seed.
+ * Build with -D PT_CAMERA=CAM_PINHOLE (or another type) to compile in one generator and skip the switch on cam->type.
+ */
+inline Ray camera_ray(__constant Camera* cam, float2 uv, uint* seed)
+{
+#ifdef PT_CAMERA
+  const int type = PT_CAMERA;
+#else
+  const int type = cam->type;
+#endif
+
+  if(type == CAM_THIN_LENS) return thin_lens_cam_ray(cam, uv, seed);
+  if(type == CAM_EQUIRECT) return equirect_cam_ray(cam, uv);
+
+  return pinhole_cam_ray(cam, uv);
+}
+
 static bool sphere_intersect(__constant Sphere* sphere, Ray* ray, float* t_out)
 {
     float3 sphere_to_o = ray->origin - sphere->xyz;
@@ -96,9 +113,4 @@ static bool sphere_list_intersect(__constant Sphere* primitive_list,
     return has_hit;
 }
 
-static float3 pt_reflect(float3 l, float3 n)
-{
-  return normalize(l - 2.0f * dot(l, n) * n);
-}
-
 #endif //__CL_GEOMETRY_H__
@@ -58,7 +58,8 @@ void hillis_steele_scan(__global int* data, __local int* scratch_data)
   /*
    * Copy data from global to shared memory
    */
-  scratch_data[local_idx] = data[global_idx];
+  int value = data[global_idx];
+  scratch_data[local_idx] = value;
   barrier(CLK_LOCAL_MEM_FENCE);
 
 #ifndef SCAN_INCLUSIVE
@@ -103,7 +104,25 @@ void hillis_steele_scan(__global int* data, __local int* scratch_data)
     sum[global_idx / block_size] = scratch_data[local_idx];
 #else
     // In an exclusive scan, the sum of the block is second to last + last
-    sum[global_idx / block_size] = scratch_data[local_idx] + data[global_idx];
+    // data[global_idx] has been overwritten by now, use the value read at the beginning
+    sum[global_idx / block_size] = scratch_data[local_idx] + value;
 #endif
   }
 }
+
+/*
+ * This kernel performs the last step in a multi-block scan
+ * sum holds the scanned block sums, each block adds the sum of all blocks before it
+ */
+__kernel
+void hillis_steele_add_block_sums(__global int* data, __global const int* sum)
+{
+  int block_idx = get_group_id(0);
+
+#ifdef SCAN_INCLUSIVE
+  if(block_idx > 0)
+    data[get_global_id(0)] += sum[block_idx - 1];
+#else
+  data[get_global_id(0)] += sum[block_idx];
+#endif
+}
@@ -4,22 +4,6 @@
 #include "random.cl"
 #include "geometry.cl"
 
-#define MAT_LAMBERTIAN  1
-#define MAT_DIALECTRIC  2
-#define MAT_METALLIC    3
-
-typedef struct Material
-{
-  float4 albedo;
-  char   type;
-} Material;
-
-typedef struct SkyMaterial
-{
-  float3 bottom;
-  float3 top;
-} SkyMaterial;
-
 static bool material_scatter_lambertian(__constant Material* mat,
   Ray* ray_in,
   float3 hit_point,
@@ -48,6 +32,35 @@ static bool material_scatter_metallic(__constant Material* mat,
   return (dot(ray_out->dir, hit_normal) > 0);
 }
 
+/* albedo.w is the refraction index, see pt_dielectric in pt_optics.h */
+static bool material_scatter_dialectric(__constant Material* mat,
+  Ray* ray_in,
+  float3 hit_point,
+  float3 hit_normal,
+  uint *seed,
+  float3* attenuation_out,
+  Ray* ray_out)
+{
+  float3 reflected, refracted;
+  float reflect_prob;
+
+  ray_out->origin = hit_point;
+  *attenuation_out = (float3)(1.0f, 1.0f, 1.0f);
+
+  if(pt_dielectric(ray_in->dir, hit_normal, mat->albedo.s3, &reflected, &refracted, &reflect_prob))
+    ray_out->dir = (sample_unit_1D(seed) < reflect_prob) ? reflected : refracted;
+  else
+    ray_out->dir = reflected;
+
+  return true;
+}
+
+/* Radiance an emissive material gives off, nothing for the others. Emissive materials do not scatter */
+static float3 material_emission(__constant Material* mat)
+{
+  return (mat->type == MAT_EMISSIVE) ? mat->albedo.rgb : (float3)(0.0f, 0.0f, 0.0f);
+}
+
 static bool material_scatter(__constant Material* mat,
   Ray* ray_in,
   float3 hit_point,
@@ -64,6 +77,10 @@ static bool material_scatter(__constant Material* mat,
   {
     return material_scatter_metallic(mat, ray_in, hit_point, hit_normal, seed, attenuation_out, ray_out);
   }
+  else if(mat->type == MAT_DIALECTRIC)
+  {
+    return material_scatter_dialectric(mat, ray_in, hit_point, hit_normal, seed, attenuation_out, ray_out);
+  }
 
   return false;
 }
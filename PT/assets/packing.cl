@@ -0,0 +1,84 @@
+#ifndef __CL_PACKING_H__
+#define __CL_PACKING_H__
+
+#include "pt_types.h"
+#include "geometry.cl"
+
+/*
+ * Octahedral encoding of unit vectors in 32 bits: project on the octahedron, unfold the lower half
+ * over the upper one and quantize both coordinates to snorm16. Worst case error is around 1e-4 rad.
+ * Must match cl_oct_encode and cl_oct_decode in ptCL.h bit for bit.
+ */
+static float2 oct_wrap(float2 v)
+{
+  return (float2)((1.0f - fabs(v.y)) * (v.x >= 0.0f ? 1.0f : -1.0f),
+                  (1.0f - fabs(v.x)) * (v.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+static uint oct_encode(float3 n)
+{
+  n /= fabs(n.x) + fabs(n.y) + fabs(n.z);
+  float2 p = (n.z >= 0.0f) ? n.xy : oct_wrap(n.xy);
+  int2 q = convert_int2_rte(clamp(p, -1.0f, 1.0f) * 32767.0f);
+  return ((uint)q.x & 0xffffu) | (((uint)q.y & 0xffffu) << 16);
+}
+
+static float3 oct_decode(uint e)
+{
+  float2 p = (float2)((float)(short)(e & 0xffffu), (float)(short)(e >> 16)) * (1.0f / 32767.0f);
+  float3 n = (float3)(p.x, p.y, 1.0f - fabs(p.x) - fabs(p.y));
+  float t = max(-n.z, 0.0f);
+  n.x += (n.x >= 0.0f) ? -t : t;
+  n.y += (n.y >= 0.0f) ? -t : t;
+  return normalize(n);
+}
+
+static PackedRay pack_ray(Ray* ray)
+{
+  PackedRay packed;
+  packed.ox = ray->origin.x;
+  packed.oy = ray->origin.y;
+  packed.oz = ray->origin.z;
+  packed.dir = oct_encode(ray->dir);
+  return packed;
+}
+
+static Ray unpack_ray(PackedRay packed)
+{
+  Ray ray;
+  ray.origin = (float3)(packed.ox, packed.oy, packed.oz);
+  ray.dir = oct_decode(packed.dir);
+  return ray;
+}
+
+/* Camera rays keep only the direction, every ray of a pinhole camera starts at its origin */
+static Ray unpack_cam_ray(__constant Camera* cam, uint dir)
+{
+  Ray ray;
+  ray.origin = cam->origin;
+  ray.dir = oct_decode(dir);
+  return ray;
+}
+
+static PackedHit pack_hit(float t, uint prim, float3 normal)
+{
+  PackedHit packed;
+  packed.t = t;
+  packed.prim = prim;
+  packed.normal = oct_encode(normal);
+  packed.pad = 0;
+  return packed;
+}
+
+/* Throughput and radiance in half precision, w is free for the caller */
+static void store_half3(float3 v, uint i, __global half* stream)
+{
+  vstore_half4((float4)(v, 0.0f), i, stream);
+}
+
+static float3 load_half3(uint i, __global const half* stream)
+{
+  return vload_half4(i, stream).xyz;
+}
+
+#endif //__CL_PACKING_H__
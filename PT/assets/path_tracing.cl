@@ -1,4 +1,6 @@
+#ifndef MAX_PRIMITIVES
 #define MAX_PRIMITIVES 10
+#endif
 #define MAX_RECURSION 5
 //#define INVERT
 
@@ -6,30 +8,24 @@
 #include "utils.cl"
 #include "geometry.cl"
 #include "rendering.cl"
+#include "tonemap.cl"
 
-__kernel
-void path_tracing(__constant struct PinholeCamera* cam,
-                  __constant struct Sphere* primitive_list,
-                  __constant struct Material* material_list,
-                  __constant struct SkyMaterial* sky,
-                  uint primitive_list_size,
-                  write_only image2d_t out_buffer,
-                  uint samples)
+inline float3 trace_pixel(__constant struct Camera* cam,
+                          __constant struct Sphere* primitive_list,
+                          __constant struct Material* material_list,
+                          __constant struct SkyMaterial* sky,
+                          uint count,
+                          int2 coord,
+                          float2 wh,
+                          uint samples,
+                          uint seed,
+                          PathCounters* counters)
 {
-  
-
-  int2 size  = (int2)(get_global_size(0), get_global_size(1));
-  int2 coord = (int2)(get_global_id(0), get_global_id(1));
-
-  uint seed = hash2(coord.x, coord.y);
   float3 out_color = (float3)(0,0,0);
   float weigth = 1.0f / (float)samples;
 
   float2 uv;
   float2 xy = convert_float2(coord);
-  float2 wh = convert_float2(size);
-
-  uint count = min(primitive_list_size, (uint)(MAX_PRIMITIVES));
 
   Ray ray;
 
@@ -39,14 +35,78 @@ void path_tracing(__constant struct PinholeCamera* cam,
 #ifdef INVERT
       uv.y = 1.0f - uv.y;
 #endif
-      ray = pinhole_cam_ray(cam, uv);
-      out_color = fma(weigth, radiance_iterative(&ray, primitive_list, material_list, count, &seed, sky), out_color);
-      // out_color += weigth * radiance_iterative(&ray, primitive_list, material_list, count, &seed, sky), out_color);
+      ray = camera_ray(cam, uv, &seed);
+      out_color = fma(weigth, radiance_iterative_counted(&ray, primitive_list, material_list, count, &seed, sky, counters), out_color);
+      // out_color += weigth * radiance_iterative_counted(&ray, primitive_list, material_list, count, &seed, sky, counters), out_color);
       // out_color += weigth * radiance_iterative_recursion_map(&ray, primitive_list, material_list, count, &seed);
   }
 
+  return out_color;
+}
+
+__kernel
+void path_tracing(__constant struct Camera* cam,
+                  __constant struct Sphere* primitive_list,
+                  __constant struct Material* material_list,
+                  __constant struct SkyMaterial* sky,
+                  uint primitive_list_size,
+                  write_only image2d_t out_buffer,
+                  uint samples)
+{
+  int2 size  = (int2)(get_global_size(0), get_global_size(1));
+  int2 coord = (int2)(get_global_id(0), get_global_id(1));
+
+  uint count = min(primitive_list_size, (uint)(MAX_PRIMITIVES));
+
+  PathCounters unused;
+  float3 out_color = trace_pixel(cam, primitive_list, material_list, sky, count, coord, convert_float2(size), samples, hash2(coord.x, coord.y), &unused);
+
   // uint4 pixel = (uint4)(to8U_C1_gamma(out_color.r), to8U_C1_gamma(out_color.g), to8U_C1_gamma(out_color.b), 255);
   float4 pixel = (float4)(to32F_C1_gamma(out_color.r), to32F_C1_gamma(out_color.g), to32F_C1_gamma(out_color.b), 1.0f);
   //write_imageui(out_buffer, coord, pixel);
   write_imagef(out_buffer, coord, pixel);
 }
+
+/*
+ * Adds samples per pixel to the HDR accumulation buffer of width x height,
+ * xyz is the running mean radiance and w the number of samples behind it, zero it to restart.
+ * Nothing is clamped or gamma corrected here, tonemap.cl turns the buffer into an image.
+ * The global size may be padded to the work group size, frame decorrelates successive frames.
+ * Built with -D PT_COUNTERS it takes the debug counter buffer as one more argument (counters.cl).
+ */
+__kernel
+void path_tracing_accumulate(__constant struct Camera* cam,
+                             __constant struct Sphere* primitive_list,
+                             __constant struct Material* material_list,
+                             __constant struct SkyMaterial* sky,
+                             uint primitive_list_size,
+                             __global float4* accumulation,
+                             uint samples,
+                             uint width,
+                             uint height,
+                             uint frame
+                             PT_COUNTERS_KERNEL_ARG)
+{
+  int2 coord = (int2)(get_global_id(0), get_global_id(1));
+  if(coord.x >= width || coord.y >= height) return;
+
+  uint count = min(primitive_list_size, (uint)(MAX_PRIMITIVES));
+
+  PathCounters counters;
+  counters_init(&counters);
+
+  float3 out_color = trace_pixel(cam, primitive_list, material_list, sky, count, coord, (float2)(width, height), samples, hash2(hash2(coord.x, coord.y), frame), &counters);
+
+#ifdef PT_COUNTERS
+  counters_flush(&counters, debug_counters);
+#endif
+
+  uint i = coord.y * width + coord.x;
+  float4 acc = accumulation[i];
+  float total = acc.w + (float)samples;
+
+  acc.xyz += (out_color - acc.xyz) * ((float)samples / total);
+  acc.w = total;
+
+  accumulation[i] = acc;
+}
@@ -0,0 +1,17 @@
+#ifndef __PT_COUNTERS_H__
+#define __PT_COUNTERS_H__
+
+/*
+ * Indices of the render counters of PT_COUNTERS builds, shared by the host (ptCounters.h)
+ * and the kernels (counters.cl). Rays are all closest hit and shadow queries, shadow rays a part of them.
+ */
+
+#define PT_COUNTER_PATHS              0
+#define PT_COUNTER_RAYS               1
+#define PT_COUNTER_SHADOW_RAYS        2
+#define PT_COUNTER_BOUNCES            3
+#define PT_COUNTER_RR_TERMINATIONS    4
+#define PT_COUNTER_INTERSECTION_TESTS 5
+#define PT_COUNTER_COUNT              6
+
+#endif //__PT_COUNTERS_H__
@@ -0,0 +1,120 @@
+#ifndef __PT_OPTICS_H__
+#define __PT_OPTICS_H__
+
+/*
+ * Reflection, refraction and the dielectric scatter decision, compiled as OpenCL C (geometry.cl, material.cl)
+ * and as C++ templates over the precision (ptGeometry.h, Dialectric<T> in ptMaterial.h).
+ * The random number is drawn by the caller, each side with its own generator.
+ */
+
+#ifdef __OPENCL_VERSION__
+
+#define PT_OPTICS_BEGIN
+#define PT_OPTICS_END
+#define PT_OPTICS_TEMPLATE
+#define PT_REAL float
+#define PT_VEC3 float3
+#define PT_DOT(a, b) dot((a), (b))
+#define PT_NORMALIZE(a) normalize(a)
+#define PT_SQRT(a) sqrt(a)
+#define PT_POW(a, b) pow((a), (b))
+
+#else
+
+#define PT_OPTICS_BEGIN namespace pt {
+#define PT_OPTICS_END }
+#define PT_OPTICS_TEMPLATE template<typename T>
+#define PT_REAL T
+#define PT_VEC3 ptvec<T>
+#define PT_DOT(a, b) glm::dot((a), (b))
+#define PT_NORMALIZE(a) glm::normalize(a)
+#define PT_SQRT(a) std::sqrt(a)
+#define PT_POW(a, b) std::pow((a), (b))
+
+#endif
+
+PT_OPTICS_BEGIN
+
+PT_OPTICS_TEMPLATE
+inline PT_VEC3 pt_reflect(PT_VEC3 l, PT_VEC3 n)
+{
+  return PT_NORMALIZE(l - (PT_REAL)2.0 * PT_DOT(l, n) * n);
+}
+
+/* false on total internal reflection */
+PT_OPTICS_TEMPLATE
+inline bool pt_refract(PT_VEC3 l, PT_VEC3 n, PT_REAL ni_over_nt, PT_VEC3* out_refracted)
+{
+  PT_REAL cosi = PT_DOT(l, n);
+  PT_REAL cost2 = (PT_REAL)1.0 - ni_over_nt * ni_over_nt * ((PT_REAL)1.0 - cosi * cosi);
+
+  if(cost2 > (PT_REAL)0.0)
+  {
+    *out_refracted = PT_NORMALIZE(ni_over_nt * (l - n * cosi) - n * PT_SQRT(cost2));
+    return true;
+  }
+
+  return false;
+}
+
+PT_OPTICS_TEMPLATE
+inline PT_REAL pt_schlick(PT_REAL cosine, PT_REAL ref_idx)
+{
+  PT_REAL r0 = ((PT_REAL)1.0 - ref_idx) / ((PT_REAL)1.0 + ref_idx);
+  r0 = r0 * r0;
+  return r0 + ((PT_REAL)1.0 - r0) * PT_POW((PT_REAL)1.0 - cosine, (PT_REAL)5.0);
+}
+
+/*
+ * Scatter direction of a dielectric of index refr_idx hit from dir with normal pointing out of the surface.
+ * Returns true when the ray can refract: the caller reflects with probability *out_reflect_prob (Schlick)
+ * and refracts otherwise. On false (total internal reflection) it reflects.
+ */
+PT_OPTICS_TEMPLATE
+inline bool pt_dielectric(PT_VEC3 dir,
+                          PT_VEC3 normal,
+                          PT_REAL refr_idx,
+                          PT_VEC3* out_reflected,
+                          PT_VEC3* out_refracted,
+                          PT_REAL* out_reflect_prob)
+{
+  PT_VEC3 outward_normal;
+  PT_REAL ni_over_nt;
+  PT_REAL cosine;
+  PT_REAL d = PT_DOT(dir, normal);
+
+  *out_reflected = pt_reflect(dir, normal);
+
+  /* entrance or exit? */
+  if(d > (PT_REAL)0.0)
+  {
+    outward_normal = -normal;
+    ni_over_nt = refr_idx;
+    cosine = refr_idx * d;
+  }
+  else
+  {
+    outward_normal = normal;
+    ni_over_nt = (PT_REAL)1.0 / refr_idx;
+    cosine = -d;
+  }
+
+  if(!pt_refract(dir, outward_normal, ni_over_nt, out_refracted)) return false;
+
+  *out_reflect_prob = pt_schlick(cosine, refr_idx);
+  return true;
+}
+
+PT_OPTICS_END
+
+#undef PT_OPTICS_BEGIN
+#undef PT_OPTICS_END
+#undef PT_OPTICS_TEMPLATE
+#undef PT_REAL
+#undef PT_VEC3
+#undef PT_DOT
+#undef PT_NORMALIZE
+#undef PT_SQRT
+#undef PT_POW
+
+#endif //__PT_OPTICS_H__
@@ -0,0 +1,234 @@
+#ifndef __PT_TYPES_H__
+#define __PT_TYPES_H__
+
+/*
+ * Records shared by the host and the kernels, this header compiles as OpenCL C and as C++ (ptCL.h).
+ *
+ * Every member is a 4 or 16 byte scalar or vector and every record is 16 byte aligned with explicit padding,
+ * so the layout does not depend on the compiler. float3 takes 16 bytes on both sides (cl_float3 on the host).
+ * The host checks sizes and offsets at compile time below, the kernel in sizecheck.cl writes the device ones
+ * for test_device_layout to compare: change a record here and both sides follow or the test fails.
+ */
+
+#ifdef __OPENCL_VERSION__
+
+#define PT_ALIGN(n) __attribute__((aligned(n)))
+#define PT_FLOAT3 float3
+#define PT_FLOAT4 float4
+#define PT_INT int
+#define PT_UINT uint
+#define PT_FLOAT float
+
+#define PT_TYPES_BEGIN
+#define PT_TYPES_END
+
+#else
+
+#define PT_ALIGN(n) alignas(n)
+#define PT_FLOAT3 cl_float3
+#define PT_FLOAT4 cl_float4
+#define PT_INT cl_int
+#define PT_UINT cl_uint
+#define PT_FLOAT cl_float
+
+#define PT_TYPES_BEGIN namespace pt { namespace device {
+#define PT_TYPES_END } }
+
+#endif
+
+#define MAT_LAMBERTIAN  1
+#define MAT_DIALECTRIC  2
+#define MAT_METALLIC    3
+#define MAT_EMISSIVE    4
+
+/* tone map operators of tonemap_buffer (tonemap.cl, cl_set_tonemap_args) */
+#define TONEMAP_CLAMP 0
+#define TONEMAP_REINHARD 1
+#define TONEMAP_ACES 2
+
+/* sort keys of the wavefront paths (wavefront.cl, cl_render_wavefront): nothing to shade, then the material types */
+#define WAVEFRONT_BUCKETS 4
+
+PT_TYPES_BEGIN
+
+/*
+ * A parametric line of the form P(t) = origin + t * dir
+ */
+typedef struct PT_ALIGN(16) Ray
+{
+  PT_FLOAT3 origin;
+  PT_FLOAT3 dir;
+} Ray;
+
+/*
+ * Every camera the kernels trace from, type picks the ray generator (camera_ray in geometry.cl).
+ * Pinhole and thin lens rays go through lower_left + s * hor + t * ver, on the focus plane for a thin lens,
+ * from origin or from a point of the lens of radius lens_radius spanned by u and v.
+ * Equirectangular rays leave origin at longitude (s - .5) * longitude and latitude (t - .5) * latitude,
+ * in radians, of the frame u (right), v (up), w (back): the captures of a panoramic tripod.
+ */
+#define CAM_PINHOLE     0
+#define CAM_THIN_LENS   1
+#define CAM_EQUIRECT    2
+
+typedef struct PT_ALIGN(16) Camera
+{
+  PT_FLOAT3 origin;
+  PT_FLOAT3 lower_left;
+  PT_FLOAT3 hor;
+  PT_FLOAT3 ver;
+  PT_FLOAT3 u;
+  PT_FLOAT3 v;
+  PT_FLOAT3 w;
+  PT_FLOAT  lens_radius;
+  PT_FLOAT  longitude;
+  PT_FLOAT  latitude;
+  PT_INT    type;
+} Camera;
+
+/* center in xyz, radius in w */
+typedef PT_FLOAT4 Sphere;
+
+/*
+ * albedo.w is the extra parameter of the type (fuzz for metals, refraction index for dielectrics),
+ * albedo.rgb of an emissive material is the radiance it gives off
+ */
+typedef struct PT_ALIGN(16) Material
+{
+  PT_FLOAT4 albedo;
+  PT_INT    type;
+  PT_INT    pad[3];
+} Material;
+
+typedef struct PT_ALIGN(16) SkyMaterial
+{
+  PT_FLOAT3 bottom;
+  PT_FLOAT3 top;
+} SkyMaterial;
+
+/*
+ * Compact records for ray and hit streams (packing.cl and the cl_pack_* helpers in ptCL.h)
+ * dir and normal are octahedral encoded unit vectors, two snorm16 in 32 bits.
+ * Camera rays of a pinhole camera go further and keep only dir, the origin is the camera one.
+ * Throughput and radiance streams are half4 (vstore_half4), 8 bytes instead of 16.
+ */
+typedef struct PT_ALIGN(16) PackedRay
+{
+  PT_FLOAT ox;
+  PT_FLOAT oy;
+  PT_FLOAT oz;
+  PT_UINT  dir;
+} PackedRay;
+
+typedef struct PT_ALIGN(16) PackedHit
+{
+  PT_FLOAT t;
+  PT_UINT  prim;
+  PT_UINT  normal;
+  PT_UINT  pad;
+} PackedHit;
+
+/*
+ * Triangle of a mesh (Triangle<T>), v0 and the edges to v1 and v2, w unused
+ */
+typedef struct PT_ALIGN(16) Triangle
+{
+  PT_FLOAT4 v0;
+  PT_FLOAT4 e1;
+  PT_FLOAT4 e2;
+} Triangle;
+
+/*
+ * Node of BVH<T> (ptGeometry.h): an inner node has count 0 and its children at left_first and left_first + 1,
+ * a leaf covers count entries of the primitive index array from left_first
+ */
+typedef struct PT_ALIGN(16) BVHNode
+{
+  PT_FLOAT bmin[3];
+  PT_INT   left_first;
+  PT_FLOAT bmax[3];
+  PT_INT   count;
+} BVHNode;
+
+/*
+ * Instance of a bottom level BVH (Instance<T>): to_object as three rows with the translation in w,
+ * root is the first node of its BVH and material overrides the materials of its primitives unless it is -1
+ */
+typedef struct PT_ALIGN(16) Instance
+{
+  PT_FLOAT4 to_object[3];
+  PT_UINT   root;
+  PT_INT    material;
+  PT_UINT   pad[2];
+} Instance;
+
+PT_TYPES_END
+
+/*
+ * Every record and member whose layout must agree, in the order sizecheck.cl writes them:
+ * first the sizes of the records, then the offsets of the members
+ */
+#define PT_LAYOUT_TYPES(X) \
+  X(Ray) \
+  X(Camera) \
+  X(Sphere) \
+  X(Material) \
+  X(SkyMaterial) \
+  X(PackedRay) \
+  X(PackedHit) \
+  X(Triangle) \
+  X(BVHNode) \
+  X(Instance)
+
+#define PT_LAYOUT_MEMBERS(X) \
+  X(Ray, origin) \
+  X(Ray, dir) \
+  X(Camera, origin) \
+  X(Camera, lower_left) \
+  X(Camera, hor) \
+  X(Camera, ver) \
+  X(Camera, u) \
+  X(Camera, v) \
+  X(Camera, w) \
+  X(Camera, lens_radius) \
+  X(Camera, longitude) \
+  X(Camera, latitude) \
+  X(Camera, type) \
+  X(Material, albedo) \
+  X(Material, type) \
+  X(SkyMaterial, bottom) \
+  X(SkyMaterial, top) \
+  X(PackedRay, dir) \
+  X(PackedHit, normal) \
+  X(Triangle, e2) \
+  X(BVHNode, left_first) \
+  X(BVHNode, bmax) \
+  X(BVHNode, count) \
+  X(Instance, root) \
+  X(Instance, material)
+
+#ifndef __OPENCL_VERSION__
+
+#include <cstddef>
+
+static_assert(sizeof(cl_float3) == 16 && alignof(cl_float3) == 16, "cl_float3 must match the device float3");
+static_assert(sizeof(pt::device::Ray) == 32, "Ray layout changed");
+static_assert(offsetof(pt::device::Ray, dir) == 16, "Ray layout changed");
+static_assert(sizeof(pt::device::Camera) == 128, "Camera layout changed");
+static_assert(offsetof(pt::device::Camera, ver) == 48 && offsetof(pt::device::Camera, lens_radius) == 112, "Camera layout changed");
+static_assert(offsetof(pt::device::Camera, type) == 124, "Camera layout changed");
+static_assert(sizeof(pt::device::Sphere) == 16, "Sphere layout changed");
+static_assert(sizeof(pt::device::Material) == 32, "Material layout changed");
+static_assert(offsetof(pt::device::Material, type) == 16, "Material layout changed");
+static_assert(sizeof(pt::device::SkyMaterial) == 32, "SkyMaterial layout changed");
+static_assert(offsetof(pt::device::SkyMaterial, top) == 16, "SkyMaterial layout changed");
+static_assert(sizeof(pt::device::PackedRay) == 16 && offsetof(pt::device::PackedRay, dir) == 12, "PackedRay layout changed");
+static_assert(sizeof(pt::device::PackedHit) == 16 && offsetof(pt::device::PackedHit, normal) == 8, "PackedHit layout changed");
+static_assert(sizeof(pt::device::Triangle) == 48 && offsetof(pt::device::Triangle, e2) == 32, "Triangle layout changed");
+static_assert(sizeof(pt::device::BVHNode) == 32 && offsetof(pt::device::BVHNode, bmax) == 16, "BVHNode layout changed");
+static_assert(sizeof(pt::device::Instance) == 64 && offsetof(pt::device::Instance, root) == 48, "Instance layout changed");
+static_assert(alignof(pt::device::Material) == 16 && alignof(pt::device::Camera) == 16, "Records must be 16 byte aligned");
+
+#endif
+
+#endif //__PT_TYPES_H__
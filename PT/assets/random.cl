@@ -58,6 +58,20 @@ inline uint hash(int i) {
 }
 
 
+/*
+ * Sample unit disk by sampling the unit square and reject, the draws of sample_unit_disk in ptRandom.h
+ */
+inline float2 sample_unit_disk(uint* rng_state)
+{
+    float2 p;
+    do {
+        p.x = 2.0f * sample_unit_1D(rng_state) - 1.0f;
+        p.y = 2.0f * sample_unit_1D(rng_state) - 1.0f;
+    } while (dot(p,p) >= 1.0f);
+
+    return p;
+}
+
 /*
  * Sample unit sphere by sampling unit cube and reject
  * rng_state: current state used by xor random generator
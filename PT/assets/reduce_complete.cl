@@ -1,32 +1,81 @@
-__kernel
-void reduce(__global  float* data,
-            __local   float* partial_sums,
-            __global  float* output)
+/*
+ * Complete reduction of n floats to one value in two passes of the same kernel (see cl_reduce in ptCL.h):
+ * the first pass leaves one partial result per work group, the second runs a single group over them.
+ *
+ * Build options:
+ * REDUCE_OP          REDUCE_SUM (default), REDUCE_MIN or REDUCE_MAX, a mean is a sum with scale = 1 / n
+ * REDUCE_GROUP_SIZE  work group size, a power of two (default 256)
+ */
+
+#define REDUCE_SUM 0
+#define REDUCE_MIN 1
+#define REDUCE_MAX 2
+
+#ifndef REDUCE_OP
+#define REDUCE_OP REDUCE_SUM
+#endif
+
+#ifndef REDUCE_GROUP_SIZE
+#define REDUCE_GROUP_SIZE 256
+#endif
+
+#if REDUCE_OP == REDUCE_MIN
+#define REDUCE_IDENTITY MAXFLOAT
+#define reduce_op(a, b) fmin((a), (b))
+#elif REDUCE_OP == REDUCE_MAX
+#define REDUCE_IDENTITY (-MAXFLOAT)
+#define reduce_op(a, b) fmax((a), (b))
+#else
+#define REDUCE_IDENTITY 0.0f
+#define reduce_op(a, b) ((a) + (b))
+#endif
+
+__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP_SIZE, 1, 1)))
+void reduce_complete(__global const float4* data,
+                     uint n,
+                     __global float* output,
+                     float scale)
 {
-  // where the work item is in the work group
-  int local_id = get_local_id(0);
+  __local float scratch[REDUCE_GROUP_SIZE];
 
-  // how many work items in the work group
-  int group_size = get_local_size(0);
+  uint local_id = get_local_id(0);
+  uint global_id = get_global_id(0);
+  uint stride = get_global_size(0);
+  uint n4 = n / 4;
 
-  // each work item copies its data to the local memory
-  partial_sums[local_id] = data[get_global_id(0)];
+  /* as many float4 per work item as it takes to cover the input, neighbours read neighbouring float4 */
+  float4 acc4 = (float4)(REDUCE_IDENTITY);
 
-  // wait for all work items in group to have acquired their data
+  for(uint i = global_id; i < n4; i += stride)
+  {
+    acc4 = reduce_op(acc4, data[i]);
+  }
+
+  float acc = reduce_op(reduce_op(acc4.x, acc4.y), reduce_op(acc4.z, acc4.w));
+
+  /* the last n % 4 floats */
+  if(global_id < n - 4 * n4)
+  {
+    acc = reduce_op(acc, ((__global const float*)data)[4 * n4 + global_id]);
+  }
+
+  scratch[local_id] = acc;
   barrier(CLK_LOCAL_MEM_FENCE);
 
-  // the logN "recursive" sum
-  for(int i = group_size/2; i > 0; i >>= 1)
+  /*
+   * The group size is known at compile time so the tree is fully unrolled.
+   * Dropping the barriers once a single warp is left is not portable in OpenCL 1.x, they stay.
+   */
+#pragma unroll
+  for(uint s = REDUCE_GROUP_SIZE / 2; s > 0; s >>= 1)
   {
-    if(local_id < i)
+    if(local_id < s)
     {
-      partial_sums[local_id] += partial_sums[local_id + i];
+      scratch[local_id] = reduce_op(scratch[local_id], scratch[local_id + s]);
     }
     barrier(CLK_LOCAL_MEM_FENCE);
   }
 
-  // first work item in group collects result
   if(local_id == 0)
-    output[get_group_id(0)] = partial_sums[0];
-
+    output[get_group_id(0)] = scratch[0] * scale;
 }
@@ -3,6 +3,7 @@
 
 #include "geometry.cl"
 #include "material.cl"
+#include "counters.cl"
 
 #ifndef MAX_RECURSION
 #define MAX_RECURSION 5
@@ -64,17 +65,20 @@ static float3 radiance_iterative_recursion_map(Ray* ray,
     return (float3)(0,1.0f,1.0f);
 }
 
-static float3 radiance_iterative(Ray* ray,
+/* radiance_iterative counting into counters, which only PT_COUNTERS builds touch */
+static float3 radiance_iterative_counted(Ray* ray,
   __constant Sphere* primitive_list,
   __constant Material* material_list,
   uint primitive_list_size,
   uint* rng_state,
-  __constant SkyMaterial* sky)
+  __constant SkyMaterial* sky,
+  PathCounters* counters)
 {
 
   float t;
   uint idx;
   float3 col = (float3)(1,1,1);
+  float3 emitted = (float3)(0,0,0);
 
   Ray ray_in = *ray;
   Ray ray_out;
@@ -83,15 +87,22 @@ static float3 radiance_iterative(Ray* ray,
   float3 p;
   float3 normal;
 
+  PT_COUNT(counters, PT_COUNTER_PATHS, 1);
+
   for(int i = 0; i < MAX_RECURSION; ++i)
   {
+      PT_COUNT(counters, PT_COUNTER_RAYS, 1);
+      PT_COUNT(counters, PT_COUNTER_INTERSECTION_TESTS, primitive_list_size);
+
       if (sphere_list_intersect(primitive_list, primitive_list_size, &ray_in, &t, &idx))
       {
           p = ray_pointat(&ray_in, t); // where intersects
           normal = sphere_normal_at(&primitive_list[idx], p); // normal at intersection
+          emitted += col * material_emission(&material_list[idx]);
 
           if(material_scatter(&material_list[idx], &ray_in, p, normal, rng_state, &attenuation, &ray_out))
           {
+              PT_COUNT(counters, PT_COUNTER_BOUNCES, 1);
               col *= attenuation;
               ray_in = ray_out;
           }
@@ -109,7 +120,18 @@ static float3 radiance_iterative(Ray* ray,
       }
   }
 
-  return col;
+  return emitted + col;
+}
+
+static float3 radiance_iterative(Ray* ray,
+  __constant Sphere* primitive_list,
+  __constant Material* material_list,
+  uint primitive_list_size,
+  uint* rng_state,
+  __constant SkyMaterial* sky)
+{
+  PathCounters unused;
+  return radiance_iterative_counted(ray, primitive_list, material_list, primitive_list_size, rng_state, sky, &unused);
 }
 
 #endif //__CL_RENDERING_H__
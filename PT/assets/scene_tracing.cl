@@ -0,0 +1,131 @@
+#define MAX_RECURSION 5
+
+#include "random.cl"
+#include "geometry.cl"
+#include "material.cl"
+#include "counters.cl"
+#include "bvh.cl"
+#include "tonemap.cl"
+
+/*
+ * Path tracing of a scene loaded by ptScene.h (spheres and meshes under a BVH), in global memory:
+ * unlike path_tracing.cl there is no MAX_PRIMITIVES. Materials stay in constant memory, one record
+ * per material of the scene, the primitives index them. Otherwise as path_tracing_accumulate.
+ * Build with PT_INSTANCES for the two level scenes of scene_pack_instances, instances is unused otherwise.
+ */
+static float3 scene_radiance(Ray* ray,
+  const SceneArrays* scene,
+  __constant Material* material_list,
+  __constant SkyMaterial* sky,
+  uint* rng_state,
+  PathCounters* counters)
+{
+  float t;
+  uint idx;
+  uint instance = 0;
+  float3 col = (float3)(1,1,1);
+  float3 emitted = (float3)(0,0,0);
+
+  Ray ray_in = *ray;
+  Ray ray_out;
+
+  float3 attenuation;
+  float3 p;
+  float3 normal;
+
+  PT_COUNT(counters, PT_COUNTER_PATHS, 1);
+
+  for(int i = 0; i < MAX_RECURSION; ++i)
+  {
+      PT_COUNT(counters, PT_COUNTER_RAYS, 1);
+
+      if (scene_intersect(scene, &ray_in, &t, &idx, &instance, counters))
+      {
+          p = ray_pointat(&ray_in, t);
+          normal = scene_normal_at(scene, instance, idx, p);
+
+          __constant Material* mat = &material_list[scene_material_at(scene, instance, idx)];
+          emitted += col * material_emission(mat);
+
+          if(material_scatter(mat, &ray_in, p, normal, rng_state, &attenuation, &ray_out))
+          {
+              PT_COUNT(counters, PT_COUNTER_BOUNCES, 1);
+              col *= attenuation;
+              ray_in = ray_out;
+          }
+          else
+          {
+              col = (float3)(0,0,0);
+              break;
+          }
+      }
+      else
+      {
+          t = 0.5f * ray_in.dir.y + 0.5f;
+          col *= ((1.0f - t) * sky->bottom + t * sky->top);
+          break;
+      }
+  }
+
+  return emitted + col;
+}
+
+__kernel
+void scene_tracing_accumulate(__constant struct Camera* cam,
+                              __global const BVHNode* nodes,
+                              __global const uint* prim_indices,
+                              __global const Sphere* spheres,
+                              uint sphere_count,
+                              __global const Triangle* triangles,
+                              __global const uint* prim_materials,
+                              __global const Instance* instances,
+                              __constant Material* material_list,
+                              __constant SkyMaterial* sky,
+                              __global float4* accumulation,
+                              uint samples,
+                              uint width,
+                              uint height,
+                              uint frame
+                              PT_COUNTERS_KERNEL_ARG)
+{
+  int2 coord = (int2)(get_global_id(0), get_global_id(1));
+  if(coord.x >= width || coord.y >= height) return;
+
+  SceneArrays scene;
+  scene.nodes = nodes;
+  scene.prim_indices = prim_indices;
+  scene.spheres = spheres;
+  scene.triangles = triangles;
+  scene.prim_materials = prim_materials;
+  scene.instances = instances;
+  scene.sphere_count = sphere_count;
+
+  PathCounters counters;
+  counters_init(&counters);
+
+  uint seed = hash2(hash2(coord.x, coord.y), frame);
+  float2 wh = (float2)(width, height);
+  float2 xy = convert_float2(coord);
+  float weigth = 1.0f / (float)samples;
+  float3 out_color = (float3)(0,0,0);
+
+  for(uint s = 0; s < samples; ++s)
+  {
+      float2 uv = (xy + sample_unit_2D(&seed)) / wh;
+      Ray ray = camera_ray(cam, uv, &seed);
+      out_color = fma(weigth, scene_radiance(&ray, &scene, material_list, sky, &seed, &counters), out_color);
+  }
+
+#ifdef PT_COUNTERS
+  counters_flush(&counters, debug_counters);
+#endif
+
+  uint i = coord.y * width + coord.x;
+  float4 acc = accumulation[i];
+  float total = acc.w + (float)samples;
+
+  acc.xyz += (out_color - acc.xyz) * ((float)samples / total);
+  acc.w = total;
+
+  accumulation[i] = acc;
+}
@@ -1,19 +1,18 @@
-#include "random.clh"
-#include "utils.clh"
-#include "geometry.clh"
-#include "rendering.clh"
+#include "pt_types.h"
+
+/*
+ * Writes the device size of every record in PT_LAYOUT_TYPES, then the offset of every member in
+ * PT_LAYOUT_MEMBERS, for the host to compare against its own (see test_device_layout)
+ */
+
+#define PT_WRITE_SIZE(type) layout[i++] = sizeof(type);
+#define PT_WRITE_OFFSET(type, member) { type t; layout[i++] = (uint)((__private char*)&t.member - (__private char*)&t); }
 
 __kernel
-void sizecheck(__global uint* sizes)
+void sizecheck(__global uint* layout)
 {
-  uint sizeof_float = sizeof(float);
-  uint sizeof_float3 = sizeof(float3);
-  uint sizeof_cam = sizeof(PinholeCamera);
-  uint sizeof_sphere = sizeof(Sphere);
-
-  sizes[0] = sizeof_float;
-  sizes[1] = sizeof_float3;
-  sizes[2] = sizeof_cam;
-  sizes[3] = sizeof_sphere;
+  uint i = 0;
 
+  PT_LAYOUT_TYPES(PT_WRITE_SIZE)
+  PT_LAYOUT_MEMBERS(PT_WRITE_OFFSET)
 }
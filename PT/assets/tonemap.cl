@@ -0,0 +1,67 @@
+#ifndef __CL_TONEMAP_H__
+#define __CL_TONEMAP_H__
+
+/*
+ * Tone mapping of the HDR accumulation buffer written by path_tracing_accumulate
+ * (float4 per pixel, mean radiance in xyz and sample count in w), the only way to the 8 bit output.
+ */
+
+#include "pt_types.h"
+
+inline float3 tonemap_reinhard(float3 c)
+{
+  return c / (1.0f + c);
+}
+
+/* fit of the ACES filmic curve by K. Narkowicz */
+inline float3 tonemap_aces(float3 c)
+{
+  return clamp((c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f), 0.0f, 1.0f);
+}
+
+inline float3 tonemap(float3 c, float exposure, float inv_gamma, uint op)
+{
+  c *= exposure;
+
+  if(op == TONEMAP_REINHARD) c = tonemap_reinhard(c);
+  else if(op == TONEMAP_ACES) c = tonemap_aces(c);
+
+  return pow(clamp(c, 0.0f, 1.0f), inv_gamma);
+}
+
+__kernel
+void tonemap_buffer(__global const float4* accumulation,
+                    __global uchar4* out_buffer,
+                    uint width,
+                    uint height,
+                    float exposure,
+                    float inv_gamma,
+                    uint op)
+{
+  int2 coord = (int2)(get_global_id(0), get_global_id(1));
+  if(coord.x >= width || coord.y >= height) return;
+
+  uint i = coord.y * width + coord.x;
+  float3 c = tonemap(accumulation[i].xyz, exposure, inv_gamma, op);
+
+  out_buffer[i] = convert_uchar4_sat_rte((float4)(c * 255.0f, 255.0f));
+}
+
+__kernel
+void tonemap_image(__global const float4* accumulation,
+                   write_only image2d_t out_image,
+                   uint width,
+                   uint height,
+                   float exposure,
+                   float inv_gamma,
+                   uint op)
+{
+  int2 coord = (int2)(get_global_id(0), get_global_id(1));
+  if(coord.x >= width || coord.y >= height) return;
+
+  float3 c = tonemap(accumulation[coord.y * width + coord.x].xyz, exposure, inv_gamma, op);
+
+  write_imagef(out_image, coord, (float4)(c, 1.0f));
+}
+
+#endif //__CL_TONEMAP_H__
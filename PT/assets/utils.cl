@@ -22,7 +22,7 @@ static float to32F_C1_linear(float x)
 /* scale vector3 value to [0, 255] with clamp and gamma correction */
 static uint3 to8U_C3_gamma(float3 x)
 {
-  return (uint3)( pow(clamp(x, 0.0f, 1.0f), 1.0f/2.2f) * 255.0f + (float3)(0.5f, 0.5f, 0.5f) );
+  return convert_uint3( pow(clamp(x, 0.0f, 1.0f), 1.0f/2.2f) * 255.0f + (float3)(0.5f, 0.5f, 0.5f) );
 }
 
 #endif //__CL_UTILS_H__
@@ -0,0 +1,237 @@
+#ifndef MAX_RECURSION
+#define MAX_RECURSION 5
+#endif
+
+#include "random.cl"
+#include "geometry.cl"
+#include "rendering.cl"
+#include "packing.cl"
+
+/*
+ * Path tracing split in passes over a stream of paths, one path per pixel and frame:
+ * generate, then MAX_RECURSION times intersect and shade, then resolve into the frame.
+ * Path state lives in global memory between passes: packed ray, throughput (w is 1 while alive),
+ * radiance, rng seed and the packed hit of the current bounce.
+ *
+ * Shading either runs one kernel over all paths that branches on the material type (wavefront_shade_all)
+ * or sorts the paths by material first and runs one kernel per material over its range of the sorted list.
+ * The sort is a counting sort over WAVEFRONT_BUCKETS keys: wavefront_intersect writes one flag per key and path,
+ * key major, an inclusive scan of the flags (cl_scan) gives every path its place and wavefront_sort moves it there.
+ * The same per path arithmetic runs in both cases, the two give the same image.
+ */
+
+/* key 0 of WAVEFRONT_BUCKETS (pt_types.h) holds the paths with nothing to shade, dead or missed, the others are the material types */
+
+__kernel
+void wavefront_generate(__constant struct Camera* cam,
+                        __global PackedRay* rays,
+                        __global float4* throughput,
+                        __global float4* radiance,
+                        __global uint* seeds,
+                        uint width,
+                        uint height,
+                        uint frame)
+{
+  uint i = get_global_id(0);
+  if(i >= width * height) return;
+
+  uint y = i / width;
+  uint x = i - y * width;
+
+  uint seed = hash2(x, y) ^ hash(frame);
+
+  float2 uv = ((float2)(x, y) + sample_unit_2D(&seed)) / (float2)(width, height);
+#ifdef INVERT
+  uv.y = 1.0f - uv.y;
+#endif
+
+  Ray ray = camera_ray(cam, uv, &seed);
+
+  rays[i] = pack_ray(&ray);
+  throughput[i] = (float4)(1.0f, 1.0f, 1.0f, 1.0f);
+  radiance[i] = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+  seeds[i] = seed;
+}
+
+/*
+ * Closest hit of every live path. Misses pick up the sky and die, as in radiance_iterative,
+ * so do hits of emissive materials with their emission, which leaves them nothing to shade.
+ * With sort set, also writes flags[k * n + i] = 1 for the key k of path i.
+ */
+__kernel
+void wavefront_intersect(__global const PackedRay* rays,
+                         __global float4* throughput,
+                         __global float4* radiance,
+                         __global PackedHit* hits,
+                         __global int* flags,
+                         __constant Sphere* primitive_list,
+                         __constant struct Material* material_list,
+                         __constant struct SkyMaterial* sky,
+                         uint primitive_list_size,
+                         uint n,
+                         uint sort)
+{
+  uint i = get_global_id(0);
+  if(i >= n) return;
+
+  float4 tp = throughput[i];
+  int key = 0;
+
+  if(tp.w > 0.0f)
+  {
+    Ray ray = unpack_ray(rays[i]);
+    float t;
+    uint idx;
+
+    if(sphere_list_intersect(primitive_list, primitive_list_size, &ray, &t, &idx))
+    {
+      if(material_list[idx].type == MAT_EMISSIVE)
+      {
+        radiance[i] = (float4)(radiance[i].xyz + tp.xyz * material_emission(&material_list[idx]), 0.0f);
+        throughput[i] = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+      }
+      else
+      {
+        hits[i] = pack_hit(t, idx, sphere_normal_at(&primitive_list[idx], ray_pointat(&ray, t)));
+        key = material_list[idx].type;
+      }
+    }
+    else
+    {
+      t = 0.5f * ray.dir.y + 0.5f;
+      radiance[i] = (float4)(tp.xyz * ((1.0f - t) * sky->bottom + t * sky->top), 0.0f);
+      throughput[i] = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+    }
+  }
+
+  if(sort)
+  {
+    for(int k = 0; k < WAVEFRONT_BUCKETS; ++k)
+      flags[k * n + i] = (k == key);
+  }
+}
+
+/* Scatter every path index to its place in the material sorted list, scanned holds the inclusive scan of the flags */
+__kernel
+void wavefront_sort(__global const int* scanned,
+                    __global uint* sorted_paths,
+                    uint n)
+{
+  uint i = get_global_id(0);
+  if(i >= n) return;
+
+  for(uint k = 0; k < WAVEFRONT_BUCKETS; ++k)
+  {
+    uint at = k * n + i;
+    int before = (at > 0) ? scanned[at - 1] : 0;
+
+    if(scanned[at] != before)
+    {
+      sorted_paths[scanned[at] - 1] = i;
+      return;
+    }
+  }
+}
+
+/*
+ * Scatter of one path. type is a constant in every kernel below so the branch folds away,
+ * except in wavefront_shade_all where it is 0 and material_scatter branches on the material.
+ */
+inline void wavefront_shade(uint i,
+                            int type,
+                            __global PackedRay* rays,
+                            __global const PackedHit* hits,
+                            __global float4* throughput,
+                            __global uint* seeds,
+                            __constant struct Material* material_list)
+{
+  PackedHit hit = hits[i];
+  Ray ray_in = unpack_ray(rays[i]);
+  Ray ray_out;
+
+  float3 p = ray_pointat(&ray_in, hit.t);
+  float3 normal = oct_decode(hit.normal);
+  float3 attenuation;
+  uint seed = seeds[i];
+  bool scattered;
+
+  __constant Material* mat = &material_list[hit.prim];
+
+  if(type == MAT_LAMBERTIAN)
+    scattered = material_scatter_lambertian(mat, &ray_in, p, normal, &seed, &attenuation, &ray_out);
+  else if(type == MAT_METALLIC)
+    scattered = material_scatter_metallic(mat, &ray_in, p, normal, &seed, &attenuation, &ray_out);
+  else if(type == MAT_DIALECTRIC)
+    scattered = material_scatter_dialectric(mat, &ray_in, p, normal, &seed, &attenuation, &ray_out);
+  else
+    scattered = material_scatter(mat, &ray_in, p, normal, &seed, &attenuation, &ray_out);
+
+  if(scattered)
+  {
+    throughput[i] = (float4)(throughput[i].xyz * attenuation, 1.0f);
+    rays[i] = pack_ray(&ray_out);
+  }
+  else
+  {
+    throughput[i] = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+  }
+
+  seeds[i] = seed;
+}
+
+__kernel
+void wavefront_shade_all(__global PackedRay* rays,
+                         __global const PackedHit* hits,
+                         __global float4* throughput,
+                         __global uint* seeds,
+                         __constant struct Material* material_list,
+                         uint n)
+{
+  uint i = get_global_id(0);
+  if(i >= n || throughput[i].w <= 0.0f) return;
+
+  wavefront_shade(i, 0, rays, hits, throughput, seeds, material_list);
+}
+
+/* One kernel per material over [offset, offset + count) of the sorted paths */
+#define WAVEFRONT_SHADE_KERNEL(name, type) \
+__kernel \
+void name(__global const uint* sorted_paths, \
+          uint offset, \
+          uint count, \
+          __global PackedRay* rays, \
+          __global const PackedHit* hits, \
+          __global float4* throughput, \
+          __global uint* seeds, \
+          __constant struct Material* material_list) \
+{ \
+  uint j = get_global_id(0); \
+  if(j >= count) return; \
+  wavefront_shade(sorted_paths[offset + j], type, rays, hits, throughput, seeds, material_list); \
+}
+
+WAVEFRONT_SHADE_KERNEL(wavefront_shade_lambertian, MAT_LAMBERTIAN)
+WAVEFRONT_SHADE_KERNEL(wavefront_shade_dialectric, MAT_DIALECTRIC)
+WAVEFRONT_SHADE_KERNEL(wavefront_shade_metallic, MAT_METALLIC)
+
+/*
+ * Paths still alive after MAX_RECURSION bounces keep their throughput, as radiance_iterative returns it.
+ * Adds the path to the running mean of the frame, count in w.
+ */
+__kernel
+void wavefront_resolve(__global const float4* throughput,
+                       __global const float4* radiance,
+                       __global float4* accumulation,
+                       uint n)
+{
+  uint i = get_global_id(0);
+  if(i >= n) return;
+
+  float4 tp = throughput[i];
+  float3 color = radiance[i].xyz + ((tp.w > 0.0f) ? tp.xyz : (float3)(0.0f, 0.0f, 0.0f));
+
+  float4 acc = accumulation[i];
+  acc.w += 1.0f;
+  acc.xyz += (color - acc.xyz) / acc.w;
+  accumulation[i] = acc;
+}
@@ -0,0 +1,198 @@
+#ifndef AccumulationUnitTest_h
+#define AccumulationUnitTest_h
+
+#include "ptTestUtils.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /* Host version of tonemap_aces in tonemap.cl */
+        float tonemap_aces_host(float c)
+        {
+            return std::min(1.0f, std::max(0.0f, (c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f)));
+        }
+        
+        /*
+         * path_tracing_accumulate at 1 sample per frame converges towards a many samples render,
+         * the sample count restarts when the camera moves and tonemap_buffer matches the host curve
+         */
+        pt_test_result test_hdr_accumulation(cl::Device& device, cl::Context& context, cl::CommandQueue& cmd_queue)
+        {
+            cl_int clStatus;
+            cl::Program program;
+            
+            const cl_uint width = 160;
+            const cl_uint height = 120;
+            const cl_uint frames = 16;
+            const cl_uint reference_samples = 256;
+            const size_t pixel_count = width * height;
+            
+            clStatus = test_util_get_program(device, context, program, "../../../assets/path_tracing.cl", "-I ../../../assets/ -cl-denorms-are-zero");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+            
+            cl::Kernel kernel(program, "path_tracing_accumulate", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+            
+            cl::Kernel tonemap_kernel(program, "tonemap_buffer", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+            
+            CLBufferPool::Scope buffers(test_util_buffer_pool(context));
+            
+            cl::Buffer d_buff_r_cam = buffers.acquire(sizeof(cl_pinhole_cam), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create camera buffer")
+            cl::Buffer d_buff_r_prim = buffers.acquire(MAX_PRIMITIVES * sizeof(cl_sphere), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create primitive buffer")
+            cl::Buffer d_buff_r_mat = buffers.acquire(MAX_PRIMITIVES * sizeof(cl_material), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create material buffer")
+            cl::Buffer d_buff_r_sky = buffers.acquire(sizeof(cl_sky_material), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create sky buffer")
+            cl::Buffer d_buff_w_pixels = buffers.acquire(4 * pixel_count, CL_MEM_WRITE_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create output buffer")
+            
+            cl_uint sceneObjectCount = test_util_weekend_scene(cmd_queue, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky);
+            
+            PTCL_SAFE_SET_ARG("Could not set camera argument", kernel, 0, d_buff_r_cam)
+            PTCL_SAFE_SET_ARG("Could not set primitive argument", kernel, 1, d_buff_r_prim)
+            PTCL_SAFE_SET_ARG("Could not set material argument", kernel, 2, d_buff_r_mat)
+            PTCL_SAFE_SET_ARG("Could not set sky argument", kernel, 3, d_buff_r_sky)
+            PTCL_SAFE_SET_ARG("Could not set object count argument", kernel, 4, sceneObjectCount)
+            PTCL_SAFE_SET_ARG("Could not set width argument", kernel, 7, width)
+            PTCL_SAFE_SET_ARG("Could not set height argument", kernel, 8, height)
+            
+            pt::PinholeCamera<float> camera(45.0f, (float)width / (float)height, glm::vec3(-2,1,1), glm::vec3(0,0,-1), glm::vec3(0,1,0));
+            pt::PinholeCamera<float> moved(45.0f, (float)width / (float)height, glm::vec3(-2,1.5f,1), glm::vec3(0,0,-1), glm::vec3(0,1,0));
+            
+            cl::NDRange global(width, height);
+            bool reset = false;
+            
+            /* Reference, many samples in one launch */
+            cl_accumulation reference_accumulation;
+            clStatus = cl_make_accumulation(context, pixel_count, cmd_queue, reference_accumulation);
+            PTCL_ASSERT(clStatus, "Could not create accumulation buffer")
+            
+            clStatus = cl_set_pinhole_cam_arg(camera, d_buff_r_cam, reference_accumulation, cmd_queue);
+            PTCL_ASSERT(clStatus, "Could not fill camera buffer")
+            
+            PTCL_SAFE_SET_ARG("Could not set accumulation argument", kernel, 5, reference_accumulation.buffer)
+            PTCL_SAFE_SET_ARG("Could not set samples argument", kernel, 6, reference_samples)
+            PTCL_SAFE_SET_ARG("Could not set frame argument", kernel, 9, (cl_uint)1000)
+            
+            clStatus = cmd_queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, cl::NullRange);
+            PTCL_ASSERT(clStatus, "Could not enqueue kernel")
+            
+            std::vector<cl_float4> reference(pixel_count);
+            clStatus = cmd_queue.enqueueReadBuffer(reference_accumulation.buffer, CL_TRUE, 0, pixel_count * sizeof(cl_float4), reference.data());
+            PTCL_ASSERT(clStatus, "Could not read accumulation buffer")
+            
+            /* One sample per frame, the camera does not move so nothing restarts after the first frame */
+            cl_accumulation accumulation;
+            clStatus = cl_make_accumulation(context, pixel_count, cmd_queue, accumulation);
+            PTCL_ASSERT(clStatus, "Could not create accumulation buffer")
+            
+            PTCL_SAFE_SET_ARG("Could not set accumulation argument", kernel, 5, accumulation.buffer)
+            PTCL_SAFE_SET_ARG("Could not set samples argument", kernel, 6, (cl_uint)1)
+            
+            std::vector<cl_float4> accumulated(pixel_count);
+            double first_rmse = 0;
+            
+            for (cl_uint f = 0; f < frames; ++f)
+            {
+                clStatus = cl_set_pinhole_cam_arg(camera, d_buff_r_cam, accumulation, cmd_queue, &reset);
+                PTCL_ASSERT(clStatus, "Could not fill camera buffer")
+                
+                if (reset != (f == 0))
+                {
+                    std::cout << "Accumulation restarted without a camera change\n";
+                    return PT_TEST_FAIL;
+                }
+                
+                PTCL_SAFE_SET_ARG("Could not set frame argument", kernel, 9, f)
+                
+                clStatus = cmd_queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, cl::NullRange);
+                PTCL_ASSERT(clStatus, "Could not enqueue kernel")
+                
+                if (f == 0)
+                {
+                    clStatus = cmd_queue.enqueueReadBuffer(accumulation.buffer, CL_TRUE, 0, pixel_count * sizeof(cl_float4), accumulated.data());
+                    PTCL_ASSERT(clStatus, "Could not read accumulation buffer")
+                    first_rmse = rmse(accumulated, reference);
+                }
+            }
+            
+            clStatus = cmd_queue.enqueueReadBuffer(accumulation.buffer, CL_TRUE, 0, pixel_count * sizeof(cl_float4), accumulated.data());
+            PTCL_ASSERT(clStatus, "Could not read accumulation buffer")
+            
+            double accumulated_rmse = rmse(accumulated, reference);
+            
+            std::cout << "========= ACCUMULATION =========\n";
+            std::cout << "RMSE after 1 frame : " << first_rmse << "\n"
+            << "RMSE after " << frames << " frames : " << accumulated_rmse << "\n";
+            std::cout << "================================\n\n";
+            
+            for (const cl_float4& p : accumulated)
+            {
+                if (p.s[3] != (float)frames)
+                {
+                    std::cout << "Wrong sample count " << p.s[3] << "\n";
+                    return PT_TEST_FAIL;
+                }
+            }
+            
+            /* 16 times the samples, the error should drop by about 4 */
+            if (accumulated_rmse > 0.5 * first_rmse)
+            {
+                std::cout << "Accumulation does not converge\n";
+                return PT_TEST_FAIL;
+            }
+            
+            /* Tone map what was accumulated */
+            clStatus = cl_set_tonemap_args(tonemap_kernel, accumulation, width, height, 1.0f, 2.2f, TONEMAP_ACES);
+            PTCL_ASSERT(clStatus, "Could not set tone map arguments")
+            PTCL_SAFE_SET_ARG("Could not set output argument", tonemap_kernel, 1, d_buff_w_pixels)
+            
+            clStatus = cmd_queue.enqueueNDRangeKernel(tonemap_kernel, cl::NullRange, global, cl::NullRange);
+            PTCL_ASSERT(clStatus, "Could not enqueue kernel")
+            
+            std::vector<unsigned char> pixels(4 * pixel_count);
+            clStatus = cmd_queue.enqueueReadBuffer(d_buff_w_pixels, CL_TRUE, 0, pixels.size(), pixels.data());
+            PTCL_ASSERT(clStatus, "Could not read output buffer")
+            
+            for (size_t i = 0; i < pixel_count; ++i)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    float expected = 255.0f * powf(tonemap_aces_host(accumulated[i].s[c]), 1.0f / 2.2f);
+                    
+                    if (fabsf((float)pixels[4 * i + c] - expected) > 1.0f)
+                    {
+                        std::cout << "Tone map mismatch at pixel " << i << "\n";
+                        return PT_TEST_FAIL;
+                    }
+                }
+            }
+            
+            pt::write_ppm<unsigned char>(pixels.data(), width, height, 4, pt::BUFFER_TRANSFORM_NONE, "accumulation.ppm");
+            
+            /* Moving the camera restarts from zero */
+            clStatus = cl_set_pinhole_cam_arg(moved, d_buff_r_cam, accumulation, cmd_queue, &reset);
+            PTCL_ASSERT(clStatus, "Could not fill camera buffer")
+            
+            clStatus = cmd_queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, cl::NullRange);
+            PTCL_ASSERT(clStatus, "Could not enqueue kernel")
+            
+            clStatus = cmd_queue.enqueueReadBuffer(accumulation.buffer, CL_TRUE, 0, pixel_count * sizeof(cl_float4), accumulated.data());
+            PTCL_ASSERT(clStatus, "Could not read accumulation buffer")
+            
+            if (!reset || accumulated[0].s[3] != 1.0f || accumulated[pixel_count - 1].s[3] != 1.0f)
+            {
+                std::cout << "Accumulation did not restart on camera change\n";
+                return PT_TEST_FAIL;
+            }
+            
+            return PT_TEST_PASS;
+        }
+    }
+}
+
+#endif /* AccumulationUnitTest_h */
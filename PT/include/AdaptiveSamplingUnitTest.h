@@ -0,0 +1,209 @@
+#ifndef AdaptiveSamplingUnitTest_h
+#define AdaptiveSamplingUnitTest_h
+
+#include "ptTestUtils.h"
+#include "ptUtil.h"
+#include "ptTests.h"
+#include "ptCL.h"
+#include <chrono>
+
+namespace pt
+{
+    namespace test
+    {
+        double rmse(const float* a, const float* b, size_t n)
+        {
+            double sum = 0;
+
+            for(size_t i = 0; i < n; ++i)
+            {
+                double d = (double)clamp(a[i]) - (double)clamp(b[i]);
+                sum += d * d;
+            }
+
+            return sqrt(sum / (double)n);
+        }
+
+        /* Decorrelates a render from the default per pixel seeds */
+        class SaltedHash : public Hash
+        {
+        public:
+            SaltedHash(int _salt) : salt(_salt) {}
+            unsigned int operator()(int i) override { return pcg((int)pcg(i), salt); }
+            unsigned int operator()(int i, int j) override { return pcg((int)pcg(i, j), salt); }
+        private:
+            PcgHash pcg;
+            int salt;
+        };
+        
+        /*
+         * diffuse_metal_glass scene, uniform render_frame against render_frame_adaptive at equal total samples
+         * The error of both is measured against a high sample count reference with independent seeds
+         */
+        pt_test_result test_adaptive_sampling_rmse()
+        {
+            const unsigned int width = 80;
+            const unsigned int height = 60;
+            const unsigned int samples = 16;
+            const unsigned int reference_samples = 1024;
+            const float threshold = 0.02f;
+
+            size_t size = 3 * width * height;
+            std::vector<float> reference(size), uniform(size), adaptive(size);
+
+            PinholeCamera<float> cam(60.0f, (float)width/(float)height,
+                                     glm::vec3(-2,2,1),
+                                     glm::vec3(0,0,-1),
+                                     glm::vec3(0,1,0));
+
+            PrimitiveList<float> list;
+            std::vector<std::shared_ptr<Material<float>>> materials;
+            diffuse_metal_glass_scene(list, materials);
+
+            XORUniformRNG<float> rng;
+            PcgHash hash;
+
+            SaltedHash reference_hash(0x5eed);
+            render_frame(width, height, reference_samples, cam, list, materials, reference.data(), rng, reference_hash);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            render_frame(width, height, samples, cam, list, materials, uniform.data(), rng, hash);
+            std::chrono::duration<double> uniform_time = std::chrono::high_resolution_clock::now() - start;
+
+            start = std::chrono::high_resolution_clock::now();
+            size_t spent = render_frame_adaptive(width, height, samples, threshold, cam, list, materials, adaptive.data(), rng, hash);
+            std::chrono::duration<double> adaptive_time = std::chrono::high_resolution_clock::now() - start;
+
+            double uniform_rmse = rmse(uniform.data(), reference.data(), size);
+            double adaptive_rmse = rmse(adaptive.data(), reference.data(), size);
+
+            std::cout << "========= ADAPTIVE =========\n";
+            std::cout << "diffuse_metal_glass " << width << "x" << height << " " << samples << " spp\n"
+            << "Uniform RMSE : " << uniform_rmse << " (" << uniform_time.count() * 1000.0 << " ms)\n"
+            << "Adaptive RMSE : " << adaptive_rmse << " (" << adaptive_time.count() * 1000.0 << " ms)\n"
+            << "Adaptive samples : " << spent << " / " << (size_t)samples * width * height << "\n";
+            std::cout << "============================\n\n";
+
+            if(spent > (size_t)samples * width * height)
+            {
+                std::cout << "Adaptive sampling exceeded its budget\n";
+                return PT_TEST_FAIL;
+            }
+
+            if(adaptive_rmse >= uniform_rmse)
+            {
+                std::cout << "Adaptive sampling did not reduce the error\n";
+                return PT_TEST_FAIL;
+            }
+
+            return PT_TEST_PASS;
+        }
+
+        /*
+         * adaptive_sampling.cl against the same kernels with every pixel always active, at equal total samples
+         * Also checks the compacted active list against the pixel errors computed on the host
+         */
+        pt_test_result test_adaptive_sampling_cl(cl::Device& device, cl::Context& context, cl::CommandQueue& cmd_queue)
+        {
+            cl_int clStatus;
+            cl::Program adaptive_program;
+            cl::Program scan_program;
+            
+            const cl_uint width = 320;
+            const cl_uint height = 240;
+            const cl_uint samples = 16;
+            const cl_uint reference_samples = 1024;
+            const cl_float threshold = 0.02f;
+            
+            clStatus = pt::test::test_util_get_program(device, context, adaptive_program, "../../../assets/adaptive_sampling.cl", "-I ../../../assets/ -cl-denorms-are-zero");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+            
+            clStatus = pt::test::test_util_get_program(device, context, scan_program, "../../../assets/hillis_steele_scan.cl", "-cl-denorms-are-zero -D SCAN_INCLUSIVE");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+            
+            /* Create and upload the scene */
+            cl::Buffer d_buff_r_cam(context, CL_MEM_READ_ONLY, sizeof(cl_pinhole_cam), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create camera buffer")
+            cl::Buffer d_buff_r_prim(context, CL_MEM_READ_ONLY, MAX_PRIMITIVES * sizeof(cl_sphere), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create primitive buffer")
+            cl::Buffer d_buff_r_mat(context, CL_MEM_READ_ONLY, MAX_PRIMITIVES * sizeof(cl_material), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create material buffer")
+            cl::Buffer d_buff_r_sky(context, CL_MEM_READ_ONLY, sizeof(cl_sky_material), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create sky buffer")
+            
+            const cl_uint sceneObjectCount = test_util_weekend_scene(cmd_queue, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky);
+            
+            clStatus = cl_set_pinhole_cam_arg(pt::PinholeCamera<float>(45.0f, (float)width / (float)height, glm::vec3(-2,1,1), glm::vec3(0,0,-1), glm::vec3(0,1,0)), d_buff_r_cam, cmd_queue);
+            PTCL_ASSERT(clStatus, "Could not fill camera buffer")
+            
+            /* a negative threshold keeps every pixel active, i.e. uniform sampling */
+            std::vector<cl_float4> reference, uniform, adaptive;
+            
+            cl_render_adaptive(device, context, cmd_queue, adaptive_program, scan_program, d_buff_r_cam, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky,
+                               sceneObjectCount, width, height, reference_samples, -1.0f, 0x5eed, reference);
+            
+            size_t uniform_spent = cl_render_adaptive(device, context, cmd_queue, adaptive_program, scan_program, d_buff_r_cam, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky,
+                                                      sceneObjectCount, width, height, samples, -1.0f, 0, uniform);
+            
+            size_t adaptive_spent = cl_render_adaptive(device, context, cmd_queue, adaptive_program, scan_program, d_buff_r_cam, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky,
+                                                       sceneObjectCount, width, height, samples, threshold, 0, adaptive);
+            
+            double uniform_rmse = rmse(uniform, reference);
+            double adaptive_rmse = rmse(adaptive, reference);
+            
+            std::cout << "========= ADAPTIVE =========\n";
+            std::cout << "adaptive_sampling.cl " << width << "x" << height << " " << samples << " spp\n"
+            << "Uniform RMSE : " << uniform_rmse << " (" << uniform_spent << " samples)\n"
+            << "Adaptive RMSE : " << adaptive_rmse << " (" << adaptive_spent << " samples)\n";
+            std::cout << "============================\n\n";
+            
+            /* compact the final adaptive stats again and check the list on the host */
+            cl_uint pixel_count = width * height;
+            cl::Kernel flag_kernel(adaptive_program, "adaptive_flag", &clStatus);
+            cl::Kernel compact_kernel(adaptive_program, "adaptive_compact", &clStatus);
+            cl::Kernel scan_sum_kernel(scan_program, "hillis_steele_scan_sum", &clStatus);
+            cl::Kernel add_block_sums_kernel(scan_program, "hillis_steele_add_block_sums", &clStatus);
+            size_t block_size = scan_sum_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+            size_t padded_size = ((pixel_count + block_size - 1) / block_size) * block_size;
+            
+            std::vector<cl_uint> counts(pixel_count, 2);
+            cl::Buffer stats(context, CL_MEM_READ_WRITE, pixel_count * sizeof(cl_float4), NULL, &clStatus);
+            cl::Buffer sample_count(context, CL_MEM_READ_WRITE, pixel_count * sizeof(cl_uint), NULL, &clStatus);
+            cl::Buffer flags(context, CL_MEM_READ_WRITE, padded_size * sizeof(cl_int), NULL, &clStatus);
+            cl::Buffer active_pixels(context, CL_MEM_READ_WRITE, pixel_count * sizeof(cl_uint), NULL, &clStatus);
+            std::vector<cl::Buffer> block_sums;
+            
+            PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write stats buffer error.", cmd_queue, stats, CL_TRUE, 0, pixel_count * sizeof(cl_float4), adaptive.data(), NULL, NULL)
+            PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write sample count buffer error.", cmd_queue, sample_count, CL_TRUE, 0, pixel_count * sizeof(cl_uint), counts.data(), NULL, NULL)
+            
+            cl_uint active_count = cl_compact_active_pixels(context, cmd_queue, flag_kernel, compact_kernel, scan_sum_kernel, add_block_sums_kernel,
+                                                            stats, sample_count, flags, active_pixels, block_sums, pixel_count, threshold, block_size);
+            
+            std::vector<cl_uint> expected;
+            for (cl_uint i = 0; i < pixel_count; ++i)
+                if (sqrtf(adaptive[i].s[3] / 2.0f) > threshold) expected.push_back(i);
+            
+            std::vector<cl_uint> computed(std::max<size_t>(active_count, 1));
+            PTCL_SAFE_OP("Could not read active pixels", enqueueReadBuffer, cmd_queue, active_pixels, CL_TRUE, 0, computed.size() * sizeof(cl_uint), computed.data())
+            
+            if (active_count != expected.size())
+            {
+                std::cout << "Active pixel count mismatch, expected " << expected.size() << " computed " << active_count << "\n";
+                return PT_TEST_FAIL;
+            }
+            
+            if (active_count > 0 && compare_array(expected.data(), computed.data(), active_count, "adaptive_compact test failed") != PT_TEST_PASS)
+                return PT_TEST_FAIL;
+            
+            if (adaptive_spent > uniform_spent || adaptive_rmse >= uniform_rmse)
+            {
+                std::cout << "Adaptive sampling did not reduce the error\n";
+                return PT_TEST_FAIL;
+            }
+            
+            return PT_TEST_PASS;
+        }
+    }
+}
+
+#endif /* AdaptiveSamplingUnitTest_h */
@@ -0,0 +1,183 @@
+#ifndef AutotunerUnitTest_h
+#define AutotunerUnitTest_h
+
+#include "ptTestUtils.h"
+#include "ptCLAutotuner.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * Tunes the local size of path_tracing, reduce, hillis_steele_scan and cam_rays_kernel and prints the table
+         * Checks the reduction is still right with the tuned size and that a second query comes from the cache
+         */
+        pt_test_result test_autotune_kernels(cl::Device& device, cl::Context& context, cl::CommandQueue& cmd_queue)
+        {
+            cl_int clStatus;
+
+            CLAutotuner& autotuner = test_util_autotuner(device, context, cmd_queue);
+            CLBufferPool::Scope buffers(test_util_buffer_pool(context));
+
+            const cl_uint width = 512;
+            const cl_uint height = 512;
+            const cl_uint samples = 4;
+            const size_t n = 1 << 20;
+
+            /* path_tracing, 2D over an image */
+            cl::Program pt_program;
+            clStatus = test_util_get_program(device, context, pt_program, "../../../assets/path_tracing.cl", "-I ../../../assets/ -cl-denorms-are-zero");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+
+            cl::Kernel pt_kernel(pt_program, "path_tracing", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+
+            cl::Buffer d_buff_r_cam = buffers.acquire(sizeof(cl_pinhole_cam), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create camera buffer")
+            cl::Buffer d_buff_r_prim = buffers.acquire(MAX_PRIMITIVES * sizeof(cl_sphere), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create primitive buffer")
+            cl::Buffer d_buff_r_mat = buffers.acquire(MAX_PRIMITIVES * sizeof(cl_material), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create material buffer")
+            cl::Buffer d_buff_r_sky = buffers.acquire(sizeof(cl_sky_material), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create sky buffer")
+
+            cl::Image2D d_img(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height, 0, NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create image")
+
+            cl_pinhole_cam camera = cl_make_pinhole_cam(pt::PinholeCamera<float>(45.0f, 1.0f, glm::vec3(-2,1,1), glm::vec3(0,0,-1), glm::vec3(0,1,0)));
+            PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write camera buffer error.", cmd_queue, d_buff_r_cam, CL_TRUE, 0, sizeof(cl_pinhole_cam), &camera, NULL, NULL)
+
+            cl_uint sceneObjectCount = test_util_weekend_scene(cmd_queue, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky);
+
+            PTCL_SAFE_SET_ARG("Could not set camera argument", pt_kernel, 0, d_buff_r_cam)
+            PTCL_SAFE_SET_ARG("Could not set primitive argument", pt_kernel, 1, d_buff_r_prim)
+            PTCL_SAFE_SET_ARG("Could not set material argument", pt_kernel, 2, d_buff_r_mat)
+            PTCL_SAFE_SET_ARG("Could not set sky argument", pt_kernel, 3, d_buff_r_sky)
+            PTCL_SAFE_SET_ARG("Could not set object count argument", pt_kernel, 4, sceneObjectCount)
+            PTCL_SAFE_SET_ARG("Could not set image argument", pt_kernel, 5, d_img)
+            PTCL_SAFE_SET_ARG("Could not set samples argument", pt_kernel, 6, samples)
+
+            cl::NDRange pt_global(width, height);
+            autotuner.localSize(pt_kernel, pt_global);
+
+            /* reduce, 1D with a __local buffer of the group size */
+            cl::Program reduce_program;
+            clStatus = test_util_get_program(device, context, reduce_program, "../../../assets/reduce.cl", "");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+
+            cl::Kernel reduce_kernel(reduce_program, "reduce", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+
+            std::vector<float> reduce_data(n, 1.0f);
+
+            cl::Buffer d_buff_r_data = buffers.acquire(n * sizeof(float), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create data buffer")
+            PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write data buffer error.", cmd_queue, d_buff_r_data, CL_TRUE, 0, n * sizeof(float), reduce_data.data(), NULL, NULL)
+
+            /* one partial sum per group, n is enough for any group size */
+            cl::Buffer d_buff_w_sums = buffers.acquire(n * sizeof(float), CL_MEM_READ_WRITE, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create sums buffer")
+
+            PTCL_SAFE_SET_ARG("Could not set data argument", reduce_kernel, 0, d_buff_r_data)
+            PTCL_SAFE_SET_ARG("Could not set sums argument", reduce_kernel, 2, d_buff_w_sums)
+
+            CLAutotuner::Configure local_floats = [](cl::Kernel& kernel, const cl::NDRange& local) {
+                return kernel.setArg(1, cl::__local(local[0] * sizeof(float)));
+            };
+
+            cl::NDRange reduce_local = autotuner.localSize(reduce_kernel, cl::NDRange(n), local_floats);
+
+            /* hillis_steele_scan, 1D with a __local buffer of the group size, zeros so the repeated launches do not overflow */
+            cl::Program scan_program;
+            clStatus = test_util_get_program(device, context, scan_program, "../../../assets/hillis_steele_scan.cl", "-cl-denorms-are-zero -D SCAN_INCLUSIVE");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+
+            cl::Kernel scan_kernel(scan_program, "hillis_steele_scan", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+
+            std::vector<int> scan_data(n, 0);
+            cl::Buffer d_buff_rw_scan = buffers.acquire(n * sizeof(int), CL_MEM_READ_WRITE, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create scan buffer")
+            PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write scan buffer error.", cmd_queue, d_buff_rw_scan, CL_TRUE, 0, n * sizeof(int), scan_data.data(), NULL, NULL)
+
+            PTCL_SAFE_SET_ARG("Could not set data argument", scan_kernel, 0, d_buff_rw_scan)
+
+            CLAutotuner::Configure local_ints = [](cl::Kernel& kernel, const cl::NDRange& local) {
+                return kernel.setArg(1, cl::__local(local[0] * sizeof(int)));
+            };
+
+            autotuner.localSize(scan_kernel, cl::NDRange(n), local_ints);
+
+            /* cam_rays_kernel, 1D one thread per ray */
+            cl::Program rays_program;
+            clStatus = test_util_get_program(device, context, rays_program, "../../../assets/cam_rays_kernel.cl", "-I ../../../assets/ -cl-denorms-are-zero -D INVERT -D MAX_PRIMITIVES=10 -D MAX_RECURSION=5");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+
+            cl::Kernel rays_kernel(rays_program, "cam_rays_kernel", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+
+            size_t num_rays = width * height * samples;
+
+            cl::Buffer d_buff_w_ray_origin = buffers.acquire(num_rays * sizeof(cl_float3), CL_MEM_READ_WRITE, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create out ray buffer")
+            cl::Buffer d_buff_w_ray_dir = buffers.acquire(num_rays * sizeof(cl_float3), CL_MEM_READ_WRITE, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create out ray buffer")
+
+            PTCL_SAFE_SET_ARG("Could not set ray buffer argument", rays_kernel, 0, d_buff_w_ray_origin)
+            PTCL_SAFE_SET_ARG("Could not set ray buffer argument", rays_kernel, 1, d_buff_w_ray_dir)
+            PTCL_SAFE_SET_ARG("Could not set cam buffer argument", rays_kernel, 2, d_buff_r_cam)
+            PTCL_SAFE_SET_ARG("Could not set width argument", rays_kernel, 3, width)
+            PTCL_SAFE_SET_ARG("Could not set height argument", rays_kernel, 4, height)
+            PTCL_SAFE_SET_ARG("Could not set samples argument", rays_kernel, 5, samples)
+
+            autotuner.localSize(rays_kernel, cl::NDRange(num_rays));
+
+            autotuner.printResults();
+
+            /* Every launch found at least one working size */
+            const cl::Kernel* kernels[] = { &pt_kernel, &reduce_kernel, &scan_kernel, &rays_kernel };
+            const cl::NDRange globals[] = { pt_global, cl::NDRange(n), cl::NDRange(n), cl::NDRange(num_rays) };
+
+            for (size_t k = 0; k < 4; ++k)
+            {
+                const CLAutotuner::Result* r = autotuner.find(*kernels[k], globals[k]);
+
+                if (r == NULL || (r->x == 0 && r->driver_ms == 0))
+                {
+                    std::cout << "No local size for " << kernels[k]->getInfo<CL_KERNEL_FUNCTION_NAME>() << "\n";
+                    return PT_TEST_FAIL;
+                }
+            }
+
+            /* The tuned reduction still sums right, and is answered by the cache the second time */
+            cl::NDRange cached_local = autotuner.localSize(reduce_kernel, cl::NDRange(n), local_floats);
+
+            if (cached_local[0] != reduce_local[0])
+            {
+                std::cout << "Cached local size differs\n";
+                return PT_TEST_FAIL;
+            }
+
+            clStatus = cmd_queue.enqueueNDRangeKernel(reduce_kernel, cl::NullRange, cl::NDRange(n), reduce_local);
+            PTCL_ASSERT(clStatus, "Could not enqueue kernel")
+
+            size_t num_groups = n / reduce_local[0];
+            std::vector<float> sums(num_groups);
+            clStatus = cmd_queue.enqueueReadBuffer(d_buff_w_sums, CL_TRUE, 0, num_groups * sizeof(float), sums.data());
+            PTCL_ASSERT(clStatus, "Could not read sums buffer")
+
+            double total = 0;
+            for (float s : sums) total += s;
+
+            if (total != (double)n)
+            {
+                std::cout << "Reduction with the tuned size is wrong: " << total << "\n";
+                return PT_TEST_FAIL;
+            }
+
+            return PT_TEST_PASS;
+        }
+    }
+}
+
+#endif /* AutotunerUnitTest_h */
@@ -0,0 +1,287 @@
+#ifndef BVHUnitTest_h
+#define BVHUnitTest_h
+
+#include <chrono>
+#include "ptTestUtils.h"
+#include "ptTests.h"
+#include "ptScene.h"
+#include "SceneUnitTest.h"
+#include "MaterialSortUnitTest.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /* n small triangles scattered in the box [-2, 2] x [0, 2] x [-3, 1] where test_util_same_hits casts its rays */
+        void test_util_triangle_soup(size_t n, PrimitiveList<float>& out_list)
+        {
+            XORUniformRNG<float> rng(0x50e9);
+            out_list.clear();
+            out_list.reserve(n);
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                glm::vec3 p(4.0f * rng() - 2.0f, 2.0f * rng(), 4.0f * rng() - 3.0f);
+                glm::vec3 a(rng() - 0.5f, rng() - 0.5f, rng() - 0.5f);
+                glm::vec3 b(rng() - 0.5f, rng() - 0.5f, rng() - 0.5f);
+                out_list.push_back(std::make_shared<Triangle<float>>(p, p + 0.1f * a, p + 0.1f * b));
+            }
+        }
+
+        /* The same primitives with no BVH, tested one by one */
+        void test_util_linear_copy(const PrimitiveList<float>& list, PrimitiveList<float>& out_list)
+        {
+            out_list = list;
+            out_list.setBVH(nullptr);
+        }
+
+        bool test_util_box_contains(const glm::vec3& outer_min, const glm::vec3& outer_max, const glm::vec3& inner_min, const glm::vec3& inner_max)
+        {
+            return outer_min.x <= inner_min.x && outer_min.y <= inner_min.y && outer_min.z <= inner_min.z
+            && outer_max.x >= inner_max.x && outer_max.y >= inner_max.y && outer_max.z >= inner_max.z;
+        }
+
+        /*
+         * Every primitive in exactly one leaf, children after their parent, every box holding its children or its primitives
+         * and no deeper than MaxDepth
+         */
+        bool test_util_valid_bvh(const BVH<float>& bvh, const PrimitiveList<float>& list)
+        {
+            std::vector<int> seen(list.size(), 0);
+            std::vector<int> depth(bvh.nodes.size(), 0);
+
+            for (size_t i = 0; i < bvh.nodes.size(); ++i)
+            {
+                const BVH<float>::Node& node = bvh.nodes[i];
+
+                if (node.count > 0)
+                {
+                    for (int k = node.left_first; k < node.left_first + node.count; ++k)
+                    {
+                        uint32_t idx = bvh.indices[k];
+                        if (idx >= list.size() || seen[idx]++ > 0) return false;
+
+                        glm::vec3 lo, hi;
+                        list[idx]->bounds(lo, hi);
+                        if (!test_util_box_contains(node.bmin, node.bmax, lo, hi)) return false;
+                    }
+
+                    continue;
+                }
+
+                if (node.left_first <= (int)i || node.left_first + 1 >= (int)bvh.nodes.size()) return false;
+
+                for (int c = 0; c < 2; ++c)
+                {
+                    const BVH<float>::Node& child = bvh.nodes[node.left_first + c];
+                    if (!test_util_box_contains(node.bmin, node.bmax, child.bmin, child.bmax)) return false;
+                    depth[node.left_first + c] = depth[i] + 1;
+                    if (depth[i] + 1 >= BVH<float>::MaxDepth) return false;
+                }
+            }
+
+            for (int s : seen) if (s != 1) return false;
+
+            return true;
+        }
+
+        float test_util_half_area(const glm::vec3& bmin, const glm::vec3& bmax)
+        {
+            glm::vec3 e = bmax - bmin;
+            return e.x * e.y + e.y * e.z + e.z * e.x;
+        }
+
+        /* Expected cost of a random ray through the tree, one per node visited and one per primitive tested */
+        double test_util_sah_cost(const BVH<float>& bvh)
+        {
+            double root_area = test_util_half_area(bvh.nodes[0].bmin, bvh.nodes[0].bmax);
+            double cost = 0;
+
+            for (const BVH<float>::Node& node : bvh.nodes)
+            {
+                double p = test_util_half_area(node.bmin, node.bmax) / root_area;
+                cost += p * (node.count > 0 ? (double)node.count : 1.0);
+            }
+
+            return cost;
+        }
+
+        /*
+         * Each builder over random_scene spheres and over a soup of triangles large enough for the parallel build:
+         * a valid tree hitting the same primitives as the linear list. The SAH tree built on the pool and on the
+         * calling thread alone must have the same cost, the node order is all the tasks may change.
+         */
+        pt_test_result test_bvh_builders()
+        {
+            const char* names[] = { "SAH", "LBVH", "median" };
+            const BVHBuild methods[] = { BVH_BUILD_SAH, BVH_BUILD_LBVH, BVH_BUILD_MEDIAN };
+
+            PrimitiveList<float> spheres;
+            std::vector<fMaterialRef> materials;
+            random_scene(spheres, materials);
+
+            PrimitiveList<float> soup;
+            test_util_triangle_soup(20000, soup);
+
+            const PrimitiveList<float>* lists[] = { &spheres, &soup };
+            const char* list_names[] = { "random_scene", "triangle soup" };
+
+            std::cout << "=========== BVH BUILDERS ===========\n";
+
+            for (int l = 0; l < 2; ++l)
+            {
+                PrimitiveList<float> linear;
+                test_util_linear_copy(*lists[l], linear);
+
+                for (int m = 0; m < 3; ++m)
+                {
+                    PrimitiveList<float> list;
+                    test_util_linear_copy(*lists[l], list);
+                    list.buildBVH(methods[m]);
+
+                    const BVH<float>& bvh = *list.getBVH();
+                    std::cout << list_names[l] << " " << names[m] << " : " << bvh.nodes.size() << " nodes, SAH cost " << test_util_sah_cost(bvh) << "\n";
+
+                    if (!test_util_valid_bvh(bvh, list))
+                    {
+                        std::cout << "Invalid " << names[m] << " BVH over " << list_names[l] << "\n";
+                        return PT_TEST_FAIL;
+                    }
+
+                    if (!test_util_same_hits(list, linear, 2000))
+                    {
+                        std::cout << names[m] << " BVH over " << list_names[l] << " misses hits of the linear list\n";
+                        return PT_TEST_FAIL;
+                    }
+                }
+            }
+
+            /* four threads whatever the machine, for the tasks to race */
+            TaskPool parallel(4), serial(0);
+            BVH<float> parallel_bvh, serial_bvh;
+            parallel_bvh.build(soup, BVH_BUILD_SAH, parallel);
+            serial_bvh.build(soup, BVH_BUILD_SAH, serial);
+
+            double parallel_cost = test_util_sah_cost(parallel_bvh);
+            double serial_cost = test_util_sah_cost(serial_bvh);
+
+            std::cout << "SAH cost on " << parallel.size() << " threads : " << parallel_cost << ", serial : " << serial_cost << "\n";
+            std::cout << "====================================\n\n";
+
+            if (parallel_bvh.nodes.size() != serial_bvh.nodes.size() || fabs(parallel_cost - serial_cost) > 1e-6 * serial_cost)
+            {
+                std::cout << "Parallel and serial SAH builds differ\n";
+                return PT_TEST_FAIL;
+            }
+
+            return PT_TEST_PASS;
+        }
+
+        /* Millions of closest hit queries a second for camera rays through list, and the fraction that hit */
+        double test_util_trace_rate(const PrimitiveList<float>& list, const PinholeCamera<float>& cam, int width, int height, double& out_hit_rate)
+        {
+            XORUniformRNG<float> rng(0x5eed);
+            size_t hits = 0;
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+            for (int y = 0; y < height; ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    Ray<float> ray = cam.getRay(((float)x + 0.5f) / (float)width, ((float)y + 0.5f) / (float)height, rng);
+                    float t;
+                    size_t idx;
+                    if (list.intersect_simple(ray, t, idx, ray_min<float>())) ++hits;
+                }
+            }
+
+            double ms = test_util_ms_since(start);
+            out_hit_rate = (double)hits / (double)(width * height);
+            return (double)(width * height) / (ms * 1000.0);
+        }
+
+        /*
+         * Build time against primitive count for each builder, SAH on the calling thread alone and on the pool,
+         * over triangle soups of 10^3 to 10^6. Then the mesh at obj_path built each way, its SAH cost and the rate of camera rays.
+         */
+        void bench_bvh_build(const std::string& obj_path)
+        {
+            typedef std::chrono::high_resolution_clock bench_clock;
+
+            const char* names[] = { "median", "SAH serial", "SAH parallel", "LBVH" };
+            const BVHBuild methods[] = { BVH_BUILD_MEDIAN, BVH_BUILD_SAH, BVH_BUILD_SAH, BVH_BUILD_LBVH };
+            TaskPool serial(0);
+            TaskPool* pools[] = { &task_pool(), &serial, &task_pool(), &task_pool() };
+
+            std::cout << "=========== BVH BUILD ===========\n";
+            std::cout << task_pool().size() << " threads in the pool\n";
+            std::cout << "build ms      ";
+            for (int m = 0; m < 4; ++m) std::cout << names[m] << "  ";
+            std::cout << "\n";
+
+            for (size_t n = 1000; n <= 1000000; n *= 10)
+            {
+                PrimitiveList<float> soup;
+                test_util_triangle_soup(n, soup);
+                std::cout << n << " triangles :";
+
+                for (int m = 0; m < 4; ++m)
+                {
+                    BVH<float> bvh;
+                    bench_clock::time_point start = bench_clock::now();
+                    bvh.build(soup, methods[m], *pools[m]);
+                    std::cout << " " << test_util_ms_since(start);
+                }
+
+                std::cout << "\n";
+            }
+
+            std::vector<glm::vec3> positions;
+            std::vector<uint32_t> indices;
+
+            if (!scene_load_obj(obj_path, positions, indices))
+            {
+                std::cout << "Could not read " << obj_path << "\n";
+                std::cout << "=================================\n\n";
+                return;
+            }
+
+            PrimitiveList<float> mesh;
+            for (size_t i = 0; i < indices.size(); i += 3)
+                mesh.push_back(std::make_shared<Triangle<float>>(positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]]));
+
+            glm::vec3 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+            for (const glm::vec3& p : positions)
+            {
+                lo = glm::min(lo, p);
+                hi = glm::max(hi, p);
+            }
+
+            const int width = 512, height = 256;
+            glm::vec3 center = 0.5f * (lo + hi);
+            float size = glm::length(hi - lo);
+            PinholeCamera<float> cam(40.0f, 2.0f, center + glm::vec3(0.3f, 0.2f, 1.0f) * size, center, glm::vec3(0,1,0));
+
+            std::cout << mesh.size() << " triangles of " << obj_path << "\n";
+
+            for (int m = 0; m < 4; ++m)
+            {
+                bench_clock::time_point start = bench_clock::now();
+                std::shared_ptr<BVH<float>> bvh = std::make_shared<BVH<float>>();
+                bvh->build(mesh, methods[m], *pools[m]);
+                double build_ms = test_util_ms_since(start);
+                mesh.setBVH(bvh);
+
+                double hit_rate = 0;
+                double mrays = test_util_trace_rate(mesh, cam, width, height, hit_rate);
+
+                std::cout << names[m] << " : build " << build_ms << " ms, SAH cost " << test_util_sah_cost(*bvh)
+                << ", " << mrays << " Mrays/s (" << 100.0 * hit_rate << "% hit)\n";
+            }
+
+            std::cout << "=================================\n\n";
+        }
+    }
+}
+
+#endif /* BVHUnitTest_h */
@@ -0,0 +1,126 @@
+#ifndef CLBufferPoolUnitTest_h
+#define CLBufferPoolUnitTest_h
+
+#include "ptTestUtils.h"
+#include "ptCLBufferPool.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * A wavefront style frame loop: ray, hit and accumulation buffers every frame, sizes jittering
+         * within their size class. After the first frame the pool must not allocate anymore,
+         * and a scope only releases the buffers it still owns
+         */
+        pt_test_result test_buffer_pool(cl::Context& context)
+        {
+            cl_int clStatus;
+            
+            const unsigned int frames = 8;
+            const size_t pixels = 320 * 240;
+            
+            if (CLBufferPool::sizeClass(1) != CLBufferPool::MinClassSize
+                || CLBufferPool::sizeClass(4096) != 4096
+                || CLBufferPool::sizeClass(4097) != 8192)
+            {
+                std::cout << "Wrong buffer size classes\n";
+                return PT_TEST_FAIL;
+            }
+            
+            CLBufferPool pool(context);
+            
+            pool.acquire(sizeof(int), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &clStatus);
+            
+            if (clStatus != CL_INVALID_VALUE)
+            {
+                std::cout << "Host pointer buffers must not be pooled\n";
+                return PT_TEST_FAIL;
+            }
+            
+            size_t first_frame_allocations = 0;
+            
+            for (unsigned int f = 0; f < frames; ++f)
+            {
+                pool.beginFrame();
+                
+                size_t active = pixels - f * 100;
+                
+                pool.acquireFrame(active * 2 * sizeof(cl_float3), CL_MEM_READ_WRITE, &clStatus); // rays
+                PTCL_ASSERT(clStatus, "Could not acquire ray buffer")
+                pool.acquireFrame(active * sizeof(cl_float4), CL_MEM_READ_WRITE, &clStatus); // hits
+                PTCL_ASSERT(clStatus, "Could not acquire hit buffer")
+                pool.acquireFrame(pixels * sizeof(cl_float4), CL_MEM_READ_WRITE, &clStatus); // accumulation
+                PTCL_ASSERT(clStatus, "Could not acquire accumulation buffer")
+                
+                {
+                    /* temporaries of a single pass */
+                    CLBufferPool::Scope pass(pool);
+                    pass.acquire(active * sizeof(cl_uint), CL_MEM_READ_WRITE, &clStatus);
+                    PTCL_ASSERT(clStatus, "Could not acquire scan buffer")
+                }
+                
+                pool.endFrame();
+                
+                if (f == 0) first_frame_allocations = pool.getStats().allocations;
+            }
+            
+            const CLBufferPool::Stats& stats = pool.getStats();
+            pool.printStats();
+            
+            size_t expected_high_water = CLBufferPool::sizeClass(pixels * 2 * sizeof(cl_float3))
+                                        + 2 * CLBufferPool::sizeClass(pixels * sizeof(cl_float4))
+                                        + CLBufferPool::sizeClass(pixels * sizeof(cl_uint));
+            
+            if (stats.allocations != first_frame_allocations || stats.bytes_in_use != 0 || stats.high_water_bytes != expected_high_water)
+            {
+                std::cout << "Buffer pool allocated in steady state\n";
+                return PT_TEST_FAIL;
+            }
+            
+            if (stats.reuse_ratio() < (double)(frames - 1) / (double)frames)
+            {
+                std::cout << "Buffer pool reuse ratio " << stats.reuse_ratio() << "\n";
+                return PT_TEST_FAIL;
+            }
+            
+            pool.trim();
+            
+            if (pool.getStats().bytes_allocated != 0)
+            {
+                std::cout << "Buffer pool trim left " << pool.getStats().bytes_allocated << " bytes\n";
+                return PT_TEST_FAIL;
+            }
+            
+            /* a buffer released before its scope ends and acquired again is not released by the scope */
+            cl::Buffer kept;
+            
+            {
+                CLBufferPool::Scope pass(pool);
+                cl::Buffer early = pass.acquire(pixels * sizeof(cl_uint), CL_MEM_READ_WRITE, &clStatus);
+                PTCL_ASSERT(clStatus, "Could not acquire scan buffer")
+                pool.release(early);
+                kept = pool.acquire(pixels * sizeof(cl_uint), CL_MEM_READ_WRITE, &clStatus);
+                PTCL_ASSERT(clStatus, "Could not acquire buffer")
+                
+                if (kept() != early())
+                {
+                    std::cout << "Buffer pool did not reuse the released buffer\n";
+                    return PT_TEST_FAIL;
+                }
+            }
+            
+            if (pool.getStats().bytes_in_use != CLBufferPool::sizeClass(pixels * sizeof(cl_uint)))
+            {
+                std::cout << "Buffer pool scope released a buffer it no longer owned\n";
+                return PT_TEST_FAIL;
+            }
+            
+            pool.release(kept);
+            
+            return PT_TEST_PASS;
+        }
+    }
+}
+
+#endif /* CLBufferPoolUnitTest_h */
@@ -12,6 +12,8 @@
 #include "ptTestUtils.h"
 #include "ptUtil.h"
 #include "ptCL.h"
+#include <random>
+#include <limits>
 
 /*
  * TODO: massively refractor this into a class approach
@@ -56,13 +58,16 @@ namespace pt
             cl::Kernel kernel_render = cl::Kernel(program, "path_tracing", &clStatus);
             PTCL_ASSERT(clStatus, "Could not create kernel");
             
-            cl::Buffer d_buff_w_ray_origin = cl::Buffer(context, CL_MEM_READ_WRITE, ray_partial_size, NULL, &clStatus);
+            /* Ray and frame buffers are recycled across runs */
+            CLBufferPool::Scope buffers(test_util_buffer_pool(context));
+            
+            cl::Buffer d_buff_w_ray_origin = buffers.acquire(ray_partial_size, CL_MEM_READ_WRITE, &clStatus);
             PTCL_ASSERT(clStatus, "Could not create out ray buffer")
             
-            cl::Buffer d_buff_w_ray_dir = cl::Buffer(context, CL_MEM_READ_WRITE, ray_partial_size, NULL, &clStatus);
+            cl::Buffer d_buff_w_ray_dir = buffers.acquire(ray_partial_size, CL_MEM_READ_WRITE, &clStatus);
             PTCL_ASSERT(clStatus, "Could not create out ray buffer")
             
-            cl::Buffer device_buff_r_cam = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(cl_pinhole_cam), NULL, &clStatus);
+            cl::Buffer device_buff_r_cam = buffers.acquire(sizeof(cl_pinhole_cam), CL_MEM_READ_ONLY, &clStatus);
             PTCL_ASSERT(clStatus, "Could not create camera buffer")
             
             /* Upload the data and set the kernel arguments */
@@ -98,7 +103,7 @@ namespace pt
             arg_start = 0;
             
             /* Write buffer for image output */
-            cl::Buffer d_buff_w_frame = cl::Buffer(context, CL_MEM_WRITE_ONLY, samples * width * height * sizeof(cl_float3), NULL, &clStatus);
+            cl::Buffer d_buff_w_frame = buffers.acquire(samples * width * height * sizeof(cl_float3), CL_MEM_WRITE_ONLY, &clStatus);
             PTCL_ASSERT(clStatus, "Could not create out frame buffer")
             PTCL_SAFE_SET_ARG("Could not set frame buffer argument", kernel_render, arg_start++, d_buff_w_frame)
             
@@ -107,13 +112,13 @@ namespace pt
             PTCL_SAFE_SET_ARG("Could not set ray buffer argument", kernel_render, arg_start++, d_buff_w_ray_dir)
             
             /* Create and upload the scene */
-            cl::Buffer d_buff_r_prim = cl::Buffer (context, CL_MEM_READ_ONLY, MAX_PRIMITIVES * sizeof(cl_sphere), NULL, &clStatus);
+            cl::Buffer d_buff_r_prim = buffers.acquire(MAX_PRIMITIVES * sizeof(cl_sphere), CL_MEM_READ_ONLY, &clStatus);
             PTCL_ASSERT(clStatus, "Could not create primitive buffer")
             
-            cl::Buffer d_buff_r_mat = cl::Buffer (context, CL_MEM_READ_ONLY, MAX_PRIMITIVES * sizeof(cl_material), NULL, &clStatus);
+            cl::Buffer d_buff_r_mat = buffers.acquire(MAX_PRIMITIVES * sizeof(cl_material), CL_MEM_READ_ONLY, &clStatus);
             PTCL_ASSERT(clStatus, "Could not create primitive buffer")
             
-            cl::Buffer d_buff_r_sky = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(cl_sky_material), NULL, &clStatus);
+            cl::Buffer d_buff_r_sky = buffers.acquire(sizeof(cl_sky_material), CL_MEM_READ_ONLY, &clStatus);
             PTCL_ASSERT(clStatus, "Could not create sky buffer")
             
             size_t sceneObjectCount = 5;
@@ -247,13 +252,15 @@ namespace pt
             
             size_t ray_partial_size = num_rays * sizeof(cl_float3); //size of origin or dir array
             
-            cl::Buffer d_buff_w_ray_origin = cl::Buffer(context, CL_MEM_WRITE_ONLY, ray_partial_size, NULL, &clStatus);
+            CLBufferPool::Scope buffers(test_util_buffer_pool(context));
+            
+            cl::Buffer d_buff_w_ray_origin = buffers.acquire(ray_partial_size, CL_MEM_WRITE_ONLY, &clStatus);
             PTCL_ASSERT(clStatus, "Could not create out ray buffer")
             
-            cl::Buffer d_buff_w_ray_dir = cl::Buffer(context, CL_MEM_WRITE_ONLY, ray_partial_size, NULL, &clStatus);
+            cl::Buffer d_buff_w_ray_dir = buffers.acquire(ray_partial_size, CL_MEM_WRITE_ONLY, &clStatus);
             PTCL_ASSERT(clStatus, "Could not create out ray buffer")
             
-            cl::Buffer device_buff_r_cam = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(cl_pinhole_cam), NULL, &clStatus);
+            cl::Buffer device_buff_r_cam = buffers.acquire(sizeof(cl_pinhole_cam), CL_MEM_READ_ONLY, &clStatus);
             PTCL_ASSERT(clStatus, "Could not create camera buffer")
             
             /* Upload the data and set the kernel arguments */
@@ -351,6 +358,245 @@ namespace pt
             
             return PT_TEST_PASS;
         }
+        
+        /* In double, acos of a float dot product is off by more than the quantization near 1 */
+        double test_util_angle(const glm::vec3& a, const glm::vec3& b)
+        {
+            double cx = (double)a.y * b.z - (double)a.z * b.y;
+            double cy = (double)a.z * b.x - (double)a.x * b.z;
+            double cz = (double)a.x * b.y - (double)a.y * b.x;
+            double d = (double)a.x * b.x + (double)a.y * b.y + (double)a.z * b.z;
+            return atan2(sqrt(cx * cx + cy * cy + cz * cz), d);
+        }
+        
+        /*
+         * Host packing helpers: octahedral directions within 1e-4 rad, halves exact where representable
+         */
+        pt_test_result test_ray_packing()
+        {
+            std::mt19937 rng(1234);
+            std::normal_distribution<float> normal(0.0f, 1.0f);
+            
+            double max_angle = 0;
+            
+            for (int i = 0; i < 100000; ++i)
+            {
+                glm::vec3 dir = glm::normalize(glm::vec3(normal(rng), normal(rng), normal(rng)));
+                
+                /* the axes and the octahedron edges are the corner cases */
+                if (i < 6) dir = glm::vec3(i == 0 ? 1 : i == 1 ? -1 : 0, i == 2 ? 1 : i == 3 ? -1 : 0, i == 4 ? 1 : i == 5 ? -1 : 0);
+                
+                glm::vec3 origin, decoded;
+                cl_unpack_ray(cl_pack_ray(glm::vec3(1, 2, 3), dir), origin, decoded);
+                
+                if (origin != glm::vec3(1, 2, 3)) return PT_TEST_FAIL;
+                
+                max_angle = std::max(max_angle, test_util_angle(dir, decoded));
+            }
+            
+            const float values[] = { 0.0f, -0.0f, 1.0f, -2.5f, 0.333251953125f, 65504.0f, 6.103515625e-05f, 5.9604644775390625e-08f };
+            
+            for (float v : values)
+            {
+                float back = half_to_float(float_to_half(v));
+                if (back != v)
+                {
+                    std::cout << "Half round trip " << v << " -> " << back << "\n";
+                    return PT_TEST_FAIL;
+                }
+            }
+            
+            if (half_to_float(float_to_half(1e6f)) != std::numeric_limits<float>::infinity()) return PT_TEST_FAIL;
+            if (fabsf(half_to_float(float_to_half(0.1f)) - 0.1f) > 0.1f / 2048.0f) return PT_TEST_FAIL;
+            
+            std::cout << "Octahedral max error : " << max_angle << " rad\n";
+            
+            return (max_angle < 1e-4) ? PT_TEST_PASS : PT_TEST_FAIL;
+        }
+        
+        double test_util_event_ms(const cl::Event& evt)
+        {
+            return (evt.getProfilingInfo<CL_PROFILING_COMMAND_END>() - evt.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 0.001 * 0.001;
+        }
+        
+        /*
+         * Camera rays then path tracing over them, once with float3 origin and direction streams and float3 radiance,
+         * once with packed camera rays and half radiance. Prints time and bytes moved per pass and compares the images.
+         */
+        pt_test_result test_ray_layout_bandwidth(cl::Device& device, cl::Context& context, cl::CommandQueue& cmd_queue)
+        {
+            cl_int clStatus;
+            cl::Program program;
+            
+            const cl_uint width = 512;
+            const cl_uint height = 512;
+            const cl_uint samples = 8;
+            const size_t num_rays = width * height * samples;
+            const int repeats = 5;
+            
+            clStatus = pt::test::test_util_get_program(device, context, program, "../../../assets/cam_rays_kernel.cl", "-I ../../../assets/ -cl-denorms-are-zero -D INVERT -D MAX_PRIMITIVES=10 -D MAX_RECURSION=5");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+            
+            cl::Kernel rays(program, "cam_rays_kernel", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+            cl::Kernel render(program, "path_tracing", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+            cl::Kernel rays_packed(program, "cam_rays_kernel_packed", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+            cl::Kernel render_packed(program, "path_tracing_packed", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+            
+            CLBufferPool::Scope buffers(test_util_buffer_pool(context));
+            
+            cl::Buffer d_buff_ray_origin = buffers.acquire(num_rays * sizeof(cl_float3), CL_MEM_READ_WRITE, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create ray buffer")
+            cl::Buffer d_buff_ray_dir = buffers.acquire(num_rays * sizeof(cl_float3), CL_MEM_READ_WRITE, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create ray buffer")
+            cl::Buffer d_buff_frame = buffers.acquire(num_rays * sizeof(cl_float3), CL_MEM_READ_WRITE, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create frame buffer")
+            
+            cl::Buffer d_buff_ray_packed = buffers.acquire(num_rays * sizeof(cl_uint), CL_MEM_READ_WRITE, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create packed ray buffer")
+            cl::Buffer d_buff_frame_half = buffers.acquire(num_rays * 4 * sizeof(cl_half), CL_MEM_READ_WRITE, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create half frame buffer")
+            
+            cl::Buffer d_buff_r_cam = buffers.acquire(sizeof(cl_pinhole_cam), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create camera buffer")
+            cl::Buffer d_buff_r_prim = buffers.acquire(MAX_PRIMITIVES * sizeof(cl_sphere), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create primitive buffer")
+            cl::Buffer d_buff_r_mat = buffers.acquire(MAX_PRIMITIVES * sizeof(cl_material), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create material buffer")
+            cl::Buffer d_buff_r_sky = buffers.acquire(sizeof(cl_sky_material), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create sky buffer")
+            
+            cl_pinhole_cam camera = cl_make_pinhole_cam(pt::PinholeCamera<float>(45.0f, 1.0f, glm::vec3(-2,1,1), glm::vec3(0,0,-1), glm::vec3(0,1,0)));
+            PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write camera buffer error.", cmd_queue, d_buff_r_cam, CL_TRUE, 0, sizeof(cl_pinhole_cam), &camera, NULL, NULL)
+            
+            cl_uint count = test_util_weekend_scene(cmd_queue, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky);
+            float weight = 1.0f / (float)samples;
+            
+            cl_uint arg = 0;
+            PTCL_SAFE_SET_ARG("Could not set ray buffer argument", rays, arg++, d_buff_ray_origin)
+            PTCL_SAFE_SET_ARG("Could not set ray buffer argument", rays, arg++, d_buff_ray_dir)
+            PTCL_SAFE_SET_ARG("Could not set cam buffer argument", rays, arg++, d_buff_r_cam)
+            PTCL_SAFE_SET_ARG("Could not set width argument", rays, arg++, width)
+            PTCL_SAFE_SET_ARG("Could not set height argument", rays, arg++, height)
+            PTCL_SAFE_SET_ARG("Could not set samples argument", rays, arg++, samples)
+            
+            arg = 0;
+            PTCL_SAFE_SET_ARG("Could not set frame buffer argument", render, arg++, d_buff_frame)
+            PTCL_SAFE_SET_ARG("Could not set ray buffer argument", render, arg++, d_buff_ray_origin)
+            PTCL_SAFE_SET_ARG("Could not set ray buffer argument", render, arg++, d_buff_ray_dir)
+            PTCL_SAFE_SET_ARG("Could not set primitive argument", render, arg++, d_buff_r_prim)
+            PTCL_SAFE_SET_ARG("Could not set material argument", render, arg++, d_buff_r_mat)
+            PTCL_SAFE_SET_ARG("Could not set sky argument", render, arg++, d_buff_r_sky)
+            PTCL_SAFE_SET_ARG("Could not set count argument", render, arg++, count)
+            PTCL_SAFE_SET_ARG("Could not set weight argument", render, arg++, weight)
+            
+            arg = 0;
+            PTCL_SAFE_SET_ARG("Could not set ray buffer argument", rays_packed, arg++, d_buff_ray_packed)
+            PTCL_SAFE_SET_ARG("Could not set cam buffer argument", rays_packed, arg++, d_buff_r_cam)
+            PTCL_SAFE_SET_ARG("Could not set width argument", rays_packed, arg++, width)
+            PTCL_SAFE_SET_ARG("Could not set height argument", rays_packed, arg++, height)
+            PTCL_SAFE_SET_ARG("Could not set samples argument", rays_packed, arg++, samples)
+            
+            arg = 0;
+            PTCL_SAFE_SET_ARG("Could not set frame buffer argument", render_packed, arg++, d_buff_frame_half)
+            PTCL_SAFE_SET_ARG("Could not set ray buffer argument", render_packed, arg++, d_buff_ray_packed)
+            PTCL_SAFE_SET_ARG("Could not set cam buffer argument", render_packed, arg++, d_buff_r_cam)
+            PTCL_SAFE_SET_ARG("Could not set primitive argument", render_packed, arg++, d_buff_r_prim)
+            PTCL_SAFE_SET_ARG("Could not set material argument", render_packed, arg++, d_buff_r_mat)
+            PTCL_SAFE_SET_ARG("Could not set sky argument", render_packed, arg++, d_buff_r_sky)
+            PTCL_SAFE_SET_ARG("Could not set count argument", render_packed, arg++, count)
+            PTCL_SAFE_SET_ARG("Could not set weight argument", render_packed, arg++, weight)
+            
+            /* best of repeats after a warm up, per kernel */
+            cl::Kernel* kernels[] = { &rays, &render, &rays_packed, &render_packed };
+            double best_ms[4] = { 0, 0, 0, 0 };
+            
+            for (int r = 0; r <= repeats; ++r)
+            {
+                for (int k = 0; k < 4; ++k)
+                {
+                    cl::Event evt;
+                    clStatus = cmd_queue.enqueueNDRangeKernel(*kernels[k], cl::NullRange, cl::NDRange(num_rays), cl::NullRange, NULL, &evt);
+                    PTCL_ASSERT(clStatus, "Could not enqueue kernel")
+                    evt.wait();
+                    
+                    double ms = test_util_event_ms(evt);
+                    if (r > 0 && (best_ms[k] == 0 || ms < best_ms[k])) best_ms[k] = ms;
+                }
+            }
+            
+            /* bytes per ray each kernel moves through the streams, the scene is in constant memory */
+            const double bytes[4] = {
+                2.0 * sizeof(cl_float3),
+                3.0 * sizeof(cl_float3),
+                sizeof(cl_uint),
+                sizeof(cl_uint) + 4 * sizeof(cl_half)
+            };
+            
+            const char* names[] = { "float3 camera rays", "float3 path tracing", "packed camera rays", "packed path tracing" };
+            
+            std::cout << "=========== RAY LAYOUT BANDWIDTH ===========\n";
+            std::cout << "Rays : " << num_rays << "\n";
+            
+            for (int k = 0; k < 4; ++k)
+            {
+                std::cout << names[k] << " : " << best_ms[k] << " ms, "
+                << bytes[k] << " B/ray, "
+                << (best_ms[k] > 0 ? bytes[k] * num_rays / (best_ms[k] * 1e6) : 0) << " GB/s\n";
+            }
+            
+            std::cout << "Round trip : " << best_ms[0] + best_ms[1] << " ms vs " << best_ms[2] + best_ms[3] << " ms packed\n";
+            
+            /* packed directions within quantization of the float3 ones */
+            std::vector<cl_float3> h_dir(num_rays);
+            std::vector<cl_uint> h_dir_packed(num_rays);
+            
+            PTCL_SAFE_OP("Could not read ray buffer", enqueueReadBuffer, cmd_queue, d_buff_ray_dir, CL_TRUE, 0, num_rays * sizeof(cl_float3), h_dir.data())
+            PTCL_SAFE_OP("Could not read ray buffer", enqueueReadBuffer, cmd_queue, d_buff_ray_packed, CL_TRUE, 0, num_rays * sizeof(cl_uint), h_dir_packed.data())
+            
+            double max_angle = 0;
+            
+            for (size_t i = 0; i < num_rays; ++i)
+            {
+                glm::vec3 expected(h_dir[i].x, h_dir[i].y, h_dir[i].z);
+                max_angle = std::max(max_angle, test_util_angle(expected, cl_oct_decode(h_dir_packed[i])));
+            }
+            
+            /* and the images match, up to the few paths the quantization sends elsewhere */
+            std::vector<cl_float3> h_frame(num_rays);
+            std::vector<cl_half> h_frame_half(4 * num_rays);
+            
+            PTCL_SAFE_OP("Could not read frame buffer", enqueueReadBuffer, cmd_queue, d_buff_frame, CL_TRUE, 0, num_rays * sizeof(cl_float3), h_frame.data())
+            PTCL_SAFE_OP("Could not read frame buffer", enqueueReadBuffer, cmd_queue, d_buff_frame_half, CL_TRUE, 0, num_rays * 4 * sizeof(cl_half), h_frame_half.data())
+            
+            std::vector<cl_float4> img(width * height), img_packed(width * height);
+            
+            for (size_t i = 0; i < width * height; ++i)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    img[i].s[c] = 0;
+                    img_packed[i].s[c] = 0;
+                    
+                    for (cl_uint k = 0; k < samples; ++k)
+                    {
+                        img[i].s[c] += h_frame[samples * i + k].s[c];
+                        img_packed[i].s[c] += half_to_float(h_frame_half[4 * (samples * i + k) + c]);
+                    }
+                }
+            }
+            
+            double error = rmse(img, img_packed);
+            
+            std::cout << "Direction max error : " << max_angle << " rad\n";
+            std::cout << "Image RMSE : " << error << "\n";
+            std::cout << "============================================\n\n";
+            
+            return (max_angle < 1e-3 && error < 0.01) ? PT_TEST_PASS : PT_TEST_FAIL;
+        }
     }
 }
 
@@ -0,0 +1,173 @@
+#ifndef CameraUnitTest_h
+#define CameraUnitTest_h
+
+#include <functional>
+#include "ptTestUtils.h"
+#include "ptCL.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * Largest difference between the rays of the camera_rays kernel for camera and expected(s, t, rng) of every pixel,
+         * rng seeded as the kernel seeds the pixel
+         */
+        double test_util_camera_rays_error(cl::Context& context,
+                                           cl::CommandQueue& cmd_queue,
+                                           cl::Program& program,
+                                           const cl_camera& camera,
+                                           cl_uint width,
+                                           cl_uint height,
+                                           const std::function<Ray<float>(float, float, UniformRNG<float>&)>& expected)
+        {
+            cl_int clStatus;
+
+            cl::Kernel kernel(program, "camera_rays", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+
+            cl::Buffer d_buff_w_rays(context, CL_MEM_WRITE_ONLY, width * height * sizeof(cl_ray), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create ray buffer")
+
+            cl::Buffer d_buff_r_cam(context, CL_MEM_READ_ONLY, sizeof(cl_camera), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create camera buffer")
+            clStatus = cl_set_camera_arg(camera, d_buff_r_cam, cmd_queue);
+            PTCL_ASSERT(clStatus, "Could not fill camera buffer")
+
+            cl_uint arg = 0;
+            PTCL_SAFE_SET_ARG("Could not set ray argument", kernel, arg++, d_buff_w_rays)
+            PTCL_SAFE_SET_ARG("Could not set cam argument", kernel, arg++, d_buff_r_cam)
+            PTCL_SAFE_SET_ARG("Could not set width argument", kernel, arg++, width)
+            PTCL_SAFE_SET_ARG("Could not set height argument", kernel, arg++, height)
+
+            clStatus = cmd_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(width * height), cl::NullRange);
+            PTCL_ASSERT(clStatus, "Could not enqueue kernel")
+
+            std::vector<cl_ray> rays(width * height);
+            PTCL_SAFE_OP("Could not read ray buffer", enqueueReadBuffer, cmd_queue, d_buff_w_rays, CL_TRUE, 0, rays.size() * sizeof(cl_ray), rays.data())
+
+            PcgHash hash;
+            double max_error = 0;
+
+            for (cl_uint y = 0; y < height; ++y)
+            {
+                for (cl_uint x = 0; x < width; ++x)
+                {
+                    XORUniformRNG<float> rng(hash(x, y));
+                    float s = ((float)x + rng()) / (float)width;
+                    float t = ((float)y + rng()) / (float)height;
+                    Ray<float> ray = expected(s, t, rng);
+
+                    const cl_ray& device_ray = rays[y * width + x];
+
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        max_error = std::max(max_error, (double)fabs(device_ray.origin.s[c] - ray.origin[c]));
+                        max_error = std::max(max_error, (double)fabs(device_ray.dir.s[c] - ray.dir[c]));
+                    }
+                }
+            }
+
+            return max_error;
+        }
+
+        /*
+         * Direction of a pose of the PanoramicTripodController of the light field capture (LightfieldAcquisitionUnity)
+         * in the camera basis u, v, w. Unity is left handed with x right, y up and z forward, which are u, v and -w here:
+         * servoX tilts forward by elevation about x, positive down, then servoY turns it by azimuth about y, positive right
+         */
+        glm::vec3 test_util_tripod_dir(float azimuthdeg, float elevationdeg, const glm::vec3& u, const glm::vec3& v, const glm::vec3& w)
+        {
+            float a = azimuthdeg * (float)M_PI / 180.0f;
+            float e = elevationdeg * (float)M_PI / 180.0f;
+
+            glm::vec3 tilted(0.0f, -sinf(e), cosf(e));
+            glm::vec3 turned(tilted.x * cosf(a) + tilted.z * sinf(a), tilted.y, tilted.z * cosf(a) - tilted.x * sinf(a));
+
+            return turned.x * u + turned.y * v - turned.z * w;
+        }
+
+        /*
+         * Tripod pose of the point s, t of a full panorama, t from the bottom row: azimuth 0 in the middle of the image,
+         * growing to the right and wrapped to [0, 360), elevation from 90 on the bottom row to -90 on the top one
+         */
+        void test_util_equirect_pose(float s, float t, float& azimuthdeg, float& elevationdeg)
+        {
+            azimuthdeg = fmodf(360.0f * s + 180.0f, 360.0f);
+            elevationdeg = 90.0f - 180.0f * t;
+        }
+
+        /*
+         * Device rays of a pinhole, a thin lens and an equirectangular camera against the CPU ones: PinholeCamera<float>,
+         * LensCamera<float> with the lens point drawn from the same stream, and a full panorama against the tripod poses
+         * of its pixels, once the middle, the quarters, the edges and the top and bottom rows are checked to look
+         * along -w, +u, -u, +w, +v and -v. The thin lens again with the generator chosen at compile time (PT_CAMERA)
+         */
+        pt_test_result test_camera_rays(cl::Device& device, cl::Context& context, cl::CommandQueue& cmd_queue)
+        {
+            cl_int clStatus;
+            cl::Program program, lens_program;
+
+            const cl_uint width = 160;
+            const cl_uint height = 80;
+            const double tolerance = 1e-4;
+            const float aspect = (float)width / (float)height;
+
+            clStatus = test_util_get_program(device, context, program, "../../../assets/cam_rays_kernel.cl", "-I ../../../assets/ -cl-denorms-are-zero");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+
+            clStatus = test_util_get_program(device, context, lens_program, "../../../assets/cam_rays_kernel.cl", "-I ../../../assets/ -cl-denorms-are-zero -D PT_CAMERA=CAM_THIN_LENS");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+
+            glm::vec3 eye(3,3,2);
+            glm::vec3 lookat(0,0,-1);
+            glm::vec3 up(0,1,0);
+
+            PinholeCamera<float> pinhole(45.0f, aspect, eye, lookat, up);
+            LensCamera<float> lens(20.0f, aspect, eye, lookat, up, 2.0f, glm::length(eye - lookat));
+
+            double pinhole_error = test_util_camera_rays_error(context, cmd_queue, program, cl_make_pinhole_cam(pinhole), width, height,
+                [&](float s, float t, UniformRNG<float>& rng) { return pinhole.getRay(s, t, rng); });
+
+            double lens_error = test_util_camera_rays_error(context, cmd_queue, program, cl_make_lens_cam(lens), width, height,
+                [&](float s, float t, UniformRNG<float>& rng) { return lens.getRay(s, t, rng); });
+
+            double lens_define_error = test_util_camera_rays_error(context, cmd_queue, lens_program, cl_make_lens_cam(lens), width, height,
+                [&](float s, float t, UniformRNG<float>& rng) { return lens.getRay(s, t, rng); });
+
+            glm::vec3 w = glm::normalize(eye - lookat);
+            glm::vec3 u = glm::normalize(glm::cross(up, w));
+            glm::vec3 v = glm::cross(w, u);
+
+            auto tripod = [&](float s, float t)
+            {
+                float azimuth, elevation;
+                test_util_equirect_pose(s, t, azimuth, elevation);
+                return test_util_tripod_dir(azimuth, elevation, u, v, w);
+            };
+
+            /* the poses of the middle, the quarters, the edges and the top and bottom rows */
+            const float anchors[][2] = { { 0.5f, 0.5f }, { 0.75f, 0.5f }, { 0.25f, 0.5f }, { 0.0f, 0.5f }, { 1.0f, 0.5f }, { 0.5f, 1.0f }, { 0.5f, 0.0f } };
+            const glm::vec3 axes[] = { -w, u, -u, w, w, v, -v };
+            double anchor_error = 0;
+
+            for (int i = 0; i < 7; ++i)
+                anchor_error = std::max(anchor_error, (double)glm::length(tripod(anchors[i][0], anchors[i][1]) - axes[i]));
+
+            double equirect_error = test_util_camera_rays_error(context, cmd_queue, program, cl_make_equirect_cam(eye, lookat, up), width, height,
+                [&](float s, float t, UniformRNG<float>& rng) { return Ray<float>(eye, tripod(s, t)); });
+
+            std::cout << "=========== CAMERA RAYS ===========\n";
+            std::cout << width << "x" << height << ", max difference to the CPU rays\n";
+            std::cout << "pinhole : " << pinhole_error << "\n";
+            std::cout << "thin lens : " << lens_error << ", " << lens_define_error << " with PT_CAMERA\n";
+            std::cout << "equirectangular : " << equirect_error << ", tripod poses off the camera axes by " << anchor_error << "\n";
+            std::cout << "===================================\n\n";
+
+            return pinhole_error < tolerance && lens_error < tolerance && lens_define_error < tolerance && equirect_error < tolerance && anchor_error < tolerance
+            ? PT_TEST_PASS : PT_TEST_FAIL;
+        }
+    }
+}
+
+#endif /* CameraUnitTest_h */
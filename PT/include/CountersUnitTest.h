@@ -0,0 +1,96 @@
+#ifndef CountersUnitTest_h
+#define CountersUnitTest_h
+
+#include <thread>
+#include "ptTestUtils.h"
+#include "ptTests.h"
+#include "ptCounters.h"
+#include "PathTracerUnitTest.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * Counts a small render_frame: one path per sample, one to MAX_RECURSION rays per path,
+         * every ray tests every primitive. Without PT_COUNTERS nothing may be counted.
+         * Repeated PathTracer renders do not add counter blocks.
+         */
+        pt_test_result test_counters()
+        {
+            const unsigned int width = 40;
+            const unsigned int height = 20;
+            const unsigned int samples = 8;
+            
+            PinholeCamera<float> cam(60.0f, (float)width / (float)height,
+                                     glm::vec3(-2,2,1),
+                                     glm::vec3(0,0,-1),
+                                     glm::vec3(0,1,0));
+            
+            PrimitiveList<float> list;
+            std::vector<fMaterialRef> materials;
+            diffuse_metal_glass_scene(list, materials);
+            
+            std::vector<float> image(3 * width * height);
+            XORUniformRNG<float> rng;
+            PcgHash hash;
+            
+            counters_reset();
+            render_frame(width, height, samples, cam, list, materials, image.data(), rng, hash);
+            CounterTotals totals = counters_merge();
+            const uint64_t* c = totals.count;
+
+#ifdef PT_COUNTERS
+            counters_print(totals);
+            
+            uint64_t paths = (uint64_t)width * height * samples;
+            
+            if (c[PT_COUNTER_PATHS] != paths
+                || c[PT_COUNTER_RAYS] < paths
+                || c[PT_COUNTER_RAYS] > paths * MAX_RECURSION
+                || c[PT_COUNTER_RAYS] > paths + c[PT_COUNTER_BOUNCES]
+                || c[PT_COUNTER_INTERSECTION_TESTS] != c[PT_COUNTER_RAYS] * list.size())
+            {
+                std::cout << "Counters do not add up\n";
+                return PT_TEST_FAIL;
+            }
+#else
+            for (int i = 0; i < PT_COUNTER_COUNT; ++i)
+            {
+                if (c[i] != 0)
+                {
+                    std::cout << "Counter " << i << " counted without PT_COUNTERS\n";
+                    return PT_TEST_FAIL;
+                }
+            }
+#endif
+            
+            /* renders that start threads every time reuse the blocks of the threads before them */
+            Scenef scene;
+            cornell_box_scene(scene);
+            FrameBuffer frame;
+            PathTracerf tracer;
+            double seconds;
+
+            tracer.Trace(scene, 32, 24, 4, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &seconds);
+            std::thread([]() { counters_local(); }).join();
+            size_t blocks = counters_block_count();
+
+            for (int i = 0; i < 16; ++i)
+            {
+                tracer.Trace(scene, 32, 24, 4, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &seconds);
+                std::thread([]() { counters_local(); }).join();
+            }
+
+            if (counters_block_count() != blocks)
+            {
+                std::cout << "Counter blocks grew from " << blocks << " to " << counters_block_count() << " over repeated renders\n";
+                return PT_TEST_FAIL;
+            }
+
+            return PT_TEST_PASS;
+        }
+    }
+}
+
+#endif /* CountersUnitTest_h */
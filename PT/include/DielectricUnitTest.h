@@ -0,0 +1,124 @@
+#ifndef DielectricUnitTest_h
+#define DielectricUnitTest_h
+
+#include "ptTestUtils.h"
+#include "ptTests.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * The scene of test_diffuse_metal_glass_ppm (two glass spheres, one hollow) rendered by render_frame on the CPU
+         * and path_tracing_accumulate on the device. The random streams differ, block averages are compared.
+         * Glass rendered black, as before the device had dielectrics, misses by far more than the tolerance.
+         */
+        pt_test_result test_dielectric_cl(cl::Device& device, cl::Context& context, cl::CommandQueue& cmd_queue)
+        {
+            cl_int clStatus;
+            cl::Program program;
+            
+            const cl_uint width = 160;
+            const cl_uint height = 80;
+            const cl_uint samples = 256;
+            const cl_uint samples_per_frame = 16;
+            const cl_uint block = 8;
+            const double tolerance = 0.04;
+            
+            PinholeCamera<float> cam(60.0f, (float)width / (float)height,
+                                     glm::vec3(-2,2,1),
+                                     glm::vec3(0,0,-1),
+                                     glm::vec3(0,1,0));
+            
+            PrimitiveList<float> list;
+            std::vector<fMaterialRef> materials;
+            diffuse_metal_glass_scene(list, materials);
+            
+            /* CPU reference, rows top to bottom */
+            std::vector<float> cpu_image(3 * width * height);
+            XORUniformRNG<float> rng;
+            PcgHash hash;
+            render_frame(width, height, samples, cam, list, materials, cpu_image.data(), rng, hash);
+            
+            /* device, rows bottom to top */
+            clStatus = test_util_get_program(device, context, program, "../../../assets/path_tracing.cl", "-I ../../../assets/ -cl-denorms-are-zero");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+            
+            cl::Kernel kernel(program, "path_tracing_accumulate", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+            
+            cl::Buffer d_buff_r_prim, d_buff_r_mat, d_buff_r_sky;
+            cl_uint object_count = test_util_upload_scene(context, cmd_queue, list, materials, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky);
+            
+            cl::Buffer d_buff_r_cam(context, CL_MEM_READ_ONLY, sizeof(cl_pinhole_cam), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create camera buffer")
+            clStatus = cl_set_pinhole_cam_arg(cam, d_buff_r_cam, cmd_queue);
+            PTCL_ASSERT(clStatus, "Could not fill camera buffer")
+            
+            cl_accumulation accumulation;
+            clStatus = cl_make_accumulation(context, width * height, cmd_queue, accumulation);
+            PTCL_ASSERT(clStatus, "Could not create accumulation buffer")
+            
+            cl_uint arg = 0;
+            PTCL_SAFE_SET_ARG("Could not set cam argument", kernel, arg++, d_buff_r_cam)
+            PTCL_SAFE_SET_ARG("Could not set primitive argument", kernel, arg++, d_buff_r_prim)
+            PTCL_SAFE_SET_ARG("Could not set material argument", kernel, arg++, d_buff_r_mat)
+            PTCL_SAFE_SET_ARG("Could not set sky argument", kernel, arg++, d_buff_r_sky)
+            PTCL_SAFE_SET_ARG("Could not set count argument", kernel, arg++, object_count)
+            PTCL_SAFE_SET_ARG("Could not set accumulation argument", kernel, arg++, accumulation.buffer)
+            PTCL_SAFE_SET_ARG("Could not set samples argument", kernel, arg++, samples_per_frame)
+            PTCL_SAFE_SET_ARG("Could not set width argument", kernel, arg++, width)
+            PTCL_SAFE_SET_ARG("Could not set height argument", kernel, arg++, height)
+            
+            for (cl_uint frame = 0; frame < samples / samples_per_frame; ++frame)
+            {
+                PTCL_SAFE_SET_ARG("Could not set frame argument", kernel, arg, frame)
+                clStatus = cmd_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(width, height), cl::NullRange);
+                PTCL_ASSERT(clStatus, "Could not enqueue kernel")
+            }
+            
+            std::vector<cl_float4> gpu_image(width * height);
+            PTCL_SAFE_OP("Could not read accumulation buffer", enqueueReadBuffer, cmd_queue, accumulation.buffer, CL_TRUE, 0, width * height * sizeof(cl_float4), gpu_image.data())
+            
+            double max_error = 0;
+            
+            for (cl_uint by = 0; by < height; by += block)
+            {
+                for (cl_uint bx = 0; bx < width; bx += block)
+                {
+                    double sum_cpu[3] = { 0, 0, 0 }, sum_gpu[3] = { 0, 0, 0 };
+                    
+                    for (cl_uint y = by; y < by + block; ++y)
+                    {
+                        for (cl_uint x = bx; x < bx + block; ++x)
+                        {
+                            for (int c = 0; c < 3; ++c)
+                            {
+                                sum_cpu[c] += clamp(cpu_image[3 * ((height - y - 1) * width + x) + c]);
+                                sum_gpu[c] += clamp(gpu_image[y * width + x].s[c]);
+                            }
+                        }
+                    }
+                    
+                    for (int c = 0; c < 3; ++c)
+                        max_error = std::max(max_error, fabs(sum_cpu[c] - sum_gpu[c]) / (double)(block * block));
+                }
+            }
+            
+            std::cout << "========= DIELECTRIC =========\n";
+            std::cout << "diffuse_metal_glass " << width << "x" << height << " " << samples << " spp\n"
+            << "Max block error : " << max_error << "\n";
+            std::cout << "==============================\n\n";
+            
+            if (max_error > tolerance)
+            {
+                std::cout << "Device and CPU images differ by " << max_error << "\n";
+                return PT_TEST_FAIL;
+            }
+            
+            return PT_TEST_PASS;
+        }
+    }
+}
+
+#endif /* DielectricUnitTest_h */
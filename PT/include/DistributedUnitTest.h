@@ -0,0 +1,175 @@
+#ifndef DistributedUnitTest_h
+#define DistributedUnitTest_h
+
+#include "ptTestUtils.h"
+#include "ptTests.h"
+#include "ptDistributed.h"
+#include "PathTracerUnitTest.h"
+
+namespace pt
+{
+    namespace test
+    {
+#if !defined(_WIN32)
+        /*
+         * The mean of passes frames of one process, pass by pass in pass order, as the coordinator adds them.
+         * Both end up in a float FrameBuffer, compare after the same rounding
+         */
+        void test_util_pass_reference(const Scenef& scene, unsigned int width, unsigned int height, unsigned int samples,
+                                      unsigned int passes, std::vector<double>& out_image)
+        {
+            PathTracerf tracer;
+            FrameBuffer frame;
+            double rendertime;
+
+            out_image.assign(width * height * 3, 0);
+
+            for (unsigned int p = 0; p < passes; ++p)
+            {
+                tracer.samplePass = p;
+                tracer.Trace(scene, width, height, samples, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &rendertime);
+
+                for (size_t i = 0; i < out_image.size(); ++i) out_image[i] += (double)frame.getData()[i];
+            }
+
+            for (double& v : out_image) v /= (double)passes;
+        }
+
+        double test_util_max_difference(const std::vector<double>& reference, const FrameBuffer& frame)
+        {
+            double diff = 0;
+            for (size_t i = 0; i < reference.size(); ++i) diff = std::max(diff, fabs((double)(float)reference[i] - (double)frame.getData()[i]));
+            return diff;
+        }
+
+        /*
+         * Worker processes trace the Cornell box in tiles and passes: the image must equal the passes of one process
+         * whatever the number of workers, also when a worker dies or hangs mid frame, and the coordinator gives up once
+         * no worker is left
+         */
+        pt_test_result test_distributed_trace()
+        {
+            const unsigned int width = 64;
+            const unsigned int height = 48;
+            const unsigned int samples = 8;
+            const unsigned int passes = 3;
+
+            Scenef scene;
+            cornell_box_scene(scene);
+
+            std::vector<double> reference;
+            test_util_pass_reference(scene, width, height, samples, passes, reference);
+
+            std::cout << "=========== DISTRIBUTED TRACE ===========\n";
+
+            bool identical = true;
+            const unsigned int workers[] = { 1, 3 };
+
+            for (unsigned int w : workers)
+            {
+                DistributedTracer<float> farm(w, passes);
+                farm.tileSize = 16;
+                FrameBuffer frame;
+                double rendertime;
+
+                farm.Trace(scene, width, height, samples, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &rendertime);
+
+                double diff = test_util_max_difference(reference, frame);
+                identical = identical && diff == 0;
+
+                std::cout << w << " workers : " << rendertime << " s, max difference " << diff << "\n";
+            }
+
+            /* the first worker exits on its third job, its tile is traced again by the next worker */
+            DistributedTracer<float> faulty(2, passes);
+            faulty.tileSize = 16;
+            faulty.faultWorker = 0;
+            faulty.faultAfter = 2;
+            FrameBuffer frame;
+            double rendertime;
+
+            faulty.Trace(scene, width, height, samples, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &rendertime);
+
+            double fault_diff = test_util_max_difference(reference, frame);
+            std::cout << "A worker lost : " << faulty.workersLost << " lost, max difference " << fault_diff << "\n";
+
+            /* the first worker hangs on its second job, it is lost once the job times out */
+            DistributedTracer<float> hung(2, passes);
+            hung.tileSize = 16;
+            hung.jobTimeoutMs = 500;
+            hung.faultWorker = 0;
+            hung.faultAfter = 1;
+            hung.faultHang = true;
+
+            hung.Trace(scene, width, height, samples, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &rendertime);
+
+            double hang_diff = test_util_max_difference(reference, frame);
+            std::cout << "A worker hung : " << hung.workersLost << " lost, max difference " << hang_diff << "\n";
+
+            /* the first worker hangs halfway through its reply to its second job, the reply times out as the job did */
+            DistributedTracer<float> stalled(2, passes);
+            stalled.tileSize = 16;
+            stalled.jobTimeoutMs = 500;
+            stalled.faultWorker = 0;
+            stalled.faultAfter = 1;
+            stalled.faultHang = true;
+            stalled.faultMidReply = true;
+
+            stalled.Trace(scene, width, height, samples, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &rendertime);
+
+            double stall_diff = test_util_max_difference(reference, frame);
+            std::cout << "A worker stalled in its reply : " << stalled.workersLost << " lost, max difference " << stall_diff << "\n";
+
+            /* nobody to take over */
+            DistributedTracer<float> doomed(1, passes);
+            doomed.faultWorker = 0;
+            doomed.maxRespawns = 0;
+            bool gave_up = false;
+
+            try
+            {
+                doomed.Trace(scene, width, height, samples, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &rendertime);
+            }
+            catch (const char* e)
+            {
+                std::cout << "Without workers : " << e << "\n";
+                gave_up = true;
+            }
+
+            std::cout << "==================================\n\n";
+
+            return identical && faulty.workersLost == 1 && fault_diff == 0 && hung.workersLost == 1 && hang_diff == 0
+                && stalled.workersLost == 1 && stall_diff == 0 && gave_up ? PT_TEST_PASS : PT_TEST_FAIL;
+        }
+
+        /*
+         * Render time of the farm against the number of workers, passes of 16 samples per pixel
+         */
+        void bench_distributed_trace(unsigned int width, unsigned int height, unsigned int passes)
+        {
+            Scenef scene;
+            cornell_box_scene(scene);
+
+            std::cout << "=========== DISTRIBUTED TRACE BENCH ===========\n";
+            std::cout << width << "x" << height << ", " << passes << " passes of 16 samples\n";
+
+            const unsigned int workers[] = { 1, 2, 4, 8 };
+
+            for (unsigned int w : workers)
+            {
+                DistributedTracer<float> farm(w, passes);
+                FrameBuffer frame;
+                double rendertime;
+
+                farm.Trace(scene, width, height, 16, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &rendertime);
+
+                std::cout << w << " workers : " << rendertime << " s\n";
+            }
+
+            std::cout << "==================================\n\n";
+        }
+#endif
+    }
+}
+
+#endif /* DistributedUnitTest_h */
@@ -0,0 +1,162 @@
+#ifndef FrameSchedulerUnitTest_h
+#define FrameSchedulerUnitTest_h
+
+#include "ptTestUtils.h"
+#include "ptCLFrameScheduler.h"
+#include <chrono>
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * Renders frames of an orbiting then still camera with path_tracing_accumulate through CLFrameScheduler,
+         * returns the wall time in ms and appends the delivered frames to out_frames
+         */
+        double run_frame_scheduler(cl::Device& device,
+                                   cl::Context& context,
+                                   cl::CommandQueue& cmd_queue,
+                                   cl::Kernel& kernel,
+                                   cl::Kernel& tonemap_kernel,
+                                   size_t frames_in_flight,
+                                   unsigned int frame_count,
+                                   cl_uint width,
+                                   cl_uint height,
+                                   std::vector<std::vector<unsigned char> >& out_frames,
+                                   std::vector<unsigned int>& out_order,
+                                   CLFrameScheduler::Timings& out_timings)
+        {
+            cl_int clStatus;
+            
+            cl::CommandQueue transfer_queue(context, device, CL_QUEUE_PROFILING_ENABLE, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create transfer queue")
+            
+            size_t max_local = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+            cl::NDRange local = (max_local >= 64) ? cl::NDRange(8, 8) : cl::NullRange;
+            
+            cl_accumulation accumulation;
+            clStatus = cl_make_accumulation(context, width * height, cmd_queue, accumulation);
+            PTCL_ASSERT(clStatus, "Could not create accumulation buffer")
+            
+            clStatus = cl_set_tonemap_args(tonemap_kernel, accumulation, width, height);
+            PTCL_ASSERT(clStatus, "Could not set tone map arguments")
+            
+            auto start = std::chrono::high_resolution_clock::now();
+            
+            {
+                CLFrameScheduler scheduler(context, cmd_queue, transfer_queue, kernel, tonemap_kernel, accumulation, width, height, local, frames_in_flight);
+                
+                scheduler.setFrameCallback([&](unsigned int frame, const unsigned char* rgba) {
+                    out_order.push_back(frame);
+                    out_frames.push_back(std::vector<unsigned char>(rgba, rgba + 4 * width * height));
+                });
+                
+                for (unsigned int f = 0; f < frame_count; ++f)
+                {
+                    /* the second half accumulates */
+                    float angle = 0.05f * (float)std::min(f, frame_count / 2);
+                    glm::vec3 eye = glm::vec3(-2.0f * cosf(angle), 1.0f, 1.0f + 2.0f * sinf(angle));
+                    
+                    scheduler.submit(cl_make_pinhole_cam(pt::PinholeCamera<float>(45.0f, (float)width / (float)height, eye, glm::vec3(0,0,-1), glm::vec3(0,1,0))));
+                    scheduler.poll();
+                }
+                
+                scheduler.drain();
+                
+                /* the callbacks may still be running after the last wait */
+                transfer_queue.finish();
+                cmd_queue.finish();
+                out_timings = scheduler.getTimings();
+            }
+            
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            return elapsed.count();
+        }
+        
+        /*
+         * One frame in flight against three: same frames, same order, same pixels
+         */
+        pt_test_result test_frame_scheduler(cl::Device& device, cl::Context& context, cl::CommandQueue& cmd_queue)
+        {
+            cl_int clStatus;
+            cl::Program program;
+            
+            const cl_uint width = 320;
+            const cl_uint height = 240;
+            const cl_uint samples = 4;
+            const unsigned int frame_count = 12;
+            
+            clStatus = pt::test::test_util_get_program(device, context, program, "../../../assets/path_tracing.cl", "-I ../../../assets/ -cl-denorms-are-zero");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+            
+            cl::Kernel kernel(program, "path_tracing_accumulate", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+            
+            cl::Kernel tonemap_kernel(program, "tonemap_buffer", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+            
+            cl::Buffer d_buff_r_prim(context, CL_MEM_READ_ONLY, MAX_PRIMITIVES * sizeof(cl_sphere), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create primitive buffer")
+            cl::Buffer d_buff_r_mat(context, CL_MEM_READ_ONLY, MAX_PRIMITIVES * sizeof(cl_material), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create material buffer")
+            cl::Buffer d_buff_r_sky(context, CL_MEM_READ_ONLY, sizeof(cl_sky_material), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create sky buffer")
+            
+            cl_uint sceneObjectCount = test_util_weekend_scene(cmd_queue, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky);
+            
+            PTCL_SAFE_SET_ARG("Could not set primitive argument", kernel, 1, d_buff_r_prim)
+            PTCL_SAFE_SET_ARG("Could not set material argument", kernel, 2, d_buff_r_mat)
+            PTCL_SAFE_SET_ARG("Could not set sky argument", kernel, 3, d_buff_r_sky)
+            PTCL_SAFE_SET_ARG("Could not set object count argument", kernel, 4, sceneObjectCount)
+            PTCL_SAFE_SET_ARG("Could not set samples argument", kernel, 6, samples)
+            PTCL_SAFE_SET_ARG("Could not set width argument", kernel, 7, width)
+            PTCL_SAFE_SET_ARG("Could not set height argument", kernel, 8, height)
+            
+            std::vector<std::vector<unsigned char> > serial_frames, async_frames;
+            std::vector<unsigned int> serial_order, async_order;
+            CLFrameScheduler::Timings serial_timings, async_timings;
+            
+            double serial_ms = run_frame_scheduler(device, context, cmd_queue, kernel, tonemap_kernel, 1, frame_count, width, height, serial_frames, serial_order, serial_timings);
+            double async_ms = run_frame_scheduler(device, context, cmd_queue, kernel, tonemap_kernel, 3, frame_count, width, height, async_frames, async_order, async_timings);
+            
+            std::cout << "========= SCHEDULER =========\n";
+            std::cout << frame_count << " frames " << width << "x" << height << " " << samples << " spp\n"
+            << "1 frame in flight : " << serial_ms << " ms\n"
+            << "3 frames in flight : " << async_ms << " ms\n"
+            << "Speedup : " << serial_ms / async_ms << "x\n"
+            << "Device time per frame, upload / kernel / tone map / readback : "
+            << async_timings.upload_ms / frame_count << " / "
+            << async_timings.kernel_ms / frame_count << " / "
+            << async_timings.tonemap_ms / frame_count << " / "
+            << async_timings.readback_ms / frame_count << " ms\n";
+            std::cout << "=============================\n\n";
+            
+            if (serial_frames.size() != frame_count || async_frames.size() != frame_count)
+            {
+                std::cout << "Missing frames\n";
+                return PT_TEST_FAIL;
+            }
+            
+            for (unsigned int f = 0; f < frame_count; ++f)
+            {
+                if (serial_order[f] != f || async_order[f] != f)
+                {
+                    std::cout << "Frames delivered out of order\n";
+                    return PT_TEST_FAIL;
+                }
+                
+                if (serial_frames[f] != async_frames[f])
+                {
+                    std::cout << "Frame " << f << " differs with frames in flight\n";
+                    return PT_TEST_FAIL;
+                }
+            }
+            
+            pt::write_ppm<unsigned char>(async_frames.back().data(), width, height, 4, pt::BUFFER_TRANSFORM_NONE, "scheduler.ppm");
+            
+            return PT_TEST_PASS;
+        }
+    }
+}
+
+#endif /* FrameSchedulerUnitTest_h */
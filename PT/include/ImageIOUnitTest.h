@@ -0,0 +1,284 @@
+#ifndef ImageIOUnitTest_h
+#define ImageIOUnitTest_h
+
+#include "ptTestUtils.h"
+#include "ptImageIO.h"
+#include "PathTracerUnitTest.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * Writes a tiled EXR with tiles submitted out of order and parses it back:
+         * header layout, offset table and half float pixel values are checked.
+         * A misaligned tile must be reported by the writer instead of thrown
+         */
+        pt_test_result test_exr_tiled_writer()
+        {
+            const unsigned int width = 37;
+            const unsigned int height = 21;
+            const unsigned int tile_size = 16;
+            const char* filename = "tiled_test.exr";
+
+            auto value = [](unsigned int x, unsigned int y, unsigned int c) {
+                return (double)(x * 3 + c) * 0.125 + (double)y * 10.0;
+            };
+
+            {
+                ExrTiledWriter writer(filename, width, height, tile_size);
+                std::vector<glm::dvec3> tile;
+
+                // bottom right tile first
+                for (int ty = (height - 1) / tile_size; ty >= 0; --ty)
+                {
+                    for (int tx = (width - 1) / tile_size; tx >= 0; --tx)
+                    {
+                        unsigned int x0 = tx * tile_size, y0 = ty * tile_size;
+                        unsigned int w = std::min(tile_size, width - x0), h = std::min(tile_size, height - y0);
+                        tile.resize(w * h);
+
+                        for (unsigned int j = 0; j < h; ++j)
+                            for (unsigned int i = 0; i < w; ++i)
+                                tile[j * w + i] = glm::dvec3(value(x0 + i, y0 + j, 0), value(x0 + i, y0 + j, 1), value(x0 + i, y0 + j, 2));
+
+                        writer.writeTile(x0, y0, w, h, tile.data());
+                    }
+                }
+
+                if (!writer.close())
+                {
+                    std::cout << "EXR writer failed: " << writer.getError() << "\n";
+                    return PT_TEST_FAIL;
+                }
+            }
+
+            /* a bad tile is kept as the error of the writer, render threads cannot throw */
+            {
+                ExrTiledWriter writer("tiled_error.exr", width, height, tile_size);
+                std::vector<glm::dvec3> tile(tile_size * tile_size);
+                writer.writeTile(1, 0, tile_size, tile_size, tile.data());
+
+                if (writer.getError() == nullptr || writer.close())
+                {
+                    std::cout << "Misaligned tile not reported\n";
+                    return PT_TEST_FAIL;
+                }
+            }
+
+            remove("tiled_error.exr");
+
+            std::ifstream file(filename, std::ios::binary);
+            std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+            int32_t magic, version;
+            memcpy(&magic, &bytes[0], 4);
+            memcpy(&version, &bytes[4], 4);
+
+            if (magic != 20000630 || version != 0x202)
+            {
+                std::cout << "Invalid EXR magic number or version\n";
+                return PT_TEST_FAIL;
+            }
+
+            /* walk the attributes up to the empty name terminating the header */
+            size_t pos = 8;
+            bool has_tiles = false;
+
+            while (bytes[pos] != 0)
+            {
+                std::string name(&bytes[pos]); pos += name.size() + 1;
+                std::string type(&bytes[pos]); pos += type.size() + 1;
+                int32_t size; memcpy(&size, &bytes[pos], 4); pos += 4;
+
+                if (name == "tiles")
+                {
+                    uint32_t tx, ty;
+                    memcpy(&tx, &bytes[pos], 4);
+                    memcpy(&ty, &bytes[pos + 4], 4);
+                    has_tiles = (tx == tile_size && ty == tile_size && type == "tiledesc");
+                }
+
+                pos += size;
+            }
+
+            ++pos;
+
+            if (!has_tiles)
+            {
+                std::cout << "Missing or invalid tiles attribute\n";
+                return PT_TEST_FAIL;
+            }
+
+            unsigned int num_tiles_x = (width + tile_size - 1) / tile_size;
+            unsigned int num_tiles_y = (height + tile_size - 1) / tile_size;
+
+            for (unsigned int ty = 0; ty < num_tiles_y; ++ty)
+            {
+                for (unsigned int tx = 0; tx < num_tiles_x; ++tx)
+                {
+                    uint64_t offset;
+                    memcpy(&offset, &bytes[pos + 8 * (ty * num_tiles_x + tx)], 8);
+
+                    int32_t chunk[5];
+                    memcpy(chunk, &bytes[offset], sizeof(chunk));
+
+                    unsigned int x0 = tx * tile_size, y0 = ty * tile_size;
+                    unsigned int w = std::min(tile_size, width - x0), h = std::min(tile_size, height - y0);
+
+                    if (chunk[0] != (int32_t)tx || chunk[1] != (int32_t)ty || chunk[4] != (int32_t)(w * h * 3 * 2))
+                    {
+                        std::cout << "Invalid tile header at tile " << tx << " " << ty << "\n";
+                        return PT_TEST_FAIL;
+                    }
+
+                    const char* pixels = &bytes[offset + sizeof(chunk)];
+
+                    for (unsigned int j = 0; j < h; ++j)
+                    {
+                        for (unsigned int c = 0; c < 3; ++c) // B G R
+                        {
+                            for (unsigned int i = 0; i < w; ++i)
+                            {
+                                uint16_t half;
+                                memcpy(&half, pixels + 2 * ((j * 3 + c) * w + i), 2);
+
+                                float expected = half_to_float(float_to_half((float)value(x0 + i, y0 + j, 2 - c)));
+
+                                if (half_to_float(half) != expected)
+                                {
+                                    std::cout << "Pixel mismatch at " << x0 + i << " " << y0 + j << "\n";
+                                    return PT_TEST_FAIL;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            remove(filename);
+
+            return PT_TEST_PASS;
+        }
+
+        /*
+         * FrameBuffer keeps its storage across Trace calls, takes float tiles as they are
+         * and its 8 bit conversion matches to255Linear
+         */
+        pt_test_result test_frame_buffer()
+        {
+            const unsigned int width = 67;
+            const unsigned int height = 45;
+
+            Scened scene;
+            cornell_box_scene(scene);
+
+            PathTracerd tracer;
+            FrameBuffer frame;
+            double rendertime;
+
+            tracer.Trace(scene, width, height, 4, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &rendertime);
+
+            const float* storage = frame.getData();
+
+            if (((size_t)storage % FrameBuffer::Alignment) != 0)
+            {
+                std::cout << "Frame buffer storage is not aligned\n";
+                return PT_TEST_FAIL;
+            }
+
+            tracer.Trace(scene, width / 2, height / 2, 4, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &rendertime);
+            tracer.Trace(scene, width, height, 4, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &rendertime);
+
+            if (frame.getData() != storage)
+            {
+                std::cout << "Frame buffer storage was reallocated\n";
+                return PT_TEST_FAIL;
+            }
+
+            /* include out of range values, the conversion clamps */
+            frame.getData()[0] = -1.0f;
+            frame.getData()[1] = 2.0f;
+            frame.getData()[2] = 0.5f;
+
+            std::vector<unsigned char> rgb8(frame.size());
+            frame.toRGB8(rgb8.data());
+
+            for (size_t i = 0; i < frame.size(); ++i)
+            {
+                if (rgb8[i] != (unsigned char)to255Linear<float>(frame.getData()[i]))
+                {
+                    std::cout << "8 bit conversion mismatch at " << i << "\n";
+                    return PT_TEST_FAIL;
+                }
+            }
+
+            /* a float tile lands as the same floats, through FrameBuffer and through the widening of TileSink */
+            struct WideSink : TileSink
+            {
+                FrameBuffer frame;
+                void writeTile(unsigned int x, unsigned int y, unsigned int w, unsigned int h, const glm::dvec3* tile) override { frame.writeTile(x, y, w, h, tile); }
+            };
+
+            std::vector<glm::vec3> float_tile(6 * 5);
+            for (size_t i = 0; i < float_tile.size(); ++i) float_tile[i] = glm::vec3(0.1f * (float)i, 1.0f / (float)(i + 3), -(float)i);
+
+            WideSink wide;
+            wide.frame.resize(width, height);
+            static_cast<TileSink&>(wide).writeTile(7, 3, 6, 5, float_tile.data());
+            frame.writeTile(7, 3, 6, 5, float_tile.data());
+
+            for (unsigned int j = 0; j < 5; ++j)
+            {
+                for (unsigned int i = 0; i < 3 * 6; ++i)
+                {
+                    size_t at = 3 * ((size_t)(3 + j) * width + 7) + i;
+
+                    if (frame.getData()[at] != float_tile[j * 6 + i / 3][i % 3] || wide.frame.getData()[at] != frame.getData()[at])
+                    {
+                        std::cout << "Float tile written as other values\n";
+                        return PT_TEST_FAIL;
+                    }
+                }
+            }
+
+            return PT_TEST_PASS;
+        }
+
+        /*
+         * Peak RSS of a streamed (tiled EXR) render against a full frame render
+         * Run each mode in a fresh process, peak RSS never goes down
+         */
+        void bench_tiled_trace_rss(unsigned int width, unsigned int height, unsigned int samples, bool tiled)
+        {
+            Scened scene;
+            cornell_box_scene(scene);
+
+            PathTracerd tracer;
+            double rendertime;
+
+            size_t rss_before = peak_rss_bytes();
+
+            if (tiled)
+            {
+                ExrTiledWriter writer("cornell_tiled.exr", width, height, PathTracerd::DefaultTileSize);
+                tracer.Trace(scene, width, height, samples, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, writer, &rendertime);
+            }
+            else
+            {
+                char* frame = (char*)malloc(3 * width * height);
+                tracer.Trace(scene, width, height, samples, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &rendertime);
+                free(frame);
+            }
+
+            std::cout << "=========== RSS ============\n";
+            std::cout << (tiled ? "Tiled EXR output" : "Full frame output") << " " << width << "x" << height << "\n"
+            << "Peak RSS before : " << rss_before / (1024 * 1024) << " MB\n"
+            << "Peak RSS after : " << peak_rss_bytes() / (1024 * 1024) << " MB\n"
+            << "Render time : " << rendertime << " s\n";
+            std::cout << "============================\n\n";
+        }
+    }
+}
+
+#endif /* ImageIOUnitTest_h */
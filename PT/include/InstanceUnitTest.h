@@ -0,0 +1,447 @@
+#ifndef InstanceUnitTest_h
+#define InstanceUnitTest_h
+
+#include <chrono>
+#include "ptTestUtils.h"
+#include "ptTests.h"
+#include "ptRendering.h"
+#include "ptScene.h"
+#include "MaterialSortUnitTest.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * A flat list of spheres as instances of one unit sphere, scaled and moved in place,
+         * instance i overrides the material with i so the material list of the flat scene still applies
+         */
+        void test_util_instance_spheres(const PrimitiveList<float>& list, InstanceList<float>& out_instances)
+        {
+            std::shared_ptr<Geometry<float>> unit = std::make_shared<Geometry<float>>();
+            unit->primitives.push_back(std::make_shared<Sphere<float>>(glm::vec3(0), 1.0f));
+            unit->materials.push_back(0);
+            unit->build();
+
+            out_instances.clear();
+
+            for (size_t i = 0; i < list.size(); ++i)
+            {
+                fSphereRef sphere = std::dynamic_pointer_cast<Sphere<float>>(list[i]);
+                if (!sphere) throw "Only spheres are instanced";
+
+                Transform<float> to_world = Transform<float>::translation(sphere->getCenter()) * Transform<float>::scale(sphere->getRadius());
+                out_instances.push_back(Instance<float>(unit, to_world, (int)i));
+            }
+
+            out_instances.build();
+        }
+
+        /* The 12 triangles of a cube of half size 1 centered on the origin, counter clockwise seen from outside */
+        std::shared_ptr<Geometry<float>> test_util_cube_geometry(uint32_t material)
+        {
+            /* corner i has x, y, z from bits 0, 1, 2 */
+            const int faces[6][4] = { {0,2,3,1}, {4,5,7,6}, {0,1,5,4}, {2,6,7,3}, {0,4,6,2}, {1,3,7,5} };
+            glm::vec3 v[8];
+            for (int i = 0; i < 8; ++i) v[i] = glm::vec3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+
+            std::shared_ptr<Geometry<float>> cube = std::make_shared<Geometry<float>>();
+
+            for (int f = 0; f < 6; ++f)
+            {
+                glm::vec3 a = v[faces[f][0]], b = v[faces[f][1]], c = v[faces[f][2]], d = v[faces[f][3]];
+                cube->primitives.push_back(std::make_shared<Triangle<float>>(a, b, c));
+                cube->primitives.push_back(std::make_shared<Triangle<float>>(a, c, d));
+                cube->materials.push_back(material);
+                cube->materials.push_back(material);
+            }
+
+            cube->build();
+            return cube;
+        }
+
+        /* The triangles of every instance of a triangle geometry moved to world space, in instance then primitive order */
+        void test_util_flatten_triangles(const InstanceList<float>& instances, PrimitiveList<float>& out_list)
+        {
+            out_list.clear();
+
+            for (const Instance<float>& instance : instances)
+            {
+                Transform<float> to_world = instance.to_object.inverse();
+
+                for (const std::shared_ptr<Primitive<float>>& prim : instance.geometry->primitives)
+                {
+                    fTriangleRef tri = std::dynamic_pointer_cast<Triangle<float>>(prim);
+                    out_list.push_back(std::make_shared<Triangle<float>>(to_world.point(tri->getVertex(0)),
+                                                                         to_world.point(tri->getVertex(1)),
+                                                                         to_world.point(tri->getVertex(2))));
+                }
+            }
+
+            out_list.buildBVH();
+        }
+
+        /*
+         * Same closest hit, t and normal, for the rays of a camera; flat primitive i is instance i / per_instance.
+         * Rays grazing a silhouette may hit or miss after the transforms, up to one in a thousand may go either way,
+         * and t is compared relatively: the ground of random_scene is a unit sphere scaled by 1000.
+         */
+        bool test_util_same_instance_hits(const PrimitiveList<float>& flat, const InstanceList<float>& instances,
+                                          size_t per_instance, const Camera<float>& cam, int width, int height)
+        {
+            XORUniformRNG<float> rng(0x5eed);
+            size_t grazing = 0;
+
+            for (int y = 0; y < height; ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    Ray<float> ray = cam.getRay(((float)x + 0.5f) / (float)width, ((float)y + 0.5f) / (float)height, rng);
+                    float ta, tb;
+                    size_t ia;
+                    InstanceList<float>::Hit ib;
+
+                    bool ha = flat.intersect_simple(ray, ta, ia, ray_min<float>());
+                    bool hb = instances.intersect_simple(ray, tb, ib, ray_min<float>());
+
+                    if (ha != hb || (ha && ia / per_instance != ib.instance))
+                    {
+                        ++grazing;
+                        continue;
+                    }
+
+                    if (!ha) continue;
+
+                    glm::vec3 na = flat.normalAt(ia, ray(ta));
+                    glm::vec3 nb = instances.normalAt(ib, ray(tb));
+
+                    if (fabsf(ta - tb) > 5e-3f * std::max(1.0f, ta) || glm::dot(na, nb) < 0.999f)
+                    {
+                        std::cout << "Different t or normal at pixel " << x << " " << y << " : " << ta << " " << tb << "\n";
+                        return false;
+                    }
+                }
+            }
+
+            if (grazing * 1000 > (size_t)(width * height))
+            {
+                std::cout << grazing << " rays of " << width * height << " hit something else\n";
+                return false;
+            }
+
+            return true;
+        }
+
+        /* Largest difference of the block averages of two images of width x height, rows in the same order */
+        double test_util_block_error(const float* a, const float* b, unsigned int width, unsigned int height, unsigned int block)
+        {
+            double max_error = 0;
+
+            for (unsigned int by = 0; by < height; by += block)
+            {
+                for (unsigned int bx = 0; bx < width; bx += block)
+                {
+                    double sum_a[3] = { 0, 0, 0 }, sum_b[3] = { 0, 0, 0 };
+
+                    for (unsigned int y = by; y < by + block; ++y)
+                    {
+                        for (unsigned int x = bx; x < bx + block; ++x)
+                        {
+                            for (int c = 0; c < 3; ++c)
+                            {
+                                sum_a[c] += clamp(a[3 * (y * width + x) + c]);
+                                sum_b[c] += clamp(b[3 * (y * width + x) + c]);
+                            }
+                        }
+                    }
+
+                    for (int c = 0; c < 3; ++c)
+                        max_error = std::max(max_error, fabs(sum_a[c] - sum_b[c]) / (double)(block * block));
+                }
+            }
+
+            return max_error;
+        }
+
+        /* Cubes turned around y and scaled over random_scene, all instances of one cube geometry */
+        void test_util_instance_cubes(InstanceList<float>& instances)
+        {
+            std::shared_ptr<Geometry<float>> cube = test_util_cube_geometry(0);
+
+            for (int i = 0; i < 5; ++i)
+            {
+                Transform<float> to_world = Transform<float>::translation(glm::vec3(-3.0f + 1.5f * (float)i, 0.6f, 2.0f))
+                * Transform<float>::rotationY(17.0f * (float)i) * Transform<float>::scale(0.3f + 0.05f * (float)i);
+                instances.push_back(Instance<float>(cube, to_world, (i % 2) ? Instance<float>::NoOverride : i));
+            }
+        }
+
+        /*
+         * random_scene as instances of one unit sphere against the flat list: same hits and normals for the camera rays,
+         * and render_frame on both within the block tolerance of test_scene_cl. Then rotated and scaled cube instances
+         * against their triangles moved to world space.
+         */
+        pt_test_result test_instances()
+        {
+            const unsigned int width = 96;
+            const unsigned int height = 48;
+            const unsigned int samples = 64;
+            const double tolerance = 0.04;
+
+            PrimitiveList<float> list;
+            std::vector<fMaterialRef> materials;
+            random_scene(list, materials);
+            list.buildBVH();
+
+            InstanceList<float> instances;
+            test_util_instance_spheres(list, instances);
+
+            PinholeCamera<float> cam(60.0f, (float)width / (float)height, glm::vec3(-4,1,-5), glm::vec3(0,0,0), glm::vec3(0,1,0));
+
+            if (!test_util_same_instance_hits(list, instances, 1, cam, 4 * width, 4 * height))
+            {
+                std::cout << "Sphere instances and spheres differ\n";
+                return PT_TEST_FAIL;
+            }
+
+            std::vector<float> flat_image(3 * width * height), instanced_image(3 * width * height);
+            XORUniformRNG<float> rng;
+            PcgHash hash;
+            render_frame(width, height, samples, cam, list, materials, flat_image.data(), rng, hash);
+            render_frame(width, height, samples, cam, instances, materials, instanced_image.data(), rng, hash);
+
+            double error = test_util_block_error(flat_image.data(), instanced_image.data(), width, height, 8);
+
+            InstanceList<float> cubes;
+            test_util_instance_cubes(cubes);
+            cubes.build();
+
+            PrimitiveList<float> cube_triangles;
+            test_util_flatten_triangles(cubes, cube_triangles);
+
+            PinholeCamera<float> cube_cam(40.0f, 2.0f, glm::vec3(0,2,6), glm::vec3(0,0.5f,2), glm::vec3(0,1,0));
+
+            if (!test_util_same_instance_hits(cube_triangles, cubes, 12, cube_cam, 4 * width, 4 * height))
+            {
+                std::cout << "Cube instances and triangles differ\n";
+                return PT_TEST_FAIL;
+            }
+
+            std::cout << "=========== INSTANCES ===========\n";
+            std::cout << "random_scene " << list.size() << " sphere instances, " << width << "x" << height << " " << samples << " spp\n"
+            << "Max block error : " << error << "\n";
+            std::cout << "=================================\n\n";
+
+            if (error > tolerance)
+            {
+                std::cout << "Instanced and flat images differ by " << error << "\n";
+                return PT_TEST_FAIL;
+            }
+
+            return PT_TEST_PASS;
+        }
+
+        /*
+         * random_scene instances and the cube instances rendered by render_frame on the CPU and by
+         * scene_tracing_accumulate with PT_INSTANCES on the device, block averages compared as in test_scene_cl
+         */
+        pt_test_result test_instances_cl(cl::Device& device, cl::Context& context, cl::CommandQueue& cmd_queue)
+        {
+            cl_int clStatus;
+            cl::Program program;
+
+            const cl_uint width = 160;
+            const cl_uint height = 80;
+            const cl_uint samples = 256;
+            const cl_uint samples_per_frame = 16;
+            const double tolerance = 0.04;
+
+            PrimitiveList<float> list;
+            std::vector<fMaterialRef> materials;
+            random_scene(list, materials);
+
+            InstanceList<float> instances;
+            test_util_instance_spheres(list, instances);
+            test_util_instance_cubes(instances);
+            instances.build();
+
+            PinholeCamera<float> cam(60.0f, (float)width / (float)height, glm::vec3(-4,1,-5), glm::vec3(0,0,0), glm::vec3(0,1,0));
+
+            std::vector<float> cpu_image(3 * width * height);
+            XORUniformRNG<float> rng;
+            PcgHash hash;
+            render_frame(width, height, samples, cam, instances, materials, cpu_image.data(), rng, hash);
+
+            clStatus = test_util_get_program(device, context, program, "../../../assets/scene_tracing.cl", "-I ../../../assets/ -cl-denorms-are-zero -D PT_INSTANCES");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+
+            cl::Kernel kernel(program, "scene_tracing_accumulate", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+
+            SceneDescription scene;
+            scene_pack_instances(instances, materials, scene);
+
+            cl_scene_buffers buffers;
+            clStatus = cl_upload_scene(context, cmd_queue, scene, buffers);
+            PTCL_ASSERT(clStatus, "Could not upload scene")
+
+            cl::Buffer d_buff_r_cam(context, CL_MEM_READ_ONLY, sizeof(cl_pinhole_cam), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create camera buffer")
+            clStatus = cl_set_pinhole_cam_arg(cam, d_buff_r_cam, cmd_queue);
+            PTCL_ASSERT(clStatus, "Could not fill camera buffer")
+
+            cl_accumulation accumulation;
+            clStatus = cl_make_accumulation(context, width * height, cmd_queue, accumulation);
+            PTCL_ASSERT(clStatus, "Could not create accumulation buffer")
+
+            PTCL_SAFE_SET_ARG("Could not set cam argument", kernel, 0, d_buff_r_cam)
+            clStatus = cl_set_scene_args(kernel, buffers);
+            PTCL_ASSERT(clStatus, "Could not set scene arguments")
+            PTCL_SAFE_SET_ARG("Could not set accumulation argument", kernel, 10, accumulation.buffer)
+            PTCL_SAFE_SET_ARG("Could not set samples argument", kernel, 11, samples_per_frame)
+            PTCL_SAFE_SET_ARG("Could not set width argument", kernel, 12, width)
+            PTCL_SAFE_SET_ARG("Could not set height argument", kernel, 13, height)
+
+            for (cl_uint frame = 0; frame < samples / samples_per_frame; ++frame)
+            {
+                PTCL_SAFE_SET_ARG("Could not set frame argument", kernel, 14, frame)
+                clStatus = cmd_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(width, height), cl::NullRange);
+                PTCL_ASSERT(clStatus, "Could not enqueue kernel")
+            }
+
+            std::vector<cl_float4> gpu_image(width * height);
+            PTCL_SAFE_OP("Could not read accumulation buffer", enqueueReadBuffer, cmd_queue, accumulation.buffer, CL_TRUE, 0, width * height * sizeof(cl_float4), gpu_image.data())
+
+            /* the CPU image is bottom up */
+            std::vector<float> device_image(3 * width * height);
+            for (cl_uint y = 0; y < height; ++y)
+                for (cl_uint x = 0; x < width; ++x)
+                    for (int c = 0; c < 3; ++c)
+                        device_image[3 * ((height - y - 1) * width + x) + c] = gpu_image[y * width + x].s[c];
+
+            double max_error = test_util_block_error(cpu_image.data(), device_image.data(), width, height, 8);
+
+            std::cout << "=========== INSTANCES CL ===========\n";
+            std::cout << instances.size() << " instances, " << scene.spheres.size << " spheres, " << scene.triangles.size << " triangles, "
+            << width << "x" << height << " " << samples << " spp\n"
+            << "Max block error : " << max_error << "\n";
+            std::cout << "====================================\n\n";
+
+            if (max_error > tolerance)
+            {
+                std::cout << "Device and CPU images differ by " << max_error << "\n";
+                return PT_TEST_FAIL;
+            }
+
+            return PT_TEST_PASS;
+        }
+
+        /*
+         * A field of count instances of the mesh at obj_path, turned, scaled and with one of four materials each.
+         * Build time of the shared bottom level BVH and of the top level one, memory of the CPU objects and of the device
+         * records against the same scene with every triangle copied (computed, not built), and the rate of camera rays.
+         */
+        void bench_instances(const std::string& obj_path, size_t count)
+        {
+            typedef std::chrono::high_resolution_clock bench_clock;
+
+            std::vector<glm::vec3> positions;
+            std::vector<uint32_t> indices;
+
+            if (!scene_load_obj(obj_path, positions, indices))
+            {
+                std::cout << "Could not read " << obj_path << "\n";
+                return;
+            }
+
+            size_t rss_start = peak_rss_bytes();
+
+            std::shared_ptr<Geometry<float>> mesh = std::make_shared<Geometry<float>>();
+            mesh->primitives.reserve(indices.size() / 3);
+
+            for (size_t i = 0; i < indices.size(); i += 3)
+            {
+                mesh->primitives.push_back(std::make_shared<Triangle<float>>(positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]]));
+                mesh->materials.push_back(0);
+            }
+
+            bench_clock::time_point start = bench_clock::now();
+            mesh->build();
+            double blas_ms = test_util_ms_since(start);
+
+            glm::vec3 lo, hi;
+            mesh->bounds(lo, hi);
+            float size = glm::length(hi - lo);
+            int side = (int)ceil(sqrt((double)count));
+
+            XORUniformRNG<float> rng(0x5eed);
+            InstanceList<float> instances;
+            instances.reserve(count);
+
+            start = bench_clock::now();
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                glm::vec3 at(size * (float)(i % side), 0, -size * (float)(i / side));
+                Transform<float> to_world = Transform<float>::translation(at) * Transform<float>::rotationY(360.0f * rng())
+                * Transform<float>::scale(0.5f + rng());
+                instances.push_back(Instance<float>(mesh, to_world, (int)(i % 4)));
+            }
+
+            instances.build();
+            double tlas_ms = test_util_ms_since(start);
+
+            size_t triangles = mesh->primitives.size();
+            size_t blas_nodes = mesh->primitives.getBVH()->nodes.size();
+
+            /* a Triangle behind a shared_ptr, its control block (make_shared) and the pointer in the list, the BVH and the material index */
+            size_t triangle_bytes = sizeof(Triangle<float>) + 2 * sizeof(void*) + sizeof(std::shared_ptr<Primitive<float>>);
+            size_t blas_bytes = triangles * (triangle_bytes + sizeof(uint32_t) + sizeof(uint32_t)) + blas_nodes * sizeof(BVH<float>::Node);
+            size_t tlas_bytes = instances.capacity() * sizeof(Instance<float>) + instances.getBVH().nodes.size() * sizeof(BVH<float>::Node)
+            + instances.getBVH().indices.size() * sizeof(uint32_t);
+            double flat_bytes = (double)count * (double)blas_bytes;
+
+            size_t device_bytes = triangles * (sizeof(cl_triangle) + 2 * sizeof(cl_uint)) + blas_nodes * sizeof(cl_bvh_node)
+            + count * sizeof(cl_instance) + instances.getBVH().nodes.size() * sizeof(cl_bvh_node) + count * sizeof(cl_uint);
+            double flat_device_bytes = (double)count * (double)(triangles * (sizeof(cl_triangle) + 2 * sizeof(cl_uint)) + blas_nodes * sizeof(cl_bvh_node));
+
+            size_t rss_end = peak_rss_bytes();
+
+            /* camera rays across the field from a corner, low enough to see the dragons and the ones behind them */
+            const int width = 256, height = 128;
+            glm::vec3 center(size * 0.5f * (float)side, 0, -size * 0.5f * (float)side);
+            PinholeCamera<float> cam(50.0f, 2.0f, glm::vec3(-2.0f * size, 1.5f * size, 2.0f * size), center, glm::vec3(0,1,0));
+
+            size_t hits = 0;
+            start = bench_clock::now();
+
+            for (int y = 0; y < height; ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    Ray<float> ray = cam.getRay(((float)x + 0.5f) / (float)width, ((float)y + 0.5f) / (float)height, rng);
+                    float t;
+                    InstanceList<float>::Hit hit;
+                    if (instances.intersect_simple(ray, t, hit, ray_min<float>())) ++hits;
+                }
+            }
+
+            double trace_ms = test_util_ms_since(start);
+
+            std::cout << "=========== INSTANCING ===========\n";
+            std::cout << obj_path << " : " << triangles << " triangles, " << blas_nodes << " BVH nodes\n"
+            << count << " instances, " << (double)count * (double)triangles << " instanced triangles\n"
+            << "Bottom level build : " << blas_ms << " ms\n"
+            << "Instances and top level build : " << tlas_ms << " ms\n"
+            << "CPU memory : " << (blas_bytes + tlas_bytes) / 1e6 << " MB (mesh " << blas_bytes / 1e6 << " MB, instances " << tlas_bytes / 1e6
+            << " MB), copied triangles would take " << flat_bytes / 1e9 << " GB\n"
+            << "Peak RSS growth : " << (rss_end - rss_start) / 1e6 << " MB\n"
+            << "Device records : " << device_bytes / 1e6 << " MB, copied triangles would take " << flat_device_bytes / 1e9 << " GB\n"
+            << "Camera rays : " << width * height << " (" << hits << " hits) in " << trace_ms << " ms, "
+            << (double)(width * height) / trace_ms / 1e3 << " Mrays/s\n";
+            std::cout << "==================================\n\n";
+        }
+    }
+}
+
+#endif /* InstanceUnitTest_h */
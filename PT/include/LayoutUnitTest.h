@@ -0,0 +1,56 @@
+#ifndef LayoutUnitTest_h
+#define LayoutUnitTest_h
+
+#include "ptTestUtils.h"
+#include "ptCL.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * Runs the sizecheck kernel and compares every size and offset of assets/pt_types.h with the host ones
+         */
+        pt_test_result test_device_layout(cl::Device& device, cl::Context& context, cl::CommandQueue& cmd_queue)
+        {
+            cl_int clStatus;
+            cl::Program program;
+            
+            std::vector<std::string> names;
+            std::vector<cl_uint> expected = cl_host_layout(&names);
+            std::vector<cl_uint> result(expected.size(), 0);
+            
+            clStatus = test_util_get_program(device, context, program, "../../../assets/sizecheck.cl", "-I ../../../assets/");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+            
+            cl::Kernel kernel(program, "sizecheck", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+            
+            cl::Buffer d_buff_w_layout(context, CL_MEM_WRITE_ONLY, result.size() * sizeof(cl_uint), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create layout buffer")
+            
+            PTCL_SAFE_SET_ARG("Could not set layout argument", kernel, 0, d_buff_w_layout)
+            
+            clStatus = cmd_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(1), cl::NDRange(1));
+            PTCL_ASSERT(clStatus, "Could not enqueue kernel")
+            
+            clStatus = cmd_queue.enqueueReadBuffer(d_buff_w_layout, CL_TRUE, 0, result.size() * sizeof(cl_uint), result.data());
+            PTCL_ASSERT(clStatus, "Could not read layout buffer")
+            
+            pt_test_result test_result = PT_TEST_PASS;
+            
+            for (size_t i = 0; i < expected.size(); ++i)
+            {
+                if (result[i] != expected[i])
+                {
+                    std::cout << "Layout mismatch " << names[i] << " : device " << result[i] << ", host " << expected[i] << "\n";
+                    test_result = PT_TEST_FAIL;
+                }
+            }
+            
+            return test_result;
+        }
+    }
+}
+
+#endif /* LayoutUnitTest_h */
@@ -0,0 +1,420 @@
+#ifndef LightListUnitTest_h
+#define LightListUnitTest_h
+
+#include <chrono>
+#include <thread>
+#include "ptTestUtils.h"
+#include "ptTests.h"
+#include "ptScene.h"
+#include "PathTracerUnitTest.h"
+#include "PacketUnitTest.h"
+#include "MaterialSortUnitTest.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * The Cornell box with its light swapped for count small lights under the ceiling, of random powers
+         * adding up to the power of the original light
+         */
+        template <typename T>
+        void test_util_many_lights_scene(Scene<T>& scene, size_t count)
+        {
+            typedef ptvec<T> vec;
+            const typename SceneMaterial<T>::Type diffuse = SceneMaterial<T>::DIFFUSE;
+            const T radius = 0.5;
+
+            cornell_box_scene(scene);
+            scene.renderables.pop_back();
+
+            XORUniformRNG<T> rng(0x1175);
+            std::vector<T> weights(count);
+            T total = 0;
+
+            for (size_t i = 0; i < count; ++i) total += (weights[i] = (T)0.1 + rng());
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                vec center((T)10 + (T)80 * rng(), (T)70 + (T)10 * rng(), (T)40 + (T)80 * rng());
+                T emission = (T)400 * (T)1.5 * (T)1.5 / (radius * radius) * weights[i] / total;
+
+                scene.renderables.push_back(CreateSphereRenderable<T>(center, radius, vec(0), diffuse, vec(emission)));
+            }
+
+            scene.buildLights();
+        }
+
+        /* Camera rays through the centers of a grid of cells x cells pixels of the Cornell box view of PathTracer */
+        template <typename T>
+        std::vector<Ray<T>> test_util_cornell_rays(int cells)
+        {
+            typedef ptvec<T> vec;
+            std::vector<Ray<T>> rays;
+
+            for (int y = 0; y < cells; ++y)
+            {
+                for (int x = 0; x < cells; ++x)
+                {
+                    vec d = vec((((T)x + (T).5) / (T)cells - (T).5) * (T).5135 * (T)4 / (T)3, (((T)y + (T).5) / (T)cells - (T).5) * (T).5135, 0)
+                    + glm::normalize(vec(0, -0.042612, -1));
+                    rays.push_back(Ray<T>(vec(50, 52, 295.6) + d * (T)140, glm::normalize(d)));
+                }
+            }
+
+            return rays;
+        }
+
+        /* Mean of samples radiance estimates along each of rays */
+        template <typename T>
+        double test_util_mean_radiance(const Scene<T>& scene, const std::vector<Ray<T>>& rays, unsigned int samples)
+        {
+            XORUniformRNG<T> rng(0x5eed);
+            double sum = 0;
+
+            for (const Ray<T>& ray : rays)
+            {
+                for (unsigned int s = 0; s < samples; ++s)
+                {
+                    ptvec<T> c = radiance(ray, scene, 0, rng);
+                    sum += ((double)c.x + (double)c.y + (double)c.z) / 3.0;
+                }
+            }
+
+            return sum / (double)(rays.size() * samples);
+        }
+
+        /*
+         * The light list holds the emitters and draws them in proportion to power, shadow rays find the blockers
+         * closest hits find, sampling one light by power or down the light tree converges to sampling them all,
+         * and packets of shadow rays to a light per lane give the image of single rays. Tracing an edited scene rebuilds its lights,
+         * once when tracers render it at once.
+         */
+        pt_test_result test_light_list()
+        {
+            Scened scene;
+            test_util_many_lights_scene(scene, 32);
+            const LightList<double>& lights = scene.lights;
+
+            std::cout << "=========== LIGHT LIST ===========\n";
+
+            if (lights.size() != 32 || lights.indices[0] != 8 || !lights.builtFor(scene.renderables))
+            {
+                std::cout << "Light list holds " << lights.size() << " lights\n";
+                return PT_TEST_FAIL;
+            }
+
+            /* stratified draws land on each light as often as its share of the power (the lights are the same size), which is its pdf */
+            const size_t draws = 100000;
+            std::vector<size_t> drawn(lights.size(), 0);
+            double total = 0, pdf, pdf_error = 0, share_error = 0;
+
+            for (size_t j = 0; j < draws; ++j) ++drawn[lights.samplePower(((double)j + 0.5) / (double)draws, pdf)];
+
+            for (size_t k = 0; k < lights.size(); ++k) total += scene.renderables[lights.indices[k]]->mat->emission.x;
+
+            for (size_t k = 0; k < lights.size(); ++k)
+            {
+                double share = scene.renderables[lights.indices[k]]->mat->emission.x / total;
+                lights.samplePower(k ? lights.cdf[k - 1] : 0, pdf);
+
+                share_error = std::max(share_error, fabs((double)drawn[k] / (double)draws - share));
+                pdf_error = std::max(pdf_error, fabs(pdf - share));
+            }
+
+            std::cout << "Draws off the power share by " << share_error << ", pdf error " << pdf_error << "\n";
+
+            /* any hit against closest hit, from random points to random lengths */
+            XORUniformRNG<double> rng(0x5eed);
+            size_t mismatches = 0;
+
+            for (int i = 0; i < 20000; ++i)
+            {
+                glm::dvec3 origin(1 + 98 * rng(), 1 + 80 * rng(), 1 + 168 * rng());
+                glm::dvec3 dir = glm::normalize(glm::dvec3(rng() - 0.5, rng() - 0.5, rng() - 0.5));
+                double length = 100 * rng();
+                Ray<double> ray(origin, dir);
+
+                double t;
+                size_t idx = 0;
+                bool blocked = intersect(ray, scene, t, idx) && t < length;
+
+                if (blocked != occluded(ray, scene, length, scene.renderables.size())) ++mismatches;
+            }
+
+            std::cout << "Shadow rays disagreeing with closest hits : " << mismatches << "\n";
+
+            /* camera rays of the box, all 32 lights against one by power and one down the tree */
+            std::vector<Ray<double>> rays = test_util_cornell_rays<double>(8);
+
+            scene.lights.allLightsMax = lights.size();
+            double all = test_util_mean_radiance(scene, rays, 256);
+            scene.lights.allLightsMax = 0;
+            scene.lights.sampling = LIGHT_SAMPLE_POWER;
+            double power = test_util_mean_radiance(scene, rays, 256);
+            scene.lights.sampling = LIGHT_SAMPLE_TREE;
+            double tree = test_util_mean_radiance(scene, rays, 256);
+            double bias = std::max(fabs(power - all), fabs(tree - all)) / all;
+
+            std::cout << "Mean radiance, every light : " << all << ", one by power : " << power << ", one down the tree : " << tree
+            << " (" << 100.0 * bias << "%)\n";
+
+            const LightSampling samplings[] = { LIGHT_SAMPLE_UNIFORM, LIGHT_SAMPLE_POWER, LIGHT_SAMPLE_TREE };
+            double trace_diff = 0;
+            Scenef scene_f;
+            test_util_many_lights_scene(scene_f, 32);
+            scene_f.lights.allLightsMax = 0;
+
+            for (LightSampling sampling : samplings)
+            {
+                scene_f.lights.sampling = sampling;
+
+                for (unsigned int w = 4; w <= 16; w *= 2)
+                {
+                    FrameBuffer single, packets;
+                    PathTracerf tracer;
+                    double seconds;
+
+                    tracer.Trace(scene_f, 50, 38, 8, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, single, &seconds);
+                    tracer.packetWidth = w;
+                    tracer.Trace(scene_f, 50, 38, 8, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, packets, &seconds);
+
+                    trace_diff = std::max(trace_diff, test_util_max_difference(single.getData(), packets.getData(), single.size()));
+                }
+            }
+
+            std::cout << "Packets against single rays, one light per lane : " << trace_diff << "\n";
+
+            /* lights are rebuilt by Trace once a light is removed, and once one stops emitting in place */
+            FrameBuffer frame;
+            PathTracerf tracer;
+            double seconds;
+
+            scene_f.renderables.pop_back();
+            tracer.Trace(scene_f, 8, 8, 4, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &seconds);
+            bool removed = scene_f.lights.size() == 31;
+
+            scene_f.renderables.back()->mat->emission = ptvec<float>(0);
+            bool stale = !scene_f.lights.builtFor(scene_f.renderables);
+            tracer.Trace(scene_f, 8, 8, 4, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &seconds);
+            bool edited = scene_f.lights.size() == 30 && scene_f.lights.builtFor(scene_f.renderables);
+
+            std::cout << "Lights after removing one : " << (removed ? "rebuilt" : "stale") << ", after switching one off : " << (edited ? "rebuilt" : "stale") << "\n";
+
+            /* two tracers on the same edited scene at once, one rebuilds the lights and the other waits for it */
+            scene_f.renderables[scene_f.renderables.size() - 2]->mat->emission = ptvec<float>(0);
+            FrameBuffer concurrent[2];
+            PathTracerf tracers[2];
+            double concurrent_s[2];
+            std::vector<std::thread> threads;
+
+            for (int k = 0; k < 2; ++k)
+                threads.push_back(std::thread([&, k]() {
+                    tracers[k].Trace(scene_f, 8, 8, 4, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, concurrent[k], &concurrent_s[k]);
+                }));
+
+            for (std::thread& t : threads) t.join();
+
+            tracer.Trace(scene_f, 8, 8, 4, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &seconds);
+            double concurrent_diff = std::max(test_util_max_difference(frame.getData(), concurrent[0].getData(), frame.size()),
+                                              test_util_max_difference(frame.getData(), concurrent[1].getData(), frame.size()));
+            bool shared = scene_f.lights.size() == 29 && concurrent_diff == 0;
+
+            std::cout << "Two tracers on an edited scene : " << scene_f.lights.size() << " lights, max difference " << concurrent_diff << "\n";
+
+            std::cout << "==================================\n\n";
+
+            return share_error < 1e-4 && pdf_error < 1e-9 && mismatches == 0 && bias < 0.03 && trace_diff == 0 && removed && stale && edited && shared ? PT_TEST_PASS : PT_TEST_FAIL;
+        }
+
+        /*
+         * The Cornell box with its light swapped for a wall of rows x cols lights in front of the back wall,
+         * most of them dim and one in sixteen ten times brighter, adding up to the power of the original light
+         */
+        template <typename T>
+        void test_util_led_wall_scene(Scene<T>& scene, int rows, int cols)
+        {
+            typedef ptvec<T> vec;
+            const typename SceneMaterial<T>::Type diffuse = SceneMaterial<T>::DIFFUSE;
+            const T radius = 0.6;
+
+            cornell_box_scene(scene);
+            scene.renderables.pop_back();
+
+            XORUniformRNG<T> rng(0x1ed);
+            std::vector<T> weights(rows * cols);
+            T total = 0;
+
+            for (size_t i = 0; i < weights.size(); ++i) total += (weights[i] = (rng() < (T)0.0625 ? (T)10 : (T)1) * ((T)0.2 + rng()));
+
+            for (int y = 0; y < rows; ++y)
+            {
+                for (int x = 0; x < cols; ++x)
+                {
+                    vec center((T)8 + (T)84 * ((T)x + (T).5) / (T)cols, (T)6 + (T)70 * ((T)y + (T).5) / (T)rows, (T)3);
+                    T emission = (T)400 * (T)1.5 * (T)1.5 / (radius * radius) * weights[y * cols + x] / total;
+
+                    scene.renderables.push_back(CreateSphereRenderable<T>(center, radius, vec(0), diffuse, vec(emission)));
+                }
+            }
+
+            scene.buildLights();
+        }
+
+        /*
+         * Direct light at the diffuse first hits of rays, one light per sample, for as long as budget_ms:
+         * the mean of the estimates over the hits and its standard error in out_mean and out_error,
+         * the RMS of the standard errors of the hits in out_noise. Returns the samples per hit
+         */
+        template <typename T>
+        size_t test_util_direct_noise(const Scene<T>& scene, const std::vector<Ray<T>>& rays, double budget_ms,
+                                      double& out_mean, double& out_error, double& out_noise)
+        {
+            std::vector<ptvec<T>> points, normals;
+
+            for (const Ray<T>& ray : rays)
+            {
+                T t;
+                size_t idx;
+                if (!intersect(ray, scene, t, idx) || scene.renderables[idx]->mat->emission != ptvec<T>(0)) continue;
+
+                ptvec<T> x = ray.origin + t * ray.dir;
+                ptvec<T> n = scene.renderables[idx]->primitive->normalAt(x);
+
+                points.push_back(x);
+                normals.push_back(glm::dot(n, ray.dir) < 0 ? n : n * (T)-1);
+            }
+
+            std::vector<double> mean(points.size(), 0), m2(points.size(), 0);
+            XORUniformRNG<T> rng(0x5eed);
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            size_t n = 0;
+
+            while (n < 2 || test_util_ms_since(start) < budget_ms)
+            {
+                ++n;
+
+                for (size_t i = 0; i < points.size(); ++i)
+                {
+                    ptvec<T> e = direct_light(scene, points[i], normals[i], ptvec<T>(1), rng);
+                    double v = ((double)e.x + (double)e.y + (double)e.z) / 3.0;
+                    double delta = v - mean[i];
+
+                    mean[i] += delta / (double)n;
+                    m2[i] += delta * (v - mean[i]);
+                }
+            }
+
+            out_mean = 0;
+            out_noise = 0;
+
+            for (size_t i = 0; i < points.size(); ++i)
+            {
+                out_mean += mean[i] / (double)points.size();
+                out_noise += m2[i] / (double)(n - 1) / (double)n / (double)points.size();
+            }
+
+            out_noise = sqrt(out_noise);
+            out_error = out_noise / sqrt((double)points.size());
+            return n;
+        }
+
+        /*
+         * A wall of 256 lights sampled uniformly, by power and down the light tree, for the same time each:
+         * the tree must show the least noise, and all three the same mean. Then an Emissive material of the
+         * templated stack gives its emission to the rays that reach it and survives the trip through its device record
+         */
+        pt_test_result test_light_tree()
+        {
+            Scened scene;
+            test_util_led_wall_scene(scene, 16, 16);
+            scene.lights.allLightsMax = 0;
+
+            const LightSampling samplings[] = { LIGHT_SAMPLE_UNIFORM, LIGHT_SAMPLE_POWER, LIGHT_SAMPLE_TREE };
+            const char* names[] = { "uniform", "power", "tree" };
+            std::vector<Ray<double>> rays = test_util_cornell_rays<double>(16);
+            double mean[3], error[3], noise[3];
+
+            std::cout << "=========== LIGHT TREE ===========\n";
+            std::cout << scene.lights.size() << " lights, " << scene.lights.nodes.size() << " tree nodes\n";
+
+            for (int m = 0; m < 3; ++m)
+            {
+                scene.lights.sampling = samplings[m];
+                size_t samples = test_util_direct_noise(scene, rays, 300.0, mean[m], error[m], noise[m]);
+
+                std::cout << names[m] << " : " << samples << " samples in 300 ms, mean " << mean[m] << ", noise " << noise[m] << "\n";
+            }
+
+            /* within four standard errors */
+            bool same_mean = fabs(mean[0] - mean[2]) < 4 * sqrt(error[0] * error[0] + error[2] * error[2])
+            && fabs(mean[1] - mean[2]) < 4 * sqrt(error[1] * error[1] + error[2] * error[2]);
+            std::cout << "Noise at equal time against uniform : " << noise[2] / noise[0] << " tree, " << noise[1] / noise[0] << " power\n";
+            std::cout << "Standard errors of the means : " << error[0] << " uniform, " << error[1] << " power, " << error[2] << " tree\n";
+
+            PrimitiveList<float> list;
+            std::vector<fMaterialRef> materials;
+            list.push_back(std::make_shared<Sphere<float>>(glm::vec3(0, 0, -2), 0.5f));
+            materials.push_back(std::make_shared<Emissive<float>>(glm::vec3(4, 2, 1)));
+
+            XORUniformRNG<float> rng(0x5eed);
+            glm::vec3 direct = color_iterative(Ray<float>(glm::vec3(0), glm::vec3(0, 0, -1)), list, materials, rng);
+            fMaterialRef round_trip = scene_make_material(cl_make_material(materials[0]));
+            bool emissive = direct == glm::vec3(4, 2, 1) && round_trip->emitted() == glm::vec3(4, 2, 1);
+
+            std::cout << "Emissive material seen from a camera ray : " << direct.x << " " << direct.y << " " << direct.z << "\n";
+            std::cout << "==================================\n\n";
+
+            return noise[2] < noise[0] && noise[2] < noise[1] && same_mean && emissive ? PT_TEST_PASS : PT_TEST_FAIL;
+        }
+
+        /*
+         * PathTracer<double> over the Cornell box lit by 1 to 1000 small lights, every light sampled at each hit
+         * against one light picked uniformly, by power and down the light tree
+         */
+        void bench_light_scaling()
+        {
+            const unsigned int width = 64, height = 48, samples = 4;
+            const size_t counts[] = { 1, 10, 100, 1000 };
+
+            std::cout << "=========== LIGHT SCALING ===========\n";
+            std::cout << "Cornell box " << width << "x" << height << " " << samples << " spp\n";
+
+            for (size_t count : counts)
+            {
+                Scened scene;
+                test_util_many_lights_scene(scene, count);
+
+                PathTracerd tracer;
+                FrameBuffer frame;
+                double one_s[3], all_s = 0;
+                const LightSampling samplings[] = { LIGHT_SAMPLE_UNIFORM, LIGHT_SAMPLE_POWER, LIGHT_SAMPLE_TREE };
+
+                scene.lights.allLightsMax = 0;
+
+                for (int m = 0; m < 3; ++m)
+                {
+                    scene.lights.sampling = samplings[m];
+                    tracer.Trace(scene, width, height, samples, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &one_s[m]);
+                }
+
+                std::cout << count << " lights : one uniform / by power / down the tree " << 1000.0 * one_s[0] << " / "
+                << 1000.0 * one_s[1] << " / " << 1000.0 * one_s[2] << " ms";
+
+                /* a thousand lights at every hit would take minutes */
+                if (count <= 100)
+                {
+                    scene.lights.allLightsMax = count;
+                    tracer.Trace(scene, width, height, samples, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &all_s);
+                    std::cout << ", every light " << 1000.0 * all_s << " ms";
+                }
+
+                std::cout << "\n";
+            }
+
+            std::cout << "=====================================\n\n";
+        }
+    }
+}
+
+#endif /* LightListUnitTest_h */
@@ -0,0 +1,83 @@
+#ifndef MaterialSortUnitTest_h
+#define MaterialSortUnitTest_h
+
+#include "ptTestUtils.h"
+#include "ptTests.h"
+#include "ptCLWavefront.h"
+#include <chrono>
+
+namespace pt
+{
+    namespace test
+    {
+        double test_util_ms_since(const std::chrono::high_resolution_clock::time_point& start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+        
+        /*
+         * random_scene through wavefront.cl with and without sorting by material:
+         * same image either way, prints the time per stage and the share of every material
+         */
+        pt_test_result test_material_sort(cl::Device& device, cl::Context& context, cl::CommandQueue& cmd_queue)
+        {
+            cl_int clStatus;
+            cl::Program wavefront_program;
+            cl::Program scan_program;
+            
+            const cl_uint width = 640;
+            const cl_uint height = 360;
+            const cl_uint frames = 8;
+            
+            clStatus = test_util_get_program(device, context, wavefront_program, "../../../assets/wavefront.cl", "-I ../../../assets/ -cl-denorms-are-zero");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+            
+            clStatus = test_util_get_program(device, context, scan_program, "../../../assets/hillis_steele_scan.cl", "-cl-denorms-are-zero -D SCAN_INCLUSIVE");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+            
+            PrimitiveList<float> list;
+            std::vector<fMaterialRef> materials;
+            random_scene(list, materials);
+            
+            cl::Buffer d_buff_r_prim, d_buff_r_mat, d_buff_r_sky;
+            cl_uint object_count = test_util_upload_scene(context, cmd_queue, list, materials, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky);
+            
+            cl::Buffer d_buff_r_cam(context, CL_MEM_READ_ONLY, sizeof(cl_pinhole_cam), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create camera buffer")
+            
+            clStatus = cl_set_pinhole_cam_arg(pt::PinholeCamera<float>(30.0f, (float)width / (float)height, glm::vec3(13,2,3), glm::vec3(0,0,0), glm::vec3(0,1,0)), d_buff_r_cam, cmd_queue);
+            PTCL_ASSERT(clStatus, "Could not fill camera buffer")
+            
+            std::vector<cl_float4> unsorted_frame, sorted_frame;
+            cl_wavefront_timings unsorted, sorted;
+            
+            /* the first run pays for compilation of the shading kernels by the driver */
+            cl_render_wavefront(device, context, cmd_queue, test_util_buffer_pool(context), wavefront_program, scan_program, d_buff_r_cam, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky,
+                                object_count, width, height, 1, true, sorted_frame, sorted);
+            
+            cl_render_wavefront(device, context, cmd_queue, test_util_buffer_pool(context), wavefront_program, scan_program, d_buff_r_cam, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky,
+                                object_count, width, height, frames, false, unsorted_frame, unsorted);
+            
+            cl_render_wavefront(device, context, cmd_queue, test_util_buffer_pool(context), wavefront_program, scan_program, d_buff_r_cam, d_buff_r_prim, d_buff_r_mat, d_buff_r_sky,
+                                object_count, width, height, frames, true, sorted_frame, sorted);
+            
+            double error = rmse(unsorted_frame, sorted_frame);
+            size_t shaded = sorted.bucket_paths[1] + sorted.bucket_paths[2] + sorted.bucket_paths[3];
+            
+            std::cout << "========= MATERIAL SORT =========\n";
+            std::cout << "random_scene " << object_count << " spheres, " << width << "x" << height << ", " << frames << " frames\n"
+            << "Shaded paths : " << shaded << " ("
+            << 100.0 * sorted.bucket_paths[MAT_LAMBERTIAN] / std::max<size_t>(shaded, 1) << "% lambertian, "
+            << 100.0 * sorted.bucket_paths[MAT_METALLIC] / std::max<size_t>(shaded, 1) << "% metallic, "
+            << 100.0 * sorted.bucket_paths[MAT_DIALECTRIC] / std::max<size_t>(shaded, 1) << "% dialectric)\n"
+            << "Unsorted : intersect " << unsorted.intersect_ms << " ms, shade " << unsorted.shade_ms << " ms, total " << unsorted.total_ms << " ms\n"
+            << "Sorted : intersect " << sorted.intersect_ms << " ms, sort " << sorted.sort_ms << " ms, shade " << sorted.shade_ms << " ms, total " << sorted.total_ms << " ms\n"
+            << "RMSE : " << error << "\n";
+            std::cout << "=================================\n\n";
+            
+            return (error < 1e-3) ? PT_TEST_PASS : PT_TEST_FAIL;
+        }
+    }
+}
+
+#endif /* MaterialSortUnitTest_h */
@@ -0,0 +1,280 @@
+#ifndef PacketUnitTest_h
+#define PacketUnitTest_h
+
+#include <chrono>
+#include "ptTestUtils.h"
+#include "ptTests.h"
+#include "ptRendering.h"
+#include "ptPacket.h"
+#include "PathTracerUnitTest.h"
+#include "BVHUnitTest.h"
+#include "MaterialSortUnitTest.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * Camera rays of random blocks of N pixels with random lanes off, closest hits of the packets against single rays,
+         * then rays from random points with random lengths, occluded lanes against single rays hitting anything.
+         * Returns the lanes that differ, rays grazing a silhouette may fall either side.
+         */
+        template <int N>
+        size_t test_util_packet_mismatches(const PrimitiveList<float>& list, const Camera<float>& cam, size_t packets)
+        {
+            const PacketList<N> packet_list(list);
+            XORUniformRNG<float> rng(0x5eed);
+            size_t mismatches = 0;
+
+            for (size_t n = 0; n < packets; ++n)
+            {
+                RayPacket<float, N> closest, shadow;
+                float u0 = rng(), v0 = rng();
+
+                for (int i = 0; i < N; ++i)
+                {
+                    if (rng() < 0.2f) continue;
+
+                    closest.set(i, cam.getRay(u0 + 0.01f * (float)(i % 4), v0 + 0.01f * (float)(i / 4), rng), ray_max<float>());
+
+                    glm::vec3 origin(8.0f * rng() - 4.0f, 2.0f * rng(), 8.0f * rng() - 4.0f);
+                    glm::vec3 dir = glm::normalize(glm::vec3(rng() - 0.5f, rng() - 0.5f, rng() - 0.5f));
+                    shadow.set(i, Ray<float>(origin, dir), 4.0f * rng());
+                }
+
+                uint32_t hits = packet_list.intersect(closest, ray_min<float>());
+                uint32_t blocked = packet_list.occluded(shadow, ray_min<float>());
+
+                for (int i = 0; i < N; ++i)
+                {
+                    if (!((closest.active >> i) & 1)) continue;
+
+                    float t;
+                    size_t idx = 0;
+                    bool hit = list.intersect_simple(closest.ray(i), t, idx, ray_min<float>(), ray_max<float>());
+
+                    if (hit != (((hits >> i) & 1) != 0) || (hit && (t != closest.t[i] || idx != closest.prim[i]))) ++mismatches;
+
+                    bool occluded = list.intersect_simple(shadow.ray(i), t, idx, ray_min<float>(), shadow.t[i]);
+                    if (occluded != (((blocked >> i) & 1) != 0)) ++mismatches;
+                }
+            }
+
+            return mismatches;
+        }
+
+        /* Largest difference of two images */
+        template <typename C>
+        double test_util_max_difference(const C* a, const C* b, size_t count)
+        {
+            double diff = 0;
+            for (size_t i = 0; i < count; ++i) diff = std::max(diff, (double)fabs((double)a[i] - (double)b[i]));
+            return diff;
+        }
+
+        template <int N>
+        double test_util_packet_render_difference(const PrimitiveList<float>& list, const std::vector<fMaterialRef>& materials,
+                                                  const Camera<float>& cam, unsigned int width, unsigned int height, unsigned int samples)
+        {
+            std::vector<float> single(3 * width * height), packets(3 * width * height);
+            XORUniformRNG<float> rng;
+            PcgHash hash;
+
+            render_frame(width, height, samples, cam, list, materials, single.data(), rng, hash);
+            render_frame(width, height, samples, cam, PacketList<N>(list), materials, packets.data(), hash);
+
+            return test_util_max_difference(single.data(), packets.data(), single.size());
+        }
+
+        template <typename T>
+        double test_util_packet_trace_difference(unsigned int packet_width, unsigned int width, unsigned int height, unsigned int samples)
+        {
+            Scene<T> scene;
+            cornell_box_scene(scene);
+
+            FrameBuffer single, packets;
+            double seconds;
+            PathTracer<T> tracer;
+
+            tracer.Trace(scene, width, height, samples, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, single, &seconds);
+            tracer.packetWidth = packet_width;
+            tracer.Trace(scene, width, height, samples, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, packets, &seconds);
+
+            return test_util_max_difference(single.getData(), packets.getData(), 3 * (size_t)width * height);
+        }
+
+        /*
+         * Packets of 4, 8 and 16 rays against single rays: the same closest hits and occlusion over random_scene with its BVH
+         * and a triangle soup, the same render_frame image, and the same Cornell box from PathTracer<float> and <double>
+         * (an image size that is not a multiple of the blocks, for the lanes off at the edges)
+         */
+        pt_test_result test_packets()
+        {
+            PrimitiveList<float> spheres, soup;
+            std::vector<fMaterialRef> materials;
+            random_scene(spheres, materials);
+            spheres.buildBVH();
+            test_util_triangle_soup(20000, soup);
+            soup.buildBVH();
+
+            PinholeCamera<float> cam(60.0f, 2.0f, glm::vec3(-4,1,-5), glm::vec3(0,0,0), glm::vec3(0,1,0));
+            PinholeCamera<float> soup_cam(60.0f, 2.0f, glm::vec3(0,1,3), glm::vec3(0,1,-1), glm::vec3(0,1,0));
+
+            const size_t packets = 2000;
+            size_t mismatches[3] = {
+                test_util_packet_mismatches<4>(spheres, cam, packets) + test_util_packet_mismatches<4>(soup, soup_cam, packets),
+                test_util_packet_mismatches<8>(spheres, cam, packets) + test_util_packet_mismatches<8>(soup, soup_cam, packets),
+                test_util_packet_mismatches<16>(spheres, cam, packets) + test_util_packet_mismatches<16>(soup, soup_cam, packets)
+            };
+
+            double render_diff[3] = {
+                test_util_packet_render_difference<4>(spheres, materials, cam, 50, 25, 8),
+                test_util_packet_render_difference<8>(spheres, materials, cam, 50, 25, 8),
+                test_util_packet_render_difference<16>(spheres, materials, cam, 50, 25, 8)
+            };
+
+            double trace_diff[3] = {
+                std::max(test_util_packet_trace_difference<float>(4, 50, 38, 8), test_util_packet_trace_difference<double>(4, 50, 38, 8)),
+                std::max(test_util_packet_trace_difference<float>(8, 50, 38, 8), test_util_packet_trace_difference<double>(8, 50, 38, 8)),
+                std::max(test_util_packet_trace_difference<float>(16, 50, 38, 8), test_util_packet_trace_difference<double>(16, 50, 38, 8))
+            };
+
+            /* a width TraceTile does not take is refused before the render threads start */
+            bool refused = false;
+
+            try
+            {
+                Scenef scene;
+                cornell_box_scene(scene);
+                FrameBuffer frame;
+                PathTracerf tracer;
+                double seconds;
+                tracer.packetWidth = 5;
+                tracer.Trace(scene, 8, 8, 4, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &seconds);
+            }
+            catch (const char*)
+            {
+                refused = true;
+            }
+
+            std::cout << "=========== PACKETS ===========\n";
+
+            bool pass = refused;
+
+            for (int w = 0; w < 3; ++w)
+            {
+                std::cout << (4 << w) << " rays : " << mismatches[w] << " lanes differ, render_frame difference " << render_diff[w]
+                << ", PathTracer difference " << trace_diff[w] << "\n";
+
+                /* one lane in a thousand may graze */
+                pass = pass && mismatches[w] * 1000 <= packets * (4 << w) && render_diff[w] <= 1e-6 && trace_diff[w] == 0;
+            }
+
+            std::cout << "===============================\n\n";
+
+            return pass ? PT_TEST_PASS : PT_TEST_FAIL;
+        }
+
+        /* Camera rays of the image traced in blocks of N, Mrays/s */
+        template <int N>
+        double test_util_packet_rate(const PacketList<N>& packets, const Camera<float>& cam, unsigned int width, unsigned int height)
+        {
+            const unsigned int block_width = N >= 8 ? 4 : 2;
+            const unsigned int block_height = N / block_width;
+            XORUniformRNG<float> rng;
+            size_t hits = 0;
+
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+            for (unsigned int by = 0; by < height; by += block_height)
+            {
+                for (unsigned int bx = 0; bx < width; bx += block_width)
+                {
+                    RayPacket<float, N> packet;
+
+                    for (int i = 0; i < N; ++i)
+                        packet.set(i, cam.getRay(((float)(bx + i % block_width) + 0.5f) / (float)width,
+                                                 ((float)(by + i / block_width) + 0.5f) / (float)height, rng), ray_max<float>());
+
+                    hits += packet_count(packets.intersect(packet, ray_min<float>()));
+                }
+            }
+
+            double ms = test_util_ms_since(start);
+            return hits ? (double)(width * height) / (ms * 1000.0) : 0;
+        }
+
+        /*
+         * Primary rays of random_scene: single rays as render_frame traces them (every sphere, or the BVH once built)
+         * against packets of 4, 8 and 16 through the BVH. Then whole frames of render_frame, and the Cornell box
+         * of PathTracer<float>, with and without packets.
+         */
+        void bench_packets()
+        {
+            const unsigned int width = 640, height = 320;
+
+            PrimitiveList<float> list;
+            std::vector<fMaterialRef> materials;
+            random_scene(list, materials);
+            PinholeCamera<float> cam(60.0f, (float)width / (float)height, glm::vec3(-4,1,-5), glm::vec3(0,0,0), glm::vec3(0,1,0));
+
+            double hit_rate;
+            double linear = test_util_trace_rate(list, cam, width, height, hit_rate);
+            list.buildBVH();
+            double single = test_util_trace_rate(list, cam, width, height, hit_rate);
+            double packet4 = test_util_packet_rate(PacketList<4>(list), cam, width, height);
+            double packet8 = test_util_packet_rate(PacketList<8>(list), cam, width, height);
+            double packet16 = test_util_packet_rate(PacketList<16>(list), cam, width, height);
+
+            std::cout << "=========== PACKETS ===========\n";
+            std::cout << "random_scene " << list.size() << " spheres, " << width << "x" << height << " primary rays, "
+            << 100.0 * hit_rate << "% hit\n"
+#ifdef __SSE2__
+            << "Lanes : SSE2\n"
+#else
+            << "Lanes : scalar\n"
+#endif
+            << "Single rays, every sphere : " << linear << " Mrays/s\n"
+            << "Single rays, BVH : " << single << " Mrays/s\n"
+            << "Packets of 4 : " << packet4 << " Mrays/s, " << packet4 / single << "x\n"
+            << "Packets of 8 : " << packet8 << " Mrays/s, " << packet8 / single << "x\n"
+            << "Packets of 16 : " << packet16 << " Mrays/s, " << packet16 / single << "x\n";
+
+            const unsigned int frame_width = 320, frame_height = 160, samples = 4;
+            std::vector<float> image(3 * frame_width * frame_height);
+            XORUniformRNG<float> rng;
+            PcgHash hash;
+            PinholeCamera<float> frame_cam(60.0f, 2.0f, glm::vec3(-4,1,-5), glm::vec3(0,0,0), glm::vec3(0,1,0));
+
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            render_frame(frame_width, frame_height, samples, frame_cam, list, materials, image.data(), rng, hash);
+            double single_ms = test_util_ms_since(start);
+
+            start = std::chrono::high_resolution_clock::now();
+            render_frame(frame_width, frame_height, samples, frame_cam, PacketList<8>(list), materials, image.data(), hash);
+            double packet_ms = test_util_ms_since(start);
+
+            std::cout << "render_frame " << frame_width << "x" << frame_height << " " << samples << " spp : "
+            << single_ms << " ms single, " << packet_ms << " ms packets of 8\n";
+
+            Scenef scene;
+            cornell_box_scene(scene);
+            FrameBuffer frame;
+            PathTracerf tracer;
+            double trace_s[4];
+            const unsigned int widths[] = { 0, 4, 8, 16 };
+
+            for (int w = 0; w < 4; ++w)
+            {
+                tracer.packetWidth = widths[w];
+                tracer.Trace(scene, 256, 192, 16, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, frame, &trace_s[w]);
+            }
+
+            std::cout << "PathTracer<float> Cornell box 256x192 16 spp : " << 1000.0 * trace_s[0] << " ms single, "
+            << 1000.0 * trace_s[1] << " / " << 1000.0 * trace_s[2] << " / " << 1000.0 * trace_s[3] << " ms packets of 4 / 8 / 16\n";
+            std::cout << "===============================\n\n";
+        }
+    }
+}
+
+#endif /* PacketUnitTest_h */
@@ -6,14 +6,22 @@
 #include <vector>
 
 #include <exception>
+#include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
 #include <chrono>
 #include <thread>
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <limits>
 #include "ptRandom.h"
 #include "ptUtil.h"
 #include "ptGeometry.h"
+#include "ptImageIO.h"
+#include "ptFrameBuffer.h"
+#include "ptTrace.h"
+#include "ptPacket.h"
 
 #ifndef M_PI
 #define M_PI        3.14159265358979323846264338327950288   /* pi             */
@@ -23,11 +31,23 @@
 #define M_1_PI      0.318309886183790671537767526745028724  /* 1/pi           */
 #endif
 
+/*
+ * Rounding error of a ray-sphere hit distance, in units of machine epsilon times the sphere extent.
+ * Irrelevant in double, but the 1e5 radius walls of the Cornell box make it ~0.1 in float
+ */
+#ifndef PT_SCALE_EPSILON_ULPS
+#define PT_SCALE_EPSILON_ULPS 4
+#endif
+
 #define USE_MT
 
 namespace pt
 {
-	class Material
+	/*
+	 * Material of the smallpt style tracer, not to be confused with the scattering Material<T> of ptMaterial.h
+	 */
+	template <typename T>
+	class SceneMaterial
 	{
 	public:
 		typedef enum Type
@@ -35,169 +55,901 @@ namespace pt
 			DIFFUSE
 		} Type;
 
-		Material(const glm::dvec3& _color, Type _type, const glm::dvec3& _emission = glm::dvec3(0))
+		SceneMaterial(const ptvec<T>& _color, Type _type, const ptvec<T>& _emission = ptvec<T>(0))
 			: color(_color)
 			, emission(_emission)
 			, type(_type) {}
 
-		glm::dvec3 color; //rgb in unbounded domain
-		glm::dvec3 emission; //rgb in unbounded domain
+		ptvec<T> color; //rgb in unbounded domain
+		ptvec<T> emission; //rgb in unbounded domain
 		Type type;
 
-		Material() = delete;
-		Material(const Material& other) = delete;
-		void operator=(const Material& other) = delete;
+		SceneMaterial() = delete;
+		SceneMaterial(const SceneMaterial& other) = delete;
+		void operator=(const SceneMaterial& other) = delete;
 	};
 
+	/*
+	 * Smallest hit distance accepted on a sphere
+	 * Absolute rounding error of the intersection grows with the magnitude of the sphere coordinates
+	 */
+	template <typename T>
+	inline T scale_aware_epsilon(const Sphere<T>& sphere)
+	{
+		T extent = glm::length(sphere.getCenter()) + sphere.getRadius();
+		return std::max((T)PT_EPSILON, (T)PT_SCALE_EPSILON_ULPS * std::numeric_limits<T>::epsilon() * extent);
+	}
+
+	/*
+	 * Ray-sphere intersection for normalized ray directions, returns the closest t > eps or 0
+	 * Discriminant and constant term are evaluated as differences of squares and the
+	 * roots through the stable quadratic formula, so that float survives very large spheres
+	 */
+	template <typename T>
+	inline T intersect_sphere(const Sphere<T>& sphere, const Ray<T>& ray, T eps)
+	{
+		ptvec<T> f = ray.origin - sphere.getCenter();
+		T r = sphere.getRadius();
+		T b = -glm::dot(f, ray.dir);
+
+		T l = glm::length(f + b * ray.dir); // distance between center and ray
+		T det = (r - l) * (r + l);
+		if (det < 0) return 0; // ray misses sphere
+
+		T q = b + (b < 0 ? -std::sqrt(det) : std::sqrt(det));
+		if (q == 0) return 0;
 
+		T fl = glm::length(f);
+		T t0 = q;
+		T t1 = ((fl - r) * (fl + r)) / q;
+		if (t0 > t1) std::swap(t0, t1);
+
+		return t0 > eps ? t0 : (t1 > eps ? t1 : 0); // smaller positive t, or 0 if sphere behind ray
+	}
+
+	template <typename T>
 	class Renderable
 	{
 	public:
-		Renderable(const std::shared_ptr<Primitive>& _primitive, const std::shared_ptr<Material>& _mat) : primitive(_primitive), mat(_mat) {}
-		std::shared_ptr<Primitive>	primitive;
-		std::shared_ptr<Material>	mat;
+		Renderable(const std::shared_ptr<Sphere<T>>& _primitive, const std::shared_ptr<SceneMaterial<T>>& _mat)
+			: primitive(_primitive)
+			, mat(_mat)
+			, eps(scale_aware_epsilon(*_primitive)) {}
+
+		std::shared_ptr<Sphere<T>>			primitive;
+		std::shared_ptr<SceneMaterial<T>>	mat;
+		T									eps;
 
 		Renderable() = delete;
 		Renderable(const Renderable& other) = delete;
 		void operator=(const Renderable& other) = delete;
 	};
 
-	
+	template <typename T> using RenderableRef = std::shared_ptr<Renderable<T>>;
+	template <typename T> using SceneMaterialRef = std::shared_ptr<SceneMaterial<T>>;
 
-	typedef std::shared_ptr<Renderable> RenderableRef;
-	typedef std::shared_ptr<Material>	MaterialRef;
-	typedef std::shared_ptr<Primitive>	PrimitiveRef;
-	typedef std::shared_ptr<Sphere>		SphereRef;
-	typedef std::shared_ptr<Ray>		RayRef;
+	/*
+	 * How a shading point picks its light once there are more than allLightsMax:
+	 * uniformly, in proportion to power, or down the light tree by the importance of each cluster as seen from the point
+	 */
+	typedef enum LightSampling
+	{
+		LIGHT_SAMPLE_UNIFORM,
+		LIGHT_SAMPLE_POWER,
+		LIGHT_SAMPLE_TREE
+	} LightSampling;
 
-	inline pt::RenderableRef CreateSphereRenderable(const glm::dvec3& _center, double _radius, const glm::dvec3& _color, Material::Type _type, const glm::dvec3& _emission = glm::dvec3(0))
+	/*
+	 * The emitting renderables of a scene, the running sum of their power and a tree of them, built once per scene
+	 * Shading points sample every light up to allLightsMax of them, beyond that one light picked as sampling says
+	 */
+	template <typename T>
+	class LightList
 	{
-		return pt::RenderableRef(new pt::Renderable(
-			pt::SphereRef(new pt::Sphere(_center, _radius)),
-			pt::MaterialRef(new pt::Material(_color, _type, _emission))
+	public:
+		static const size_t DefaultAllLightsMax = 8;
+
+		/*
+		 * Cluster of lights: bounds of their spheres and their power.
+		 * An inner node has count 0 and its children at left_first and left_first + 1, a leaf is the light left_first
+		 */
+		struct Node
+		{
+			ptvec<T>	bmin;
+			ptvec<T>	bmax;
+			T			power;
+			int			left_first;
+			int			count;
+		};
+
+		void build(const std::vector<RenderableRef<T>>& renderables)
+		{
+			indices.clear();
+			cdf.clear();
+			nodes.clear();
+			T total = 0;
+
+			for (size_t i = 0; i < renderables.size(); ++i)
+			{
+				const SceneMaterial<T>& mat = *renderables[i]->mat;
+				if (mat.emission.x <= 0 && mat.emission.y <= 0 && mat.emission.z <= 0) continue; //not a light
+
+				// power of a sphere up to a constant, emission times area
+				T r = renderables[i]->primitive->getRadius();
+				total += (std::max(mat.emission.x, (T)0) + std::max(mat.emission.y, (T)0) + std::max(mat.emission.z, (T)0)) * r * r;
+
+				indices.push_back((uint32_t)i);
+				cdf.push_back(total);
+			}
+
+			if (!cdf.empty())
+			{
+				std::vector<Node> leaves(cdf.size());
+				std::vector<uint32_t> order(cdf.size());
+
+				for (size_t k = 0; k < cdf.size(); ++k)
+				{
+					const Sphere<T>& prm = *renderables[indices[k]]->primitive;
+					leaves[k].bmin = prm.getCenter() - ptvec<T>(prm.getRadius());
+					leaves[k].bmax = prm.getCenter() + ptvec<T>(prm.getRadius());
+					leaves[k].power = cdf[k] - (k > 0 ? cdf[k - 1] : 0);
+					leaves[k].left_first = (int)k;
+					leaves[k].count = 1;
+					order[k] = (uint32_t)k;
+				}
+
+				nodes.reserve(2 * cdf.size() - 1);
+				nodes.push_back(Node());
+				buildNode(0, leaves, order.begin(), order.end());
+			}
+
+			for (size_t k = 0; k < cdf.size(); ++k) cdf[k] /= total;
+			if (!cdf.empty()) cdf.back() = 1;
+
+			sceneKey = key(renderables);
+		}
+
+		/* Whether the list was built from renderables as they are now */
+		bool builtFor(const std::vector<RenderableRef<T>>& renderables) const { return sceneKey == key(renderables); }
+
+		/* Hash of what the list is made of: the number of renderables, their centers, radii and emissions */
+		static uint64_t key(const std::vector<RenderableRef<T>>& renderables)
+		{
+			uint64_t h = 14695981039346656037ULL;
+			size_t n = renderables.size();
+			hash(&n, sizeof(n), h);
+
+			for (size_t i = 0; i < n; ++i)
+			{
+				ptvec<T> c = renderables[i]->primitive->getCenter();
+				const ptvec<T>& e = renderables[i]->mat->emission;
+				T values[7] = { c.x, c.y, c.z, renderables[i]->primitive->getRadius(), e.x, e.y, e.z };
+				hash(values, sizeof(values), h);
+			}
+
+			return h;
+		}
+
+		/* Light of u in [0, 1) drawn in proportion to power, as an index into indices, and its probability */
+		size_t samplePower(T u, T& out_pdf) const
+		{
+			size_t k = std::min((size_t)(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), cdf.size() - 1);
+			out_pdf = cdf[k] - (k > 0 ? cdf[k - 1] : 0);
+			return k;
+		}
+
+		/*
+		 * Light of u in [0, 1) for a diffuse point x facing orn, as an index into indices, and its probability
+		 * Down the tree u picks a child in proportion to its importance and is rescaled to [0, 1) for the next level.
+		 * Returns size() when no light can reach x
+		 */
+		size_t sample(const ptvec<T>& x, const ptvec<T>& orn, T u, T& out_pdf) const
+		{
+			if (indices.empty()) return 0;
+
+			if (sampling == LIGHT_SAMPLE_UNIFORM)
+			{
+				out_pdf = (T)1 / (T)indices.size();
+				return std::min((size_t)(u * (T)indices.size()), indices.size() - 1);
+			}
+
+			if (sampling == LIGHT_SAMPLE_POWER) return samplePower(u, out_pdf);
+
+			const Node* node = &nodes[0];
+			out_pdf = 1;
+
+			while (node->count == 0)
+			{
+				const Node& left = nodes[node->left_first];
+				const Node& right = nodes[node->left_first + 1];
+				T il = importance(left, x, orn);
+				T ir = importance(right, x, orn);
+
+				if (!(il + ir > 0)) return indices.size();
+
+				T pl = il / (il + ir);
+
+				if (u < pl)
+				{
+					u = u / pl;
+					out_pdf *= pl;
+					node = &left;
+				}
+				else
+				{
+					u = (u - pl) / ((T)1 - pl);
+					out_pdf *= (T)1 - pl;
+					node = &right;
+				}
+			}
+
+			return (size_t)node->left_first;
+		}
+
+		/*
+		 * Light a cluster may send to x: power over squared distance, the distance kept above the cluster radius,
+		 * times the cosine at x of the direction into the bounding sphere closest to orn. Zero only for clusters below the horizon of x
+		 */
+		static T importance(const Node& node, const ptvec<T>& x, const ptvec<T>& orn)
+		{
+			ptvec<T> center = (node.bmin + node.bmax) * (T).5;
+			ptvec<T> d = center - x;
+			T r2 = glm::dot(node.bmax - center, node.bmax - center);
+			T d2 = glm::dot(d, d);
+
+			if (d2 <= r2) return node.power / r2;
+
+			T dist = sqrt(d2);
+			T cos_theta = glm::dot(d, orn) / dist;
+			T sin_alpha = sqrt(r2 / d2);
+			T cos_alpha = sqrt((T)1 - r2 / d2);
+
+			T cos_bound = cos_theta >= cos_alpha ? (T)1 : cos_theta * cos_alpha + sqrt(std::max((T)0, (T)1 - cos_theta * cos_theta)) * sin_alpha;
+
+			return node.power * std::max((T)0, cos_bound) / d2;
+		}
+
+		bool sampleAll() const { return indices.size() <= allLightsMax; }
+
+		size_t size() const { return indices.size(); }
+
+		std::vector<uint32_t>	indices;	// into the renderables
+		std::vector<T>			cdf;		// of the power, ends at 1
+		std::vector<Node>		nodes;		// root first
+		size_t					allLightsMax;
+		LightSampling			sampling;
+		uint64_t				sceneKey;	// key of the renderables when built, to catch a scene edited since
+
+		LightList() : allLightsMax(DefaultAllLightsMax), sampling(LIGHT_SAMPLE_TREE), sceneKey(0) {}
+
+	private:
+		/* FNV-1a */
+		static void hash(const void* data, size_t size, uint64_t& h)
+		{
+			for (size_t i = 0; i < size; ++i)
+			{
+				h ^= ((const unsigned char*)data)[i];
+				h *= 1099511628211ULL;
+			}
+		}
+
+		static T halfArea(const ptvec<T>& bmin, const ptvec<T>& bmax)
+		{
+			ptvec<T> e = bmax - bmin;
+			return e.x * e.y + e.y * e.z + e.z * e.x;
+		}
+
+		/*
+		 * Fills nodes[index] with the lights [begin, end) of order, split where the lights sorted along the longest axis
+		 * of their centers give the least power times surface area on both sides, so that bright lights keep tight clusters
+		 */
+		void buildNode(size_t index, const std::vector<Node>& leaves, std::vector<uint32_t>::iterator begin, std::vector<uint32_t>::iterator end)
+		{
+			Node node = leaves[*begin];
+			ptvec<T> cmin = (node.bmin + node.bmax) * (T).5, cmax = cmin;
+
+			for (std::vector<uint32_t>::iterator it = begin + 1; it != end; ++it)
+			{
+				const Node& leaf = leaves[*it];
+				node.bmin = glm::min(node.bmin, leaf.bmin);
+				node.bmax = glm::max(node.bmax, leaf.bmax);
+				node.power += leaf.power;
+
+				ptvec<T> c = (leaf.bmin + leaf.bmax) * (T).5;
+				cmin = glm::min(cmin, c);
+				cmax = glm::max(cmax, c);
+			}
+
+			size_t n = end - begin;
+
+			if (n == 1)
+			{
+				nodes[index] = node;
+				return;
+			}
+
+			ptvec<T> extent = cmax - cmin;
+			int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+
+			std::sort(begin, end, [&](uint32_t a, uint32_t b) {
+				return leaves[a].bmin[axis] + leaves[a].bmax[axis] < leaves[b].bmin[axis] + leaves[b].bmax[axis];
+			});
+
+			// cost of the first k lights on the left, then the best split against the lights on the right
+			std::vector<T> left_cost(n);
+			Node acc = leaves[*begin];
+
+			for (size_t k = 1; k < n; ++k)
+			{
+				left_cost[k] = acc.power * halfArea(acc.bmin, acc.bmax);
+
+				const Node& leaf = leaves[begin[k]];
+				acc.bmin = glm::min(acc.bmin, leaf.bmin);
+				acc.bmax = glm::max(acc.bmax, leaf.bmax);
+				acc.power += leaf.power;
+			}
+
+			size_t split = n / 2;
+			T best = std::numeric_limits<T>::max();
+			acc = leaves[begin[n - 1]];
+
+			for (size_t k = n - 1; k > 0; --k)
+			{
+				T cost = left_cost[k] + acc.power * halfArea(acc.bmin, acc.bmax);
+				if (cost < best)
+				{
+					best = cost;
+					split = k;
+				}
+
+				const Node& leaf = leaves[begin[k - 1]];
+				acc.bmin = glm::min(acc.bmin, leaf.bmin);
+				acc.bmax = glm::max(acc.bmax, leaf.bmax);
+				acc.power += leaf.power;
+			}
+
+			node.left_first = (int)nodes.size();
+			node.count = 0;
+			nodes[index] = node;
+			nodes.push_back(Node());
+			nodes.push_back(Node());
+
+			buildNode(node.left_first, leaves, begin, begin + split);
+			buildNode(node.left_first + 1, leaves, begin + split, end);
+		}
+	};
+
+	/*
+	 * A flat list of renderables, traversed linearly
+	 * The lights are built again by updateLights, which the tracers call, once the renderables were added, removed or
+	 * moved, or their emission changed. buildLights builds them up front.
+	 * Tracers may render the same scene at once, the first of them to update the lights does it under lightsMutex
+	 * and the others wait for it. Editing a scene while it renders is not supported.
+	 */
+	template <typename T>
+	class Scene
+	{
+	public:
+		std::vector<RenderableRef<T>> renderables;
+		mutable LightList<T> lights;
+
+		Scene() : lightsMutex(std::make_shared<std::mutex>()) {}
+
+		void buildLights()
+		{
+			std::lock_guard<std::mutex> lock(*lightsMutex);
+			lights.build(renderables);
+		}
+
+		void updateLights() const
+		{
+			std::lock_guard<std::mutex> lock(*lightsMutex);
+			if (!lights.builtFor(renderables)) lights.build(renderables);
+		}
+
+	private:
+		std::shared_ptr<std::mutex> lightsMutex; // copies of a scene share it
+	};
+
+	typedef Scene<float>	Scenef;
+	typedef Scene<double>	Scened;
+
+	template <typename T>
+	inline RenderableRef<T> CreateSphereRenderable(const ptvec<T>& _center, T _radius, const ptvec<T>& _color, typename SceneMaterial<T>::Type _type, const ptvec<T>& _emission = ptvec<T>(0))
+	{
+		return RenderableRef<T>(new Renderable<T>(
+			std::shared_ptr<Sphere<T>>(new Sphere<T>(_center, _radius)),
+			SceneMaterialRef<T>(new SceneMaterial<T>(_color, _type, _emission))
 		));
 	}
 
-	
+	/*
+	 * Copies a scene to another scalar type, e.g. to render a double scene in float
+	 */
+	template <typename T, typename U>
+	inline Scene<T> scene_cast(const Scene<U>& scene)
+	{
+		Scene<T> out;
+
+		for (size_t i = 0; i < scene.renderables.size(); ++i)
+		{
+			const RenderableRef<U>& r = scene.renderables[i];
+			out.renderables.push_back(CreateSphereRenderable<T>(ptvec<T>(r->primitive->getCenter()),
+				(T)r->primitive->getRadius(),
+				ptvec<T>(r->mat->color),
+				(typename SceneMaterial<T>::Type)r->mat->type,
+				ptvec<T>(r->mat->emission)));
+		}
+
+		out.lights.allLightsMax = scene.lights.allLightsMax;
+		out.lights.sampling = scene.lights.sampling;
+		out.buildLights();
+
+		return out;
+	}
 
 	/*
 	 * Intersects ray with a scene and keep closest intersection found
 	 * writes distance t from ray origin and index of object in scene
 	 * this is where a space data structure could help speed up
 	 */
-	inline bool intersect(const Ray& ray, const Scene& scene, double& out_t, size_t &out_idx)
+	template <typename T>
+	inline bool intersect(const Ray<T>& ray, const Scene<T>& scene, T& out_t, size_t &out_idx)
 	{
 		size_t n = scene.renderables.size();
-		double d;
-        out_t = 1e20;//std::numeric_limits<double>::max();
+		T d;
+		const T inf = std::numeric_limits<T>::max();
+		out_t = inf;
+
+		PT_STAGE(STAGE_INTERSECT);
+		PT_COUNT(PT_COUNTER_RAYS, 1);
+		PT_COUNT(PT_COUNTER_INTERSECTION_TESTS, n);
 
 		for (size_t i = 0; i < n; ++i)
 		{
-			if ((d = scene.renderables[i]->primitive->intersect(ray)) && d < out_t)
+			const Renderable<T>& r = *scene.renderables[i];
+
+			if ((d = intersect_sphere(*r.primitive, ray, r.eps)) && d < out_t)
 			{
 				out_t = d;
 				out_idx = i;
 			}
 		}
 
-        return out_t < 1e20;//std::numeric_limits<double>::max();
+		return out_t < inf;
+	}
+
+	/*
+	 * Whether anything but renderable skip lies on the ray closer than t_far, for shadow rays aimed at skip
+	 * Returns at the first blocker where intersect has to find the closest hit
+	 */
+	template <typename T>
+	inline bool occluded(const Ray<T>& ray, const Scene<T>& scene, T t_far, size_t skip)
+	{
+		size_t n = scene.renderables.size();
+		T d;
+
+		PT_STAGE(STAGE_INTERSECT);
+		PT_COUNT(PT_COUNTER_RAYS, 1);
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			if (i == skip) continue;
+
+			const Renderable<T>& r = *scene.renderables[i];
+
+			if ((d = intersect_sphere(*r.primitive, ray, r.eps)) && d < t_far)
+			{
+				PT_COUNT(PT_COUNTER_INTERSECTION_TESTS, i + 1);
+				return true;
+			}
+		}
+
+		PT_COUNT(PT_COUNTER_INTERSECTION_TESTS, n);
+		return false;
+	}
+
+	/*
+	 * intersect_sphere on the lanes of mask of a packet, lowers t and sets prim to index where the sphere is closer
+	 */
+	template <typename T, int N>
+	inline uint32_t packet_intersect_sphere(const Sphere<T>& sphere, T eps, RayPacket<T, N>& p, uint32_t mask, uint32_t index)
+	{
+		typedef Lanes4<T> L;
+		ptvec<T> center = sphere.getCenter();
+		L r = L::set(sphere.getRadius());
+		L zero = L::set(0);
+		uint32_t hits = 0;
+
+		for (int k = 0; k < N; k += 4)
+		{
+			if (!((mask >> k) & 15)) continue;
+
+			L dx = L::load(p.dx + k), dy = L::load(p.dy + k), dz = L::load(p.dz + k);
+			L fx = L::load(p.ox + k) - L::set(center.x);
+			L fy = L::load(p.oy + k) - L::set(center.y);
+			L fz = L::load(p.oz + k) - L::set(center.z);
+			L b = zero - (fx * dx + fy * dy + fz * dz);
+
+			L gx = fx + b * dx, gy = fy + b * dy, gz = fz + b * dz;
+			L l = lanes_sqrt(gx * gx + gy * gy + gz * gz);
+			L det = (r - l) * (r + l);
+
+			L root = lanes_sqrt(lanes_max(det, zero));
+			L q = b + lanes_select(b < zero, zero - root, root);
+			L fl = lanes_sqrt(fx * fx + fy * fy + fz * fz);
+			L t0 = q;
+			L t1 = ((fl - r) * (fl + r)) / q;
+			L near_t = lanes_select(t1 < t0, t1, t0);
+			L far_t = lanes_select(t1 < t0, t0, t1);
+			L d = lanes_select(near_t > L::set(eps), near_t, lanes_select(far_t > L::set(eps), far_t, zero));
+
+			LaneMask4<T> hit = LaneMask4<T>::fromBits((int)(mask >> k)) & (zero <= det) & (q != zero) & (d != zero) & (d < L::load(p.t + k));
+
+			packet_record(p, k, hit, d, index);
+			hits |= (uint32_t)hit.toBits() << k;
+		}
+
+		return hits;
+	}
+
+	/*
+	 * intersect for the active lanes of a packet whose t start at the far end of the rays, returns the lanes hit
+	 */
+	template <typename T, int N>
+	inline uint32_t intersect(RayPacket<T, N>& packet, const Scene<T>& scene)
+	{
+		size_t n = scene.renderables.size();
+		uint32_t hits = 0;
+
+		PT_STAGE(STAGE_INTERSECT);
+		PT_COUNT(PT_COUNTER_RAYS, packet_count(packet.active));
+		PT_COUNT(PT_COUNTER_INTERSECTION_TESTS, n * packet_count(packet.active));
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			const Renderable<T>& r = *scene.renderables[i];
+			hits |= packet_intersect_sphere(*r.primitive, r.eps, packet, packet.active, (uint32_t)i);
+		}
+
+		return hits;
+	}
+
+	/*
+	 * occluded for the active lanes of a packet whose t are the far ends, lane i skipping renderable skip[i]
+	 * Returns the lanes blocked, a lane leaves the loop at its first blocker
+	 */
+	template <typename T, int N>
+	inline uint32_t occluded(RayPacket<T, N>& packet, const Scene<T>& scene, const uint32_t* skip)
+	{
+		size_t n = scene.renderables.size();
+		uint32_t open = packet.active;
+		size_t i = 0;
+
+		PT_STAGE(STAGE_INTERSECT);
+		PT_COUNT(PT_COUNTER_RAYS, packet_count(packet.active));
+
+		for (; i < n && open; ++i)
+		{
+			uint32_t lanes = open;
+
+			for (uint32_t m = open; m; m &= m - 1)
+			{
+				int k = packet_first(m);
+				if (skip[k] == i) lanes &= ~(1u << k);
+			}
+
+			const Renderable<T>& r = *scene.renderables[i];
+			open &= ~packet_intersect_sphere(*r.primitive, r.eps, packet, lanes, (uint32_t)i);
+		}
+
+		PT_COUNT(PT_COUNTER_INTERSECTION_TESTS, i * packet_count(packet.active));
+		return packet.active & ~open;
+	}
+
+	/*
+	 * Direction from x to a uniform point of the cone a sphere light subtends, two draws of rng,
+	 * and the cosine of the half angle of the cone
+	 */
+	template <typename T>
+	inline ptvec<T> sample_light_cone(const Sphere<T>& prm, const ptvec<T>& x, XORUniformRNG<T>& rng, T& out_cos_a_max)
+	{
+		ptvec<T> sw = prm.getCenter() - x;
+		ptvec<T> su = glm::normalize(glm::cross(fabs(sw.x) > (T).1 ? ptvec<T>(0, 1, 0) : ptvec<T>(1, 0, 0), sw));
+		ptvec<T> sv = glm::cross(sw, su);
+
+		out_cos_a_max = sqrt((T)1 - prm.getRadius() * prm.getRadius() / glm::dot(x - prm.getCenter(), x - prm.getCenter()));
+
+		T eps1 = rng(); T eps2 = rng();
+
+		T cos_a = (T)1 - eps1 + eps1 * out_cos_a_max;
+		T sin_a = sqrt(1 - cos_a * cos_a);
+		T phi = (T)(2 * M_PI) * eps2;
+
+		return glm::normalize(su * (T)cos(phi) * sin_a + sv * (T)sin(phi) * sin_a + sw * cos_a);
+	}
+
+	/*
+	 * Light of emission arriving along l, inside a cone of cos_a_max, reflected by a diffuse surface of color facing orn
+	 * Divides by the probability of l with respect to solid angle
+	 */
+	template <typename T>
+	inline ptvec<T> light_contribution(const ptvec<T>& emission, const ptvec<T>& l, const ptvec<T>& orn, T cos_a_max, const ptvec<T>& color)
+	{
+		T omega = (T)(2 * M_PI) * (1 - cos_a_max);
+		ptvec<T> temp = emission * glm::dot(l, orn) * omega;
+
+		return ptvec<T>(color.x * temp.x, color.y * temp.y, color.z * temp.z) * (T)M_1_PI;
 	}
 
-	
+	/*
+	 * Direct light of renderable i at x through one shadow ray, which stops at the light
+	 */
+	template <typename T>
+	inline ptvec<T> sample_light(const Scene<T>& scene, size_t i, const ptvec<T>& x, const ptvec<T>& orn, const ptvec<T>& color, XORUniformRNG<T>& rng)
+	{
+		PT_STAGE(STAGE_LIGHTS);
+
+		const Renderable<T>& light = *scene.renderables[i];
+		T cos_a_max;
+		Ray<T> shadow(x, sample_light_cone(*light.primitive, x, rng, cos_a_max));
+
+		PT_COUNT(PT_COUNTER_SHADOW_RAYS, 1);
+
+		T t_light = intersect_sphere(*light.primitive, shadow, light.eps);
+		if (!t_light || occluded(shadow, scene, t_light, i)) return ptvec<T>(0);
+
+		return light_contribution(light.mat->emission, shadow.dir, orn, cos_a_max, color);
+	}
+
+	/*
+	 * Light of the explicit lights at x, all of them or one picked as scene.lights.sampling says
+	 */
+	template <typename T>
+	inline ptvec<T> direct_light(const Scene<T>& scene, const ptvec<T>& x, const ptvec<T>& orn, const ptvec<T>& color, XORUniformRNG<T>& rng)
+	{
+		const LightList<T>& lights = scene.lights;
+		ptvec<T> e(0);
+
+		if (lights.sampleAll())
+		{
+			for (size_t k = 0; k < lights.size(); ++k)
+				e = e + sample_light(scene, lights.indices[k], x, orn, color, rng);
+		}
+		else if (lights.size() > 0)
+		{
+			T pdf;
+			size_t k = lights.sample(x, orn, rng(), pdf);
+
+			if (k < lights.size()) e = sample_light(scene, lights.indices[k], x, orn, color, rng) * ((T)1 / pdf);
+		}
+
+		return e;
+	}
 
 	// E: whether we are considering emittance or not
-	static glm::dvec3 radiance(const Ray& ray, const Scene& scene, int depth, URNG& rng, int E = 1)
+	template <typename T>
+	static ptvec<T> radiance(const Ray<T>& ray, const Scene<T>& scene, int depth, XORUniformRNG<T>& rng, int E = 1)
 	{
-		double t; size_t idx = 0;
-		if (!intersect(ray, scene, t, idx)) return glm::dvec3(0);
+		if (depth == 0) PT_COUNT(PT_COUNTER_PATHS, 1);
 
-		std::shared_ptr<Primitive> obj = scene.renderables[idx]->primitive;
-        std::shared_ptr<Material> objMat = scene.renderables[idx]->mat;
+		T t; size_t idx = 0;
+		if (!intersect(ray, scene, t, idx)) return ptvec<T>(0);
 
-		glm::dvec3 x = ray.origin + t * ray.dir; //where we intersected
-		glm::dvec3 n = obj->normalAt(x);
-		glm::dvec3 orn = glm::dot(n, ray.dir) < 0 ? n : (n*-1.); //oriented surface normal
-		glm::dvec3 color = objMat->color;
+		const Sphere<T>& obj = *scene.renderables[idx]->primitive;
+		const SceneMaterial<T>& objMat = *scene.renderables[idx]->mat;
+
+		ptvec<T> x = ray.origin + t * ray.dir; //where we intersected
+		ptvec<T> n = obj.normalAt(x);
+		ptvec<T> orn = glm::dot(n, ray.dir) < 0 ? n : (n * (T)-1); //oriented surface normal
+		ptvec<T> color = objMat.color;
 
 		// Russian rulette technique uses max component on r,g,b of surface color after depth 5 to cut recursion
-		double p = color.x > color.y && color.x > color.z ? color.x : color.y > color.z ? color.y : color.z;
+		T p = color.x > color.y && color.x > color.z ? color.x : color.y > color.z ? color.y : color.z;
 		if (++depth > 5 || !p)
 		{
 			if (rng() < p)
-				color = color * (1. / p);
+				color = color * ((T)1 / p);
 			else
-				return objMat->emission * (double)E;
-		}
-		
-        if(Material::DIFFUSE == scene.renderables[idx]->mat->type)
-        {
-            double r1 = 2 * M_PI * rng(); // pick a random angle around
-            double r2 = rng();
-            double r2s = sqrt(r2); //pick a random distance from center
-            
-            //w, u, v ortonormal coordinate frame oriented along object surface at point of intersection
-            glm::dvec3 w = orn;
-            glm::dvec3 u = glm::normalize(glm::cross((fabs(w.x) > .1) ? glm::dvec3(0,1,0) : glm::dvec3(1, 0, 0), w));
-            glm::dvec3 v = glm::cross(w, u);
-            
-            // d is a random reflection ray (this is the unit hemisphere sampling formula
-            glm::dvec3 d = glm::normalize(u * cos(r1) * r2s + v * sin(r1) * r2s + w * sqrt(1 - r2));
-            
-            //loop through all explicit lights
-            glm::dvec3 e;
-            for(size_t i = 0; i < scene.renderables.size(); ++i)
-            {
-                std::shared_ptr<Material> mat = scene.renderables[i]->mat;
-                std::shared_ptr<Primitive> prm = scene.renderables[i]->primitive;
-                
-                if(mat->emission.x <= 0 && mat->emission.y <= 0 && mat->emission.z <= 0) continue; //not a light
-                
-                //create random direction towards sphere
-                glm::dvec3 sw = prm->getCenter() - x;
-                glm::dvec3 su = glm::normalize(glm::cross(fabs(sw.x) > .1 ? glm::dvec3(0,1,0) : glm::dvec3(1,0,0), sw));
-                
-                glm::dvec3 sv = glm::cross(sw, su);
-                
-                double cos_a_max = sqrt(1. - prm->getRadius() * prm->getRadius() / glm::dot(x - prm->getCenter(), x - prm->getCenter()));
-                
-                double eps1 = rng(); double eps2 = rng();
-                
-                double cos_a = 1. - eps1 + eps1 * cos_a_max;
-                double sin_a = sqrt(1 - cos_a * cos_a);
-                double phi = 2. * M_PI * eps2;
-                glm::dvec3 l = su * cos(phi) * sin_a + sv * sin(phi) * sin_a + sw * cos_a;
-                l = glm::normalize(l);
-                
-                // shadow ray
-                if(intersect(Ray(x, l), scene, t, idx) && idx == i)
-                {
-                    double omega = 2. * M_PI * (1 - cos_a_max);
-                    glm::dvec3 temp = mat->emission * glm::dot(l, orn) * omega;
-                    
-                    //Compute 1/probability with respect to solid angle
-                    e = e + glm::dvec3(color.x * temp.x, color.y * temp.y, color.z * temp.z) * M_1_PI;
-                }
-            }
-            
-            glm::dvec3 prev = radiance(Ray(x, d), scene, depth, rng, 0);
-            
-            return (objMat->emission * (double)E
-                    + e
-                    + glm::dvec3(prev.x * color.x, prev.y * color.y, prev.z * color.z));
-            
-        }
-        else
-        {
-            throw "Other material types not yet implemented.";
-        }
+			{
+				PT_COUNT(PT_COUNTER_RR_TERMINATIONS, 1);
+				return objMat.emission * (T)E;
+			}
+		}
+
+		if (SceneMaterial<T>::DIFFUSE == objMat.type)
+		{
+			PT_STAGE(STAGE_SCATTER);
+
+			T r1 = (T)(2 * M_PI) * rng(); // pick a random angle around
+			T r2 = rng();
+			T r2s = sqrt(r2); //pick a random distance from center
+
+			//w, u, v ortonormal coordinate frame oriented along object surface at point of intersection
+			ptvec<T> w = orn;
+			ptvec<T> u = glm::normalize(glm::cross((fabs(w.x) > (T).1) ? ptvec<T>(0, 1, 0) : ptvec<T>(1, 0, 0), w));
+			ptvec<T> v = glm::cross(w, u);
+
+			// d is a random reflection ray (this is the unit hemisphere sampling formula
+			ptvec<T> d = glm::normalize(u * (T)cos(r1) * r2s + v * (T)sin(r1) * r2s + w * (T)sqrt(1 - r2));
+
+			ptvec<T> e = direct_light(scene, x, orn, color, rng);
+
+			PT_COUNT(PT_COUNTER_BOUNCES, 1);
+			ptvec<T> prev = radiance(Ray<T>(x, d), scene, depth, rng, 0);
+
+			return (objMat.emission * (T)E
+				+ e
+				+ ptvec<T>(prev.x * color.x, prev.y * color.y, prev.z * color.z));
+
+		}
+		else
+		{
+			throw "Other material types not yet implemented.";
+		}
+	}
+
+	/*
+	 * radiance of the camera rays of a packet: the first hits and the shadow rays to the lights go as packets,
+	 * the bounces one ray at a time. rng and out hold a generator and a color per lane, a lane draws what radiance draws.
+	 */
+	template <typename T, int N>
+	static void radiance_packet(RayPacket<T, N>& packet, const Scene<T>& scene, XORUniformRNG<T>* rng, ptvec<T>* out)
+	{
+		uint32_t hits = intersect(packet, scene);
+		uint32_t diffuse = 0;
+		ptvec<T> x[N], orn[N], color[N], d[N], e[N];
+
+		PT_COUNT(PT_COUNTER_PATHS, packet_count(packet.active));
+
+		for (uint32_t m = packet.active; m; m &= m - 1)
+		{
+			int i = packet_first(m);
+			out[i] = ptvec<T>(0);
+
+			if (!((hits >> i) & 1)) continue;
+
+			const Sphere<T>& obj = *scene.renderables[packet.prim[i]]->primitive;
+			const SceneMaterial<T>& objMat = *scene.renderables[packet.prim[i]]->mat;
+
+			x[i] = ptvec<T>(packet.ox[i], packet.oy[i], packet.oz[i]) + packet.t[i] * ptvec<T>(packet.dx[i], packet.dy[i], packet.dz[i]);
+			ptvec<T> n = obj.normalAt(x[i]);
+			orn[i] = glm::dot(n, ptvec<T>(packet.dx[i], packet.dy[i], packet.dz[i])) < 0 ? n : (n * (T)-1);
+			color[i] = objMat.color;
+
+			// Russian roulette, a first hit only plays it on black surfaces
+			T p = color[i].x > color[i].y && color[i].x > color[i].z ? color[i].x : color[i].y > color[i].z ? color[i].y : color[i].z;
+			if (!p)
+			{
+				if (rng[i]() < p)
+					color[i] = color[i] * ((T)1 / p);
+				else
+				{
+					PT_COUNT(PT_COUNTER_RR_TERMINATIONS, 1);
+					out[i] = objMat.emission;
+					continue;
+				}
+			}
+
+			if (SceneMaterial<T>::DIFFUSE != objMat.type) throw "Other material types not yet implemented.";
+
+			PT_STAGE(STAGE_SCATTER);
+
+			T r1 = (T)(2 * M_PI) * rng[i]();
+			T r2 = rng[i]();
+			T r2s = sqrt(r2);
+
+			ptvec<T> w = orn[i];
+			ptvec<T> u = glm::normalize(glm::cross((fabs(w.x) > (T).1) ? ptvec<T>(0, 1, 0) : ptvec<T>(1, 0, 0), w));
+			ptvec<T> v = glm::cross(w, u);
+
+			d[i] = glm::normalize(u * (T)cos(r1) * r2s + v * (T)sin(r1) * r2s + w * (T)sqrt(1 - r2));
+			e[i] = ptvec<T>(0);
+			diffuse |= 1u << i;
+		}
+
+		// one shadow packet per light, or a single one of a light per lane picked as lights.sampling says
+		const LightList<T>& lights = scene.lights;
+		size_t rounds = lights.sampleAll() ? lights.size() : std::min(lights.size(), (size_t)1);
+
+		for (size_t k = 0; k < rounds && diffuse; ++k)
+		{
+			PT_STAGE(STAGE_LIGHTS);
+
+			RayPacket<T, N> shadow;
+			T cos_a_max[N], weight[N];
+			uint32_t target[N] = {};
+
+			for (uint32_t m = diffuse; m; m &= m - 1)
+			{
+				int i = packet_first(m);
+				T pdf = 1;
+				size_t pick = lights.sampleAll() ? k : lights.sample(x[i], orn[i], rng[i](), pdf);
+
+				if (pick == lights.size()) continue;
+
+				target[i] = lights.indices[pick];
+				weight[i] = (T)1 / pdf;
+
+				const Renderable<T>& light = *scene.renderables[target[i]];
+				Ray<T> ray(x[i], sample_light_cone(*light.primitive, x[i], rng[i], cos_a_max[i]));
+
+				T t_light = intersect_sphere(*light.primitive, ray, light.eps);
+				if (t_light) shadow.set(i, ray, t_light);
+			}
+
+			PT_COUNT(PT_COUNTER_SHADOW_RAYS, packet_count(diffuse));
+			uint32_t lit = shadow.active & ~occluded(shadow, scene, target);
+
+			for (uint32_t m = lit; m; m &= m - 1)
+			{
+				int i = packet_first(m);
+				ptvec<T> dir(shadow.dx[i], shadow.dy[i], shadow.dz[i]);
+
+				e[i] = e[i] + light_contribution(scene.renderables[target[i]]->mat->emission, dir, orn[i], cos_a_max[i], color[i]) * weight[i];
+			}
+		}
+
+		for (uint32_t m = diffuse; m; m &= m - 1)
+		{
+			int i = packet_first(m);
+			const SceneMaterial<T>& objMat = *scene.renderables[packet.prim[i]]->mat;
+
+			PT_COUNT(PT_COUNTER_BOUNCES, 1);
+			ptvec<T> prev = radiance(Ray<T>(x[i], d[i]), scene, 1, rng[i], 0);
+
+			out[i] = objMat.emission + e[i] + ptvec<T>(prev.x * color[i].x, prev.y * color[i].y, prev.z * color[i].z);
+		}
 	}
 
+	/*
+	 * Cornell box tracer, templated on the scalar type
+	 * PathTracer<float> halves the memory traffic and doubles the SIMD width of the vector math
+	 */
+	template <typename T>
 	class PathTracer
 	{
 	public:
+		static const unsigned int DefaultTileSize = 64;
+
 		std::atomic<int> tileCounter;
 
-		void TraceTile(const Scene& scene,
+		/* 4, 8 or 16 to trace the camera and shadow rays of the first hits as packets (TraceTilePackets), 0 for single rays */
+		unsigned int packetWidth;
+
+		/*
+		 * Frames of one image traced with different samplePass draw independent samples: pixel generators are seeded from
+		 * the pixel and the pass alone, so any thread or process may trace any tile of any pass (ptDistributed.h)
+		 */
+		unsigned int samplePass;
+
+		unsigned int PixelSeed(PcgHash& hash, unsigned int x, unsigned int y) const
+		{
+			return samplePass ? hash((int)hash(x, y), (int)samplePass) : hash(x, y);
+		}
+
+		/*
+		 * Camera ray and the x and y increments of the image plane, as Trace sets them up for TraceTile
+		 */
+		static void CameraBasis(unsigned int width,
+			unsigned int height,
+			const glm::dvec3& camPos,
+			const glm::dvec3& camDir,
+			double camFovRadians,
+			Ray<T>& out_cam,
+			ptvec<T>& out_cx,
+			ptvec<T>& out_cy)
+		{
+			out_cam = Ray<T>(ptvec<T>(camPos), glm::normalize(ptvec<T>(camDir)));
+			out_cx = ptvec<T>((T)((double)width * camFovRadians / (double)height), 0, 0); // x dir increment
+			out_cy = glm::normalize(glm::cross(out_cx, out_cam.dir)) * (T)camFovRadians; //y dir increment
+		}
+
+		/*
+		 * Renders pixels [from_x, to_x) x [from_y, to_y) and accumulates them in out_tile
+		 * out_tile is tile local and in image space, i.e. its first row is image row (height - to_y)
+		 */
+		void TraceTile(const Scene<T>& scene,
 			unsigned int from_x,
 			unsigned int to_x,
 			unsigned int from_y,
@@ -205,49 +957,62 @@ namespace pt
 			unsigned int width,
 			unsigned int height,
 			unsigned int samples,
-			const Ray& cam,
-			glm::dvec3 cx,
-			glm::dvec3 cy,
-			glm::dvec3* out_buffer)
+			const Ray<T>& cam,
+			ptvec<T> cx,
+			ptvec<T> cy,
+			ptvec<T>* out_tile)
 		{
-			glm::dvec3 r; //helper for accumulating colors
-			URNG rng;
+			if (packetWidth)
+			{
+				if (packetWidth == 4) TraceTilePackets<4>(scene, from_x, to_x, from_y, to_y, width, height, samples, cam, cx, cy, out_tile);
+				else if (packetWidth == 8) TraceTilePackets<8>(scene, from_x, to_x, from_y, to_y, width, height, samples, cam, cx, cy, out_tile);
+				else if (packetWidth == 16) TraceTilePackets<16>(scene, from_x, to_x, from_y, to_y, width, height, samples, cam, cx, cy, out_tile);
+				else throw "Packets are 4, 8 or 16 rays";
+
+				tileCounter++;
+				return;
+			}
+
+			ptvec<T> r; //helper for accumulating colors
+			XORUniformRNG<T> rng;
 			PcgHash hash;
 
+			unsigned int tile_width = to_x - from_x;
+
 			for (unsigned int y = from_y; y < to_y; ++y)
 			{
 				for (unsigned int x = from_x; x < to_x; ++x)
 				{
 					// For each pixel we do 2x2 subpixels, and for each subpixel we draw samples samples
-					for (unsigned int sy = 0, i = (height - y - 1) * width + x; sy < 2; ++sy)
+					for (unsigned int sy = 0, i = (to_y - y - 1) * tile_width + (x - from_x); sy < 2; ++sy)
 					{
 						/*
 						 * In original implementation, rng gets seeded at each pixel
 						 * therefore we can't use a global generator, because other threads would see him any time?
 						 */
 
-						rng.seed(hash(x, y));
+						rng.seed(PixelSeed(hash, x, y));
 
-						for (unsigned int sx = 0; sx < 2; ++sx, r = glm::dvec3(0))
+						for (unsigned int sx = 0; sx < 2; ++sx, r = ptvec<T>(0))
 						{
-							for (int s = 0; s < samples; ++s)
+							for (unsigned int s = 0; s < samples; ++s)
 							{
 								// tent filter based sampling of the 2x2 area
-								double r1 = 2.0 * rng();
-								double r2 = 2.0 * rng();
-								double dx = r1 < 1 ? sqrt(r1) - 1 : 1 - sqrt(2 - r1);
-								double dy = r2 < 1 ? sqrt(r2) - 1 : 1 - sqrt(2 - r2);
+								T r1 = (T)2 * rng();
+								T r2 = (T)2 * rng();
+								T dx = r1 < 1 ? sqrt(r1) - 1 : 1 - sqrt(2 - r1);
+								T dy = r2 < 1 ? sqrt(r2) - 1 : 1 - sqrt(2 - r2);
 
-								glm::dvec3 d = cx * (((sx + .5 + dx) / 2 + x) / width - .5)
-									+ cy * (((sy + .5 + dy) / 2 + y) / height - .5)
+								ptvec<T> d = cx * (((sx + (T).5 + dx) / 2 + x) / width - (T).5)
+									+ cy * (((sy + (T).5 + dy) / 2 + y) / height - (T).5)
 									+ cam.dir;
 
 								// weighted by num samples
-								r = r + radiance(Ray(cam.origin + d * 140.0, glm::normalize(d)), scene, 0, rng) * (1. / (double)samples);
+								r = r + radiance(Ray<T>(cam.origin + d * (T)140, glm::normalize(d)), scene, 0, rng) * ((T)1 / (T)samples);
 							}
 
 							// what's with the .25?
-							out_buffer[i] = out_buffer[i] + glm::dvec3(clamp(r.x), clamp(r.y), clamp(r.z)) * 0.25;
+							out_tile[i] = out_tile[i] + ptvec<T>(clamp(r.x), clamp(r.y), clamp(r.z)) * (T).25;
 
 						}
 					}
@@ -257,107 +1022,255 @@ namespace pt
 			tileCounter++;
 		}
 
-		void Trace(const Scene& scene,
+		/*
+		 * TraceTile over blocks of N pixels (2x2, 4x2 or 4x4), each sample of the block one packet through radiance_packet.
+		 * Every lane has the generator of its pixel, seeded as TraceTile seeds it: the image is the one of TraceTile.
+		 */
+		template <int N>
+		void TraceTilePackets(const Scene<T>& scene,
+			unsigned int from_x,
+			unsigned int to_x,
+			unsigned int from_y,
+			unsigned int to_y,
 			unsigned int width,
 			unsigned int height,
 			unsigned int samples,
-			const glm::dvec3& camPos,
-			const glm::dvec3& camDir,
-			double camFovRadians,
-            char* out_buffer,
-			double* rendertime)
+			const Ray<T>& cam,
+			ptvec<T> cx,
+			ptvec<T> cy,
+			ptvec<T>* out_tile)
 		{
-			samples /= 4; // dim of multi-sampled area
-			samples = (samples > 0) ? samples : 1;
+			const unsigned int block_width = N >= 8 ? 4 : 2;
+			const unsigned int block_height = N / block_width;
+			unsigned int tile_width = to_x - from_x;
 
-			Ray cam(camPos, glm::normalize(camDir));
-			glm::dvec3 cx((double)width * camFovRadians / (double)height, 0, 0); // x dir increment
-			glm::dvec3 cy = glm::normalize(glm::cross(cx, cam.dir)) * camFovRadians; //y dir increment
+			XORUniformRNG<T> rng[N];
+			ptvec<T> r[N], c[N];
+			PcgHash hash;
 
-			glm::dvec3 r; //helper for accumulating colors
-			glm::dvec3* buffer = new glm::dvec3[width * height]; //buffer for image rendering
+			for (unsigned int by = from_y; by < to_y; by += block_height)
+			{
+				for (unsigned int bx = from_x; bx < to_x; bx += block_width)
+				{
+					uint32_t lanes = 0;
 
-			tileCounter = 0;
+					for (int i = 0; i < N; ++i)
+						if (bx + i % block_width < to_x && by + i / block_width < to_y) lanes |= 1u << i;
 
-			unsigned int num_tiles_x = 4;
-			unsigned int num_tiles_y = 2;
+					for (unsigned int sy = 0; sy < 2; ++sy)
+					{
+						for (uint32_t m = lanes; m; m &= m - 1)
+						{
+							int i = packet_first(m);
+							rng[i].seed(PixelSeed(hash, bx + i % block_width, by + i / block_width));
+						}
 
-			assert((width % num_tiles_x) == 0);
-			assert((height % num_tiles_y) == 0);
+						for (unsigned int sx = 0; sx < 2; ++sx)
+						{
+							for (int i = 0; i < N; ++i) r[i] = ptvec<T>(0);
 
-			unsigned int tile_width = width / num_tiles_x;
-			unsigned int tile_height = height / num_tiles_y;
+							for (unsigned int s = 0; s < samples; ++s)
+							{
+								RayPacket<T, N> packet;
 
-			std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+								for (uint32_t m = lanes; m; m &= m - 1)
+								{
+									int i = packet_first(m);
+									unsigned int x = bx + i % block_width, y = by + i / block_width;
 
-			start = std::chrono::high_resolution_clock::now();
+									T r1 = (T)2 * rng[i]();
+									T r2 = (T)2 * rng[i]();
+									T dx = r1 < 1 ? sqrt(r1) - 1 : 1 - sqrt(2 - r1);
+									T dy = r2 < 1 ? sqrt(r2) - 1 : 1 - sqrt(2 - r2);
 
-#ifdef USE_MT
-			std::vector<std::shared_ptr<std::thread> > allThreads;
-#endif
+									ptvec<T> d = cx * (((sx + (T).5 + dx) / 2 + x) / width - (T).5)
+										+ cy * (((sy + (T).5 + dy) / 2 + y) / height - (T).5)
+										+ cam.dir;
 
-			for (int j = 0; j < num_tiles_y; ++j)
-			{
-				for (int i = 0; i < num_tiles_x; ++i)
+									packet.set(i, Ray<T>(cam.origin + d * (T)140, glm::normalize(d)), std::numeric_limits<T>::max());
+								}
+
+								radiance_packet(packet, scene, rng, c);
+
+								for (uint32_t m = lanes; m; m &= m - 1)
+								{
+									int i = packet_first(m);
+									r[i] = r[i] + c[i] * ((T)1 / (T)samples);
+								}
+							}
+
+							for (uint32_t m = lanes; m; m &= m - 1)
+							{
+								int i = packet_first(m);
+								unsigned int x = bx + i % block_width, y = by + i / block_width;
+								unsigned int idx = (to_y - y - 1) * tile_width + (x - from_x);
+
+								out_tile[idx] = out_tile[idx] + ptvec<T>(clamp(r[i].x), clamp(r[i].y), clamp(r[i].z)) * (T).25;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		/*
+		 * Tile scheduler: render threads pull tile_size x tile_size tiles from a shared counter,
+		 * each thread renders into its own tile buffer and hands finished tiles to the sink.
+		 * Peak memory is one tile per thread, the full frame is never allocated here.
+		 * Throws on the caller's thread when packetWidth is not one TraceTile takes.
+		 */
+		void TraceTiles(const Scene<T>& scene,
+			unsigned int width,
+			unsigned int height,
+			unsigned int samples,
+			const Ray<T>& cam,
+			const ptvec<T>& cx,
+			const ptvec<T>& cy,
+			TileSink& sink,
+			unsigned int tile_size = DefaultTileSize)
+		{
+			if (packetWidth != 0 && packetWidth != 4 && packetWidth != 8 && packetWidth != 16) throw "Packets are 4, 8 or 16 rays";
+
+			unsigned int num_tiles_x = (width + tile_size - 1) / tile_size;
+			unsigned int num_tiles_y = (height + tile_size - 1) / tile_size;
+			unsigned int num_tiles = num_tiles_x * num_tiles_y;
+
+			std::atomic<unsigned int> nextTile(0);
+
+			auto worker = [&]() {
+
+				std::vector<ptvec<T>> tile(tile_size * tile_size); // sinks take float and double tiles as they are
+				unsigned int t;
+
+				while ((t = nextTile++) < num_tiles)
 				{
-					unsigned int from_x = i * tile_width;
-					unsigned int from_y = j * tile_height;
-					unsigned int to_x = from_x + tile_width;
-					unsigned int to_y = from_y + tile_height;
+					TraceScope span("tile", "cpu", "tile", t);
 
-#ifdef USE_MT
-                    allThreads.push_back(std::shared_ptr<std::thread>(new std::thread(&PathTracer::TraceTile, this,
-#else
-					TraceTile(
-#endif
-						scene,
-						from_x, to_x, from_y, to_y,
+					/* tiles are enumerated in image space, top row first */
+					unsigned int img_x = (t % num_tiles_x) * tile_size;
+					unsigned int img_y = (t / num_tiles_x) * tile_size;
+					unsigned int w = std::min(tile_size, width - img_x);
+					unsigned int h = std::min(tile_size, height - img_y);
+
+					std::fill(tile.begin(), tile.begin() + w * h, ptvec<T>(0));
+
+					TraceTile(scene,
+						img_x, img_x + w,
+						height - img_y - h, height - img_y,
 						width, height, samples,
 						cam, cx, cy,
-						buffer)
-#ifdef USE_MT
-						))
-#endif
-						;
+						tile.data());
+
+					sink.writeTile(img_x, img_y, w, h, tile.data());
 				}
-			}
+			};
 
 #ifdef USE_MT
-			while (tileCounter < (num_tiles_x * num_tiles_y))
-				std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+			unsigned int num_threads = std::max(1u, std::thread::hardware_concurrency());
+			std::vector<std::thread> allThreads;
+
+			for (unsigned int i = 0; i < num_threads; ++i)
+				allThreads.push_back(std::thread(worker));
 
-			for (int i = 0; i < allThreads.size(); ++i)
-				allThreads[i]->join();
+			for (size_t i = 0; i < allThreads.size(); ++i)
+				allThreads[i].join();
+#else
+			worker();
 #endif
-            
+
+			/* sinks do not throw on the render threads, they keep their first error */
+			if (const char* error = sink.getError()) throw error;
+		}
+
+		/*
+		 * Streams the frame tile by tile into sink, e.g. an ExrTiledWriter for frames that do not fit in memory
+		 */
+		void Trace(const Scene<T>& scene,
+			unsigned int width,
+			unsigned int height,
+			unsigned int samples,
+			const glm::dvec3& camPos,
+			const glm::dvec3& camDir,
+			double camFovRadians,
+			TileSink& sink,
+			double* rendertime,
+			unsigned int tile_size = DefaultTileSize)
+		{
+			samples /= 4; // dim of multi-sampled area
+			samples = (samples > 0) ? samples : 1;
+
+			Ray<T> cam;
+			ptvec<T> cx, cy;
+			CameraBasis(width, height, camPos, camDir, camFovRadians, cam, cx, cy);
+
+			scene.updateLights();
+
+			tileCounter = 0;
+
+			std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+
+			start = std::chrono::high_resolution_clock::now();
+
+			TraceScope span("Trace", "cpu", "samples", samples * 4);
+			TraceTiles(scene, width, height, samples, cam, cx, cy, sink, tile_size);
+
 			end = std::chrono::high_resolution_clock::now();
 
 			std::chrono::duration<double> elapsed_seconds = end - start;
 			*rendertime = elapsed_seconds.count();
+		}
+
+		/*
+		 * Renders into a caller owned FrameBuffer, which keeps its storage across calls
+		 * Nothing is written to disk, see FrameBuffer::writePPM
+		 */
+		void Trace(const Scene<T>& scene,
+			unsigned int width,
+			unsigned int height,
+			unsigned int samples,
+			const glm::dvec3& camPos,
+			const glm::dvec3& camDir,
+			double camFovRadians,
+			FrameBuffer& frame,
+			double* rendertime)
+		{
+			frame.resize(width, height);
 
-            unsigned int j = 0;
-            for(unsigned int i = 0; i < width * height; ++i)
-            {
-                out_buffer[j + 0] = to255(buffer[i].x);
-                out_buffer[j + 1] = to255(buffer[i].y);
-                out_buffer[j + 2] = to255(buffer[i].z);
-                j += 3;
-            }
-            
-            FILE *f = fopen("image.ppm", "w");         // Write image to PPM file.
-            fprintf(f, "P3\n%d %d\n%d\n", width, height, 255);
-            for (int i=0; i<width * height; i++)
-                fprintf(f,"%d %d %d ", to255(buffer[i].x), to255(buffer[i].y), to255(buffer[i].z));
+			Trace(scene, width, height, samples, camPos, camDir, camFovRadians, static_cast<TileSink&>(frame), rendertime);
+		}
 
-			delete[] buffer;
+		/*
+		 * Renders into the tracer's own FrameBuffer and converts to 8 bit rgb in out_buffer
+		 */
+		void Trace(const Scene<T>& scene,
+			unsigned int width,
+			unsigned int height,
+			unsigned int samples,
+			const glm::dvec3& camPos,
+			const glm::dvec3& camDir,
+			double camFovRadians,
+			char* out_buffer,
+			double* rendertime)
+		{
+			Trace(scene, width, height, samples, camPos, camDir, camFovRadians, frameBuffer, rendertime);
+
+			frameBuffer.toRGB8((unsigned char*)out_buffer);
 		}
 
-        PathTracer() {}
+		const FrameBuffer& getFrameBuffer() const { return frameBuffer; }
+
+		PathTracer() : packetWidth(0), samplePass(0) {}
 		PathTracer(const PathTracer& other) = delete;
 		void operator=(const PathTracer& other) = delete;
+
+	private:
+		FrameBuffer frameBuffer;
 	};
 
+	typedef PathTracer<float>	PathTracerf;
+	typedef PathTracer<double>	PathTracerd;
+
 }
 
 
-#endif //__PATH_TRACER_H__
\ No newline at end of file
+#endif //__PATH_TRACER_H__
@@ -0,0 +1,111 @@
+#ifndef PathTracerUnitTest_h
+#define PathTracerUnitTest_h
+
+#include "ptTestUtils.h"
+#include "PathTracer.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * The Cornell box scene of PTApp
+         */
+        template <typename T>
+        void cornell_box_scene(Scene<T>& scene)
+        {
+            typedef ptvec<T> vec;
+            const typename SceneMaterial<T>::Type diffuse = SceneMaterial<T>::DIFFUSE;
+
+            scene.renderables.clear();
+
+            scene.renderables.push_back(CreateSphereRenderable<T>(vec(1e5 + 1, 40.8, 81.6), 1e5, vec(.999, 0, 0), diffuse)); // Left
+            scene.renderables.push_back(CreateSphereRenderable<T>(vec(-1e5 + 99, 40.8, 81.6), 1e5, vec(0, .999, 0), diffuse)); // Right
+            scene.renderables.push_back(CreateSphereRenderable<T>(vec(50, 40.8, 1e5), 1e5, vec(.75, .75, .75), diffuse)); // Back
+            scene.renderables.push_back(CreateSphereRenderable<T>(vec(50, 40.8, -1e5 + 170), 1e5, vec(0, 0, 0), diffuse)); // Front
+            scene.renderables.push_back(CreateSphereRenderable<T>(vec(50, 1e5, 81.6), 1e5, vec(.75, .75, .75), diffuse)); // Bottom
+            scene.renderables.push_back(CreateSphereRenderable<T>(vec(50, -1e5 + 81.6, 81.6), 1e5, vec(.75, .75, .75), diffuse)); // Top
+            scene.renderables.push_back(CreateSphereRenderable<T>(vec(27, 16.5, 47), 16.5, vec(.999), diffuse)); // Object
+            scene.renderables.push_back(CreateSphereRenderable<T>(vec(73, 16.5, 78), 16.5, vec(.999), diffuse)); // Object
+            scene.renderables.push_back(CreateSphereRenderable<T>(vec(50, 81.6 - 16.5, 81.6), 1.5, vec(0), diffuse, vec(400, 400, 400))); // Light
+
+            scene.buildLights();
+        }
+
+        /*
+         * Renders the Cornell box with PathTracer<float> and PathTracer<double>
+         * Single pixels differ by noise since the random streams differ after rounding,
+         * so block averages are compared. Float without scale aware epsilons fails this badly on the walls
+         */
+        pt_test_result test_path_tracer_float_double()
+        {
+            const unsigned int width = 128;
+            const unsigned int height = 96;
+            const unsigned int samples = 64;
+            const unsigned int block = 16;
+            const double tolerance = 0.05;
+
+            const glm::dvec3 cam_pos(50, 52, 295.6);
+            const glm::dvec3 cam_dir(0, -0.042612, -1);
+            const double fov = .5135;
+
+            Scenef scene_f;
+            Scened scene_d;
+            cornell_box_scene(scene_f);
+            cornell_box_scene(scene_d);
+
+            FrameBuffer image_f;
+            FrameBuffer image_d;
+            double time_f, time_d;
+
+            PathTracerf tracer_f;
+            PathTracerd tracer_d;
+
+            tracer_f.Trace(scene_f, width, height, samples, cam_pos, cam_dir, fov, image_f, &time_f);
+            tracer_d.Trace(scene_d, width, height, samples, cam_pos, cam_dir, fov, image_d, &time_d);
+
+            double max_error = 0;
+
+            for (unsigned int by = 0; by < height; by += block)
+            {
+                for (unsigned int bx = 0; bx < width; bx += block)
+                {
+                    double sum_f[3] = { 0, 0, 0 }, sum_d[3] = { 0, 0, 0 };
+
+                    for (unsigned int y = by; y < by + block; ++y)
+                    {
+                        for (unsigned int x = bx; x < bx + block; ++x)
+                        {
+                            for (unsigned int c = 0; c < 3; ++c)
+                            {
+                                sum_f[c] += image_f.getData()[3 * (y * width + x) + c];
+                                sum_d[c] += image_d.getData()[3 * (y * width + x) + c];
+                            }
+                        }
+                    }
+
+                    for (unsigned int c = 0; c < 3; ++c)
+                        max_error = std::max(max_error, fabs(sum_f[c] - sum_d[c]) / (double)(block * block));
+                }
+            }
+
+            std::cout << "=========== PERF ===========\n";
+            std::cout << "Cornell box " << width << "x" << height << " " << samples << " spp\n"
+            << "PathTracer<double> : " << time_d * 1000.0 << " ms\n"
+            << "PathTracer<float> : " << time_f * 1000.0 << " ms\n"
+            << "Speedup : " << time_d / time_f << "x\n"
+            << "Max block error : " << max_error << "\n";
+            std::cout << "============================\n\n";
+
+            if (max_error > tolerance)
+            {
+                std::cout << "Float and double images differ by " << max_error << "\n";
+                return PT_TEST_FAIL;
+            }
+
+            return PT_TEST_PASS;
+        }
+    }
+}
+
+#endif /* PathTracerUnitTest_h */
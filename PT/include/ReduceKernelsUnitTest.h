@@ -0,0 +1,139 @@
+#ifndef ReduceKernelsUnitTest_h
+#define ReduceKernelsUnitTest_h
+
+#include "ptTestUtils.h"
+#include "ptCL.h"
+#include <random>
+#include <limits>
+
+namespace pt
+{
+    namespace test
+    {
+        /* Bytes read and written per ms by a device to device copy, the closest to a peak OpenCL can measure */
+        double measure_copy_bandwidth(cl::Context& context, cl::CommandQueue& cmd_queue, size_t bytes)
+        {
+            cl_int clStatus;
+
+            cl::Buffer src(context, CL_MEM_READ_WRITE, bytes, NULL, &clStatus);
+            if (clStatus != CL_SUCCESS) return 0;
+            cl::Buffer dst(context, CL_MEM_READ_WRITE, bytes, NULL, &clStatus);
+            if (clStatus != CL_SUCCESS) return 0;
+
+            double best_ms = 0;
+
+            for (int i = 0; i < 5; ++i)
+            {
+                cl::Event evt;
+                if (cmd_queue.enqueueCopyBuffer(src, dst, 0, 0, bytes, NULL, &evt) != CL_SUCCESS) return 0;
+                evt.wait();
+
+                double ms = (evt.getProfilingInfo<CL_PROFILING_COMMAND_END>() - evt.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 0.001 * 0.001;
+                if (i > 0 && (best_ms == 0 || ms < best_ms)) best_ms = ms;
+            }
+
+            return (best_ms > 0) ? 2.0 * bytes / (best_ms * 1e6) : 0;
+        }
+
+        /*
+         * Reduces n random floats with op on the device and compares against the host in double
+         * n is anything, not a multiple of 4 or of the group size. Prints the bandwidth against a buffer copy.
+         */
+        pt_test_result test_reduce_complete(cl::Device& device,
+                                            cl::Context& context,
+                                            cl::CommandQueue& cmd_queue,
+                                            cl_reduce_op op,
+                                            size_t n)
+        {
+            cl_int clStatus;
+            cl::Program program;
+
+            size_t group_size = 256;
+            while (group_size > device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>()) group_size >>= 1;
+
+            size_t groups = 8 * (size_t)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+
+            clStatus = test_util_get_program(device, context, program, "../../../assets/reduce_complete.cl", cl_reduce_build_options(op, group_size).c_str());
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+
+            cl::Kernel kernel(program, "reduce_complete", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+
+            std::vector<float> data(n);
+            std::mt19937 rng(1234);
+            std::uniform_real_distribution<float> uniform(-1.0f, 2.0f);
+            for (float& v : data) v = uniform(rng);
+
+            double expected = (op == CL_REDUCE_MIN) ? std::numeric_limits<double>::max() : (op == CL_REDUCE_MAX) ? -std::numeric_limits<double>::max() : 0.0;
+
+            for (float v : data)
+            {
+                if (op == CL_REDUCE_MIN) expected = std::min(expected, (double)v);
+                else if (op == CL_REDUCE_MAX) expected = std::max(expected, (double)v);
+                else expected += v;
+            }
+
+            if (op == CL_REDUCE_MEAN) expected /= (double)n;
+
+            CLBufferPool::Scope buffers(test_util_buffer_pool(context));
+
+            cl::Buffer d_buff_r_data = buffers.acquire(n * sizeof(float), CL_MEM_READ_ONLY, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create data buffer")
+            PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write data buffer error.", cmd_queue, d_buff_r_data, CL_TRUE, 0, n * sizeof(float), data.data(), NULL, NULL)
+
+            cl::Buffer d_buff_w_result = buffers.acquire(sizeof(float), CL_MEM_READ_WRITE, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create result buffer")
+
+            cl::Buffer d_buff_partials;
+            std::vector<cl::Event> events;
+            double best_ms = 0;
+
+            /* the first run pays for the partials allocation */
+            for (int i = 0; i < 6; ++i)
+            {
+                clStatus = cl_reduce(context, cmd_queue, kernel, op, d_buff_r_data, n, group_size, groups, d_buff_partials, d_buff_w_result, &events);
+                PTCL_ASSERT(clStatus, "Could not enqueue reduction")
+
+                cl::Event::waitForEvents(events);
+
+                double ms = 0;
+                for (cl::Event& evt : events)
+                {
+                    ms += (evt.getProfilingInfo<CL_PROFILING_COMMAND_END>() - evt.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 0.001 * 0.001;
+                }
+
+                if (i > 0 && (best_ms == 0 || ms < best_ms)) best_ms = ms;
+            }
+
+            float result = 0;
+            clStatus = cmd_queue.enqueueReadBuffer(d_buff_w_result, CL_TRUE, 0, sizeof(float), &result);
+            PTCL_ASSERT(clStatus, "Could not read result buffer")
+
+            const char* names[] = { "sum", "min", "max", "mean" };
+            double gbs = (best_ms > 0) ? n * sizeof(float) / (best_ms * 1e6) : 0;
+            double peak_gbs = measure_copy_bandwidth(context, cmd_queue, n * sizeof(float));
+
+            std::cout << "=========== REDUCE ===========\n";
+            std::cout << "Op : " << names[op] << "\n"
+            << "Elements : " << n << "\n"
+            << "Groups : " << groups << " x " << group_size << "\n"
+            << "Result : " << result << " expected " << expected << "\n"
+            << "Time : " << best_ms << " ms\n"
+            << "Bandwidth : " << gbs << " GB/s, " << (peak_gbs > 0 ? 100.0 * gbs / peak_gbs : 0) << "% of copy (" << peak_gbs << " GB/s)\n";
+            std::cout << "==============================\n\n";
+
+            /* min and max are exact, sums are accumulated in float on the device */
+            double tolerance = (op == CL_REDUCE_MIN || op == CL_REDUCE_MAX) ? 0.0 : 1e-4 * std::max(1.0, fabs(expected)) + 1e-5;
+
+            if (fabs((double)result - expected) > tolerance)
+            {
+                std::cout << "Reduction mismatch\n";
+                return PT_TEST_FAIL;
+            }
+
+            return PT_TEST_PASS;
+        }
+    }
+}
+
+#endif /* ReduceKernelsUnitTest_h */
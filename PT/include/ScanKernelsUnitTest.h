@@ -12,6 +12,7 @@
 #include "ptTestUtils.h"
 #include "ptUtil.h"
 #include "ptCL.h"
+#include <chrono>
 
 /*
  * TODO: massively refractor this into a class approach
@@ -198,6 +199,88 @@ namespace pt
             return test_hillis_steele_scan_single_block(device, context, cmd_queue, false);
         }
         
+        /*
+         * cl_scan over many blocks, the block sums are scanned recursively and added back
+         */
+        pt_test_result test_hillis_steele_scan_multi_block(cl::Device& device,
+                                                           cl::Context& context,
+                                                           cl::CommandQueue& cmd_queue,
+                                                           bool inclusive_scan,
+                                                           size_t data_num)
+        {
+            pt_test_result result = PT_TEST_PASS;
+            
+            cl_int clStatus;
+            cl::Program program;
+            
+            std::string program_compile_opt = "-cl-denorms-are-zero";
+            
+            if(inclusive_scan)
+            {
+                program_compile_opt += " -D SCAN_INCLUSIVE";
+            }
+            
+            clStatus = pt::test::test_util_get_program(device, context, program, "../../../assets/hillis_steele_scan.cl", program_compile_opt.c_str());
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+            
+            cl::Kernel scan_kernel = cl::Kernel(program, "hillis_steele_scan_sum", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel");
+            
+            cl::Kernel add_kernel = cl::Kernel(program, "hillis_steele_add_block_sums", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel");
+            
+            size_t block_size = scan_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+            size_t padded_num = ((data_num + block_size - 1) / block_size) * block_size;
+            
+            /* small values, the sum of all must fit an int */
+            int* test_data = (int*)malloc(padded_num * sizeof(int));
+            int* expected_result = (int*)malloc(data_num * sizeof(int));
+            
+            for(size_t i = 0; i < padded_num; ++i)
+            {
+                test_data[i] = (i < data_num) ? (int)(i % 7) + 1 : 0;
+            }
+            
+            expected_result[0] = inclusive_scan ? test_data[0] : 0;
+            
+            for(size_t i = 1; i < data_num; ++i)
+            {
+                expected_result[i] = expected_result[i - 1] + test_data[inclusive_scan ? i : (i - 1)];
+            }
+            
+            cl::Buffer d_buff_rw_data = cl::Buffer(context, CL_MEM_READ_WRITE, padded_num * sizeof(int), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create data buffer")
+            
+            PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write data buffer error.", cmd_queue, d_buff_rw_data, CL_TRUE, 0, padded_num * sizeof(int), test_data, NULL, NULL)
+            
+            std::vector<cl::Buffer> block_sums;
+            
+            auto start = std::chrono::high_resolution_clock::now();
+            
+            clStatus = cl_scan(context, cmd_queue, scan_kernel, add_kernel, d_buff_rw_data, data_num, block_size, block_sums);
+            PTCL_ASSERT(clStatus, "Could not scan data")
+            
+            cmd_queue.finish();
+            
+#ifdef PT_TEST_PERF
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            print_perf_results(std::string("cl_scan ") + (inclusive_scan ? "inclusive" : "exclusive"),
+                               padded_num, block_size, elapsed.count());
+#endif
+            
+            int* computed_result = (int*)malloc(data_num * sizeof(int));
+            
+            PTCL_SAFE_OP("Could not read data buffer", enqueueReadBuffer, cmd_queue, d_buff_rw_data, CL_TRUE, 0, data_num * sizeof(int), computed_result)
+            
+            result = compare_array(expected_result, computed_result, data_num, "cl_scan test failed");
+            
+            free(test_data);
+            free(expected_result);
+            free(computed_result);
+            
+            return result;
+        }
+        
     }
 }
 
@@ -0,0 +1,366 @@
+#ifndef SceneUnitTest_h
+#define SceneUnitTest_h
+
+#include <chrono>
+#include "ptTestUtils.h"
+#include "ptTests.h"
+#include "ptScene.h"
+
+namespace pt
+{
+    namespace test
+    {
+        /*
+         * A scene file with every statement: the three kinds of material, a ring of spheres on a ground sphere
+         * and a cube whose faces are quads written in the v, v/vt, v//vn and negative index forms
+         */
+        void test_util_write_scene(const std::string& path, const std::string& mesh_path)
+        {
+            std::ofstream mesh(mesh_path.c_str());
+            mesh << "# cube\n"
+            << "v -1 -1 -1\nv 1 -1 -1\nv 1 1 -1\nv -1 1 -1\nv -1 -1 1\nv 1 -1 1\nv 1 1 1\nv -1 1 1\n"
+            << "vt 0 0\nvn 0 0 1\n"
+            << "f 1 4 3 2\n"
+            << "f 5/1 6/1 7/1 8/1\n"
+            << "f 1//1 2//1 6//1 5//1\n"
+            << "f -5/1/1 -1/1/1 -2/1/1 -6/1/1\n"
+            << "f 1 5 8 4\n"
+            << "f 2 3 7 6\n";
+
+            std::ofstream scene(path.c_str());
+            scene << "# scene of test_scene_cache\n"
+            << "camera 60 -2 2 1  0 0 -1  0 1 0\n"
+            << "sky 1 1 1  0.5 0.7 1\n"
+            << "material ground lambertian 0.5 0.5 0.5\n"
+            << "material red lambertian 0x730202 # hex color\n"
+            << "material gold metal 0.8 0.6 0.2 0.3\n"
+            << "material glass dielectric 1.5\n"
+            << "sphere ground 0 -100.5 -1 100\n";
+
+            const char* names[] = { "red", "gold", "glass" };
+
+            for (int i = 0; i < 30; ++i)
+            {
+                float a = 2.0f * (float)M_PI * (float)i / 30.0f;
+                scene << "sphere " << names[i % 3] << " " << 2.0f * cosf(a) << " -0.3 " << -1.0f + 2.0f * sinf(a) << " 0.2\n";
+            }
+
+            scene << "mesh gold " << mesh_path.substr(mesh_path.find_last_of("/\\") + 1) << " 0 0 -1 0.4\n";
+        }
+
+        /* Same closest hit for random rays, t and primitive */
+        bool test_util_same_hits(const PrimitiveList<float>& a, const PrimitiveList<float>& b, size_t rays)
+        {
+            XORUniformRNG<float> rng(0x5eed);
+
+            for (size_t r = 0; r < rays; ++r)
+            {
+                Ray<float> ray(glm::vec3(4.0f * rng() - 2.0f, 2.0f * rng(), 4.0f * rng() - 3.0f),
+                               glm::normalize(glm::vec3(rng() - 0.5f, rng() - 0.5f, rng() - 0.5f)));
+
+                float ta, tb;
+                size_t ia = 0, ib = 0;
+                bool ha = a.intersect_simple(ray, ta, ia, ray_min<float>());
+                bool hb = b.intersect_simple(ray, tb, ib, ray_min<float>());
+
+                if (ha != hb || (ha && (ta != tb || ia != ib))) return false;
+            }
+
+            return true;
+        }
+
+        template <typename R>
+        bool test_util_same_records(const SceneArray<R>& a, const SceneArray<R>& b)
+        {
+            return a.size == b.size && (a.size == 0 || memcmp(a.data, b.data, a.size * sizeof(R)) == 0);
+        }
+
+        /*
+         * Loads a scene file, then its cache: both forms must hold the same records, camera and sky,
+         * and hit the same primitives as the primitives tested one by one. The cache is rebuilt when the file changes.
+         */
+        pt_test_result test_scene_cache()
+        {
+            const std::string path = "scene_test.scene";
+            const std::string cache = path + ".cache";
+
+            test_util_write_scene(path, "scene_test.obj");
+            remove(cache.c_str());
+
+            SceneDescription text, cached;
+            bool from_cache = true;
+
+            scene_load(path, text, &from_cache);
+
+            if (from_cache || text.spheres.size != 31 || text.triangles.size != 12 || text.material_table.size != 4)
+            {
+                std::cout << "Scene file loaded " << text.spheres.size << " spheres, " << text.triangles.size << " triangles, "
+                << text.material_table.size << " materials\n";
+                return PT_TEST_FAIL;
+            }
+
+            scene_load(path, cached, &from_cache);
+
+            if (!from_cache || !cached.mapping)
+            {
+                std::cout << "Scene cache was not used\n";
+                return PT_TEST_FAIL;
+            }
+
+            if (!test_util_same_records(text.spheres, cached.spheres)
+                || !test_util_same_records(text.triangles, cached.triangles)
+                || !test_util_same_records(text.material_table, cached.material_table)
+                || !test_util_same_records(text.primitive_materials, cached.primitive_materials)
+                || !test_util_same_records(text.nodes, cached.nodes)
+                || !test_util_same_records(text.primitive_indices, cached.primitive_indices))
+            {
+                std::cout << "Scene cache records differ from the scene file\n";
+                return PT_TEST_FAIL;
+            }
+
+            if (text.camera.eye != cached.camera.eye || text.camera.vfov != cached.camera.vfov
+                || text.sky_bottom != cached.sky_bottom || text.sky_top != cached.sky_top)
+            {
+                std::cout << "Scene cache camera or sky differ from the scene file\n";
+                return PT_TEST_FAIL;
+            }
+
+            for (size_t i = 0; i < text.primitiveCount(); ++i)
+            {
+                if (cl_make_material(text.materials[i]).type != cl_make_material(cached.materials[i]).type)
+                {
+                    std::cout << "Scene cache material " << i << " differs\n";
+                    return PT_TEST_FAIL;
+                }
+            }
+
+            PrimitiveList<float> linear = text.list;
+            linear.setBVH(NULL);
+
+            if (!test_util_same_hits(text.list, linear, 20000) || !test_util_same_hits(cached.list, linear, 20000))
+            {
+                std::cout << "BVH hits differ from the linear list\n";
+                return PT_TEST_FAIL;
+            }
+
+            /* a cache whose root points past the nodes is refused rather than traversed */
+            {
+                std::ifstream in(cache.c_str(), std::ios::binary);
+                std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+                SceneCacheHeader header;
+                memcpy(&header, bytes.data(), sizeof(header));
+
+                cl_bvh_node root;
+                memcpy(&root, bytes.data() + header.offsets[SCENE_NODES], sizeof(root));
+                root.left_first = (cl_int)header.counts[SCENE_NODES];
+                memcpy(bytes.data() + header.offsets[SCENE_NODES], &root, sizeof(root));
+
+                const std::string bad = "scene_test_bad.cache";
+                std::ofstream(bad.c_str(), std::ios::binary).write(bytes.data(), bytes.size());
+
+                SceneDescription corrupt;
+                if (scene_load_cache(bad, corrupt))
+                {
+                    std::cout << "Scene cache with a node out of range was loaded\n";
+                    return PT_TEST_FAIL;
+                }
+            }
+
+            /* a cache with a material of unknown type is refused and the scene file parsed instead */
+            {
+                std::ifstream in(cache.c_str(), std::ios::binary);
+                std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+                in.close();
+
+                SceneCacheHeader header;
+                memcpy(&header, bytes.data(), sizeof(header));
+
+                cl_material material;
+                memcpy(&material, bytes.data() + header.offsets[SCENE_MATERIALS], sizeof(material));
+                material.type = MAT_EMISSIVE + 1;
+                memcpy(bytes.data() + header.offsets[SCENE_MATERIALS], &material, sizeof(material));
+
+                std::ofstream(cache.c_str(), std::ios::binary).write(bytes.data(), bytes.size());
+
+                SceneDescription reparsed;
+                scene_load(path, reparsed, &from_cache);
+
+                if (from_cache || reparsed.material_table.size != text.material_table.size)
+                {
+                    std::cout << "Scene cache with an unknown material type was loaded\n";
+                    return PT_TEST_FAIL;
+                }
+            }
+
+            std::ofstream(path.c_str(), std::ios::app) << "# changed\n";
+
+            SceneDescription changed;
+            scene_load(path, changed, &from_cache);
+
+            if (from_cache)
+            {
+                std::cout << "Scene cache used after the scene file changed\n";
+                return PT_TEST_FAIL;
+            }
+
+            return PT_TEST_PASS;
+        }
+
+        /*
+         * The scene of test_scene_cache rendered by render_frame on the CPU and scene_tracing_accumulate
+         * on the device, block averages compared as in test_dielectric_cl
+         */
+        pt_test_result test_scene_cl(cl::Device& device, cl::Context& context, cl::CommandQueue& cmd_queue)
+        {
+            cl_int clStatus;
+            cl::Program program;
+
+            const cl_uint width = 160;
+            const cl_uint height = 80;
+            const cl_uint samples = 256;
+            const cl_uint samples_per_frame = 16;
+            const cl_uint block = 8;
+            const double tolerance = 0.04;
+
+            test_util_write_scene("scene_test.scene", "scene_test.obj");
+
+            SceneDescription scene;
+            scene_load("scene_test.scene", scene);
+
+            PinholeCamera<float> cam = scene.camera.pinhole((float)width / (float)height);
+
+            std::vector<float> cpu_image(3 * width * height);
+            XORUniformRNG<float> rng;
+            PcgHash hash;
+            render_frame(width, height, samples, cam, scene.list, scene.materials, cpu_image.data(), rng, hash);
+
+            clStatus = test_util_get_program(device, context, program, "../../../assets/scene_tracing.cl", "-I ../../../assets/ -cl-denorms-are-zero");
+            PTCL_ASSERT(clStatus, "Failed to compile program.");
+
+            cl::Kernel kernel(program, "scene_tracing_accumulate", &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create kernel")
+
+            cl_scene_buffers buffers;
+            clStatus = cl_upload_scene(context, cmd_queue, scene, buffers);
+            PTCL_ASSERT(clStatus, "Could not upload scene")
+
+            cl::Buffer d_buff_r_cam(context, CL_MEM_READ_ONLY, sizeof(cl_pinhole_cam), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create camera buffer")
+            clStatus = cl_set_pinhole_cam_arg(cam, d_buff_r_cam, cmd_queue);
+            PTCL_ASSERT(clStatus, "Could not fill camera buffer")
+
+            cl_accumulation accumulation;
+            clStatus = cl_make_accumulation(context, width * height, cmd_queue, accumulation);
+            PTCL_ASSERT(clStatus, "Could not create accumulation buffer")
+
+            PTCL_SAFE_SET_ARG("Could not set cam argument", kernel, 0, d_buff_r_cam)
+            clStatus = cl_set_scene_args(kernel, buffers);
+            PTCL_ASSERT(clStatus, "Could not set scene arguments")
+            PTCL_SAFE_SET_ARG("Could not set accumulation argument", kernel, 10, accumulation.buffer)
+            PTCL_SAFE_SET_ARG("Could not set samples argument", kernel, 11, samples_per_frame)
+            PTCL_SAFE_SET_ARG("Could not set width argument", kernel, 12, width)
+            PTCL_SAFE_SET_ARG("Could not set height argument", kernel, 13, height)
+
+            for (cl_uint frame = 0; frame < samples / samples_per_frame; ++frame)
+            {
+                PTCL_SAFE_SET_ARG("Could not set frame argument", kernel, 14, frame)
+                clStatus = cmd_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(width, height), cl::NullRange);
+                PTCL_ASSERT(clStatus, "Could not enqueue kernel")
+            }
+
+            std::vector<cl_float4> gpu_image(width * height);
+            PTCL_SAFE_OP("Could not read accumulation buffer", enqueueReadBuffer, cmd_queue, accumulation.buffer, CL_TRUE, 0, width * height * sizeof(cl_float4), gpu_image.data())
+
+            double max_error = 0;
+
+            for (cl_uint by = 0; by < height; by += block)
+            {
+                for (cl_uint bx = 0; bx < width; bx += block)
+                {
+                    double sum_cpu[3] = { 0, 0, 0 }, sum_gpu[3] = { 0, 0, 0 };
+
+                    for (cl_uint y = by; y < by + block; ++y)
+                    {
+                        for (cl_uint x = bx; x < bx + block; ++x)
+                        {
+                            for (int c = 0; c < 3; ++c)
+                            {
+                                sum_cpu[c] += clamp(cpu_image[3 * ((height - y - 1) * width + x) + c]);
+                                sum_gpu[c] += clamp(gpu_image[y * width + x].s[c]);
+                            }
+                        }
+                    }
+
+                    for (int c = 0; c < 3; ++c)
+                        max_error = std::max(max_error, fabs(sum_cpu[c] - sum_gpu[c]) / (double)(block * block));
+                }
+            }
+
+            std::cout << "=========== SCENE ===========\n";
+            std::cout << "scene_test " << width << "x" << height << " " << samples << " spp, "
+            << scene.spheres.size << " spheres, " << scene.triangles.size << " triangles\n"
+            << "Max block error : " << max_error << "\n";
+            std::cout << "=============================\n\n";
+
+            if (max_error > tolerance)
+            {
+                std::cout << "Device and CPU images differ by " << max_error << "\n";
+                return PT_TEST_FAIL;
+            }
+
+            return PT_TEST_PASS;
+        }
+
+        /*
+         * Load time of a scene from its text and from its cache, scene_load of every form runs
+         * repeats times on a warm file cache: parse, OBJ and BVH build against mmap and the CPU objects only.
+         */
+        void bench_scene_load(const std::string& path, int repeats)
+        {
+            std::string text;
+            if (!scene_read_file(path, text))
+            {
+                std::cout << "Could not read " << path << "\n";
+                return;
+            }
+
+            double text_ms = 0, cache_ms = 0;
+            size_t triangles = 0, nodes = 0;
+            const std::string cache = path + ".cache";
+
+            for (int i = 0; i < repeats; ++i)
+            {
+                SceneDescription scene;
+                auto start = std::chrono::high_resolution_clock::now();
+                scene_load_text(path, scene);
+                text_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+                triangles = scene.triangles.size;
+                nodes = scene.nodes.size;
+                if (i == 0) scene_write_cache(scene, cache);
+            }
+
+            for (int i = 0; i < repeats; ++i)
+            {
+                SceneDescription scene;
+                auto start = std::chrono::high_resolution_clock::now();
+                if (!scene_load_cache(cache, scene))
+                {
+                    std::cout << "Could not load " << cache << "\n";
+                    return;
+                }
+                cache_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            }
+
+            std::cout << "=========== SCENE LOAD ===========\n";
+            std::cout << path << " : " << triangles << " triangles, " << nodes << " BVH nodes\n"
+            << "Text : " << text_ms / repeats << " ms\n"
+            << "Cache : " << cache_ms / repeats << " ms\n"
+            << "Speedup : " << text_ms / cache_ms << "x\n";
+            std::cout << "==================================\n\n";
+        }
+    }
+}
+
+#endif /* SceneUnitTest_h */
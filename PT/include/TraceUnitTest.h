@@ -0,0 +1,96 @@
+#ifndef TraceUnitTest_h
+#define TraceUnitTest_h
+
+#include <thread>
+#include <sstream>
+#include "ptTestUtils.h"
+#include "ptTrace.h"
+
+namespace pt
+{
+    namespace test
+    {
+        size_t test_util_count(const std::string& text, const std::string& pattern)
+        {
+            size_t n = 0;
+            for (size_t at = text.find(pattern); at != std::string::npos; at = text.find(pattern, at + 1)) ++n;
+            return n;
+        }
+        
+        /*
+         * Spans of four threads all make it to the Chrome trace, then one thread overruns its ring buffer
+         * and only its last TraceBufferCapacity spans are left. Threads started one after the other
+         * reuse the buffer and track of the previous one, host tracks never reach the device range
+         */
+        pt_test_result test_trace()
+        {
+            const int threads = 4;
+            const int spans = 100;
+            
+            trace_enable(true);
+            
+            std::vector<std::thread> workers;
+            
+            for (int t = 0; t < threads; ++t)
+            {
+                workers.push_back(std::thread([t]() {
+                    if (t == 0) trace_set_thread_name("trace test worker");
+                    for (int i = 0; i < spans; ++i) TraceScope span("trace test", "test", "i", i);
+                }));
+            }
+            
+            for (std::thread& w : workers) w.join();
+            
+            std::ostringstream before;
+            trace_write_chrome(before);
+            
+            std::thread overrun([]() {
+                for (size_t i = 0; i < TraceBufferCapacity + 10; ++i) trace_span("wrap", "test", 0.0, 1.0, 0, "i", (int64_t)i);
+            });
+            overrun.join();
+            
+            std::ostringstream after;
+            trace_write_chrome(after);
+            
+            uint32_t tracks_before = trace_registry().next_thread;
+            
+            for (int t = 0; t < 64; ++t)
+            {
+                std::thread short_lived([]() { TraceScope span("short lived", "test"); });
+                short_lived.join();
+            }
+            
+            bool tracks_reused = trace_registry().next_thread == tracks_before && tracks_before < TraceDeviceTracks;
+            
+            trace_enable(false);
+            
+            pt_test_result result = PT_TEST_PASS;
+            
+            if (before.str().find("{\"displayTimeUnit\"") != 0
+                || test_util_count(before.str(), "\"name\":\"trace test\"") != (size_t)(threads * spans)
+                || test_util_count(before.str(), "\"name\":\"trace test worker\"") != 1)
+            {
+                std::cout << "Trace misses spans\n";
+                result = PT_TEST_FAIL;
+            }
+            
+            if (test_util_count(after.str(), "\"name\":\"wrap\"") != TraceBufferCapacity
+                || after.str().find("\"i\":9}") != std::string::npos
+                || after.str().find("\"i\":10}") == std::string::npos)
+            {
+                std::cout << "Ring buffer did not keep the latest spans\n";
+                result = PT_TEST_FAIL;
+            }
+            
+            if (!tracks_reused)
+            {
+                std::cout << "Threads did not reuse the tracks of finished ones\n";
+                result = PT_TEST_FAIL;
+            }
+            
+            return result;
+        }
+    }
+}
+
+#endif /* TraceUnitTest_h */
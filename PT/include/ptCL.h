@@ -9,12 +9,17 @@
 #include <CL/cl.hpp>
 #endif
 
+#include <sstream>
+#include <algorithm>
+
 #include "glm/gtc/type_ptr.hpp"
 #include "ptUtil.h"
 #include "ptGeometry.h"
 #include "ptRandom.h"
 #include "ptMaterial.h"
 #include "ptRendering.h"
+#include "ptImageIO.h"
+#include "../assets/pt_types.h"
 
 #define MAX_PRIMITIVES 10
 
@@ -48,6 +53,8 @@ exit(EXIT_FAILURE); \
 
 #define PTCL_SAFE_SET_ARG(errorMsg, kernel, ...) kernel.setArg(__VA_ARGS__);
 
+#define PTCL_SAFE_OP(errorMsg, op, target, ...) target.op(__VA_ARGS__);
+
 #endif
 
 
@@ -61,39 +68,111 @@ void pt_assert(const cl_int& status, const std::string& errorMsg)
     }
 }
 
-//TODO: packing stuff is compiler dependent
+/*
+ * The records the kernels read are declared once in assets/pt_types.h, these are the host names
+ */
+typedef pt::device::Camera cl_camera;
+typedef pt::device::Camera cl_pinhole_cam; // a cl_camera of type CAM_PINHOLE
+typedef pt::device::Ray cl_ray;
+typedef pt::device::Material cl_material;
+typedef pt::device::SkyMaterial cl_sky_material;
+
+#define PT_HOST_SIZE(type) layout.push_back((cl_uint)sizeof(pt::device::type)); if (names) names->push_back("sizeof(" #type ")");
+#define PT_HOST_OFFSET(type, member) layout.push_back((cl_uint)offsetof(pt::device::type, member)); if (names) names->push_back("offsetof(" #type ", " #member ")");
 
-typedef struct cl_pinhole_cam
+/*
+ * The host side of the table the sizecheck kernel in sizecheck.cl writes, same order, with a name per entry
+ */
+std::vector<cl_uint> cl_host_layout(std::vector<std::string>* names = NULL)
 {
-    cl_float3 origin;
-    cl_float3 lower_left;
-    cl_float3 hor;
-    cl_float3 ver;
-} cl_pinhole_cam;
+    std::vector<cl_uint> layout;
+    
+    PT_LAYOUT_TYPES(PT_HOST_SIZE)
+    PT_LAYOUT_MEMBERS(PT_HOST_OFFSET)
+    
+    return layout;
+}
+
+#undef PT_HOST_SIZE
+#undef PT_HOST_OFFSET
 
 cl_pinhole_cam cl_make_pinhole_cam(const pt::PinholeCamera<float>& cam)
 {
-    cl_pinhole_cam cl_cam;
+    cl_pinhole_cam cl_cam = cl_pinhole_cam();
+    
+    memcpy(&cl_cam.origin, glm::value_ptr(cam.getOrigin()), 3 * sizeof(float));
+    memcpy(&cl_cam.lower_left, glm::value_ptr(cam.getLowerLeft()), 3 * sizeof(float));
+    memcpy(&cl_cam.hor, glm::value_ptr(cam.getHor()), 3 * sizeof(float));
+    memcpy(&cl_cam.ver, glm::value_ptr(cam.getVer()), 3 * sizeof(float));
+    
+    return cl_cam;
+}
+
+cl_pinhole_cam cl_make_pinhole_cam(const glm::vec3& origin,
+                                   const glm::vec3& lower_left,
+                                   const glm::vec3& hor,
+                                   const glm::vec3& ver)
+{
+    cl_pinhole_cam cl_cam = cl_pinhole_cam();
+    
+    memcpy(&cl_cam.origin, glm::value_ptr(origin), 3 * sizeof(float));
+    memcpy(&cl_cam.lower_left, glm::value_ptr(lower_left), 3 * sizeof(float));
+    memcpy(&cl_cam.hor, glm::value_ptr(hor), 3 * sizeof(float));
+    memcpy(&cl_cam.ver, glm::value_ptr(ver), 3 * sizeof(float));
+    
+    return cl_cam;
+}
+
+/* Depth of field on the device, thin_lens_cam_ray gives the rays of cam.getRay */
+cl_camera cl_make_lens_cam(const pt::LensCamera<float>& cam)
+{
+    cl_camera cl_cam = cl_camera();
     
     memcpy(&cl_cam.origin, glm::value_ptr(cam.getOrigin()), 3 * sizeof(float));
     memcpy(&cl_cam.lower_left, glm::value_ptr(cam.getLowerLeft()), 3 * sizeof(float));
     memcpy(&cl_cam.hor, glm::value_ptr(cam.getHor()), 3 * sizeof(float));
     memcpy(&cl_cam.ver, glm::value_ptr(cam.getVer()), 3 * sizeof(float));
+    memcpy(&cl_cam.u, glm::value_ptr(cam.getU()), 3 * sizeof(float));
+    memcpy(&cl_cam.v, glm::value_ptr(cam.getV()), 3 * sizeof(float));
+    memcpy(&cl_cam.w, glm::value_ptr(cam.getW()), 3 * sizeof(float));
+    cl_cam.lens_radius = cam.getLensRadius();
+    cl_cam.type = CAM_THIN_LENS;
     
     return cl_cam;
 }
 
-typedef struct cl_ray
+/*
+ * Equirectangular panorama around eye, looking at lookat in the middle of the image:
+ * longitudedeg across the width and latitudedeg across the height, 360 x 180 for a full sphere
+ */
+cl_camera cl_make_equirect_cam(const glm::vec3& eye,
+                               const glm::vec3& lookat,
+                               const glm::vec3& up,
+                               float longitudedeg = 360.0f,
+                               float latitudedeg = 180.0f)
 {
-    cl_float3 origin;
-    cl_float3 dir;
-} cl_ray;
+    cl_camera cl_cam = cl_camera();
+    
+    glm::vec3 w = glm::normalize(eye - lookat);
+    glm::vec3 u = glm::normalize(glm::cross(up, w));
+    glm::vec3 v = glm::cross(w, u);
+    
+    memcpy(&cl_cam.origin, glm::value_ptr(eye), 3 * sizeof(float));
+    memcpy(&cl_cam.u, glm::value_ptr(u), 3 * sizeof(float));
+    memcpy(&cl_cam.v, glm::value_ptr(v), 3 * sizeof(float));
+    memcpy(&cl_cam.w, glm::value_ptr(w), 3 * sizeof(float));
+    cl_cam.longitude = longitudedeg * (float)M_PI / 180.0f;
+    cl_cam.latitude = latitudedeg * (float)M_PI / 180.0f;
+    cl_cam.type = CAM_EQUIRECT;
+    
+    return cl_cam;
+}
 
 /*
  * This takes half the memory of the "naive" implementation with cl_float3 and cl_float
  * size is 16 bytes here
  */
-typedef cl_float4 cl_sphere; // (center.x, center.y, center.z, radius)
+typedef pt::device::Sphere cl_sphere; // (center.x, center.y, center.z, radius)
 
 inline void pack_cl_sphere(const pt::fSphereRef& sphere, cl_sphere& out_sphere)
 {
@@ -103,22 +182,6 @@ inline void pack_cl_sphere(const pt::fSphereRef& sphere, cl_sphere& out_sphere)
 
 typedef cl_float4 cl_color;
 
-#define MAT_LAMBERTIAN 1
-#define MAT_DIALECTRIC 2
-#define MAT_METALLIC 3
-
-typedef struct cl_material
-{
-    cl_color albedo; //alpha channel used for extra scalar param with value being type dependent
-    cl_char  type;
-} cl_material;
-
-typedef struct cl_sky_material
-{
-    cl_float3 bottom;
-    cl_float3 top;
-} cl_sky_material;
-
 cl_int cl_set_skycolors(const glm::vec3& sky_bottom,
                         const glm::vec3& sky_top,
                         cl::Buffer& sky_buffer,
@@ -138,15 +201,98 @@ cl_sphere cl_make_sphere(const glm::vec3& center, const float& radius)
     return sp;
 }
 
-cl_material cl_make_material(const glm::vec3& color, const float& scalar_param_1, char type)
+typedef pt::device::PackedRay cl_packed_ray;
+typedef pt::device::PackedHit cl_packed_hit;
+
+/*
+ * Host side of packing.cl, same arithmetic so both sides produce the same bits
+ */
+cl_uint cl_oct_encode(glm::vec3 n)
+{
+    n /= fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    
+    glm::vec2 p(n.x, n.y);
+    
+    if (n.z < 0.0f)
+    {
+        p = glm::vec2((1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                      (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    
+    cl_int qx = (cl_int)nearbyintf(std::min(1.0f, std::max(-1.0f, p.x)) * 32767.0f);
+    cl_int qy = (cl_int)nearbyintf(std::min(1.0f, std::max(-1.0f, p.y)) * 32767.0f);
+    
+    return ((cl_uint)qx & 0xffffu) | (((cl_uint)qy & 0xffffu) << 16);
+}
+
+glm::vec3 cl_oct_decode(cl_uint e)
 {
-    cl_material mat;
+    glm::vec2 p((float)(cl_short)(e & 0xffffu) * (1.0f / 32767.0f), (float)(cl_short)(e >> 16) * (1.0f / 32767.0f));
+    
+    glm::vec3 n(p.x, p.y, 1.0f - fabsf(p.x) - fabsf(p.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += (n.x >= 0.0f) ? -t : t;
+    n.y += (n.y >= 0.0f) ? -t : t;
+    
+    return glm::normalize(n);
+}
+
+cl_packed_ray cl_pack_ray(const glm::vec3& origin, const glm::vec3& dir)
+{
+    cl_packed_ray packed;
+    packed.ox = origin.x;
+    packed.oy = origin.y;
+    packed.oz = origin.z;
+    packed.dir = cl_oct_encode(dir);
+    return packed;
+}
+
+void cl_unpack_ray(const cl_packed_ray& packed, glm::vec3& out_origin, glm::vec3& out_dir)
+{
+    out_origin = glm::vec3(packed.ox, packed.oy, packed.oz);
+    out_dir = cl_oct_decode(packed.dir);
+}
+
+cl_packed_hit cl_pack_hit(float t, cl_uint prim, const glm::vec3& normal)
+{
+    cl_packed_hit packed;
+    packed.t = t;
+    packed.prim = prim;
+    packed.normal = cl_oct_encode(normal);
+    packed.pad = 0;
+    return packed;
+}
+
+cl_material cl_make_material(const glm::vec3& color, const float& scalar_param_1, cl_int type)
+{
+    cl_material mat = {};
     memcpy(&mat, glm::value_ptr(color), 3 * sizeof(float));
     mat.albedo.s[3] = scalar_param_1;
     mat.type = type;
     return mat;
 }
 
+/*
+ * Device record of a CPU material, albedo.w is the fuzz of metals and the refraction index of dielectrics,
+ * albedo.rgb the emission of emissive materials
+ */
+cl_material cl_make_material(const pt::fMaterialRef& material)
+{
+    if (const pt::Lambertian<float>* lambertian = dynamic_cast<const pt::Lambertian<float>*>(material.get()))
+        return cl_make_material(lambertian->getAlbedo(), 0, MAT_LAMBERTIAN);
+    
+    if (const pt::Metallic<float>* metallic = dynamic_cast<const pt::Metallic<float>*>(material.get()))
+        return cl_make_material(metallic->getAlbedo(), metallic->getFuzz(), MAT_METALLIC);
+    
+    if (const pt::Dialectric<float>* dialectric = dynamic_cast<const pt::Dialectric<float>*>(material.get()))
+        return cl_make_material(glm::vec3(1.0f), dialectric->getRefractionIndex(), MAT_DIALECTRIC);
+    
+    if (const pt::Emissive<float>* emissive = dynamic_cast<const pt::Emissive<float>*>(material.get()))
+        return cl_make_material(emissive->getEmission(), 0, MAT_EMISSIVE);
+    
+    throw "Material has no device counterpart";
+}
+
 //cl_int cl_set_sphere_and_material_list(const std::vector<pt::fSphereRef>& primitives,
 //                                       const std::vector<pt::fLambertianRef>& materials,
 //                                       cl::Buffer& primitives_buffer,
@@ -194,12 +340,7 @@ cl_int cl_set_pinhole_cam_arg(const glm::vec3& origin,
                               cl::Buffer& cam_buffer,
                               const cl::CommandQueue& cmd_queue)
 {
-    cl_pinhole_cam cl_cam;
-    
-    memcpy(&cl_cam.origin, glm::value_ptr(origin), 3 * sizeof(float));
-    memcpy(&cl_cam.lower_left, glm::value_ptr(lower_left), 3 * sizeof(float));
-    memcpy(&cl_cam.hor, glm::value_ptr(hor), 3 * sizeof(float));
-    memcpy(&cl_cam.ver, glm::value_ptr(ver), 3 * sizeof(float));
+    cl_pinhole_cam cl_cam = cl_make_pinhole_cam(origin, lower_left, hor, ver);
     
     return cmd_queue.enqueueWriteBuffer(cam_buffer, CL_TRUE, 0, sizeof(cl_pinhole_cam), &cl_cam, NULL, NULL);
 }
@@ -208,14 +349,490 @@ cl_int cl_set_pinhole_cam_arg(const pt::PinholeCamera<float>& cam,
                               cl::Buffer& cam_buffer,
                               const cl::CommandQueue& cmd_queue)
 {
-    cl_pinhole_cam cl_cam;
+    cl_pinhole_cam cl_cam = cl_make_pinhole_cam(cam);
     
-    memcpy(&cl_cam.origin, glm::value_ptr(cam.getOrigin()), 3 * sizeof(float));
-    memcpy(&cl_cam.lower_left, glm::value_ptr(cam.getLowerLeft()), 3 * sizeof(float));
-    memcpy(&cl_cam.hor, glm::value_ptr(cam.getHor()), 3 * sizeof(float));
-    memcpy(&cl_cam.ver, glm::value_ptr(cam.getVer()), 3 * sizeof(float));
+    return cmd_queue.enqueueWriteBuffer(cam_buffer, CL_TRUE, 0, sizeof(cl_pinhole_cam), &cl_cam, NULL, NULL);
+}
+
+cl_int cl_set_camera_arg(const cl_camera& camera,
+                         cl::Buffer& cam_buffer,
+                         const cl::CommandQueue& cmd_queue)
+{
+    return cmd_queue.enqueueWriteBuffer(cam_buffer, CL_TRUE, 0, sizeof(cl_camera), &camera, NULL, NULL);
+}
+
+bool cl_camera_equal(const cl_camera& a, const cl_camera& b)
+{
+    const cl_float3* va[] = { &a.origin, &a.lower_left, &a.hor, &a.ver, &a.u, &a.v, &a.w };
+    const cl_float3* vb[] = { &b.origin, &b.lower_left, &b.hor, &b.ver, &b.u, &b.v, &b.w };
+    
+    for (int v = 0; v < 7; ++v)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            if (va[v]->s[c] != vb[v]->s[c]) return false;
+        }
+    }
+    
+    return a.type == b.type && a.lens_radius == b.lens_radius && a.longitude == b.longitude && a.latitude == b.latitude;
+}
+
+/*
+ * HDR accumulation buffer of path_tracing_accumulate, one float4 per pixel:
+ * mean radiance in xyz, number of samples in w. camera is the one the samples were taken with.
+ */
+typedef struct cl_accumulation
+{
+    cl::Buffer      buffer;
+    size_t          pixel_count;
+    cl_camera       camera;
+    bool            has_camera;
+} cl_accumulation;
+
+cl_int cl_reset_accumulation(cl_accumulation& accumulation,
+                             const cl::CommandQueue& cmd_queue,
+                             const std::vector<cl::Event>* wait_events = NULL,
+                             cl::Event* event = NULL)
+{
+    cl_float4 zero = {{ 0.0f, 0.0f, 0.0f, 0.0f }};
+    return cmd_queue.enqueueFillBuffer(accumulation.buffer, zero, 0, accumulation.pixel_count * sizeof(cl_float4), wait_events, event);
+}
+
+cl_int cl_make_accumulation(cl::Context& context,
+                            size_t pixel_count,
+                            const cl::CommandQueue& cmd_queue,
+                            cl_accumulation& out_accumulation)
+{
+    cl_int clStatus;
+    
+    out_accumulation.buffer = cl::Buffer(context, CL_MEM_READ_WRITE, pixel_count * sizeof(cl_float4), NULL, &clStatus);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    
+    out_accumulation.pixel_count = pixel_count;
+    out_accumulation.has_camera = false;
+    
+    return cl_reset_accumulation(out_accumulation, cmd_queue);
+}
+
+/*
+ * Debug counter buffer of kernels built with -D PT_COUNTERS (counters.cl),
+ * two cl_uint per counter of pt_counters.h, low word first. Zero it between the runs to count.
+ */
+cl_int cl_make_counters(cl::Context& context,
+                        const cl::CommandQueue& cmd_queue,
+                        cl::Buffer& out_counters)
+{
+    cl_int clStatus;
+    
+    out_counters = cl::Buffer(context, CL_MEM_READ_WRITE, 2 * PT_COUNTER_COUNT * sizeof(cl_uint), NULL, &clStatus);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    
+    return cmd_queue.enqueueFillBuffer(out_counters, (cl_uint)0, 0, 2 * PT_COUNTER_COUNT * sizeof(cl_uint));
+}
+
+cl_int cl_read_counters(const cl::CommandQueue& cmd_queue,
+                        const cl::Buffer& counters,
+                        pt::CounterTotals& out_totals)
+{
+    cl_uint words[2 * PT_COUNTER_COUNT];
+    
+    cl_int clStatus = cmd_queue.enqueueReadBuffer(counters, CL_TRUE, 0, sizeof(words), words);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    
+    for (int i = 0; i < PT_COUNTER_COUNT; ++i)
+        out_totals.count[i] = (uint64_t)words[2 * i] | ((uint64_t)words[2 * i + 1] << 32);
+    
+    return CL_SUCCESS;
+}
+
+/*
+ * Restarts the accumulation when camera differs from the one its samples were taken with,
+ * returns whether it did in reset. The fill is enqueued on cmd_queue, before the next accumulate kernel.
+ */
+cl_int cl_update_accumulation_camera(cl_accumulation& accumulation,
+                                     const cl_camera& camera,
+                                     const cl::CommandQueue& cmd_queue,
+                                     bool* reset = NULL)
+{
+    bool changed = !accumulation.has_camera || !cl_camera_equal(accumulation.camera, camera);
+    if (reset) *reset = changed;
+    if (!changed) return CL_SUCCESS;
+    
+    accumulation.camera = camera;
+    accumulation.has_camera = true;
+    
+    return cl_reset_accumulation(accumulation, cmd_queue);
+}
+
+/* Uploads the camera and restarts the accumulation if the camera moved */
+cl_int cl_set_pinhole_cam_arg(const pt::PinholeCamera<float>& cam,
+                              cl::Buffer& cam_buffer,
+                              cl_accumulation& accumulation,
+                              const cl::CommandQueue& cmd_queue,
+                              bool* reset = NULL)
+{
+    cl_pinhole_cam cl_cam = cl_make_pinhole_cam(cam);
+    
+    cl_int clStatus = cl_update_accumulation_camera(accumulation, cl_cam, cmd_queue, reset);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    
+    return cmd_queue.enqueueWriteBuffer(cam_buffer, CL_TRUE, 0, sizeof(cl_pinhole_cam), &cl_cam, NULL, NULL);
+}
+
+cl_int cl_set_pinhole_cam_arg(const glm::vec3& origin,
+                              const glm::vec3& lower_left,
+                              const glm::vec3& hor,
+                              const glm::vec3& ver,
+                              cl::Buffer& cam_buffer,
+                              cl_accumulation& accumulation,
+                              const cl::CommandQueue& cmd_queue,
+                              bool* reset = NULL)
+{
+    cl_pinhole_cam cl_cam = cl_make_pinhole_cam(origin, lower_left, hor, ver);
+    
+    cl_int clStatus = cl_update_accumulation_camera(accumulation, cl_cam, cmd_queue, reset);
+    if (clStatus != CL_SUCCESS) return clStatus;
     
     return cmd_queue.enqueueWriteBuffer(cam_buffer, CL_TRUE, 0, sizeof(cl_pinhole_cam), &cl_cam, NULL, NULL);
 }
 
+/* Any camera record, e.g. cl_make_lens_cam or cl_make_equirect_cam */
+cl_int cl_set_camera_arg(const cl_camera& camera,
+                         cl::Buffer& cam_buffer,
+                         cl_accumulation& accumulation,
+                         const cl::CommandQueue& cmd_queue,
+                         bool* reset = NULL)
+{
+    cl_int clStatus = cl_update_accumulation_camera(accumulation, camera, cmd_queue, reset);
+    if (clStatus != CL_SUCCESS) return clStatus;
+
+    return cmd_queue.enqueueWriteBuffer(cam_buffer, CL_TRUE, 0, sizeof(cl_camera), &camera, NULL, NULL);
+}
+
+/* Arguments of tonemap_buffer / tonemap_image except the output (1) */
+cl_int cl_set_tonemap_args(cl::Kernel& tonemap_kernel,
+                           cl_accumulation& accumulation,
+                           cl_uint width,
+                           cl_uint height,
+                           float exposure = 1.0f,
+                           float gamma = 2.2f,
+                           cl_uint op = TONEMAP_ACES)
+{
+    cl_int clStatus = tonemap_kernel.setArg(0, accumulation.buffer);
+    clStatus |= tonemap_kernel.setArg(2, width);
+    clStatus |= tonemap_kernel.setArg(3, height);
+    clStatus |= tonemap_kernel.setArg(4, exposure);
+    clStatus |= tonemap_kernel.setArg(5, 1.0f / gamma);
+    clStatus |= tonemap_kernel.setArg(6, op);
+    
+    return (clStatus != CL_SUCCESS) ? CL_INVALID_KERNEL_ARGS : CL_SUCCESS;
+}
+
+/*
+ * Multi-block scan of n ints in place with the kernels of hillis_steele_scan.cl,
+ * inclusive or exclusive depending on how the program was built.
+ * Blocks are scanned and their sums scanned recursively, one block_sums buffer per level
+ * is allocated on first use and reused afterwards. data must hold n rounded up to block_size ints.
+ */
+cl_int cl_scan(cl::Context& context,
+               cl::CommandQueue& cmd_queue,
+               cl::Kernel& scan_sum_kernel,
+               cl::Kernel& add_block_sums_kernel,
+               cl::Buffer& data,
+               size_t n,
+               size_t block_size,
+               std::vector<cl::Buffer>& block_sums,
+               size_t level = 0)
+{
+    cl_int clStatus;
+    
+    size_t padded_size = ((n + block_size - 1) / block_size) * block_size;
+    size_t block_count = padded_size / block_size;
+    size_t padded_block_count = ((block_count + block_size - 1) / block_size) * block_size;
+    
+    if (block_sums.size() <= level) block_sums.resize(level + 1);
+    
+    if (block_sums[level]() == NULL || block_sums[level].getInfo<CL_MEM_SIZE>() < padded_block_count * sizeof(cl_int))
+    {
+        block_sums[level] = cl::Buffer(context, CL_MEM_READ_WRITE, padded_block_count * sizeof(cl_int), NULL, &clStatus);
+        if (clStatus != CL_SUCCESS) return clStatus;
+    }
+    
+    clStatus = scan_sum_kernel.setArg(0, data);
+    clStatus |= scan_sum_kernel.setArg(1, block_sums[level]);
+    clStatus |= scan_sum_kernel.setArg(2, block_size * sizeof(cl_int), NULL);
+    if (clStatus != CL_SUCCESS) return CL_INVALID_KERNEL_ARGS;
+    
+    clStatus = cmd_queue.enqueueNDRangeKernel(scan_sum_kernel, cl::NDRange(0), cl::NDRange(padded_size), cl::NDRange(block_size));
+    if (clStatus != CL_SUCCESS || block_count == 1) return clStatus;
+    
+    clStatus = cl_scan(context, cmd_queue, scan_sum_kernel, add_block_sums_kernel, block_sums[level], block_count, block_size, block_sums, level + 1);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    
+    clStatus = add_block_sums_kernel.setArg(0, data);
+    clStatus |= add_block_sums_kernel.setArg(1, block_sums[level]);
+    if (clStatus != CL_SUCCESS) return CL_INVALID_KERNEL_ARGS;
+    
+    return cmd_queue.enqueueNDRangeKernel(add_block_sums_kernel, cl::NDRange(0), cl::NDRange(padded_size), cl::NDRange(block_size));
+}
+
+/*
+ * Rebuilds the list of active pixels of adaptive_sampling.cl:
+ * flag the pixels above threshold, scan the flags and compact the indices of the flagged ones
+ * flags must hold pixel_count rounded up to block_size ints. Returns the number of active pixels
+ */
+cl_uint cl_compact_active_pixels(cl::Context& context,
+                                 cl::CommandQueue& cmd_queue,
+                                 cl::Kernel& flag_kernel,
+                                 cl::Kernel& compact_kernel,
+                                 cl::Kernel& scan_sum_kernel,
+                                 cl::Kernel& add_block_sums_kernel,
+                                 cl::Buffer& stats,
+                                 cl::Buffer& sample_count,
+                                 cl::Buffer& flags,
+                                 cl::Buffer& active_pixels,
+                                 std::vector<cl::Buffer>& block_sums,
+                                 cl_uint pixel_count,
+                                 cl_float threshold,
+                                 size_t block_size)
+{
+    cl_int clStatus;
+    size_t padded_size = ((pixel_count + block_size - 1) / block_size) * block_size;
+    
+    cl_uint arg = 0;
+    PTCL_SAFE_SET_ARG("Could not set stats argument", flag_kernel, arg++, stats)
+    PTCL_SAFE_SET_ARG("Could not set sample count argument", flag_kernel, arg++, sample_count)
+    PTCL_SAFE_SET_ARG("Could not set flags argument", flag_kernel, arg++, flags)
+    PTCL_SAFE_SET_ARG("Could not set pixel count argument", flag_kernel, arg++, pixel_count)
+    PTCL_SAFE_SET_ARG("Could not set threshold argument", flag_kernel, arg++, threshold)
+    
+    clStatus = cmd_queue.enqueueNDRangeKernel(flag_kernel, cl::NDRange(0), cl::NDRange(padded_size), cl::NDRange(block_size));
+    PTCL_ASSERT(clStatus, "Could not enqueue flag kernel")
+    
+    clStatus = cl_scan(context, cmd_queue, scan_sum_kernel, add_block_sums_kernel, flags, pixel_count, block_size, block_sums);
+    PTCL_ASSERT(clStatus, "Could not scan flags")
+    
+    arg = 0;
+    PTCL_SAFE_SET_ARG("Could not set stats argument", compact_kernel, arg++, stats)
+    PTCL_SAFE_SET_ARG("Could not set sample count argument", compact_kernel, arg++, sample_count)
+    PTCL_SAFE_SET_ARG("Could not set scan argument", compact_kernel, arg++, flags)
+    PTCL_SAFE_SET_ARG("Could not set active pixels argument", compact_kernel, arg++, active_pixels)
+    PTCL_SAFE_SET_ARG("Could not set pixel count argument", compact_kernel, arg++, pixel_count)
+    PTCL_SAFE_SET_ARG("Could not set threshold argument", compact_kernel, arg++, threshold)
+    
+    clStatus = cmd_queue.enqueueNDRangeKernel(compact_kernel, cl::NDRange(0), cl::NDRange(padded_size), cl::NDRange(block_size));
+    PTCL_ASSERT(clStatus, "Could not enqueue compact kernel")
+    
+    /* inclusive scan, the last element is the number of active pixels */
+    cl_int active_count = 0;
+    PTCL_SAFE_OP("Could not read active pixel count", enqueueReadBuffer, cmd_queue, flags, CL_TRUE, (pixel_count - 1) * sizeof(cl_int), sizeof(cl_int), &active_count)
+    
+    return (cl_uint)active_count;
+}
+
+/*
+ * Host side of adaptive_sampling.cl, same schedule as render_frame_adaptive:
+ * a pass of samples / 2 over all pixels, then passes of samples / 4 over the compacted active pixels
+ * Reads back mean color and m2 per pixel in out_stats, returns the number of samples taken
+ */
+size_t cl_render_adaptive(const cl::Device& device,
+                          cl::Context& context,
+                          cl::CommandQueue& cmd_queue,
+                          cl::Program& adaptive_program,
+                          cl::Program& scan_program,
+                          cl::Buffer& cam_buffer,
+                          cl::Buffer& primitive_buffer,
+                          cl::Buffer& material_buffer,
+                          cl::Buffer& sky_buffer,
+                          cl_uint object_count,
+                          cl_uint width,
+                          cl_uint height,
+                          cl_uint samples,
+                          cl_float threshold,
+                          cl_uint seed,
+                          std::vector<cl_float4>& out_stats)
+{
+    cl_int clStatus;
+    
+    cl::Kernel trace_kernel(adaptive_program, "adaptive_path_tracing", &clStatus);
+    PTCL_ASSERT(clStatus, "Could not create adaptive path tracing kernel")
+    cl::Kernel flag_kernel(adaptive_program, "adaptive_flag", &clStatus);
+    PTCL_ASSERT(clStatus, "Could not create flag kernel")
+    cl::Kernel compact_kernel(adaptive_program, "adaptive_compact", &clStatus);
+    PTCL_ASSERT(clStatus, "Could not create compact kernel")
+    cl::Kernel scan_sum_kernel(scan_program, "hillis_steele_scan_sum", &clStatus);
+    PTCL_ASSERT(clStatus, "Could not create scan kernel")
+    cl::Kernel add_block_sums_kernel(scan_program, "hillis_steele_add_block_sums", &clStatus);
+    PTCL_ASSERT(clStatus, "Could not create add block sums kernel")
+    
+    size_t block_size = std::min(trace_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+                                 scan_sum_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+    
+    cl_uint pixel_count = width * height;
+    size_t padded_size = ((pixel_count + block_size - 1) / block_size) * block_size;
+    
+    cl::Buffer stats(context, CL_MEM_READ_WRITE, pixel_count * sizeof(cl_float4), NULL, &clStatus);
+    PTCL_ASSERT(clStatus, "Could not create stats buffer")
+    cl::Buffer sample_count(context, CL_MEM_READ_WRITE, pixel_count * sizeof(cl_uint), NULL, &clStatus);
+    PTCL_ASSERT(clStatus, "Could not create sample count buffer")
+    cl::Buffer flags(context, CL_MEM_READ_WRITE, padded_size * sizeof(cl_int), NULL, &clStatus);
+    PTCL_ASSERT(clStatus, "Could not create flags buffer")
+    cl::Buffer active_pixels(context, CL_MEM_READ_WRITE, pixel_count * sizeof(cl_uint), NULL, &clStatus);
+    PTCL_ASSERT(clStatus, "Could not create active pixels buffer")
+    std::vector<cl::Buffer> block_sums;
+    
+    /* every pixel is active in the first pass */
+    std::vector<cl_float4> zero_stats(pixel_count);
+    std::vector<cl_uint> indices(pixel_count);
+    memset(zero_stats.data(), 0, pixel_count * sizeof(cl_float4));
+    for (cl_uint i = 0; i < pixel_count; ++i) indices[i] = i;
+    
+    PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write stats buffer error.", cmd_queue, stats, CL_TRUE, 0, pixel_count * sizeof(cl_float4), zero_stats.data(), NULL, NULL)
+    PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write sample count buffer error.", cmd_queue, sample_count, CL_TRUE, 0, pixel_count * sizeof(cl_uint), zero_stats.data(), NULL, NULL)
+    PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write active pixels buffer error.", cmd_queue, active_pixels, CL_TRUE, 0, pixel_count * sizeof(cl_uint), indices.data(), NULL, NULL)
+    
+    cl_uint arg = 0;
+    PTCL_SAFE_SET_ARG("Could not set camera argument", trace_kernel, arg++, cam_buffer)
+    PTCL_SAFE_SET_ARG("Could not set primitive argument", trace_kernel, arg++, primitive_buffer)
+    PTCL_SAFE_SET_ARG("Could not set material argument", trace_kernel, arg++, material_buffer)
+    PTCL_SAFE_SET_ARG("Could not set sky argument", trace_kernel, arg++, sky_buffer)
+    PTCL_SAFE_SET_ARG("Could not set object count argument", trace_kernel, arg++, object_count)
+    PTCL_SAFE_SET_ARG("Could not set active pixels argument", trace_kernel, arg++, active_pixels)
+    cl_uint active_count_arg = arg++;
+    PTCL_SAFE_SET_ARG("Could not set stats argument", trace_kernel, arg++, stats)
+    PTCL_SAFE_SET_ARG("Could not set sample count argument", trace_kernel, arg++, sample_count)
+    PTCL_SAFE_SET_ARG("Could not set width argument", trace_kernel, arg++, width)
+    PTCL_SAFE_SET_ARG("Could not set height argument", trace_kernel, arg++, height)
+    cl_uint samples_arg = arg++;
+    PTCL_SAFE_SET_ARG("Could not set seed argument", trace_kernel, arg++, seed)
+    
+    size_t budget = (size_t)samples * pixel_count;
+    size_t spent = 0;
+    cl_uint first_samples = std::max(2u, samples / 2);
+    cl_uint pass_samples = std::max(1u, samples / 4);
+    cl_uint active_count = pixel_count;
+    
+    while (active_count > 0)
+    {
+        cl_uint pass = (cl_uint)std::min((size_t)(spent ? pass_samples : first_samples), (budget - spent) / active_count);
+        if (pass == 0) break;
+        
+        PTCL_SAFE_SET_ARG("Could not set active count argument", trace_kernel, active_count_arg, active_count)
+        PTCL_SAFE_SET_ARG("Could not set samples argument", trace_kernel, samples_arg, pass)
+        
+        clStatus = cmd_queue.enqueueNDRangeKernel(trace_kernel,
+                                                  cl::NDRange(0),
+                                                  cl::NDRange(((active_count + block_size - 1) / block_size) * block_size),
+                                                  cl::NDRange(block_size));
+        PTCL_ASSERT(clStatus, "Could not enqueue adaptive path tracing kernel")
+        
+        spent += (size_t)pass * active_count;
+        
+        active_count = cl_compact_active_pixels(context, cmd_queue, flag_kernel, compact_kernel, scan_sum_kernel, add_block_sums_kernel,
+                                                stats, sample_count, flags, active_pixels, block_sums, pixel_count, threshold, block_size);
+        
+        /* everything converged with budget left: tighten the threshold and go on with the noisiest pixels */
+        while (active_count == 0 && spent + pixel_count / 16 < budget && threshold > 1e-6f)
+        {
+            threshold *= 0.5f;
+            active_count = cl_compact_active_pixels(context, cmd_queue, flag_kernel, compact_kernel, scan_sum_kernel, add_block_sums_kernel,
+                                                    stats, sample_count, flags, active_pixels, block_sums, pixel_count, threshold, block_size);
+        }
+    }
+    
+    out_stats.resize(pixel_count);
+    PTCL_SAFE_OP("Could not read stats buffer", enqueueReadBuffer, cmd_queue, stats, CL_TRUE, 0, pixel_count * sizeof(cl_float4), out_stats.data())
+    
+    return spent;
+}
+
+/*
+ * Operation of reduce_complete.cl, selected when the program is built (see cl_reduce_build_options)
+ */
+typedef enum cl_reduce_op
+{
+    CL_REDUCE_SUM,
+    CL_REDUCE_MIN,
+    CL_REDUCE_MAX,
+    CL_REDUCE_MEAN, // sum kernel, the second pass scales by 1 / n
+} cl_reduce_op;
+
+std::string cl_reduce_build_options(cl_reduce_op op, size_t group_size)
+{
+    std::ostringstream options;
+    options << "-D REDUCE_GROUP_SIZE=" << group_size << " -D REDUCE_OP=";
+    
+    switch (op)
+    {
+        case CL_REDUCE_MIN: options << "REDUCE_MIN"; break;
+        case CL_REDUCE_MAX: options << "REDUCE_MAX"; break;
+        default: options << "REDUCE_SUM"; break;
+    }
+    
+    return options.str();
+}
+
+/*
+ * Reduces n floats of data to one float in result on the device with the reduce_complete kernel,
+ * built with cl_reduce_build_options for op and group_size.
+ * The first pass runs groups work groups, each reads as many float4 as needed and writes one partial,
+ * the second pass reduces the partials with one group. partials is allocated on first use and reused.
+ * Both launches are returned in events when not NULL, for timing.
+ */
+cl_int cl_reduce(cl::Context& context,
+                 cl::CommandQueue& cmd_queue,
+                 cl::Kernel& reduce_kernel,
+                 cl_reduce_op op,
+                 cl::Buffer& data,
+                 size_t n,
+                 size_t group_size,
+                 size_t groups,
+                 cl::Buffer& partials,
+                 cl::Buffer& result,
+                 std::vector<cl::Event>* events = NULL)
+{
+    cl_int clStatus;
+    
+    /* no point in more groups than float4 to read */
+    groups = std::max<size_t>(1, std::min(groups, (n / 4 + group_size - 1) / group_size));
+    
+    /* read as float4 by the second pass */
+    size_t partials_size = ((groups + 3) / 4) * 4 * sizeof(cl_float);
+    
+    if (partials() == NULL || partials.getInfo<CL_MEM_SIZE>() < partials_size)
+    {
+        partials = cl::Buffer(context, CL_MEM_READ_WRITE, partials_size, NULL, &clStatus);
+        if (clStatus != CL_SUCCESS) return clStatus;
+    }
+    
+    cl::Event first, second;
+    
+    clStatus = reduce_kernel.setArg(0, data);
+    clStatus |= reduce_kernel.setArg(1, (cl_uint)n);
+    clStatus |= reduce_kernel.setArg(2, partials);
+    clStatus |= reduce_kernel.setArg(3, 1.0f);
+    if (clStatus != CL_SUCCESS) return CL_INVALID_KERNEL_ARGS;
+    
+    clStatus = cmd_queue.enqueueNDRangeKernel(reduce_kernel, cl::NDRange(0), cl::NDRange(groups * group_size), cl::NDRange(group_size), NULL, &first);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    
+    clStatus = reduce_kernel.setArg(0, partials);
+    clStatus |= reduce_kernel.setArg(1, (cl_uint)groups);
+    clStatus |= reduce_kernel.setArg(2, result);
+    clStatus |= reduce_kernel.setArg(3, (op == CL_REDUCE_MEAN) ? (cl_float)(1.0 / (double)n) : 1.0f);
+    if (clStatus != CL_SUCCESS) return CL_INVALID_KERNEL_ARGS;
+    
+    clStatus = cmd_queue.enqueueNDRangeKernel(reduce_kernel, cl::NDRange(0), cl::NDRange(group_size), cl::NDRange(group_size), NULL, &second);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    
+    if (events)
+    {
+        events->clear();
+        events->push_back(first);
+        events->push_back(second);
+    }
+    
+    return CL_SUCCESS;
+}
+
 #endif /* ptCL_h */
@@ -0,0 +1,375 @@
+#ifndef ptCLAutotuner_h
+#define ptCLAutotuner_h
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#include "../include/cl.hpp"
+#else
+#include <CL/cl.h>
+#include <CL/cl.hpp>
+#endif
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+
+namespace pt
+{
+    /*
+     * Picks the local size of a kernel launch by timing the candidates on the device
+     *
+     * Candidates are powers of two from CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE up to
+     * CL_KERNEL_WORK_GROUP_SIZE, split in every w x h shape for 2D launches, which divide the global size
+     * (or any size when the kernel discards the padding and padGlobal is set). Each is launched a few times
+     * after a warm up, the lowest median wins. The driver's own choice (NullRange) is timed as well for reference.
+     *
+     * Winners are kept per device, program (source or binary, and build options), kernel and global size,
+     * in memory and in a text file next to the program binary cache, so the tuning runs once per machine
+     * and again whenever the kernel or its options change. Launches where every candidate failed are not kept.
+     */
+    class CLAutotuner
+    {
+    public:
+        /* Sets the arguments depending on the local size (__local buffers) before the candidate is launched */
+        typedef std::function<cl_int(cl::Kernel& kernel, const cl::NDRange& local)> Configure;
+
+        struct Result
+        {
+            Result() : x(0), y(0), best_ms(0), worst_ms(0), driver_ms(0), candidates(0) {}
+
+            size_t x;               // 0 when the driver's choice won
+            size_t y;               // 0 for 1D launches
+            double best_ms;
+            double worst_ms;
+            double driver_ms;       // NullRange, 0 if not measured
+            size_t candidates;
+
+            cl::NDRange local() const
+            {
+                if (x == 0) return cl::NullRange;
+                return (y == 0) ? cl::NDRange(x) : cl::NDRange(x, y);
+            }
+        };
+
+        /* cache_path empty to keep the results in memory only */
+        CLAutotuner(const cl::Device& _device, const cl::CommandQueue& _queue, const std::string& _cache_path)
+        : device(_device), queue(_queue), cache_path(_cache_path), repeats(5)
+        {
+            device_key = device.getInfo<CL_DEVICE_NAME>() + "|" + device.getInfo<CL_DEVICE_VERSION>() + "|" + device.getInfo<CL_DRIVER_VERSION>();
+            std::replace(device_key.begin(), device_key.end(), '\t', ' ');
+            load();
+        }
+
+        /* Timed launches per candidate, after one warm up */
+        void setRepeats(size_t _repeats) { repeats = std::max<size_t>(1, _repeats); }
+
+        /*
+         * Best local size for this launch, tuned now if it is not in the cache
+         * The queue must have profiling enabled. The kernel arguments must be set, except for those set by configure,
+         * the launches write to the kernel's buffers.
+         */
+        cl::NDRange localSize(cl::Kernel& kernel,
+                              const cl::NDRange& global,
+                              const Configure& configure = Configure(),
+                              bool padGlobal = false)
+        {
+            std::string key = launchKey(kernel, global);
+
+            std::map<std::string, Result>::iterator it = results.find(key);
+            if (it != results.end())
+            {
+                if (configure) configure(kernel, it->second.local());
+                return it->second.local();
+            }
+
+            Result result;
+
+            /* nothing ran, e.g. configure failed for every size: try again next time */
+            if (!tune(kernel, global, configure, padGlobal, result)) return cl::NullRange;
+
+            results[key] = result;
+            store(key, result);
+
+            if (configure) configure(kernel, result.local());
+            return result.local();
+        }
+
+        /* Tuned result of a launch, NULL if it was never tuned */
+        const Result* find(const cl::Kernel& kernel, const cl::NDRange& global) const
+        {
+            std::map<std::string, Result>::const_iterator it = results.find(launchKey(kernel, global));
+            return (it == results.end()) ? NULL : &it->second;
+        }
+
+        /* Rounds global up to a multiple of local in each dimension */
+        static cl::NDRange padded(const cl::NDRange& global, const cl::NDRange& local)
+        {
+            if (local.dimensions() == 0 || local.dimensions() != global.dimensions()) return global;
+
+            size_t g[3] = { global[0], 1, 1 };
+            for (size_t d = 0; d < global.dimensions(); ++d) g[d] = ((global[d] + local[d] - 1) / local[d]) * local[d];
+
+            return makeRange(global.dimensions(), g[0], g[1], g[2]);
+        }
+
+        void printResults(std::ostream& out = std::cout) const
+        {
+            out << "========= WORK GROUPS =========\n";
+            out << "Device : " << device.getInfo<CL_DEVICE_NAME>() << "\n";
+            out << std::left << std::setw(24) << "Kernel" << std::setw(16) << "Global" << std::setw(12) << "Local"
+            << std::setw(12) << "Best ms" << std::setw(12) << "Worst ms" << std::setw(12) << "Driver ms" << "Candidates\n";
+
+            std::string prefix = device_key + "\t";
+
+            for (const std::pair<const std::string, Result>& r : results)
+            {
+                if (r.first.compare(0, prefix.size(), prefix) != 0) continue;
+
+                std::istringstream fields(r.first.substr(prefix.size()));
+                std::string program, name, global;
+                std::getline(fields, program, '\t');
+                std::getline(fields, name, '\t');
+                std::getline(fields, global, '\t');
+
+                std::ostringstream local;
+                if (r.second.x == 0) local << "driver";
+                else if (r.second.y == 0) local << r.second.x;
+                else local << r.second.x << "x" << r.second.y;
+
+                out << std::setw(24) << name << std::setw(16) << global << std::setw(12) << local.str()
+                << std::setw(12) << r.second.best_ms << std::setw(12) << r.second.worst_ms
+                << std::setw(12) << r.second.driver_ms << r.second.candidates << "\n";
+            }
+
+            out << std::right;
+            out << "===============================\n\n";
+        }
+
+        CLAutotuner(const CLAutotuner& other) = delete;
+        void operator=(const CLAutotuner& other) = delete;
+
+    private:
+
+        static cl::NDRange makeRange(size_t dims, size_t x, size_t y, size_t z)
+        {
+            if (dims == 1) return cl::NDRange(x);
+            if (dims == 2) return cl::NDRange(x, y);
+            return cl::NDRange(x, y, z);
+        }
+
+        static std::string globalString(const cl::NDRange& global)
+        {
+            std::ostringstream s;
+            for (size_t d = 0; d < global.dimensions(); ++d) s << (d ? "x" : "") << global[d];
+            return s.str();
+        }
+
+        std::string launchKey(const cl::Kernel& kernel, const cl::NDRange& global) const
+        {
+            return device_key + "\t" + programKey(kernel.getInfo<CL_KERNEL_PROGRAM>()) + "\t"
+            + kernel.getInfo<CL_KERNEL_FUNCTION_NAME>() + "\t" + globalString(global);
+        }
+
+        /*
+         * FNV-1a of the program source and build options, as the binary cache of CLRuntime.
+         * Programs created from a cached binary have no source, their binary is hashed instead.
+         * Memoized per program, the map keeps the program alive so its handle is not reused.
+         */
+        std::string programKey(const cl::Program& program) const
+        {
+            std::map<cl_program, std::pair<cl::Program, std::string> >::const_iterator it = program_keys.find(program());
+            if (it != program_keys.end()) return it->second.second;
+
+            std::string code = program.getInfo<CL_PROGRAM_SOURCE>();
+
+            if (code.empty() || code == std::string(1, '\0'))
+            {
+                size_t size = 0;
+                clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, NULL);
+                code.resize(size);
+                char* binary_ptr = &code[0];
+                if (size == 0 || clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(char*), &binary_ptr, NULL) != CL_SUCCESS) code.clear();
+            }
+
+            unsigned long long h = 14695981039346656037ULL;
+            const std::string parts[] = { code, program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(device) };
+
+            for (const std::string& part : parts)
+            {
+                for (unsigned char c : part)
+                {
+                    h ^= c;
+                    h *= 1099511628211ULL;
+                }
+
+                h ^= 0xff;
+                h *= 1099511628211ULL;
+            }
+
+            std::ostringstream key;
+            key << std::hex << std::setw(16) << std::setfill('0') << h;
+
+            program_keys[program()] = std::make_pair(program, key.str());
+            return key.str();
+        }
+
+        /* Every power of two group size and shape allowed for this kernel and launch */
+        std::vector<cl::NDRange> candidates(cl::Kernel& kernel, const cl::NDRange& global, bool padGlobal) const
+        {
+            std::vector<cl::NDRange> out;
+
+            size_t max_group = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+            size_t multiple = kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device);
+            std::vector<size_t> max_items = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+
+            size_t first = 1;
+            while (first < multiple) first <<= 1;
+            if (first > max_group) first = 1;
+
+            size_t dims = global.dimensions();
+            if (dims == 0 || dims > 2 || max_items.size() < dims) return out;
+
+            for (size_t size = first; size <= max_group; size <<= 1)
+            {
+                for (size_t x = (dims == 1) ? size : 1; x <= size; x <<= 1)
+                {
+                    size_t y = size / x;
+
+                    if (x > max_items[0] || (dims == 2 && y > max_items[1])) continue;
+                    if (!padGlobal && (global[0] % x != 0 || (dims == 2 && global[1] % y != 0))) continue;
+
+                    out.push_back((dims == 1) ? cl::NDRange(x) : cl::NDRange(x, y));
+                }
+            }
+
+            return out;
+        }
+
+        /* Median time of the timed launches, negative if the launch fails */
+        double measure(cl::Kernel& kernel, const cl::NDRange& global, const cl::NDRange& local, const Configure& configure)
+        {
+            if (configure && configure(kernel, local) != CL_SUCCESS) return -1.0;
+
+            std::vector<double> times;
+
+            for (size_t i = 0; i <= repeats; ++i)
+            {
+                cl::Event evt;
+                if (queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local, NULL, &evt) != CL_SUCCESS) return -1.0;
+                if (evt.wait() != CL_SUCCESS) return -1.0;
+
+                /* the first launch pays for caches and lazy allocations */
+                if (i == 0) continue;
+
+                cl_ulong time_start = evt.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+                cl_ulong time_end = evt.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+                times.push_back((time_end - time_start) * 0.001 * 0.001);
+            }
+
+            std::sort(times.begin(), times.end());
+            return times[times.size() / 2];
+        }
+
+        /* False if no candidate, nor the driver's choice, could be launched */
+        bool tune(cl::Kernel& kernel, const cl::NDRange& global, const Configure& configure, bool padGlobal, Result& result)
+        {
+            bool launched = false;
+
+            std::vector<cl::NDRange> locals = candidates(kernel, global, padGlobal);
+
+            for (const cl::NDRange& local : locals)
+            {
+                double ms = measure(kernel, padGlobal ? padded(global, local) : global, local, configure);
+                if (ms < 0) continue;
+
+                launched = true;
+                result.candidates++;
+                result.worst_ms = std::max(result.worst_ms, ms);
+
+                if (result.x == 0 || ms < result.best_ms)
+                {
+                    result.best_ms = ms;
+                    result.x = local[0];
+                    result.y = (local.dimensions() == 2) ? local[1] : 0;
+                }
+            }
+
+            /* kernels with __local buffers need a known local size, the driver cannot pick for them */
+            if (!configure)
+            {
+                double ms = measure(kernel, global, cl::NullRange, configure);
+
+                if (ms >= 0)
+                {
+                    launched = true;
+                    result.driver_ms = ms;
+
+                    if (result.x == 0 || ms < result.best_ms)
+                    {
+                        result.best_ms = ms;
+                        result.worst_ms = std::max(result.worst_ms, ms);
+                        result.x = result.y = 0;
+                    }
+                }
+            }
+
+            return launched;
+        }
+
+        /* One launch per line: device, program, kernel, global, x, y, best, worst, driver, candidates, tab separated */
+        void load()
+        {
+            if (cache_path.empty()) return;
+
+            std::ifstream file(cache_path.c_str());
+            std::string line;
+
+            while (std::getline(file, line))
+            {
+                std::vector<std::string> fields;
+                std::istringstream s(line);
+                std::string field;
+                while (std::getline(s, field, '\t')) fields.push_back(field);
+
+                /* lines of older files, without the program, are retuned */
+                if (fields.size() != 10) continue;
+
+                Result r;
+                r.x = strtoul(fields[4].c_str(), NULL, 10);
+                r.y = strtoul(fields[5].c_str(), NULL, 10);
+                r.best_ms = atof(fields[6].c_str());
+                r.worst_ms = atof(fields[7].c_str());
+                r.driver_ms = atof(fields[8].c_str());
+                r.candidates = strtoul(fields[9].c_str(), NULL, 10);
+
+                results[fields[0] + "\t" + fields[1] + "\t" + fields[2] + "\t" + fields[3]] = r;
+            }
+        }
+
+        void store(const std::string& key, const Result& r) const
+        {
+            if (cache_path.empty()) return;
+
+            std::ofstream file(cache_path.c_str(), std::ios::app);
+            file << key << "\t" << r.x << "\t" << r.y << "\t" << r.best_ms << "\t" << r.worst_ms
+            << "\t" << r.driver_ms << "\t" << r.candidates << "\n";
+        }
+
+        cl::Device          device;
+        cl::CommandQueue    queue;
+        std::string         cache_path;
+        std::string         device_key;
+        size_t              repeats;
+
+        std::map<std::string, Result> results;
+        mutable std::map<cl_program, std::pair<cl::Program, std::string> > program_keys;
+    };
+}
+
+#endif /* ptCLAutotuner_h */
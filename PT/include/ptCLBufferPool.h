@@ -0,0 +1,224 @@
+#ifndef ptCLBufferPool_h
+#define ptCLBufferPool_h
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#include "../include/cl.hpp"
+#else
+#include <CL/cl.h>
+#include <CL/cl.hpp>
+#endif
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+namespace pt
+{
+    /*
+     * Device buffers recycled by power of two size classes
+     *
+     * acquire returns a buffer of at least the requested size, taken from the free list of its class
+     * when possible, release puts it back. Buffers acquired through a Scope, or with acquireFrame between
+     * beginFrame and endFrame, are released together when the scope ends, so a renderer which asks for the
+     * same sizes every frame reaches a steady state with no device allocations at all. A buffer released before
+     * its scope ends is no longer the scope's, whoever acquires it next keeps it past the end of the scope.
+     *
+     * Released buffers are handed out again immediately: that is safe for work on one in order queue,
+     * with several queues the caller must make sure the device is done with a buffer before releasing it.
+     */
+    class CLBufferPool
+    {
+    public:
+        static const size_t MinClassSize = 256;
+
+        struct Stats
+        {
+            Stats() : allocations(0), acquires(0), reuses(0), bytes_allocated(0), bytes_in_use(0), high_water_bytes(0), peak_in_use_bytes(0) {}
+
+            size_t allocations;         // device allocations made by the pool
+            size_t acquires;
+            size_t reuses;              // acquires served from a free list
+            size_t bytes_allocated;     // device memory held by the pool, free or in use
+            size_t bytes_in_use;
+            size_t high_water_bytes;    // peak of bytes_allocated
+            size_t peak_in_use_bytes;
+
+            double reuse_ratio() const { return acquires ? (double)reuses / (double)acquires : 0.0; }
+        };
+
+        /* Releases everything it acquired and still owns when it goes out of scope */
+        class Scope
+        {
+        public:
+            Scope(CLBufferPool& _pool) : pool(_pool) {}
+
+            ~Scope()
+            {
+                for (cl::Buffer& buffer : buffers) pool.releaseOwned(buffer, this);
+            }
+
+            cl::Buffer acquire(size_t size, cl_mem_flags flags = CL_MEM_READ_WRITE, cl_int* err = NULL)
+            {
+                cl::Buffer buffer = pool.acquireOwned(size, flags, err, this);
+                if (buffer() != NULL) buffers.push_back(buffer);
+                return buffer;
+            }
+
+            Scope(const Scope& other) = delete;
+            void operator=(const Scope& other) = delete;
+
+        private:
+            CLBufferPool& pool;
+            std::vector<cl::Buffer> buffers;
+        };
+
+        CLBufferPool(const cl::Context& _context) : context(_context) {}
+
+        static size_t sizeClass(size_t size)
+        {
+            size_t c = MinClassSize;
+            while (c < size) c <<= 1;
+            return c;
+        }
+
+        /* Host pointer flags cannot be pooled, those fail with CL_INVALID_VALUE */
+        cl::Buffer acquire(size_t size, cl_mem_flags flags = CL_MEM_READ_WRITE, cl_int* err = NULL)
+        {
+            return acquireOwned(size, flags, err, NULL);
+        }
+
+        void release(const cl::Buffer& buffer)
+        {
+            std::map<cl_mem, LiveBuffer>::iterator it = live.find(buffer());
+            if (it == live.end()) return;
+
+            freeLists[it->second.key].push_back(buffer);
+            stats.bytes_in_use -= it->second.key.second;
+            live.erase(it);
+        }
+
+        /* Buffers from acquireFrame live until the next endFrame */
+        void beginFrame()
+        {
+            endFrame();
+        }
+
+        cl::Buffer acquireFrame(size_t size, cl_mem_flags flags = CL_MEM_READ_WRITE, cl_int* err = NULL)
+        {
+            cl::Buffer buffer = acquireOwned(size, flags, err, &frameBuffers);
+            if (buffer() != NULL) frameBuffers.push_back(buffer);
+            return buffer;
+        }
+
+        void endFrame()
+        {
+            for (cl::Buffer& buffer : frameBuffers) releaseOwned(buffer, &frameBuffers);
+            frameBuffers.clear();
+        }
+
+        /* Free the device memory of every buffer not in use */
+        void trim()
+        {
+            for (std::pair<const std::pair<cl_mem_flags, size_t>, std::vector<cl::Buffer> >& f : freeLists)
+            {
+                stats.bytes_allocated -= f.first.second * f.second.size();
+                f.second.clear();
+            }
+        }
+
+        const Stats& getStats() const { return stats; }
+
+        void printStats(std::ostream& out = std::cout) const
+        {
+            out << "========= BUFFER POOL =========\n";
+            out << "Acquires : " << stats.acquires << "\n"
+            << "Allocations : " << stats.allocations << "\n"
+            << "Reuse ratio : " << stats.reuse_ratio() << "\n"
+            << "In use : " << stats.bytes_in_use / 1024 << " KB\n"
+            << "Held : " << stats.bytes_allocated / 1024 << " KB\n"
+            << "High water mark : " << stats.high_water_bytes / 1024 << " KB\n";
+            out << "===============================\n\n";
+        }
+
+        CLBufferPool(const CLBufferPool& other) = delete;
+        void operator=(const CLBufferPool& other) = delete;
+
+    private:
+        /* A buffer in use, owner is the Scope or frame it was acquired for, NULL for acquire */
+        struct LiveBuffer
+        {
+            std::pair<cl_mem_flags, size_t> key;
+            const void* owner;
+        };
+
+        cl::Buffer acquireOwned(size_t size, cl_mem_flags flags, cl_int* err, const void* owner)
+        {
+            cl_int clStatus = CL_SUCCESS;
+            cl::Buffer buffer;
+
+            if (size == 0 || (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR | CL_MEM_ALLOC_HOST_PTR)))
+            {
+                if (err) *err = CL_INVALID_VALUE;
+                return buffer;
+            }
+
+            size_t class_size = sizeClass(size);
+            std::vector<cl::Buffer>& free_list = freeLists[std::make_pair(flags, class_size)];
+
+            if (!free_list.empty())
+            {
+                buffer = free_list.back();
+                free_list.pop_back();
+                stats.reuses++;
+            }
+            else
+            {
+                buffer = cl::Buffer(context, flags, class_size, NULL, &clStatus);
+
+                if (clStatus != CL_SUCCESS)
+                {
+                    /* out of device memory is often only fragmentation in the free lists */
+                    trim();
+                    buffer = cl::Buffer(context, flags, class_size, NULL, &clStatus);
+                }
+
+                if (clStatus != CL_SUCCESS)
+                {
+                    if (err) *err = clStatus;
+                    return cl::Buffer();
+                }
+
+                stats.allocations++;
+                stats.bytes_allocated += class_size;
+                stats.high_water_bytes = std::max(stats.high_water_bytes, stats.bytes_allocated);
+            }
+
+            LiveBuffer& entry = live[buffer()];
+            entry.key = std::make_pair(flags, class_size);
+            entry.owner = owner;
+            stats.acquires++;
+            stats.bytes_in_use += class_size;
+            stats.peak_in_use_bytes = std::max(stats.peak_in_use_bytes, stats.bytes_in_use);
+
+            if (err) *err = CL_SUCCESS;
+            return buffer;
+        }
+
+        /* Releases buffer while owner still holds it, not once it was released and acquired again */
+        void releaseOwned(const cl::Buffer& buffer, const void* owner)
+        {
+            std::map<cl_mem, LiveBuffer>::iterator it = live.find(buffer());
+            if (it != live.end() && it->second.owner == owner) release(buffer);
+        }
+
+        cl::Context context;
+        std::map<std::pair<cl_mem_flags, size_t>, std::vector<cl::Buffer> > freeLists;
+        std::map<cl_mem, LiveBuffer> live;
+        std::vector<cl::Buffer> frameBuffers;
+        Stats stats;
+    };
+}
+
+#endif /* ptCLBufferPool_h */
@@ -0,0 +1,323 @@
+#ifndef ptCLFrameScheduler_h
+#define ptCLFrameScheduler_h
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#include "../include/cl.hpp"
+#else
+#include <CL/cl.h>
+#include <CL/cl.hpp>
+#endif
+
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <memory>
+
+#include "ptCL.h"
+#include "ptTrace.h"
+
+namespace pt
+{
+    /*
+     * Keeps up to N frames of path_tracing_accumulate + tonemap_buffer in flight
+     *
+     * Each slot has its own camera and RGBA8 output buffer and host copy, the HDR accumulation is shared.
+     * A frame is: camera upload on the transfer queue -> accumulate and tone map kernels on the compute queue
+     * -> readback on the transfer queue, chained with events, nothing blocks until a slot is reused N frames later.
+     * So the host prepares frame i + 1 while the device traces frame i and reads back frame i - 1.
+     * The accumulation restarts when the submitted camera differs from the previous one, the fill is ordered
+     * on the compute queue after the kernels of the previous frames.
+     *
+     * The trace kernel arguments other than camera (0), accumulation (5) and frame (9) are set by the caller,
+     * as are the tone map arguments other than the output (1), see cl_set_tonemap_args.
+     *
+     * Stage times come from CL_COMPLETE callbacks on the profiling events, they arrive on a driver thread.
+     * While tracing (ptTrace.h) the callbacks also record every stage on a compute and a transfer track.
+     * The pixels passed to the frame callback belong to the slot, copy them to keep them.
+     */
+    class CLFrameScheduler
+    {
+    public:
+        typedef std::function<void(unsigned int frame, const unsigned char* rgba)> FrameCallback;
+
+        struct Timings
+        {
+            Timings() : frames(0), upload_ms(0), kernel_ms(0), tonemap_ms(0), readback_ms(0) {}
+
+            unsigned int frames;
+            double upload_ms;
+            double kernel_ms;
+            double tonemap_ms;
+            double readback_ms;
+        };
+
+        CLFrameScheduler(cl::Context& context,
+                         cl::CommandQueue& _compute_queue,
+                         cl::CommandQueue& _transfer_queue,
+                         cl::Kernel& _kernel,
+                         cl::Kernel& _tonemap_kernel,
+                         cl_accumulation& _accumulation,
+                         size_t _width,
+                         size_t _height,
+                         const cl::NDRange& _local,
+                         size_t frames_in_flight = 2)
+        : compute_queue(_compute_queue), transfer_queue(_transfer_queue), kernel(_kernel),
+        tonemap_kernel(_tonemap_kernel), accumulation(_accumulation), width(_width), height(_height), local(_local), next_frame(0), next_delivery(0), timings(new SharedTimings())
+        {
+            cl_int clStatus;
+
+            compute_track = trace_track("compute queue");
+            compute_wait_track = trace_track("compute queue wait");
+            transfer_track = trace_track("transfer queue");
+            transfer_wait_track = trace_track("transfer queue wait");
+
+            clStatus = kernel.setArg(5, accumulation.buffer);
+            check(clStatus, "Could not set accumulation argument");
+
+            slots.resize(std::max<size_t>(1, frames_in_flight));
+
+            for (Slot& slot : slots)
+            {
+                slot.camera = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(cl_camera), NULL, &clStatus);
+                check(clStatus, "Could not create camera buffer");
+
+                slot.output = cl::Buffer(context, CL_MEM_WRITE_ONLY, 4 * width * height, NULL, &clStatus);
+                check(clStatus, "Could not create output buffer");
+
+                slot.pixels.resize(4 * width * height);
+                slot.busy = false;
+            }
+
+            /* round up to the work group size, the kernel discards the padding */
+            global_width = width;
+            global_height = height;
+
+            if (local.dimensions() == 2)
+            {
+                global_width = ((width + local[0] - 1) / local[0]) * local[0];
+                global_height = ((height + local[1] - 1) / local[1]) * local[1];
+            }
+        }
+
+        ~CLFrameScheduler()
+        {
+            drain();
+        }
+
+        void setFrameCallback(const FrameCallback& callback) { on_frame = callback; }
+
+        /* Enqueue one frame, blocks only if the oldest slot is still in flight. Returns the frame index */
+        unsigned int submit(const cl_camera& camera)
+        {
+            cl_int clStatus;
+            Slot& slot = slots[next_frame % slots.size()];
+
+            if (slot.busy) deliver(slot);
+
+            slot.frame = next_frame++;
+            slot.camera_host = camera;
+
+            /* the camera and output buffers were last used by this slot's previous frame, already complete */
+            clStatus = transfer_queue.enqueueWriteBuffer(slot.camera, CL_FALSE, 0, sizeof(cl_camera), &slot.camera_host, NULL, &slot.upload_evt);
+            check(clStatus, "Could not enqueue camera upload");
+            profile(slot.upload_evt, &SharedTimings::upload_ns, "upload", transfer_track, transfer_wait_track);
+
+            clStatus = cl_update_accumulation_camera(accumulation, camera, compute_queue);
+            check(clStatus, "Could not reset the accumulation");
+
+            clStatus = kernel.setArg(0, slot.camera);
+            clStatus |= kernel.setArg(9, (cl_uint)slot.frame);
+            clStatus |= tonemap_kernel.setArg(1, slot.output);
+            check(clStatus, "Could not set frame arguments");
+
+            cl::NDRange global(global_width, global_height);
+
+            std::vector<cl::Event> wait_upload(1, slot.upload_evt);
+            clStatus = compute_queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local, &wait_upload, &slot.kernel_evt);
+            check(clStatus, "Could not enqueue the kernel");
+            profile(slot.kernel_evt, &SharedTimings::kernel_ns, "accumulate", compute_track, compute_wait_track);
+
+            /* in order after the accumulation */
+            clStatus = compute_queue.enqueueNDRangeKernel(tonemap_kernel, cl::NullRange, global, local, NULL, &slot.tonemap_evt);
+            check(clStatus, "Could not enqueue the tone map kernel");
+            profile(slot.tonemap_evt, &SharedTimings::tonemap_ns, "tone map", compute_track, compute_wait_track);
+
+            std::vector<cl::Event> wait_tonemap(1, slot.tonemap_evt);
+            clStatus = transfer_queue.enqueueReadBuffer(slot.output, CL_FALSE, 0, slot.pixels.size(), slot.pixels.data(), &wait_tonemap, &slot.readback_evt);
+            check(clStatus, "Could not enqueue readback");
+            profile(slot.readback_evt, &SharedTimings::readback_ns, "readback", transfer_track, transfer_wait_track);
+
+            transfer_queue.flush();
+            compute_queue.flush();
+
+            slot.busy = true;
+            return slot.frame;
+        }
+
+        /* Deliver the frames already complete, in order, without blocking */
+        void poll()
+        {
+            for (;;)
+            {
+                Slot& slot = slots[next_delivery % slots.size()];
+                if (!slot.busy || slot.frame != next_delivery) return;
+                if (slot.readback_evt.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE) return;
+                deliver(slot);
+            }
+        }
+
+        /* Wait for and deliver every frame in flight */
+        void drain()
+        {
+            while (next_delivery < next_frame)
+            {
+                deliver(slots[next_delivery % slots.size()]);
+            }
+        }
+
+        size_t framesInFlight() const { return slots.size(); }
+        unsigned int framesSubmitted() const { return next_frame; }
+        unsigned int framesDelivered() const { return next_delivery; }
+
+        Timings getTimings() const
+        {
+            std::lock_guard<std::mutex> lock(timings->mutex);
+
+            Timings t;
+            t.frames = timings->kernel_count;
+            t.upload_ms = timings->upload_ns * 1e-6;
+            t.kernel_ms = timings->kernel_ns * 1e-6;
+            t.tonemap_ms = timings->tonemap_ns * 1e-6;
+            t.readback_ms = timings->readback_ns * 1e-6;
+            return t;
+        }
+
+        CLFrameScheduler(const CLFrameScheduler& other) = delete;
+        void operator=(const CLFrameScheduler& other) = delete;
+
+    private:
+
+        struct Slot
+        {
+            cl::Buffer camera;
+            cl::Buffer output;
+            cl_camera camera_host;
+            std::vector<unsigned char> pixels;
+            cl::Event upload_evt;
+            cl::Event kernel_evt;
+            cl::Event tonemap_evt;
+            cl::Event readback_evt;
+            unsigned int frame;
+            bool busy;
+        };
+
+        /* Shared with the callbacks, outlives the scheduler until the last callback ran */
+        struct SharedTimings
+        {
+            SharedTimings() : upload_ns(0), kernel_ns(0), tonemap_ns(0), readback_ns(0), kernel_count(0) {}
+
+            std::mutex mutex;
+            cl_ulong upload_ns;
+            cl_ulong kernel_ns;
+            cl_ulong tonemap_ns;
+            cl_ulong readback_ns;
+            unsigned int kernel_count;
+        };
+
+        struct CallbackData
+        {
+            std::shared_ptr<SharedTimings> timings;
+            cl_ulong SharedTimings::* counter;
+            const char* name;
+            double enqueue_us;
+            uint32_t track;
+            uint32_t wait_track;
+        };
+
+        static void CL_CALLBACK on_complete(cl_event event, cl_int status, void* user_data)
+        {
+            CallbackData* data = (CallbackData*)user_data;
+
+            cl_ulong time_queued = 0, time_start = 0, time_end = 0;
+
+            if (status == CL_COMPLETE
+                && clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &time_start, NULL) == CL_SUCCESS
+                && clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &time_end, NULL) == CL_SUCCESS)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(data->timings->mutex);
+                    (*data->timings).*(data->counter) += time_end - time_start;
+                    if (data->counter == &SharedTimings::kernel_ns) data->timings->kernel_count++;
+                }
+
+                if (trace_enabled()
+                    && clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &time_queued, NULL) == CL_SUCCESS)
+                {
+                    trace_device_span(data->name, "frame", data->enqueue_us, time_queued, time_start, time_end, data->track, data->wait_track);
+                }
+            }
+
+            delete data;
+        }
+
+        /* Right after the enqueue, see trace_device_span */
+        void profile(cl::Event& event, cl_ulong SharedTimings::* counter, const char* name, uint32_t track, uint32_t wait_track)
+        {
+            CallbackData* data = new CallbackData();
+            data->timings = timings;
+            data->counter = counter;
+            data->name = name;
+            data->enqueue_us = trace_now_us();
+            data->track = track;
+            data->wait_track = wait_track;
+
+            if (event.setCallback(CL_COMPLETE, on_complete, data) != CL_SUCCESS) delete data;
+        }
+
+        void deliver(Slot& slot)
+        {
+            slot.readback_evt.wait();
+            slot.busy = false;
+            next_delivery = slot.frame + 1;
+
+            if (on_frame) on_frame(slot.frame, slot.pixels.data());
+        }
+
+        static void check(cl_int status, const char* errorMsg)
+        {
+            if (status != CL_SUCCESS)
+            {
+                std::cerr << errorMsg << "\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        cl::CommandQueue    compute_queue;
+        cl::CommandQueue    transfer_queue;
+        cl::Kernel          kernel;
+        cl::Kernel          tonemap_kernel;
+        cl_accumulation&    accumulation;
+
+        size_t              width;
+        size_t              height;
+        size_t              global_width;
+        size_t              global_height;
+        cl::NDRange         local;
+
+        std::vector<Slot>   slots;
+        unsigned int        next_frame;
+        unsigned int        next_delivery;
+
+        FrameCallback       on_frame;
+
+        uint32_t            compute_track;
+        uint32_t            compute_wait_track;
+        uint32_t            transfer_track;
+        uint32_t            transfer_wait_track;
+        std::shared_ptr<SharedTimings> timings;
+    };
+}
+
+#endif /* ptCLFrameScheduler_h */
@@ -0,0 +1,613 @@
+#ifndef ptCLRuntime_h
+#define ptCLRuntime_h
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#include "../include/cl.hpp"
+#else
+#include <CL/cl.h>
+#include <CL/cl.hpp>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <memory>
+
+#if defined(_WIN32)
+#include <direct.h>
+#endif
+
+#include "ptCLBufferPool.h"
+#include "ptCLAutotuner.h"
+#include "ptTrace.h"
+
+namespace pt
+{
+    /*
+     * One OpenCL device, context and set of queues shared by apps, tests and samples
+     *
+     * Device selection walks every platform and prefers a GPU, then a CPU, then anything else,
+     * so everything also runs on CPU only implementations (pocl, Intel CPU runtime...).
+     * PT_CL_DEVICE overrides the choice: "gpu", "cpu", "accelerator", "<platform>:<device>" indices
+     * or a substring of the device name.
+     *
+     * Programs are loaded by name from the assets directory (PT_CL_ASSETS or the first of the usual
+     * relative locations containing random.cl), #include "..." is resolved on the host so the
+     * source is self contained, and built binaries are cached in memory and on disk
+     * (PT_CL_CACHE, "cl_cache" by default, empty to disable) keyed on source, options and device.
+     *
+     * Construction does not exit when no device can be used, check getStatus() before anything else.
+     *
+     * Kernels enqueued through enqueueKernel are timed with profiling events, timings are collected
+     * on finish(), or while enqueueing once MaxPendingKernels are in flight, and printed by
+     * printKernelTimings(). While tracing (ptTrace.h)
+     * finish() also records them on one track per queue, their wait in the queue on another.
+     * Buffers come from one CLBufferPool, see getBufferPool(), and local sizes from one CLAutotuner,
+     * see getAutotuner(), its results are stored next to the binaries.
+     */
+    class CLRuntime
+    {
+    public:
+        struct KernelTiming
+        {
+            KernelTiming() : count(0), total_ms(0), min_ms(0), max_ms(0) {}
+
+            size_t count;
+            double total_ms;
+            double min_ms;
+            double max_ms;
+        };
+
+        /* Kernels waiting for their timings to be collected, beyond that enqueueKernel collects them */
+        static const size_t MaxPendingKernels = 1024;
+
+        CLRuntime(cl_context_properties* properties = NULL) : status(CL_SUCCESS), deviceType(0)
+        {
+            if (!selectDevice(getenv("PT_CL_DEVICE")))
+            {
+                std::cerr << "Could not find an OpenCL device.\n";
+                status = CL_DEVICE_NOT_FOUND;
+                return;
+            }
+
+            context = cl::Context({device}, properties, NULL, NULL, &status);
+
+            if (status != CL_SUCCESS)
+            {
+                std::cerr << "Could not create a context for device.\n";
+                return;
+            }
+
+            bufferPool.reset(new CLBufferPool(context));
+
+            queues.push_back(cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &status));
+
+            if (status != CL_SUCCESS)
+            {
+                std::cerr << "Could not create command queue\n";
+                return;
+            }
+
+            const char* assets = getenv("PT_CL_ASSETS");
+            const char* candidates[] = { "../../../assets/", "assets/", "../assets/", "PT/assets/" };
+
+            if (assets) addIncludeDir(assets);
+
+            for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]) && includeDirs.empty(); ++i)
+            {
+                if (fileExists(std::string(candidates[i]) + "random.cl")) addIncludeDir(candidates[i]);
+            }
+
+            const char* cache = getenv("PT_CL_CACHE");
+            cacheDir = cache ? cache : "cl_cache";
+        }
+
+        /* CL_SUCCESS once a device, its context and the default queue are ready, nothing else can be used otherwise */
+        cl_int getStatus() const { return status; }
+
+        cl::Device& getDevice() { return device; }
+        cl::Context& getContext() { return context; }
+        cl::Platform& getPlatform() { return platform; }
+
+        /* The default queue, in order with profiling enabled */
+        cl::CommandQueue& getQueue() { return queues[0]; }
+
+        /*
+         * Additional queue owned by the runtime, e.g. for transfers
+         * On failure err gets the status and the default queue is returned, so callers keep working in order.
+         */
+        cl::CommandQueue& createQueue(cl_command_queue_properties properties = CL_QUEUE_PROFILING_ENABLE, cl_int* err = NULL)
+        {
+            cl_int clStatus;
+            cl::CommandQueue queue(context, device, properties, &clStatus);
+
+            if (err) *err = clStatus;
+
+            if (clStatus != CL_SUCCESS)
+            {
+                std::cerr << "Could not create command queue\n";
+                return getQueue();
+            }
+
+            queues.push_back(queue);
+            return queues.back();
+        }
+
+        bool isGPU() const { return deviceType & CL_DEVICE_TYPE_GPU; }
+        const std::string& getDeviceName() const { return deviceName; }
+        const std::string& getCacheDir() const { return cacheDir; }
+
+        void addIncludeDir(const std::string& dir)
+        {
+            includeDirs.push_back(withSlash(dir));
+        }
+
+        /* Empty to disable the disk cache */
+        void setCacheDir(const std::string& dir) { cacheDir = dir; }
+
+        /* Path of a file given as is or relative to the include directories, empty if not found */
+        std::string findFile(const std::string& name, const std::string& relative_to = "") const
+        {
+            if (!relative_to.empty() && fileExists(withSlash(relative_to) + name)) return withSlash(relative_to) + name;
+            if (fileExists(name)) return name;
+
+            for (const std::string& dir : includeDirs)
+            {
+                if (fileExists(dir + name)) return dir + name;
+            }
+
+            return "";
+        }
+
+        /*
+         * Build a program from a file in the assets directory, or reuse a previous build
+         * Prints the build log and returns the error on failure
+         */
+        cl_int buildProgram(const std::string& file, const std::string& options, cl::Program& out_program)
+        {
+            cl_int clStatus;
+            std::string source;
+
+            std::set<std::string> included;
+            clStatus = loadSource(file, "", source, included);
+            if (clStatus != CL_SUCCESS) return clStatus;
+
+            std::string key = cacheKey(source, options);
+
+            std::map<std::string, cl::Program>::iterator it = programs.find(key);
+            if (it != programs.end())
+            {
+                out_program = it->second;
+                return CL_SUCCESS;
+            }
+
+            if (!loadBinary(key, options, out_program))
+            {
+                cl::Program::Sources sources(1, std::make_pair(source.c_str(), source.length()));
+                out_program = cl::Program(context, sources, &clStatus);
+                if (clStatus != CL_SUCCESS) return clStatus;
+
+                clStatus = out_program.build({device}, options.c_str());
+
+                if (clStatus != CL_SUCCESS)
+                {
+                    std::cerr << file << ":\n" << out_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << "\n";
+                    return clStatus;
+                }
+
+                storeBinary(key, out_program);
+            }
+
+            programs[key] = out_program;
+            return CL_SUCCESS;
+        }
+
+        /* Enqueue on the default queue and record the kernel time */
+        cl_int enqueueKernel(const cl::Kernel& kernel,
+                             const cl::NDRange& global,
+                             const cl::NDRange& local = cl::NullRange,
+                             const std::vector<cl::Event>* wait_events = NULL,
+                             cl::Event* event = NULL)
+        {
+            return enqueueKernel(getQueue(), kernel, global, local, wait_events, event);
+        }
+
+        cl_int enqueueKernel(cl::CommandQueue& queue,
+                             const cl::Kernel& kernel,
+                             const cl::NDRange& global,
+                             const cl::NDRange& local = cl::NullRange,
+                             const std::vector<cl::Event>* wait_events = NULL,
+                             cl::Event* event = NULL)
+        {
+            cl::Event profiling_evt;
+
+            cl_int clStatus = queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local, wait_events, &profiling_evt);
+            if (clStatus != CL_SUCCESS) return clStatus;
+
+            PendingKernel p;
+            p.name = kernel.getInfo<CL_KERNEL_FUNCTION_NAME>();
+            p.event = profiling_evt;
+            p.queue = queue();
+            p.enqueue_us = trace_now_us();
+            pending.push_back(p);
+            if (event) *event = profiling_evt;
+
+            /* apps that never call finish() must not keep every event alive */
+            if (pending.size() >= MaxPendingKernels)
+            {
+                collectCompleted();
+
+                while (pending.size() > MaxPendingKernels / 2)
+                {
+                    pending.front().event.wait();
+                    collectCompleted();
+                }
+            }
+
+            return CL_SUCCESS;
+        }
+
+        /* Wait for all the queues and collect the timings of the kernels enqueued so far */
+        cl_int finish()
+        {
+            cl_int clStatus = CL_SUCCESS;
+
+            /* Every queue is waited for, the first failure is reported */
+            for (cl::CommandQueue& queue : queues)
+            {
+                cl_int queueStatus = queue.finish();
+                if (clStatus == CL_SUCCESS) clStatus = queueStatus;
+            }
+
+            collectCompleted();
+            return clStatus;
+        }
+
+        const std::map<std::string, KernelTiming>& getKernelTimings() const { return timings; }
+        void resetKernelTimings() { timings.clear(); }
+
+        void printKernelTimings(std::ostream& out = std::cout) const
+        {
+            out << "=========== KERNELS ===========\n";
+            out << "Device : " << deviceName << "\n";
+
+            for (const std::pair<const std::string, KernelTiming>& t : timings)
+            {
+                out << t.first << " : " << t.second.count << " launches, "
+                << t.second.total_ms / (double)t.second.count << " ms avg, "
+                << t.second.min_ms << " ms min, "
+                << t.second.max_ms << " ms max\n";
+            }
+
+            out << "===============================\n\n";
+        }
+
+        /* Device buffers shared by everything using the runtime */
+        CLBufferPool& getBufferPool() { return *bufferPool; }
+
+        /* Tunes on the default queue, created on first use */
+        CLAutotuner& getAutotuner()
+        {
+            if (!autotuner)
+            {
+                std::string path;
+
+                if (!cacheDir.empty())
+                {
+                    makeDir(cacheDir);
+                    path = withSlash(cacheDir) + "worksizes.txt";
+                }
+
+                autotuner.reset(new CLAutotuner(device, getQueue(), path));
+            }
+
+            return *autotuner;
+        }
+
+        CLRuntime(const CLRuntime& other) = delete;
+        void operator=(const CLRuntime& other) = delete;
+
+    private:
+
+        struct PendingKernel
+        {
+            std::string name;
+            cl::Event event;
+            cl_command_queue queue;
+            double enqueue_us;
+        };
+
+        void recordTiming(PendingKernel& p)
+        {
+            cl_ulong time_start = p.event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+            cl_ulong time_end = p.event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+            double elapsed = (time_end - time_start) * 0.001 * 0.001;
+
+            if (trace_enabled())
+            {
+                std::pair<uint32_t, uint32_t> tracks = traceTracks(p.queue);
+                trace_device_span(p.name.c_str(), "kernel", p.enqueue_us,
+                                  p.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>(), time_start, time_end,
+                                  tracks.first, tracks.second);
+            }
+
+            KernelTiming& timing = timings[p.name];
+            timing.min_ms = (timing.count == 0) ? elapsed : std::min(timing.min_ms, elapsed);
+            timing.max_ms = std::max(timing.max_ms, elapsed);
+            timing.total_ms += elapsed;
+            timing.count++;
+        }
+
+        /* Records and drops the kernels that are done, failed ones have no timing and are dropped as well */
+        void collectCompleted()
+        {
+            size_t kept = 0;
+
+            for (size_t i = 0; i < pending.size(); ++i)
+            {
+                cl_int execution = pending[i].event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>();
+
+                if (execution == CL_COMPLETE) recordTiming(pending[i]);
+                else if (execution > CL_COMPLETE) pending[kept++] = pending[i];
+            }
+
+            pending.resize(kept);
+        }
+
+        /* Kernel and wait tracks of a queue, named after the device and the order queues are first seen */
+        std::pair<uint32_t, uint32_t> traceTracks(cl_command_queue queue)
+        {
+            std::map<cl_command_queue, std::pair<uint32_t, uint32_t> >::iterator it = tracks.find(queue);
+            if (it != tracks.end()) return it->second;
+
+            std::ostringstream name;
+            name << deviceName << " queue " << tracks.size();
+
+            std::pair<uint32_t, uint32_t> t(trace_track(name.str()), trace_track(name.str() + " wait"));
+            tracks[queue] = t;
+            return t;
+        }
+
+        static bool fileExists(const std::string& path)
+        {
+            std::ifstream f(path.c_str());
+            return f.good();
+        }
+
+        static std::string withSlash(const std::string& dir)
+        {
+            if (dir.empty() || dir[dir.size() - 1] == '/' || dir[dir.size() - 1] == '\\') return dir;
+            return dir + "/";
+        }
+
+        static void makeDir(const std::string& dir)
+        {
+#if defined(_WIN32)
+            _mkdir(dir.c_str());
+#else
+            mkdir(dir.c_str(), 0755);
+#endif
+        }
+
+        static std::string directoryOf(const std::string& path)
+        {
+            size_t slash = path.find_last_of("/\\");
+            return (slash == std::string::npos) ? "" : path.substr(0, slash + 1);
+        }
+
+        bool selectDevice(const char* override_str)
+        {
+            std::vector<cl::Platform> platforms;
+            if (cl::Platform::get(&platforms) != CL_SUCCESS || platforms.empty()) return false;
+
+            std::vector<std::pair<cl::Platform, cl::Device> > candidates;
+
+            for (cl::Platform& p : platforms)
+            {
+                std::vector<cl::Device> devices;
+                if (p.getDevices(CL_DEVICE_TYPE_ALL, &devices) != CL_SUCCESS) continue;
+                for (cl::Device& d : devices) candidates.push_back(std::make_pair(p, d));
+            }
+
+            if (candidates.empty()) return false;
+
+            std::string request = override_str ? override_str : "";
+            int chosen = -1;
+
+            if (!request.empty())
+            {
+                cl_device_type type = 0;
+                if (request == "gpu") type = CL_DEVICE_TYPE_GPU;
+                else if (request == "cpu") type = CL_DEVICE_TYPE_CPU;
+                else if (request == "accelerator") type = CL_DEVICE_TYPE_ACCELERATOR;
+
+                int platform_idx, device_idx;
+                char colon;
+                std::istringstream indices(request);
+                bool by_index = (indices >> platform_idx >> colon >> device_idx) && colon == ':';
+
+                for (size_t i = 0; i < candidates.size() && chosen < 0; ++i)
+                {
+                    cl::Device& d = candidates[i].second;
+
+                    if (type != 0)
+                    {
+                        if (d.getInfo<CL_DEVICE_TYPE>() & type) chosen = (int)i;
+                    }
+                    else if (by_index)
+                    {
+                        if (platform_idx >= 0 && (size_t)platform_idx < platforms.size()
+                            && candidates[i].first() == platforms[platform_idx]())
+                        {
+                            if (device_idx-- == 0) chosen = (int)i;
+                        }
+                    }
+                    else if (d.getInfo<CL_DEVICE_NAME>().find(request) != std::string::npos)
+                    {
+                        chosen = (int)i;
+                    }
+                }
+
+                if (chosen < 0) std::cerr << "PT_CL_DEVICE=" << request << " matches no device, using the default.\n";
+            }
+
+            const cl_device_type preference[] = { CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_CPU, CL_DEVICE_TYPE_ALL };
+
+            for (size_t k = 0; k < 3 && chosen < 0; ++k)
+            {
+                for (size_t i = 0; i < candidates.size() && chosen < 0; ++i)
+                {
+                    if (candidates[i].second.getInfo<CL_DEVICE_TYPE>() & preference[k]) chosen = (int)i;
+                }
+            }
+
+            platform = candidates[chosen].first;
+            device = candidates[chosen].second;
+            deviceType = device.getInfo<CL_DEVICE_TYPE>();
+            deviceName = device.getInfo<CL_DEVICE_NAME>();
+            deviceVersion = deviceName + "|" + device.getInfo<CL_DEVICE_VERSION>() + "|" + device.getInfo<CL_DRIVER_VERSION>();
+
+            return true;
+        }
+
+        /* Inline every #include "file" once, headers are guarded anyway */
+        cl_int loadSource(const std::string& file, const std::string& relative_to, std::string& out, std::set<std::string>& included)
+        {
+            std::string path = findFile(file, relative_to);
+
+            if (path.empty())
+            {
+                std::cerr << "Could not find program file " << file << "\n";
+                return CL_INVALID_VALUE;
+            }
+
+            if (!included.insert(path).second) return CL_SUCCESS;
+
+            std::ifstream program_file(path.c_str());
+            std::string line;
+
+            while (std::getline(program_file, line))
+            {
+                size_t start = line.find_first_not_of(" \t");
+
+                if (start != std::string::npos && line.compare(start, 8, "#include") == 0)
+                {
+                    size_t open = line.find('"', start);
+                    size_t close = (open == std::string::npos) ? open : line.find('"', open + 1);
+
+                    if (close != std::string::npos)
+                    {
+                        cl_int clStatus = loadSource(line.substr(open + 1, close - open - 1), directoryOf(path), out, included);
+                        if (clStatus != CL_SUCCESS) return clStatus;
+                        continue;
+                    }
+                }
+
+                out += line;
+                out += "\n";
+            }
+
+            return CL_SUCCESS;
+        }
+
+        /* FNV-1a of everything the binary depends on */
+        std::string cacheKey(const std::string& source, const std::string& options) const
+        {
+            unsigned long long h = 14695981039346656037ULL;
+            const std::string parts[] = { source, options, deviceVersion };
+
+            for (const std::string& part : parts)
+            {
+                for (unsigned char c : part)
+                {
+                    h ^= c;
+                    h *= 1099511628211ULL;
+                }
+
+                h ^= 0xff;
+                h *= 1099511628211ULL;
+            }
+
+            std::ostringstream key;
+            key << std::hex << std::setw(16) << std::setfill('0') << h;
+            return key.str();
+        }
+
+        std::string binaryPath(const std::string& key) const
+        {
+            return withSlash(cacheDir) + key + ".bin";
+        }
+
+        bool loadBinary(const std::string& key, const std::string& options, cl::Program& out_program)
+        {
+            if (cacheDir.empty()) return false;
+
+            std::ifstream file(binaryPath(key).c_str(), std::ios::binary);
+            if (!file.good()) return false;
+
+            std::string binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (binary.empty()) return false;
+
+            cl_int clStatus;
+            std::vector<cl_int> binary_status;
+            cl::Program::Binaries binaries(1, std::make_pair((const void*)binary.data(), binary.size()));
+
+            out_program = cl::Program(context, {device}, binaries, &binary_status, &clStatus);
+            if (clStatus != CL_SUCCESS) return false;
+
+            return out_program.build({device}, options.c_str()) == CL_SUCCESS;
+        }
+
+        void storeBinary(const std::string& key, cl::Program& program)
+        {
+            if (cacheDir.empty()) return;
+
+            makeDir(cacheDir);
+
+            size_t size = 0;
+            if (clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, NULL) != CL_SUCCESS || size == 0) return;
+
+            std::vector<unsigned char> binary(size);
+            unsigned char* binary_ptr = binary.data();
+            if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binary_ptr, NULL) != CL_SUCCESS) return;
+
+            std::ofstream file(binaryPath(key).c_str(), std::ios::binary);
+            file.write((const char*)binary.data(), size);
+        }
+
+        cl_int                          status;
+        cl::Platform                    platform;
+        cl::Device                      device;
+        cl::Context                     context;
+        std::deque<cl::CommandQueue>    queues;
+
+        cl_device_type                  deviceType;
+        std::string                     deviceName;
+        std::string                     deviceVersion;
+
+        std::vector<std::string>        includeDirs;
+        std::string                     cacheDir;
+        std::map<std::string, cl::Program> programs;
+
+        std::vector<PendingKernel> pending;
+        std::map<cl_command_queue, std::pair<uint32_t, uint32_t> > tracks;
+        std::map<std::string, KernelTiming> timings;
+
+        std::unique_ptr<CLBufferPool> bufferPool;
+        std::unique_ptr<CLAutotuner> autotuner;
+    };
+}
+
+#endif /* ptCLRuntime_h */
@@ -0,0 +1,250 @@
+#ifndef ptCLWavefront_h
+#define ptCLWavefront_h
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#include "../include/cl.hpp"
+#else
+#include <CL/cl.h>
+#include <CL/cl.hpp>
+#endif
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+#include "ptCL.h"
+#include "ptCLBufferPool.h"
+#include "ptMaterial.h"
+
+namespace pt
+{
+    /* Wall time per stage, every stage is finished before the next starts */
+    struct cl_wavefront_timings
+    {
+        double intersect_ms;
+        double sort_ms;
+        double shade_ms;
+        double total_ms;
+        size_t bucket_paths[WAVEFRONT_BUCKETS]; // over all bounces
+    };
+    
+    double cl_wavefront_ms_since(const std::chrono::high_resolution_clock::time_point& start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+    
+    /*
+     * Host side of wavefront.cl: frames of one path per pixel, MAX_RECURSION bounces each.
+     * With sorted, the paths are sorted by material before shading and every material gets its own kernel,
+     * otherwise wavefront_shade_all shades them in place. Reads back the running mean per pixel in out_frame.
+     * The path state is taken from pool and given back on return.
+     */
+    void cl_render_wavefront(const cl::Device& device,
+                             cl::Context& context,
+                             cl::CommandQueue& cmd_queue,
+                             CLBufferPool& pool,
+                             cl::Program& wavefront_program,
+                             cl::Program& scan_program,
+                             cl::Buffer& cam_buffer,
+                             cl::Buffer& primitive_buffer,
+                             cl::Buffer& material_buffer,
+                             cl::Buffer& sky_buffer,
+                             cl_uint object_count,
+                             cl_uint width,
+                             cl_uint height,
+                             cl_uint frames,
+                             bool sorted,
+                             std::vector<cl_float4>& out_frame,
+                             cl_wavefront_timings& out_timings)
+    {
+        cl_int clStatus;
+        
+        cl::Kernel generate_kernel(wavefront_program, "wavefront_generate", &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create generate kernel")
+        cl::Kernel intersect_kernel(wavefront_program, "wavefront_intersect", &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create intersect kernel")
+        cl::Kernel sort_kernel(wavefront_program, "wavefront_sort", &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create sort kernel")
+        cl::Kernel shade_all_kernel(wavefront_program, "wavefront_shade_all", &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create shade kernel")
+        cl::Kernel resolve_kernel(wavefront_program, "wavefront_resolve", &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create resolve kernel")
+        cl::Kernel scan_sum_kernel(scan_program, "hillis_steele_scan_sum", &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create scan kernel")
+        cl::Kernel add_block_sums_kernel(scan_program, "hillis_steele_add_block_sums", &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create add block sums kernel")
+        
+        /* one kernel per material type, index is the bucket */
+        const char* shade_names[WAVEFRONT_BUCKETS] = { NULL, "wavefront_shade_lambertian", "wavefront_shade_dialectric", "wavefront_shade_metallic" };
+        cl::Kernel shade_kernels[WAVEFRONT_BUCKETS];
+        
+        for (int k = 1; k < WAVEFRONT_BUCKETS; ++k)
+        {
+            shade_kernels[k] = cl::Kernel(wavefront_program, shade_names[k], &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create material shade kernel")
+        }
+        
+        size_t block_size = 1;
+        while (2 * block_size <= scan_sum_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)) block_size <<= 1;
+        
+        const cl_uint n = width * height;
+        const size_t local = 64;
+        const size_t global = ((n + local - 1) / local) * local;
+        const size_t flag_count = ((WAVEFRONT_BUCKETS * n + block_size - 1) / block_size) * block_size;
+        
+        CLBufferPool::Scope buffers(pool);
+        
+        cl::Buffer rays = buffers.acquire(n * sizeof(cl_packed_ray), CL_MEM_READ_WRITE, &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create ray buffer")
+        cl::Buffer hits = buffers.acquire(n * sizeof(cl_packed_hit), CL_MEM_READ_WRITE, &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create hit buffer")
+        cl::Buffer throughput = buffers.acquire(n * sizeof(cl_float4), CL_MEM_READ_WRITE, &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create throughput buffer")
+        cl::Buffer radiance = buffers.acquire(n * sizeof(cl_float4), CL_MEM_READ_WRITE, &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create radiance buffer")
+        cl::Buffer seeds = buffers.acquire(n * sizeof(cl_uint), CL_MEM_READ_WRITE, &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create seed buffer")
+        cl::Buffer flags = buffers.acquire(flag_count * sizeof(cl_int), CL_MEM_READ_WRITE, &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create flag buffer")
+        cl::Buffer sorted_paths = buffers.acquire(n * sizeof(cl_uint), CL_MEM_READ_WRITE, &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create sorted path buffer")
+        cl::Buffer accumulation = buffers.acquire(n * sizeof(cl_float4), CL_MEM_READ_WRITE, &clStatus);
+        PTCL_ASSERT(clStatus, "Could not create accumulation buffer")
+        
+        out_frame.assign(n, cl_float4());
+        PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Could not clear accumulation buffer", cmd_queue, accumulation, CL_TRUE, 0, n * sizeof(cl_float4), out_frame.data(), NULL, NULL)
+        
+        std::vector<cl::Buffer> block_sums;
+        
+        cl_uint arg = 0;
+        PTCL_SAFE_SET_ARG("Could not set cam argument", generate_kernel, arg++, cam_buffer)
+        PTCL_SAFE_SET_ARG("Could not set ray argument", generate_kernel, arg++, rays)
+        PTCL_SAFE_SET_ARG("Could not set throughput argument", generate_kernel, arg++, throughput)
+        PTCL_SAFE_SET_ARG("Could not set radiance argument", generate_kernel, arg++, radiance)
+        PTCL_SAFE_SET_ARG("Could not set seed argument", generate_kernel, arg++, seeds)
+        PTCL_SAFE_SET_ARG("Could not set width argument", generate_kernel, arg++, width)
+        PTCL_SAFE_SET_ARG("Could not set height argument", generate_kernel, arg++, height)
+        
+        cl_uint sort = sorted ? 1 : 0;
+        arg = 0;
+        PTCL_SAFE_SET_ARG("Could not set ray argument", intersect_kernel, arg++, rays)
+        PTCL_SAFE_SET_ARG("Could not set throughput argument", intersect_kernel, arg++, throughput)
+        PTCL_SAFE_SET_ARG("Could not set radiance argument", intersect_kernel, arg++, radiance)
+        PTCL_SAFE_SET_ARG("Could not set hit argument", intersect_kernel, arg++, hits)
+        PTCL_SAFE_SET_ARG("Could not set flag argument", intersect_kernel, arg++, flags)
+        PTCL_SAFE_SET_ARG("Could not set primitive argument", intersect_kernel, arg++, primitive_buffer)
+        PTCL_SAFE_SET_ARG("Could not set material argument", intersect_kernel, arg++, material_buffer)
+        PTCL_SAFE_SET_ARG("Could not set sky argument", intersect_kernel, arg++, sky_buffer)
+        PTCL_SAFE_SET_ARG("Could not set count argument", intersect_kernel, arg++, object_count)
+        PTCL_SAFE_SET_ARG("Could not set path count argument", intersect_kernel, arg++, n)
+        PTCL_SAFE_SET_ARG("Could not set sort argument", intersect_kernel, arg++, sort)
+        
+        PTCL_SAFE_SET_ARG("Could not set flag argument", sort_kernel, 0, flags)
+        PTCL_SAFE_SET_ARG("Could not set sorted path argument", sort_kernel, 1, sorted_paths)
+        PTCL_SAFE_SET_ARG("Could not set path count argument", sort_kernel, 2, n)
+        
+        arg = 0;
+        PTCL_SAFE_SET_ARG("Could not set ray argument", shade_all_kernel, arg++, rays)
+        PTCL_SAFE_SET_ARG("Could not set hit argument", shade_all_kernel, arg++, hits)
+        PTCL_SAFE_SET_ARG("Could not set throughput argument", shade_all_kernel, arg++, throughput)
+        PTCL_SAFE_SET_ARG("Could not set seed argument", shade_all_kernel, arg++, seeds)
+        PTCL_SAFE_SET_ARG("Could not set material argument", shade_all_kernel, arg++, material_buffer)
+        PTCL_SAFE_SET_ARG("Could not set path count argument", shade_all_kernel, arg++, n)
+        
+        for (int k = 1; k < WAVEFRONT_BUCKETS; ++k)
+        {
+            PTCL_SAFE_SET_ARG("Could not set sorted path argument", shade_kernels[k], 0, sorted_paths)
+            PTCL_SAFE_SET_ARG("Could not set ray argument", shade_kernels[k], 3, rays)
+            PTCL_SAFE_SET_ARG("Could not set hit argument", shade_kernels[k], 4, hits)
+            PTCL_SAFE_SET_ARG("Could not set throughput argument", shade_kernels[k], 5, throughput)
+            PTCL_SAFE_SET_ARG("Could not set seed argument", shade_kernels[k], 6, seeds)
+            PTCL_SAFE_SET_ARG("Could not set material argument", shade_kernels[k], 7, material_buffer)
+        }
+        
+        PTCL_SAFE_SET_ARG("Could not set throughput argument", resolve_kernel, 0, throughput)
+        PTCL_SAFE_SET_ARG("Could not set radiance argument", resolve_kernel, 1, radiance)
+        PTCL_SAFE_SET_ARG("Could not set accumulation argument", resolve_kernel, 2, accumulation)
+        PTCL_SAFE_SET_ARG("Could not set path count argument", resolve_kernel, 3, n)
+        
+        out_timings = cl_wavefront_timings();
+        auto render_start = std::chrono::high_resolution_clock::now();
+        
+        for (cl_uint frame = 0; frame < frames; ++frame)
+        {
+            PTCL_SAFE_SET_ARG("Could not set frame argument", generate_kernel, 7, frame)
+            clStatus = cmd_queue.enqueueNDRangeKernel(generate_kernel, cl::NullRange, cl::NDRange(global), cl::NDRange(local));
+            PTCL_ASSERT(clStatus, "Could not enqueue generate kernel")
+            
+            for (int bounce = 0; bounce < MAX_RECURSION; ++bounce)
+            {
+                cmd_queue.finish();
+                auto start = std::chrono::high_resolution_clock::now();
+                
+                clStatus = cmd_queue.enqueueNDRangeKernel(intersect_kernel, cl::NullRange, cl::NDRange(global), cl::NDRange(local));
+                PTCL_ASSERT(clStatus, "Could not enqueue intersect kernel")
+                cmd_queue.finish();
+                out_timings.intersect_ms += cl_wavefront_ms_since(start);
+                
+                if (!sorted)
+                {
+                    start = std::chrono::high_resolution_clock::now();
+                    clStatus = cmd_queue.enqueueNDRangeKernel(shade_all_kernel, cl::NullRange, cl::NDRange(global), cl::NDRange(local));
+                    PTCL_ASSERT(clStatus, "Could not enqueue shade kernel")
+                    cmd_queue.finish();
+                    out_timings.shade_ms += cl_wavefront_ms_since(start);
+                    continue;
+                }
+                
+                start = std::chrono::high_resolution_clock::now();
+                
+                clStatus = cl_scan(context, cmd_queue, scan_sum_kernel, add_block_sums_kernel, flags, WAVEFRONT_BUCKETS * n, block_size, block_sums);
+                PTCL_ASSERT(clStatus, "Could not scan flags")
+                
+                clStatus = cmd_queue.enqueueNDRangeKernel(sort_kernel, cl::NullRange, cl::NDRange(global), cl::NDRange(local));
+                PTCL_ASSERT(clStatus, "Could not enqueue sort kernel")
+                
+                /* inclusive scan, the last flag of every bucket is where the bucket ends */
+                cl_int ends[WAVEFRONT_BUCKETS];
+                for (int k = 0; k < WAVEFRONT_BUCKETS; ++k)
+                {
+                    PTCL_SAFE_OP("Could not read bucket end", enqueueReadBuffer, cmd_queue, flags, CL_FALSE, ((k + 1) * n - 1) * sizeof(cl_int), sizeof(cl_int), &ends[k])
+                }
+                cmd_queue.finish();
+                out_timings.sort_ms += cl_wavefront_ms_since(start);
+                
+                start = std::chrono::high_resolution_clock::now();
+                
+                for (int k = 1; k < WAVEFRONT_BUCKETS; ++k)
+                {
+                    cl_uint offset = (cl_uint)ends[k - 1];
+                    cl_uint count = (cl_uint)(ends[k] - ends[k - 1]);
+                    out_timings.bucket_paths[k] += count;
+                    
+                    if (count == 0) continue;
+                    
+                    PTCL_SAFE_SET_ARG("Could not set offset argument", shade_kernels[k], 1, offset)
+                    PTCL_SAFE_SET_ARG("Could not set count argument", shade_kernels[k], 2, count)
+                    
+                    clStatus = cmd_queue.enqueueNDRangeKernel(shade_kernels[k], cl::NullRange, cl::NDRange(((count + local - 1) / local) * local), cl::NDRange(local));
+                    PTCL_ASSERT(clStatus, "Could not enqueue material shade kernel")
+                }
+                
+                out_timings.bucket_paths[0] += (size_t)ends[0];
+                
+                cmd_queue.finish();
+                out_timings.shade_ms += cl_wavefront_ms_since(start);
+            }
+            
+            clStatus = cmd_queue.enqueueNDRangeKernel(resolve_kernel, cl::NullRange, cl::NDRange(global), cl::NDRange(local));
+            PTCL_ASSERT(clStatus, "Could not enqueue resolve kernel")
+        }
+        
+        cmd_queue.finish();
+        out_timings.total_ms = cl_wavefront_ms_since(render_start);
+        
+        PTCL_SAFE_OP("Could not read accumulation buffer", enqueueReadBuffer, cmd_queue, accumulation, CL_TRUE, 0, n * sizeof(cl_float4), out_frame.data())
+    }
+}
+
+#endif /* ptCLWavefront_h */
@@ -0,0 +1,199 @@
+#ifndef ptCounters_h
+#define ptCounters_h
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <iostream>
+
+#include "../assets/pt_counters.h"
+
+/*
+ * Render counters and stage timers, compiled in with PT_COUNTERS only. Without it the macros are empty.
+ *
+ * PT_COUNT(id, n) adds n to counter id (pt_counters.h) of the calling thread.
+ * PT_STAGE(stage) charges the time until the end of the scope to stage; stages nest and the time is exclusive,
+ * the intersections of the shadow rays go to STAGE_INTERSECT, not to STAGE_LIGHTS.
+ *
+ * Every thread writes its own block, blocks outlive their threads and counters_merge() sums them.
+ * Blocks of finished threads are reused by new ones with their counts, so there are never more blocks
+ * than threads alive at once, however many renders start threads.
+ * Merge and reset while no render is running.
+ */
+
+namespace pt
+{
+    enum CounterStage
+    {
+        STAGE_INTERSECT,
+        STAGE_SCATTER,
+        STAGE_LIGHTS,
+        STAGE_COUNT
+    };
+
+    struct CounterTotals
+    {
+        CounterTotals()
+        {
+            for (int i = 0; i < PT_COUNTER_COUNT; ++i) count[i] = 0;
+            for (int i = 0; i < STAGE_COUNT; ++i) stage_ms[i] = 0;
+        }
+
+        uint64_t count[PT_COUNTER_COUNT];
+        double stage_ms[STAGE_COUNT]; // summed over threads
+    };
+
+    struct CounterBlock : public CounterTotals
+    {
+        CounterBlock() : stage(-1), in_use(true) {}
+
+        int stage;
+        std::chrono::high_resolution_clock::time_point stage_start;
+        std::atomic<bool> in_use;
+    };
+
+    struct CounterRegistry
+    {
+        std::mutex mutex;
+        std::deque<std::unique_ptr<CounterBlock>> blocks;
+    };
+
+    inline CounterRegistry& counters_registry()
+    {
+        static CounterRegistry registry;
+        return registry;
+    }
+
+    /* Block of the calling thread, it goes back to the registry when the thread ends */
+    struct CounterThread
+    {
+        CounterThread() : block(NULL) {}
+        ~CounterThread() { if (block) block->in_use.store(false); }
+
+        CounterBlock* block;
+    };
+
+    /* The block of the calling thread, a free one or a new one on first use */
+    inline CounterBlock& counters_local()
+    {
+        thread_local CounterThread thread;
+
+        if (!thread.block)
+        {
+            CounterRegistry& registry = counters_registry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+
+            for (std::unique_ptr<CounterBlock>& b : registry.blocks)
+            {
+                bool expected = false;
+                if (b->in_use.compare_exchange_strong(expected, true)) { thread.block = b.get(); break; }
+            }
+
+            if (!thread.block)
+            {
+                registry.blocks.push_back(std::unique_ptr<CounterBlock>(new CounterBlock()));
+                thread.block = registry.blocks.back().get();
+            }
+        }
+
+        return *thread.block;
+    }
+
+    /* Blocks in the registry, in use or free */
+    inline size_t counters_block_count()
+    {
+        CounterRegistry& registry = counters_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        return registry.blocks.size();
+    }
+
+    inline CounterTotals counters_merge()
+    {
+        CounterRegistry& registry = counters_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        CounterTotals totals;
+
+        for (const std::unique_ptr<CounterBlock>& block : registry.blocks)
+        {
+            for (int i = 0; i < PT_COUNTER_COUNT; ++i) totals.count[i] += block->count[i];
+            for (int i = 0; i < STAGE_COUNT; ++i) totals.stage_ms[i] += block->stage_ms[i];
+        }
+
+        return totals;
+    }
+
+    inline void counters_reset()
+    {
+        CounterRegistry& registry = counters_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        for (std::unique_ptr<CounterBlock>& block : registry.blocks)
+            *static_cast<CounterTotals*>(block.get()) = CounterTotals();
+    }
+
+    /* Exclusive stage time, see PT_STAGE */
+    class CounterStageScope
+    {
+    public:
+        CounterStageScope(int stage) : block(counters_local())
+        {
+            std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+            charge(now);
+            previous = block.stage;
+            block.stage = stage;
+        }
+
+        ~CounterStageScope()
+        {
+            charge(std::chrono::high_resolution_clock::now());
+            block.stage = previous;
+        }
+
+    private:
+        void charge(const std::chrono::high_resolution_clock::time_point& now)
+        {
+            if (block.stage >= 0)
+                block.stage_ms[block.stage] += std::chrono::duration<double, std::milli>(now - block.stage_start).count();
+            block.stage_start = now;
+        }
+
+        CounterBlock& block;
+        int previous;
+    };
+
+    inline void counters_print(const CounterTotals& totals, std::ostream& out = std::cout)
+    {
+        const uint64_t* c = totals.count;
+        double paths = (double)std::max<uint64_t>(c[PT_COUNTER_PATHS], 1);
+        double rays = (double)std::max<uint64_t>(c[PT_COUNTER_RAYS], 1);
+
+        out << "=========== COUNTERS ===========\n";
+        out << "Paths : " << c[PT_COUNTER_PATHS] << "\n"
+        << "Rays : " << c[PT_COUNTER_RAYS] << " (shadow " << c[PT_COUNTER_SHADOW_RAYS] << ")\n"
+        << "Bounces : " << c[PT_COUNTER_BOUNCES] << "\n"
+        << "Russian roulette terminations : " << c[PT_COUNTER_RR_TERMINATIONS] << "\n"
+        << "Intersection tests : " << c[PT_COUNTER_INTERSECTION_TESTS] << "\n"
+        << "Average path length : " << (double)(c[PT_COUNTER_RAYS] - c[PT_COUNTER_SHADOW_RAYS]) / paths << " rays\n"
+        << "Tests per ray : " << (double)c[PT_COUNTER_INTERSECTION_TESTS] / rays << "\n"
+        << "Intersect : " << totals.stage_ms[STAGE_INTERSECT] << " ms, " << 1e6 * totals.stage_ms[STAGE_INTERSECT] / rays << " ns per ray\n"
+        << "Scatter : " << totals.stage_ms[STAGE_SCATTER] << " ms\n"
+        << "Lights : " << totals.stage_ms[STAGE_LIGHTS] << " ms\n";
+        out << "================================\n\n";
+    }
+}
+
+#ifdef PT_COUNTERS
+#define PT_COUNT(id, n) (pt::counters_local().count[id] += (uint64_t)(n))
+#define PT_STAGE_CAT_(a, b) a##b
+#define PT_STAGE_CAT(a, b) PT_STAGE_CAT_(a, b)
+#define PT_STAGE(stage) pt::CounterStageScope PT_STAGE_CAT(pt_stage_scope_, __LINE__)(stage)
+#else
+#define PT_COUNT(id, n) ((void)0)
+#define PT_STAGE(stage) ((void)0)
+#endif
+
+#endif /* ptCounters_h */
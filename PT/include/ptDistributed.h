@@ -0,0 +1,528 @@
+#ifndef ptDistributed_h
+#define ptDistributed_h
+
+#include <stdint.h>
+#include <errno.h>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "PathTracer.h"
+
+/*
+ * PathTracer frames farmed out to worker processes on the same machine.
+ *
+ * The coordinator forks the workers once the scene is in memory, so they share it without a copy, and talks to each
+ * over its own socket pair: a job is a tile of the image and a sample pass, the reply the tile traced by
+ * PathTracer::TraceTile as floats. Pixel generators are seeded from the pixel and the pass (PathTracer::samplePass),
+ * so a job gives the same pixels in any worker, and the coordinator adds the passes of a tile in pass order once
+ * all of them are in: the image depends on neither the number of workers nor the order replies arrive in.
+ *
+ * A worker that dies, breaks the protocol, gives no reply within jobTimeoutMs or stalls as long halfway through one is reaped,
+ * its job goes back to the queue
+ * and another worker is forked in its place, up to maxRespawns times a frame. Workers do not trace (ptTrace.h),
+ * their spans would stay in their copy of the registry. POSIX only.
+ */
+
+namespace pt
+{
+#if !defined(_WIN32)
+
+#ifdef MSG_NOSIGNAL
+#define PT_DISTRIBUTED_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define PT_DISTRIBUTED_SEND_FLAGS 0
+#endif
+
+    /* Tile and sample pass for a worker to trace, DistributedStop as tile ends the worker */
+    struct DistributedJob
+    {
+        uint32_t tile;
+        uint32_t pass;
+    };
+
+    /* Header of a reply, floats of rgb pixels in image space follow */
+    struct DistributedReply
+    {
+        uint32_t tile;
+        uint32_t pass;
+        uint32_t floats;
+        uint32_t pad;
+    };
+
+    static const uint32_t DistributedStop = 0xffffffffu;
+
+    /* Writes all of data, false once the other end is gone. Never raises SIGPIPE */
+    inline bool distributed_write(int fd, const void* data, size_t bytes)
+    {
+        const char* p = (const char*)data;
+
+        while (bytes > 0)
+        {
+            ssize_t n = send(fd, p, bytes, PT_DISTRIBUTED_SEND_FLAGS);
+
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+
+            p += n;
+            bytes -= (size_t)n;
+        }
+
+        return true;
+    }
+
+    /* Reads all of data, false on end of stream, error or once timeoutMs ran out, -1 waits forever */
+    inline bool distributed_read(int fd, void* data, size_t bytes, int timeoutMs = -1)
+    {
+        char* p = (char*)data;
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+        while (bytes > 0)
+        {
+            // a peer that stops halfway through is given no more than what was left
+            if (timeoutMs >= 0)
+            {
+                int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+                struct pollfd pfd = { fd, POLLIN, 0 };
+                int ready = poll(&pfd, 1, (int)std::max(left, (int64_t)0));
+
+                if (ready < 0 && errno == EINTR) continue;
+                if (ready <= 0) return false;
+            }
+
+            ssize_t n = read(fd, p, bytes);
+
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+
+            p += n;
+            bytes -= (size_t)n;
+        }
+
+        return true;
+    }
+
+    /*
+     * Coordinator of workers processes tracing tiles of a frame, passes times samples per pixel
+     */
+    template <typename T>
+    class DistributedTracer
+    {
+    public:
+        unsigned int workers;
+        unsigned int passes;
+        unsigned int tileSize;
+        unsigned int maxRespawns;
+        unsigned int jobTimeoutMs; // for a reply to a job, then for the reply to arrive in full, before the worker is lost, 0 waits forever
+
+        /*
+         * For tests: worker faultWorker exits without a reply to its job number faultAfter, or hangs when faultHang,
+         * after sending half of the reply when faultMidReply. The workers forked in its place do not
+         */
+        int faultWorker;
+        unsigned int faultAfter;
+        bool faultHang;
+        bool faultMidReply;
+
+        /* Workers lost during the last Trace */
+        unsigned int workersLost;
+
+        /*
+         * Streams the mean of the passes into sink tile by tile, as PathTracer::Trace streams one pass
+         * Throws when every worker died and none may be forked any more
+         */
+        void Trace(const Scene<T>& scene,
+            unsigned int width,
+            unsigned int height,
+            unsigned int samples,
+            const glm::dvec3& camPos,
+            const glm::dvec3& camDir,
+            double camFovRadians,
+            TileSink& sink,
+            double* rendertime)
+        {
+            scene.updateLights(); // before the fork, the workers inherit them
+            if (workers == 0 || passes == 0 || tileSize == 0) throw "Distributed tracing needs workers, passes and tiles";
+
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            TraceScope span("DistributedTrace", "cpu", "workers", workers);
+
+            Frame frame;
+            frame.width = width;
+            frame.height = height;
+            frame.samples = std::max(1u, samples / 4); // dim of multi-sampled area, as in PathTracer::Trace
+            frame.tilesX = (width + tileSize - 1) / tileSize;
+            frame.tiles = frame.tilesX * ((height + tileSize - 1) / tileSize);
+            PathTracer<T>::CameraBasis(width, height, camPos, camDir, camFovRadians, frame.cam, frame.cx, frame.cy);
+
+            std::deque<DistributedJob> queue;
+            for (uint32_t t = 0; t < frame.tiles; ++t)
+                for (uint32_t p = 0; p < passes; ++p) queue.push_back(DistributedJob{ t, p });
+
+            std::map<uint32_t, std::vector<std::vector<float>>> pending; // passes of the tiles in flight
+            std::vector<Worker> pool(workers);
+            unsigned int respawns = 0;
+            unsigned int tilesLeft = frame.tiles;
+            workersLost = 0;
+
+            for (unsigned int w = 0; w < workers; ++w) spawn(pool, w, scene, frame, faultWorker == (int)w);
+
+            try
+            {
+                while (tilesLeft > 0)
+                {
+                    std::vector<struct pollfd> fds;
+                    std::vector<unsigned int> polled;
+
+                    for (unsigned int w = 0; w < workers; ++w)
+                    {
+                        Worker& worker = pool[w];
+
+                        if (worker.pid > 0 && !worker.busy && !queue.empty())
+                        {
+                            worker.job = queue.front();
+                            queue.pop_front();
+                            worker.busy = true;
+                            worker.sent = std::chrono::steady_clock::now();
+
+                            if (!distributed_write(worker.fd, &worker.job, sizeof(DistributedJob))) lose(pool, w, queue);
+                        }
+
+                        if (worker.pid <= 0 && respawns < maxRespawns && (!queue.empty() || alive(pool) == 0))
+                        {
+                            ++respawns;
+                            spawn(pool, w, scene, frame, false);
+                            --w; // hand it a job
+                            continue;
+                        }
+
+                        if (worker.pid > 0 && worker.busy)
+                        {
+                            struct pollfd fd = { worker.fd, POLLIN, 0 };
+                            fds.push_back(fd);
+                            polled.push_back(w);
+                        }
+                    }
+
+                    if (fds.empty()) throw "All render workers died";
+
+                    // until the oldest job runs out of time
+                    int timeout = -1;
+
+                    if (jobTimeoutMs > 0)
+                    {
+                        int64_t left = jobTimeoutMs;
+                        for (unsigned int w : polled) left = std::min(left, (int64_t)jobTimeoutMs - waited(pool[w]));
+                        timeout = (int)std::max(left, (int64_t)0);
+                    }
+
+                    if (poll(fds.data(), (nfds_t)fds.size(), timeout) < 0)
+                    {
+                        if (errno == EINTR) continue;
+                        throw "Could not poll the render workers";
+                    }
+
+                    for (size_t i = 0; i < fds.size(); ++i)
+                    {
+                        unsigned int w = polled[i];
+                        Worker& worker = pool[w];
+
+                        if (!fds[i].revents)
+                        {
+                            // a reply that came in while another one was read is taken on the next poll
+                            if (jobTimeoutMs > 0 && waited(worker) >= (int64_t)jobTimeoutMs && !readable(worker.fd)) lose(pool, w, queue);
+                            continue;
+                        }
+                        unsigned int x, y, tw, th;
+                        frame.tileRect(worker.job.tile, tileSize, x, y, tw, th);
+
+                        DistributedReply reply;
+                        std::vector<float> pixels(3 * tw * th);
+
+                        // a reply under way gets jobTimeoutMs to arrive in full, a worker stalled in it is lost
+                        std::chrono::steady_clock::time_point replied = std::chrono::steady_clock::now();
+
+                        if (!distributed_read(worker.fd, &reply, sizeof(reply), timeLeft(replied))
+                            || reply.tile != worker.job.tile || reply.pass != worker.job.pass || reply.floats != pixels.size()
+                            || !distributed_read(worker.fd, pixels.data(), pixels.size() * sizeof(float), timeLeft(replied)))
+                        {
+                            lose(pool, w, queue);
+                            continue;
+                        }
+
+                        worker.busy = false;
+
+                        std::vector<std::vector<float>>& tile = pending[reply.tile];
+                        tile.resize(passes);
+                        tile[reply.pass].swap(pixels);
+
+                        bool complete = true;
+                        for (const std::vector<float>& pass : tile) complete = complete && !pass.empty();
+                        if (!complete) continue;
+
+                        // passes added in double and in order, whichever came first, the mean goes out as the floats it came in
+                        std::vector<glm::vec3> out(tw * th);
+
+                        for (unsigned int k = 0; k < tw * th; ++k)
+                        {
+                            glm::dvec3 sum(0);
+                            for (unsigned int p = 0; p < passes; ++p) sum += glm::dvec3(tile[p][3 * k], tile[p][3 * k + 1], tile[p][3 * k + 2]);
+                            out[k] = glm::vec3(sum / (double)passes);
+                        }
+
+                        sink.writeTile(x, y, tw, th, out.data());
+                        pending.erase(reply.tile);
+                        --tilesLeft;
+                    }
+                }
+            }
+            catch (...)
+            {
+                stop(pool);
+                throw;
+            }
+
+            stop(pool);
+
+            if (const char* error = sink.getError()) throw error;
+
+            std::chrono::duration<double> elapsed_seconds = std::chrono::high_resolution_clock::now() - start;
+            *rendertime = elapsed_seconds.count();
+        }
+
+        /*
+         * Renders into a caller owned FrameBuffer, see PathTracer::Trace
+         */
+        void Trace(const Scene<T>& scene,
+            unsigned int width,
+            unsigned int height,
+            unsigned int samples,
+            const glm::dvec3& camPos,
+            const glm::dvec3& camDir,
+            double camFovRadians,
+            FrameBuffer& frame,
+            double* rendertime)
+        {
+            frame.resize(width, height);
+
+            Trace(scene, width, height, samples, camPos, camDir, camFovRadians, static_cast<TileSink&>(frame), rendertime);
+        }
+
+        DistributedTracer(unsigned int _workers = 4, unsigned int _passes = 1)
+            : workers(_workers)
+            , passes(_passes)
+            , tileSize(PathTracer<T>::DefaultTileSize)
+            , maxRespawns(_workers)
+            , jobTimeoutMs(60000)
+            , faultWorker(-1)
+            , faultAfter(0)
+            , faultHang(false)
+            , faultMidReply(false)
+            , workersLost(0) {}
+
+        DistributedTracer(const DistributedTracer& other) = delete;
+        void operator=(const DistributedTracer& other) = delete;
+
+    private:
+        struct Worker
+        {
+            Worker() : pid(0), fd(-1), busy(false) {}
+
+            pid_t pid; // 0 once lost
+            int fd;
+            bool busy;
+            DistributedJob job;
+            std::chrono::steady_clock::time_point sent; // of the job
+        };
+
+        /* What workers need to trace a job, set before they fork */
+        struct Frame
+        {
+            unsigned int width, height, samples, tilesX, tiles;
+            Ray<T> cam;
+            ptvec<T> cx, cy;
+
+            /* Tile t in image space, top row first, as PathTracer::TraceTiles enumerates them */
+            void tileRect(uint32_t t, unsigned int size, unsigned int& x, unsigned int& y, unsigned int& w, unsigned int& h) const
+            {
+                x = (t % tilesX) * size;
+                y = (t / tilesX) * size;
+                w = std::min(size, width - x);
+                h = std::min(size, height - y);
+            }
+        };
+
+        /* Milliseconds since the job of worker was sent */
+        static int64_t waited(const Worker& worker)
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - worker.sent).count();
+        }
+
+        /* Milliseconds left of jobTimeoutMs from since, -1 without it */
+        int timeLeft(const std::chrono::steady_clock::time_point& since) const
+        {
+            if (jobTimeoutMs == 0) return -1;
+            int64_t spent = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count();
+            return (int)std::max((int64_t)jobTimeoutMs - spent, (int64_t)0);
+        }
+
+        static bool readable(int fd)
+        {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            return poll(&pfd, 1, 0) > 0;
+        }
+
+        static unsigned int alive(const std::vector<Worker>& pool)
+        {
+            unsigned int n = 0;
+            for (const Worker& worker : pool) n += worker.pid > 0;
+            return n;
+        }
+
+        void spawn(std::vector<Worker>& pool, unsigned int w, const Scene<T>& scene, const Frame& frame, bool fault)
+        {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) throw "Could not create a worker socket";
+
+#ifdef SO_NOSIGPIPE
+            int one = 1;
+            setsockopt(fds[0], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+            setsockopt(fds[1], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+            pid_t pid = fork();
+
+            if (pid < 0)
+            {
+                close(fds[0]);
+                close(fds[1]);
+                throw "Could not fork a render worker";
+            }
+
+            if (pid == 0)
+            {
+                close(fds[0]);
+                for (const Worker& other : pool) if (other.pid > 0) close(other.fd);
+
+                // spans of the child would never be written, and must not touch the buffers the coordinator's threads held at the fork
+                trace_enable(false);
+
+                int status = 2;
+                try
+                {
+                    status = work(fds[1], scene, frame, fault);
+                }
+                catch (...)
+                {
+                }
+
+                _exit(status);
+            }
+
+            close(fds[1]);
+
+            pool[w].pid = pid;
+            pool[w].fd = fds[0];
+            pool[w].busy = false;
+        }
+
+        /* Worker process: traces jobs until told to stop, returns its exit status */
+        int work(int fd, const Scene<T>& scene, const Frame& frame, bool fault)
+        {
+            PathTracer<T> tracer;
+            std::vector<ptvec<T>> tile(tileSize * tileSize);
+            std::vector<float> pixels(3 * tileSize * tileSize);
+            DistributedJob job;
+
+            for (unsigned int n = 0; ; ++n)
+            {
+                if (!distributed_read(fd, &job, sizeof(job))) return 1;
+                if (job.tile == DistributedStop) return 0;
+                if (fault && n == faultAfter && !faultMidReply)
+                {
+                    while (faultHang) pause(); // until lose kills it
+                    return 3;
+                }
+
+                unsigned int x, y, w, h;
+                frame.tileRect(job.tile, tileSize, x, y, w, h);
+
+                std::fill(tile.begin(), tile.begin() + w * h, ptvec<T>(0));
+                tracer.samplePass = job.pass;
+                tracer.TraceTile(scene,
+                    x, x + w,
+                    frame.height - y - h, frame.height - y,
+                    frame.width, frame.height, frame.samples,
+                    frame.cam, frame.cx, frame.cy,
+                    tile.data());
+
+                for (unsigned int k = 0; k < w * h; ++k)
+                {
+                    pixels[3 * k] = (float)tile[k].x;
+                    pixels[3 * k + 1] = (float)tile[k].y;
+                    pixels[3 * k + 2] = (float)tile[k].z;
+                }
+
+                DistributedReply reply = { job.tile, job.pass, 3 * w * h, 0 };
+
+                if (fault && n == faultAfter)
+                {
+                    distributed_write(fd, &reply, sizeof(reply));
+                    distributed_write(fd, pixels.data(), 3 * w * h * sizeof(float) / 2);
+                    while (faultHang) pause();
+                    return 3;
+                }
+
+                if (!distributed_write(fd, &reply, sizeof(reply)) || !distributed_write(fd, pixels.data(), 3 * w * h * sizeof(float))) return 1;
+            }
+        }
+
+        /* Kills and reaps worker w, its job goes back to the front of the queue */
+        void lose(std::vector<Worker>& pool, unsigned int w, std::deque<DistributedJob>& queue)
+        {
+            Worker& worker = pool[w];
+
+            if (worker.busy) queue.push_front(worker.job);
+
+            kill(worker.pid, SIGKILL);
+            close(worker.fd);
+            waitpid(worker.pid, NULL, 0);
+
+            worker = Worker();
+            ++workersLost;
+        }
+
+        /* Tells the live workers to stop and reaps them */
+        void stop(std::vector<Worker>& pool)
+        {
+            DistributedJob job = { DistributedStop, 0 };
+
+            for (Worker& worker : pool)
+            {
+                if (worker.pid <= 0) continue;
+                if (!distributed_write(worker.fd, &job, sizeof(job))) kill(worker.pid, SIGKILL);
+                close(worker.fd);
+            }
+
+            for (Worker& worker : pool)
+            {
+                if (worker.pid > 0) waitpid(worker.pid, NULL, 0);
+                worker = Worker();
+            }
+        }
+    };
+
+#endif
+}
+
+#endif /* ptDistributed_h */
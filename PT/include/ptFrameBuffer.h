@@ -0,0 +1,173 @@
+#ifndef ptFrameBuffer_h
+#define ptFrameBuffer_h
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include "glm/glm.hpp"
+#include "ptUtil.h"
+#include "ptImageIO.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace pt
+{
+    /* size must be a multiple of alignment on some platforms, callers round it up */
+    inline void* aligned_malloc(size_t size, size_t alignment)
+    {
+#if defined(_WIN32)
+        return _aligned_malloc(size, alignment);
+#else
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, alignment, size) != 0) return nullptr;
+        return ptr;
+#endif
+    }
+
+    inline void aligned_free(void* ptr)
+    {
+#if defined(_WIN32)
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    /*
+     * Convert count floats to 8 bit, clamped to [0,1] and scaled to [0,255]
+     * Same rounding as to255Linear, 16 values per iteration with SSE2
+     */
+    inline void float_to_rgb8(const float* in, unsigned char* out, size_t count)
+    {
+        size_t i = 0;
+
+#ifdef __SSE2__
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i q[4];
+
+            for (int k = 0; k < 4; ++k)
+            {
+                __m128 v = _mm_loadu_ps(in + i + 4 * k);
+                v = _mm_min_ps(_mm_max_ps(v, zero), one);
+                q[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), half));
+            }
+
+            __m128i lo = _mm_packs_epi32(q[0], q[1]);
+            __m128i hi = _mm_packs_epi32(q[2], q[3]);
+            _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+        }
+#endif
+
+        for (; i < count; ++i)
+            out[i] = (unsigned char)to255Linear<float>(in[i]);
+    }
+
+    /*
+     * Float RGB accumulation buffer, reusable across Trace calls
+     * Storage is one aligned block which only grows, so repeated renders
+     * (animations, progressive passes) do not allocate or page fault every frame.
+     * It is also a TileSink, rows are stored top-down.
+     */
+    class FrameBuffer : public TileSink
+    {
+    public:
+        static const size_t Alignment = 64;
+
+        FrameBuffer() : data(nullptr), capacity(0), width(0), height(0) {}
+
+        FrameBuffer(unsigned int _width, unsigned int _height) : FrameBuffer()
+        {
+            resize(_width, _height);
+        }
+
+        ~FrameBuffer()
+        {
+            aligned_free(data);
+        }
+
+        /* Contents are undefined after a resize, storage is reallocated only if it has to grow */
+        void resize(unsigned int _width, unsigned int _height)
+        {
+            size_t required = 3 * (size_t)_width * (size_t)_height;
+
+            if (required > capacity)
+            {
+                size_t bytes = ((required * sizeof(float) + Alignment - 1) / Alignment) * Alignment;
+                float* storage = (float*)aligned_malloc(bytes, Alignment);
+                if (!storage) throw "Could not allocate frame buffer.";
+
+                aligned_free(data);
+                data = storage;
+                capacity = bytes / sizeof(float);
+            }
+
+            width = _width;
+            height = _height;
+        }
+
+        void clear()
+        {
+            if (data) memset(data, 0, size() * sizeof(float));
+        }
+
+        void writeTile(unsigned int x, unsigned int y, unsigned int w, unsigned int h, const glm::dvec3* tile) override { writeTileOf(x, y, w, h, tile); }
+        void writeTile(unsigned int x, unsigned int y, unsigned int w, unsigned int h, const glm::vec3* tile) override { writeTileOf(x, y, w, h, tile); }
+
+        /* A tile of dvec3 or vec3 */
+        template <typename V>
+        void writeTileOf(unsigned int x, unsigned int y, unsigned int w, unsigned int h, const V* tile)
+        {
+            for (unsigned int j = 0; j < h; ++j)
+            {
+                float* row = data + 3 * ((size_t)(y + j) * width + x);
+
+                for (unsigned int i = 0; i < w; ++i)
+                {
+                    const V& c = tile[j * w + i];
+                    row[3 * i + 0] = (float)c.x;
+                    row[3 * i + 1] = (float)c.y;
+                    row[3 * i + 2] = (float)c.z;
+                }
+            }
+        }
+
+        /* out must hold 3 * width * height bytes */
+        void toRGB8(unsigned char* out) const
+        {
+            float_to_rgb8(data, out, size());
+        }
+
+        void writePPM(const std::string& filename) const
+        {
+            write_ppm<float>(data, width, height, 3, BUFFER_TRANSFORM_255_CLAMP, filename);
+        }
+
+        float* getData() { return data; }
+        const float* getData() const { return data; }
+        unsigned int getWidth() const { return width; }
+        unsigned int getHeight() const { return height; }
+        size_t size() const { return 3 * (size_t)width * (size_t)height; }
+        size_t getCapacity() const { return capacity; }
+
+        FrameBuffer(const FrameBuffer& other) = delete;
+        void operator=(const FrameBuffer& other) = delete;
+
+    private:
+        float*          data;
+        size_t          capacity; // in floats
+        unsigned int    width;
+        unsigned int    height;
+    };
+
+}
+
+#endif /* ptFrameBuffer_h */
@@ -12,6 +12,9 @@
 #include "glm/glm.hpp"
 #include "ptUtil.h"
 #include "ptRandom.h"
+#include "ptCounters.h"
+#include "ptTaskPool.h"
+#include "../assets/pt_optics.h"
 
 namespace pt
 {
@@ -103,6 +106,10 @@ namespace pt
         ptvec<T> getLowerLeft() const { return lower_left; }
         ptvec<T> getHor() const { return hor; }
         ptvec<T> getVer() const { return ver; }
+        ptvec<T> getU() const { return u; }
+        ptvec<T> getV() const { return v; }
+        ptvec<T> getW() const { return w; }
+        T getLensRadius() const { return lens_radius; }
         
     private:
         ptvec<T> origin;
@@ -132,17 +139,158 @@ namespace pt
                                       const T& t_max = std::numeric_limits<T>::infinity()) const = 0;
         
         virtual ptvec<T> normalAt(const ptvec<T>& point) const = 0;
+        
+        /* Axis aligned box around the primitive, for the BVH */
+        virtual void bounds(ptvec<T>& out_min, ptvec<T>& out_max) const = 0;
+    };
+    
+    template <typename T> class BVH;
+    
+    enum BVHBuild
+    {
+        BVH_BUILD_SAH,      // binned SAH, the splits of large ranges run in parallel
+        BVH_BUILD_LBVH,     // Morton codes of the centroids, for quick rebuilds
+        BVH_BUILD_MEDIAN    // median of the longest axis
     };
     
+    /*
+     * The primitives of a scene. intersect_simple goes through the BVH when one was built for the current primitives
+     * (buildBVH, or setBVH with a prebuilt one), and tests them all otherwise: build it again after changing the list.
+     */
     template <typename T>
     class PrimitiveList : public std::vector<std::shared_ptr<Primitive<T>>>
     {
     public:
+        /* What the renderers keep of a hit (see InstanceList), here the index of the primitive */
+        typedef size_t Hit;
+        
         bool intersect_simple(const pt::Ray<T>& ray,
                               T& t_out,
                               size_t& idx_t,
                               const T& t_min = 0,
                               const T& t_max = std::numeric_limits<T>::infinity()) const;
+        
+        ptvec<T> normalAt(const Hit& hit, const ptvec<T>& point) const { return (*this)[hit]->normalAt(point); }
+        
+        /* Index of the material of the hit primitive, one material per primitive */
+        size_t materialAt(const Hit& hit) const { return hit; }
+        
+        void clear() { std::vector<std::shared_ptr<Primitive<T>>>::clear(); bvh.reset(); }
+        
+        void buildBVH(BVHBuild method = BVH_BUILD_SAH);
+        void setBVH(const std::shared_ptr<BVH<T>>& _bvh) { bvh = _bvh; }
+        const std::shared_ptr<BVH<T>>& getBVH() const { return bvh; }
+        
+    private:
+        std::shared_ptr<BVH<T>> bvh;
+    };
+    
+    /*
+     * Bounding volume hierarchy over the primitives of a PrimitiveList, nodes in one array with the root first.
+     * An inner node has count 0 and its children at left_first and left_first + 1, after it in the array,
+     * a leaf covers indices[left_first, left_first + count). Same layout as the device BVHNode (pt_types.h).
+     *
+     * Leaves hold up to MaxLeafSize primitives, more only where the centroids are all the same or at MaxDepth.
+     * Nodes come from an arena of 2n nodes in pairs of children, ranges of thousands of primitives give their
+     * right child to another task of the pool: the order of the nodes differs from build to build, the tree does not.
+     * The SAH build bins the centroids of every node in 16 bins per axis. The LBVH build sorts the Morton codes
+     * of the centroids once, splits where the highest differing bit flips and computes the boxes bottom up.
+     */
+    template <typename T>
+    class BVH
+    {
+    public:
+        struct Node
+        {
+            ptvec<T> bmin;
+            ptvec<T> bmax;
+            int left_first;
+            int count;
+        };
+        
+        static const int MaxLeafSize = 4;
+        static const int MaxDepth = 64;
+        
+        void build(const PrimitiveList<T>& list, BVHBuild method = BVH_BUILD_SAH, TaskPool& pool = task_pool());
+        
+        /* Over the boxes of n items, indices are in [0, n) */
+        void build(const std::vector<ptvec<T>>& bmin,
+                   const std::vector<ptvec<T>>& bmax,
+                   BVHBuild method = BVH_BUILD_SAH,
+                   TaskPool& pool = task_pool());
+        
+        /* Closest hit in (t_min, t_max), idx_t is the index in list */
+        bool intersect(const PrimitiveList<T>& list,
+                       const pt::Ray<T>& ray,
+                       T& t_out,
+                       size_t& idx_t,
+                       const T& t_min = 0,
+                       const T& t_max = std::numeric_limits<T>::infinity()) const;
+        
+        /* Whether the BVH was built over n primitives */
+        bool covers(size_t n) const { return !nodes.empty() && indices.size() == n; }
+        
+        /*
+         * Visits the leaves the ray enters before t_far, nearer child first, skipping the boxes behind the closest hit so far.
+         * leaf(index, t_far) tests the item at index and returns true on a hit, after lowering t_far to it.
+         */
+        template <typename LeafTest>
+        bool traverse(const pt::Ray<T>& ray, const T& t_min, T& t_far, LeafTest leaf) const
+        {
+            bool has_hit = false;
+            ptvec<T> inv_dir = ptvec<T>(1) / ray.dir;
+            if (nodes.empty() || entry(nodes[0], ray.origin, inv_dir, t_min, t_far) < 0) return false;
+            
+            int stack[MaxDepth];
+            int top = 0;
+            stack[top++] = 0;
+            
+            while (top > 0)
+            {
+                const Node& node = nodes[stack[--top]];
+                
+                if (node.count > 0)
+                {
+                    PT_COUNT(PT_COUNTER_INTERSECTION_TESTS, node.count);
+                    
+                    for (int i = node.left_first; i < node.left_first + node.count; ++i)
+                        has_hit |= leaf(indices[i], t_far);
+                    
+                    continue;
+                }
+                
+                T enter_left = entry(nodes[node.left_first], ray.origin, inv_dir, t_min, t_far);
+                T enter_right = entry(nodes[node.left_first + 1], ray.origin, inv_dir, t_min, t_far);
+                
+                if (enter_left >= 0 && enter_right >= 0)
+                {
+                    bool left_first = enter_left <= enter_right;
+                    stack[top++] = left_first ? node.left_first + 1 : node.left_first;
+                    stack[top++] = left_first ? node.left_first : node.left_first + 1;
+                }
+                else if (enter_left >= 0) stack[top++] = node.left_first;
+                else if (enter_right >= 0) stack[top++] = node.left_first + 1;
+            }
+            
+            return has_hit;
+        }
+        
+        /* Entry distance of the ray in the box of node if it enters before t_far, -1 otherwise */
+        static T entry(const Node& node, const ptvec<T>& origin, const ptvec<T>& inv_dir, const T& t_min, const T& t_far)
+        {
+            ptvec<T> t0 = (node.bmin - origin) * inv_dir;
+            ptvec<T> t1 = (node.bmax - origin) * inv_dir;
+            ptvec<T> lo = glm::min(t0, t1);
+            ptvec<T> hi = glm::max(t0, t1);
+            
+            T enter = std::max(t_min, std::max(lo.x, std::max(lo.y, lo.z)));
+            T leave = std::min(t_far, std::min(hi.x, std::min(hi.y, hi.z)));
+            
+            return (enter <= leave) ? enter : -1;
+        }
+        
+        std::vector<Node> nodes;
+        std::vector<uint32_t> indices;
     };
     
     /*
@@ -171,6 +319,8 @@ namespace pt
         
         ptvec<T> normalAt(const ptvec<T>& point) const;
         
+        void bounds(ptvec<T>& out_min, ptvec<T>& out_max) const;
+        
         ptvec<T> getCenter() const;
         T getRadius() const;
         
@@ -185,34 +335,174 @@ namespace pt
     
     typedef std::shared_ptr<Sphere<float>>      fSphereRef;
     
+    /*
+     * A triangle of a mesh, v0 and the edges to v1 and v2. The normal is the geometric one
+     * on the side the vertices are counter clockwise from, hits are on both sides (Moller-Trumbore)
+     */
+    template <typename T>
+    class Triangle : public Primitive<T>
+    {
+    public:
+        Triangle(const ptvec<T>& v0, const ptvec<T>& v1, const ptvec<T>& v2);
+        
+        T intersect(const pt::Ray<T>& ray) const;
+        
+        bool intersect_check(const pt::Ray<T>& ray) const;
+        
+        T intersect_simple(const pt::Ray<T>& ray) const;
+        
+        bool intersect_simple(const pt::Ray<T>& ray,
+                              T& t_out,
+                              const T& t_min = 0,
+                              const T& t_max = std::numeric_limits<T>::infinity()) const;
+        
+        ptvec<T> normalAt(const ptvec<T>& point) const;
+        
+        void bounds(ptvec<T>& out_min, ptvec<T>& out_max) const;
+        
+        ptvec<T> getVertex(int i) const;
+        ptvec<T> getEdge1() const { return e1; }
+        ptvec<T> getEdge2() const { return e2; }
+        
+    private:
+        ptvec<T>    v0;
+        ptvec<T>    e1;
+        ptvec<T>    e2;
+        ptvec<T>    normal;
+    };
+    
+    typedef std::shared_ptr<Triangle<float>>    fTriangleRef;
     
+    /*
+     * Affine transform p' = (rows[0].p, rows[1].p, rows[2].p) + offset.
+     * Same layout as the to_object of the device Instance (pt_types.h), the offset in w there.
+     */
+    template <typename T>
+    class Transform
+    {
+    public:
+        Transform();
+        Transform(const ptvec<T>& row0, const ptvec<T>& row1, const ptvec<T>& row2, const ptvec<T>& _offset);
+        
+        static Transform translation(const ptvec<T>& t);
+        static Transform scale(const T& s);
+        static Transform rotationY(const T& degrees);
+        
+        /* this after other */
+        Transform operator*(const Transform& other) const;
+        
+        /* Throws when the linear part is singular */
+        Transform inverse() const;
+        
+        ptvec<T> point(const ptvec<T>& p) const;
+        ptvec<T> vector(const ptvec<T>& v) const;
+        
+        /* Normal through the inverse of this transform, the transpose of the linear part (not normalized) */
+        ptvec<T> normalFromInverse(const ptvec<T>& n) const;
+        
+        ptvec<T> rows[3];
+        ptvec<T> offset;
+    };
+    
+    /*
+     * Primitives stored once for all the instances of them: the bottom level of an InstanceList.
+     * materials has a material index for every primitive, overridden by the instances that have one.
+     * build() the BVH after filling the primitives and before instancing them.
+     */
+    template <typename T>
+    class Geometry
+    {
+    public:
+        void build(BVHBuild method = BVH_BUILD_SAH) { primitives.buildBVH(method); }
+        bool isBuilt() const { return primitives.getBVH() && primitives.getBVH()->covers(primitives.size()); }
+        
+        /* Box of the BVH root, the geometry must be built */
+        void bounds(ptvec<T>& out_min, ptvec<T>& out_max) const;
+        
+        /* Closest hit through the BVH, ray in object space */
+        bool intersect(const pt::Ray<T>& ray, T& t_out, size_t& idx_t, const T& t_min, const T& t_max) const;
+        
+        PrimitiveList<T> primitives;
+        std::vector<uint32_t> materials;
+    };
+    
+    /*
+     * A Geometry placed by to_world, its primitives all of one material when material is not NoOverride.
+     * Rays are intersected in object space: the direction is transformed without normalizing so t is the same in both spaces.
+     */
+    template <typename T>
+    class Instance
+    {
+    public:
+        static const int NoOverride = -1;
+        
+        /* Throws when the geometry is not built or to_world is singular */
+        Instance(const std::shared_ptr<const Geometry<T>>& _geometry, const Transform<T>& to_world, int _material = NoOverride);
+        
+        bool intersect(const pt::Ray<T>& ray, T& t_out, size_t& idx_t, const T& t_min, const T& t_max) const;
+        
+        ptvec<T> normalAt(size_t idx, const ptvec<T>& point) const;
+        
+        size_t materialAt(size_t idx) const { return (material == NoOverride) ? geometry->materials[idx] : (size_t)material; }
+        
+        std::shared_ptr<const Geometry<T>> geometry;
+        Transform<T> to_object;
+        ptvec<T> bmin; // world box
+        ptvec<T> bmax;
+        int material;
+    };
+    
+    /*
+     * Instances under a BVH, the top level over the BVHs of their geometries.
+     * Same hit interface as PrimitiveList for the renderers, materialAt indexes the material list of the scene.
+     * build() again after changing the instances, the linear list of instances is tested until then.
+     */
+    template <typename T>
+    class InstanceList : public std::vector<Instance<T>>
+    {
+    public:
+        struct Hit
+        {
+            size_t instance;
+            size_t primitive;
+        };
+        
+        void build(BVHBuild method = BVH_BUILD_SAH);
+        
+        bool intersect_simple(const pt::Ray<T>& ray,
+                              T& t_out,
+                              Hit& hit,
+                              const T& t_min = 0,
+                              const T& t_max = std::numeric_limits<T>::infinity()) const;
+        
+        ptvec<T> normalAt(const Hit& hit, const ptvec<T>& point) const { return (*this)[hit.instance].normalAt(hit.primitive, point); }
+        
+        size_t materialAt(const Hit& hit) const { return (*this)[hit.instance].materialAt(hit.primitive); }
+        
+        const BVH<T>& getBVH() const { return bvh; }
+        
+    private:
+        BVH<T> bvh;
+    };
+    
+    
+    /* Shared with the kernels, see assets/pt_optics.h */
     template<typename T>
     ptvec<T> reflect(const ptvec<T>& l, const ptvec<T>& n)
     {
-        return glm::normalize( l - (T)2.0 * glm::dot(l, n) * n);
+        return pt_reflect<T>(l, n);
     }
     
     template<typename T>
     bool refract(const ptvec<T>& l, const ptvec<T>& n, const T& ni_over_nt, ptvec<T>& out_refracted)
     {
-        T cosi = glm::dot(l, n);
-        T cost2 = (T)1.0 - ni_over_nt * ni_over_nt * ((T)1.0 - cosi*cosi);
-        if(cost2 > 0)
-        {
-            //out_refracted = ni_over_nt * l + ((ni_over_nt * cosi - (T)sqrt(std::abs(cost2))) * n);
-            out_refracted = glm::normalize(ni_over_nt * (l - n*cosi) - n*(T)sqrt(cost2));
-            return true;
-        }
-        
-        return false;
+        return pt_refract<T>(l, n, ni_over_nt, &out_refracted);
     }
     
     template<typename T>
     T schlick(const T& cosine, const T& ref_idx)
     {
-        T r0 = (1 - ref_idx) / (1 + ref_idx);
-        r0 = r0 * r0;
-        return r0 + (1 - r0) * pow((1 - cosine), 5);
+        return pt_schlick<T>(cosine, ref_idx);
     }
     
     
@@ -0,0 +1,363 @@
+#ifndef ptImageIO_h
+#define ptImageIO_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <mutex>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include "glm/glm.hpp"
+
+#if defined(_WIN32)
+#define pt_ftell64 _ftelli64
+#define pt_fseek64 _fseeki64
+#else
+#define pt_ftell64 ftello
+#define pt_fseek64 fseeko
+#endif
+
+namespace pt
+{
+    /*
+     * Convert a 32 bit float to a 16 bit IEEE half float (round to nearest even, as vstore_half by default)
+     * Values out of half range are clamped to +/- inf, NaN is preserved. Also used for the half buffers of ptCL.h
+     */
+    inline uint16_t float_to_half(float value)
+    {
+        uint32_t f;
+        memcpy(&f, &value, sizeof(float));
+
+        uint32_t sign = (f >> 16) & 0x8000;
+        int32_t exponent = (int32_t)((f >> 23) & 0xFF) - 127 + 15;
+        uint32_t mantissa = f & 0x007FFFFF;
+
+        if (((f >> 23) & 0xFF) == 0xFF) // inf or nan
+            return (uint16_t)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+
+        if (exponent >= 31) // overflow
+            return (uint16_t)(sign | 0x7C00);
+
+        if (exponent <= 0) // denormal or zero
+        {
+            if (exponent < -10) return (uint16_t)sign;
+            mantissa |= 0x00800000;
+            uint32_t shift = (uint32_t)(14 - exponent);
+            uint32_t half_mantissa = mantissa >> shift;
+            uint32_t rest = mantissa & ((1u << shift) - 1);
+            uint32_t halfway = 1u << (shift - 1);
+            if (rest > halfway || (rest == halfway && (half_mantissa & 1))) ++half_mantissa;
+            return (uint16_t)(sign | half_mantissa);
+        }
+
+        uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+        uint32_t rest = mantissa & 0x1FFF;
+        if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half; // may carry into exponent, which is still correct
+        return (uint16_t)half;
+    }
+
+    /* Convert a 16 bit IEEE half float back to 32 bit float */
+    inline float half_to_float(uint16_t h)
+    {
+        uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+        uint32_t exponent = (h >> 10) & 0x1F;
+        uint32_t mantissa = h & 0x3FF;
+        uint32_t f;
+
+        if (exponent == 0)
+        {
+            if (mantissa == 0)
+                f = sign;
+            else
+            {
+                // renormalize denormal
+                exponent = 127 - 15 + 1;
+                while (!(mantissa & 0x400)) { mantissa <<= 1; --exponent; }
+                mantissa &= 0x3FF;
+                f = sign | (exponent << 23) | (mantissa << 13);
+            }
+        }
+        else if (exponent == 31)
+            f = sign | 0x7F800000 | (mantissa << 13);
+        else
+            f = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+
+        float value;
+        memcpy(&value, &f, sizeof(float));
+        return value;
+    }
+
+    /*
+     * Receives finished tiles from the tile scheduler
+     * Tiles are given in image space, (x, y) being the top left pixel with rows going top-down,
+     * data is width * height rgb values laid out row by row
+     * writeTile is called concurrently by the render threads and must not throw,
+     * a failing sink keeps its first error for getError, checked once the render threads joined.
+     * Float tracers hand float tiles, a sink which does not take them as they are gets them widened to double
+     */
+    class TileSink
+    {
+    public:
+        virtual void writeTile(unsigned int x,
+                               unsigned int y,
+                               unsigned int width,
+                               unsigned int height,
+                               const glm::dvec3* data) = 0;
+
+        virtual void writeTile(unsigned int x,
+                               unsigned int y,
+                               unsigned int width,
+                               unsigned int height,
+                               const glm::vec3* data)
+        {
+            std::vector<glm::dvec3> wide(data, data + width * height);
+            writeTile(x, y, width, height, wide.data());
+        }
+
+        virtual const char* getError() const { return nullptr; }
+
+        virtual ~TileSink() {}
+    };
+
+    /*
+     * Minimal tiled OpenEXR writer
+     * Single part, single level, half float B G R channels, no compression
+     * Tiles are written to disk as soon as they arrive, in any order (lineOrder RANDOM_Y),
+     * so only one tile worth of pixels lives in memory per render thread.
+     * The tile offset table is reserved after the header and filled in on close.
+     * Offsets are 64 bit, files past 2GB are fine on every platform.
+     */
+    class ExrTiledWriter : public TileSink
+    {
+    public:
+        ExrTiledWriter(const std::string& filename,
+                       unsigned int _width,
+                       unsigned int _height,
+                       unsigned int _tile_size)
+            : error(nullptr)
+            , width(_width)
+            , height(_height)
+            , tile_size(_tile_size)
+        {
+            if (width == 0 || height == 0 || tile_size == 0) throw "Invalid EXR image or tile size.";
+
+            num_tiles_x = (width + tile_size - 1) / tile_size;
+            num_tiles_y = (height + tile_size - 1) / tile_size;
+            offsets.assign(num_tiles_x * num_tiles_y, 0);
+
+            file = fopen(filename.c_str(), "wb");
+            if (!file) throw "Could not open EXR file for writing.";
+
+            writeHeader();
+
+            // reserve the offset table, filled on close
+            table_position = pt_ftell64(file);
+            std::vector<uint64_t> zeros(offsets.size(), 0);
+            if (table_position < 0) failLocked("Could not locate the EXR offset table.");
+            else write(zeros.data(), sizeof(uint64_t), zeros.size());
+
+            if (error)
+            {
+                fclose(file);
+                file = nullptr;
+                throw error;
+            }
+        }
+
+        ~ExrTiledWriter() { close(); }
+
+        /*
+         * Tiles must match the tile grid of the file
+         * Errors do not throw, writeTile runs on the render threads: the first one is kept for getError
+         * and the tiles after it are dropped
+         */
+        void writeTile(unsigned int x,
+                       unsigned int y,
+                       unsigned int w,
+                       unsigned int h,
+                       const glm::dvec3* data) override
+        {
+            writeTileOf(x, y, w, h, data);
+        }
+
+        void writeTile(unsigned int x,
+                       unsigned int y,
+                       unsigned int w,
+                       unsigned int h,
+                       const glm::vec3* data) override
+        {
+            writeTileOf(x, y, w, h, data);
+        }
+
+        /* First error of the writer, nullptr if every write went through */
+        const char* getError() const override
+        {
+            std::lock_guard<std::mutex> lock(file_mutex);
+            return error;
+        }
+
+        /*
+         * Fills in the offset table and closes the file
+         * Returns false if this or any earlier write failed, see getError
+         */
+        bool close()
+        {
+            std::lock_guard<std::mutex> lock(file_mutex);
+
+            if (!file) return !error;
+
+            if (pt_fseek64(file, table_position, SEEK_SET) != 0) failLocked("Could not seek to the EXR offset table.");
+            else write(offsets.data(), sizeof(uint64_t), offsets.size());
+
+            if (fclose(file) != 0) failLocked("Could not close EXR file.");
+            file = nullptr;
+
+            return !error;
+        }
+
+        ExrTiledWriter() = delete;
+        ExrTiledWriter(const ExrTiledWriter& other) = delete;
+        void operator=(const ExrTiledWriter& other) = delete;
+
+    private:
+        /* A tile of dvec3 or vec3 */
+        template <typename V>
+        void writeTileOf(unsigned int x, unsigned int y, unsigned int w, unsigned int h, const V* data)
+        {
+            if ((x % tile_size) != 0 || (y % tile_size) != 0) return fail("Tile not aligned to the EXR tile grid.");
+
+            unsigned int tx = x / tile_size;
+            unsigned int ty = y / tile_size;
+
+            if (tx >= num_tiles_x || ty >= num_tiles_y) return fail("Tile outside of EXR data window.");
+            if (w != std::min(tile_size, width - x) || h != std::min(tile_size, height - y)) return fail("Invalid EXR tile size.");
+
+            /* Convert outside the lock, each line holds all B, then all G, then all R */
+            std::vector<uint16_t> pixels(3 * w * h);
+
+            for (unsigned int j = 0; j < h; ++j)
+            {
+                uint16_t* line = &pixels[3 * w * j];
+                const V* src = &data[w * j];
+
+                for (unsigned int i = 0; i < w; ++i)
+                {
+                    line[i]         = float_to_half((float)src[i].z);
+                    line[w + i]     = float_to_half((float)src[i].y);
+                    line[2 * w + i] = float_to_half((float)src[i].x);
+                }
+            }
+
+            int32_t chunk_header[5] = { (int32_t)tx, (int32_t)ty, 0, 0, (int32_t)(pixels.size() * sizeof(uint16_t)) };
+
+            std::lock_guard<std::mutex> lock(file_mutex);
+
+            if (error) return;
+            if (!file) return failLocked("EXR file already closed.");
+
+            int64_t position = pt_fseek64(file, 0, SEEK_END) == 0 ? (int64_t)pt_ftell64(file) : -1;
+            if (position < 0) return failLocked("Could not seek to the end of the EXR file.");
+
+            offsets[ty * num_tiles_x + tx] = (uint64_t)position;
+            write(chunk_header, sizeof(int32_t), 5);
+            write(pixels.data(), sizeof(uint16_t), pixels.size());
+        }
+
+        void fail(const char* message)
+        {
+            std::lock_guard<std::mutex> lock(file_mutex);
+            failLocked(message);
+        }
+
+        /* file_mutex held, the first error wins */
+        void failLocked(const char* message)
+        {
+            if (!error) error = message;
+        }
+
+        /* file_mutex held or not shared yet, stops at the first failed write */
+        void write(const void* data, size_t size, size_t count)
+        {
+            if (error) return;
+            if (fwrite(data, size, count, file) != count) failLocked("Could not write EXR file.");
+        }
+
+        /* OpenEXR files are little endian, as is every platform we target */
+        void writeAttribute(const char* name, const char* type, const void* value, int32_t size)
+        {
+            write(name, 1, strlen(name) + 1);
+            write(type, 1, strlen(type) + 1);
+            write(&size, sizeof(int32_t), 1);
+            write(value, 1, size);
+        }
+
+        void writeHeader()
+        {
+            int32_t magic = 20000630;
+            int32_t version = 2 | 0x200; // version 2, single part tiled
+            write(&magic, sizeof(int32_t), 1);
+            write(&version, sizeof(int32_t), 1);
+
+            /* channel list, sorted by name: name, pixel type (1 = HALF), pLinear, 3 reserved, x and y sampling */
+            std::vector<char> chlist;
+            const char* names[3] = { "B", "G", "R" };
+
+            for (int c = 0; c < 3; ++c)
+            {
+                int32_t fields[4] = { 1, 0, 1, 1 };
+                chlist.push_back(names[c][0]);
+                chlist.push_back('\0');
+                chlist.insert(chlist.end(), (char*)fields, (char*)fields + sizeof(fields));
+            }
+
+            chlist.push_back('\0');
+
+            writeAttribute("channels", "chlist", chlist.data(), (int32_t)chlist.size());
+
+            uint8_t compression = 0; // NO_COMPRESSION
+            writeAttribute("compression", "compression", &compression, 1);
+
+            int32_t window[4] = { 0, 0, (int32_t)width - 1, (int32_t)height - 1 };
+            writeAttribute("dataWindow", "box2i", window, sizeof(window));
+            writeAttribute("displayWindow", "box2i", window, sizeof(window));
+
+            uint8_t line_order = 2; // RANDOM_Y, tiles are stored in completion order
+            writeAttribute("lineOrder", "lineOrder", &line_order, 1);
+
+            float aspect = 1.0f;
+            writeAttribute("pixelAspectRatio", "float", &aspect, sizeof(float));
+
+            float center[2] = { 0, 0 };
+            writeAttribute("screenWindowCenter", "v2f", center, sizeof(center));
+
+            float window_width = 1.0f;
+            writeAttribute("screenWindowWidth", "float", &window_width, sizeof(float));
+
+            /* tile description: x size, y size, level mode ONE_LEVEL with rounding ROUND_DOWN */
+            uint8_t tiledesc[9];
+            uint32_t tile_dim = tile_size;
+            memcpy(&tiledesc[0], &tile_dim, 4);
+            memcpy(&tiledesc[4], &tile_dim, 4);
+            tiledesc[8] = 0;
+            writeAttribute("tiles", "tiledesc", tiledesc, sizeof(tiledesc));
+
+            char end = 0;
+            write(&end, 1, 1); // end of header
+        }
+
+        FILE*                   file;
+        mutable std::mutex      file_mutex;
+        const char*             error;
+        int64_t                 table_position;
+        std::vector<uint64_t>   offsets;
+        unsigned int            width;
+        unsigned int            height;
+        unsigned int            tile_size;
+        unsigned int            num_tiles_x;
+        unsigned int            num_tiles_y;
+    };
+
+}
+
+#endif /* ptImageIO_h */
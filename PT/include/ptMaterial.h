@@ -19,6 +19,9 @@ namespace pt
                              UniformRNG<T>&     rng,
                              ptvec<T>&          attenuation_out,
                              Ray<T>&            ray_out) const = 0;
+        
+        /* Radiance the surface gives off, added wherever a path lands on it */
+        virtual ptvec<T> emitted() const { return ptvec<T>(0); }
     };
     
     typedef std::shared_ptr<Material<float>>    fMaterialRef;
@@ -76,6 +79,9 @@ namespace pt
             return (glm::dot(ray_out.dir, hit_normal) > 0); //only use reflected 'outside' (i.e. not refracted?)
         }
         
+        ptvec<T> getAlbedo() const { return albedo; }
+        T getFuzz() const { return fuzz; }
+        
     private:
         ptvec<T> albedo;
         T fuzz;
@@ -95,29 +101,12 @@ namespace pt
                      ptvec<T>&          attenuation_out,
                      Ray<T>&            ray_out) const
         {
-            ptvec<T> reflected = reflect(ray_in.dir, hit_normal);
-            ptvec<T> outward_normal, refracted;
-            T ni_over_nt, cosine, reflect_prob;
+            ptvec<T> reflected, refracted;
+            T reflect_prob;
             attenuation_out = ptvec<T>(1); // perfect dialectrics do not absorb stuff
             
-            // entrance or exit?
-            if(glm::dot(ray_in.dir, hit_normal) > 0)
-            {
-                outward_normal = -hit_normal;
-                ni_over_nt = refr_idx;
-                cosine = refr_idx * glm::dot(ray_in.dir, hit_normal);
-            }
-            else
-            {
-                outward_normal = hit_normal;
-                ni_over_nt = 1 / refr_idx;
-                cosine = -glm::dot(ray_in.dir, hit_normal);
-            }
-            
-            if(refract(ray_in.dir, outward_normal, ni_over_nt, refracted))
+            if(pt_dielectric<T>(ray_in.dir, hit_normal, refr_idx, &reflected, &refracted, &reflect_prob))
             {
-                reflect_prob = schlick(cosine, refr_idx);
-                
                 if(rng() < reflect_prob)
                     ray_out = Ray<T>(hit_point, reflected);
                 else
@@ -131,11 +120,41 @@ namespace pt
             return true;
         }
         
+        T getRefractionIndex() const { return refr_idx; }
+        
     private:
         T refr_idx;
         
     };
     
+    /*
+     * Light source: gives off emission and ends the paths that reach it
+     */
+    template<typename T>
+    class Emissive : public Material<T>
+    {
+    public:
+        Emissive(const ptvec<T>& _emission) : emission(_emission) { }
+        
+        bool scatter(const Ray<T>&      ray_in,
+                     const ptvec<T>&    hit_point,
+                     const ptvec<T>&    hit_normal,
+                     UniformRNG<T>&     rng,
+                     ptvec<T>&          attenuation_out,
+                     Ray<T>&            ray_out) const
+        {
+            return false;
+        }
+        
+        ptvec<T> emitted() const { return emission; }
+        
+        ptvec<T> getEmission() const { return emission; }
+        
+    private:
+        ptvec<T> emission;
+        
+    };
+    
     template<typename T> T ray_min();
     template<typename T> T ray_max();
     
@@ -162,11 +181,12 @@ namespace pt
             ptvec<T> normal = list[idx]->normalAt(p); // normal at intersection
             Ray<T> ray_out;
             ptvec<T> attenuation;
+            ptvec<T> emitted = materials[idx]->emitted();
             
             if(recursion_depth < MAX_RECURSION && materials[idx]->scatter(ray, p, normal, rng, attenuation, ray_out))
-                return attenuation * color(ray_out, list, materials, rng, recursion_depth + 1);
+                return emitted + attenuation * color(ray_out, list, materials, rng, recursion_depth + 1);
             else
-                return ptvec<T>(0);
+                return emitted;
         }
         else
         {
@@ -175,33 +195,52 @@ namespace pt
         }
     }
     
-    template<typename T>
-    ptvec<T> color_iterative(const Ray<T>& ray,
-                             const PrimitiveList<T>& list,
-                             const std::vector<std::shared_ptr<Material<T>>>& materials,
-                             UniformRNG<T>& rng,
-                             const ptvec<T>& bottom_sky_color = ptvec<T>(1.0, 1.0, 1.0),
-                             const ptvec<T>& top_sky_color = ptvec<T>(0.5, 0.7, 1.0))
+    /*
+     * color_iterative once the first intersection of ray is known (hit, t, idx), e.g. from a packet of camera rays.
+     * The bounces are traced one ray at a time.
+     */
+    template<typename T, typename List>
+    ptvec<T> color_from_hit(const Ray<T>& ray,
+                            bool hit,
+                            T t,
+                            typename List::Hit idx,
+                            const List& list,
+                            const std::vector<std::shared_ptr<Material<T>>>& materials,
+                            UniformRNG<T>& rng,
+                            const ptvec<T>& bottom_sky_color = ptvec<T>(1.0, 1.0, 1.0),
+                            const ptvec<T>& top_sky_color = ptvec<T>(0.5, 0.7, 1.0))
     {
-        T t;
-        size_t idx;
-        
         ptvec<T> col(1);
+        ptvec<T> emitted(0);
         pt::Ray<T> ray_in = ray;
         Ray<T> ray_out;
         ptvec<T> attenuation;
         ptvec<T> p;
         ptvec<T> normal;
+        bool scattered;
+        
+        PT_COUNT(PT_COUNTER_PATHS, 1);
         
         for(int i = 0; i < MAX_RECURSION; ++i)
         {
-            if (list.intersect_simple(ray_in, t, idx, ray_min<T>(), ray_max<T>()))
+            if (i > 0) hit = list.intersect_simple(ray_in, t, idx, ray_min<T>(), ray_max<T>());
+            
+            if (hit)
             {
                 p = ray_in.operator()(t); // where intersects
-                normal = list[idx]->normalAt(p); // normal at intersection
+                normal = list.normalAt(idx, p); // normal at intersection
                 
-                if(materials[idx]->scatter(ray_in, p, normal, rng, attenuation, ray_out))
+                const Material<T>& material = *materials[list.materialAt(idx)];
+                emitted += col * material.emitted();
+                
+                {
+                    PT_STAGE(STAGE_SCATTER);
+                    scattered = material.scatter(ray_in, p, normal, rng, attenuation, ray_out);
+                }
+                
+                if(scattered)
                 {
+                    PT_COUNT(PT_COUNTER_BOUNCES, 1);
                     col *= attenuation;
                     ray_in = ray_out;
                 }
@@ -221,8 +260,27 @@ namespace pt
             
         }
         
-        return col;
+        return emitted + col;
+        
+    }
+    
+    /*
+     * List is a PrimitiveList<T> or an InstanceList<T>: materials is indexed by list.materialAt,
+     * one material per primitive for a PrimitiveList
+     */
+    template<typename T, typename List>
+    ptvec<T> color_iterative(const Ray<T>& ray,
+                             const List& list,
+                             const std::vector<std::shared_ptr<Material<T>>>& materials,
+                             UniformRNG<T>& rng,
+                             const ptvec<T>& bottom_sky_color = ptvec<T>(1.0, 1.0, 1.0),
+                             const ptvec<T>& top_sky_color = ptvec<T>(0.5, 0.7, 1.0))
+    {
+        T t = 0;
+        typename List::Hit idx = typename List::Hit();
+        bool hit = list.intersect_simple(ray, t, idx, ray_min<T>(), ray_max<T>());
         
+        return color_from_hit(ray, hit, t, idx, list, materials, rng, bottom_sky_color, top_sky_color);
     }
     
     
@@ -0,0 +1,471 @@
+#ifndef ptPacket_h
+#define ptPacket_h
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <memory>
+#include <limits>
+#include "glm/glm.hpp"
+#include "ptUtil.h"
+#include "ptGeometry.h"
+#include "ptCounters.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Packets of 4, 8 or 16 rays traced together. The lanes go four at a time through Lanes4,
+ * an SSE register for float where there is SSE2 and a loop otherwise: wider packets do not use wider registers,
+ * they share one node fetch and one traversal decision among more rays.
+ * The arithmetic of every lane is the one of the single ray code it replaces, so lanes hit what single rays hit.
+ */
+
+namespace pt
+{
+    /* Four lanes of T */
+    template <typename T>
+    struct Lanes4
+    {
+        T v[4];
+
+        static Lanes4 load(const T* p) { Lanes4 r; for (int i = 0; i < 4; ++i) r.v[i] = p[i]; return r; }
+        static Lanes4 set(T x) { Lanes4 r; for (int i = 0; i < 4; ++i) r.v[i] = x; return r; }
+        void store(T* p) const { for (int i = 0; i < 4; ++i) p[i] = v[i]; }
+    };
+
+    /* Result of a comparison of four lanes */
+    template <typename T>
+    struct LaneMask4
+    {
+        int bits;
+
+        static LaneMask4 fromBits(int b) { LaneMask4 m; m.bits = b & 15; return m; }
+        int toBits() const { return bits; }
+    };
+
+#define PT_LANES4_OP(op) \
+    template <typename T> inline Lanes4<T> operator op(const Lanes4<T>& a, const Lanes4<T>& b) \
+    { Lanes4<T> r; for (int i = 0; i < 4; ++i) r.v[i] = a.v[i] op b.v[i]; return r; }
+
+#define PT_LANES4_CMP(op) \
+    template <typename T> inline LaneMask4<T> operator op(const Lanes4<T>& a, const Lanes4<T>& b) \
+    { LaneMask4<T> m; m.bits = 0; for (int i = 0; i < 4; ++i) m.bits |= (a.v[i] op b.v[i]) << i; return m; }
+
+    PT_LANES4_OP(+)
+    PT_LANES4_OP(-)
+    PT_LANES4_OP(*)
+    PT_LANES4_OP(/)
+    PT_LANES4_CMP(<)
+    PT_LANES4_CMP(>)
+    PT_LANES4_CMP(<=)
+    PT_LANES4_CMP(!=)
+
+#undef PT_LANES4_OP
+#undef PT_LANES4_CMP
+
+    template <typename T> inline LaneMask4<T> operator&(const LaneMask4<T>& a, const LaneMask4<T>& b) { return LaneMask4<T>::fromBits(a.bits & b.bits); }
+    template <typename T> inline LaneMask4<T> operator|(const LaneMask4<T>& a, const LaneMask4<T>& b) { return LaneMask4<T>::fromBits(a.bits | b.bits); }
+
+    /* a where m is set, b elsewhere */
+    template <typename T>
+    inline Lanes4<T> lanes_select(const LaneMask4<T>& m, const Lanes4<T>& a, const Lanes4<T>& b)
+    {
+        Lanes4<T> r;
+        for (int i = 0; i < 4; ++i) r.v[i] = ((m.bits >> i) & 1) ? a.v[i] : b.v[i];
+        return r;
+    }
+
+    /* Smaller and larger of every pair of lanes */
+    template <typename T> inline Lanes4<T> lanes_min(const Lanes4<T>& a, const Lanes4<T>& b) { return lanes_select(a < b, a, b); }
+    template <typename T> inline Lanes4<T> lanes_max(const Lanes4<T>& a, const Lanes4<T>& b) { return lanes_select(b < a, a, b); }
+
+    template <typename T>
+    inline Lanes4<T> lanes_sqrt(const Lanes4<T>& a)
+    {
+        Lanes4<T> r;
+        for (int i = 0; i < 4; ++i) r.v[i] = sqrt(a.v[i]);
+        return r;
+    }
+
+#ifdef __SSE2__
+    template <>
+    struct Lanes4<float>
+    {
+        __m128 v;
+
+        static Lanes4 load(const float* p) { Lanes4 r; r.v = _mm_load_ps(p); return r; }
+        static Lanes4 set(float x) { Lanes4 r; r.v = _mm_set1_ps(x); return r; }
+        void store(float* p) const { _mm_store_ps(p, v); }
+    };
+
+    template <>
+    struct LaneMask4<float>
+    {
+        __m128 m;
+
+        static LaneMask4 fromBits(int b)
+        {
+            const __m128i bit = _mm_setr_epi32(1, 2, 4, 8);
+            LaneMask4 r;
+            r.m = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(b), bit), bit));
+            return r;
+        }
+
+        int toBits() const { return _mm_movemask_ps(m); }
+    };
+
+    typedef Lanes4<float> Float4;
+    typedef LaneMask4<float> Mask4;
+
+    inline Float4 float4(__m128 v) { Float4 r; r.v = v; return r; }
+    inline Mask4 mask4(__m128 m) { Mask4 r; r.m = m; return r; }
+
+    inline Float4 operator+(const Float4& a, const Float4& b) { return float4(_mm_add_ps(a.v, b.v)); }
+    inline Float4 operator-(const Float4& a, const Float4& b) { return float4(_mm_sub_ps(a.v, b.v)); }
+    inline Float4 operator*(const Float4& a, const Float4& b) { return float4(_mm_mul_ps(a.v, b.v)); }
+    inline Float4 operator/(const Float4& a, const Float4& b) { return float4(_mm_div_ps(a.v, b.v)); }
+    inline Mask4 operator<(const Float4& a, const Float4& b) { return mask4(_mm_cmplt_ps(a.v, b.v)); }
+    inline Mask4 operator>(const Float4& a, const Float4& b) { return mask4(_mm_cmpgt_ps(a.v, b.v)); }
+    inline Mask4 operator<=(const Float4& a, const Float4& b) { return mask4(_mm_cmple_ps(a.v, b.v)); }
+    inline Mask4 operator!=(const Float4& a, const Float4& b) { return mask4(_mm_cmpneq_ps(a.v, b.v)); }
+    inline Mask4 operator&(const Mask4& a, const Mask4& b) { return mask4(_mm_and_ps(a.m, b.m)); }
+    inline Mask4 operator|(const Mask4& a, const Mask4& b) { return mask4(_mm_or_ps(a.m, b.m)); }
+
+    inline Float4 lanes_select(const Mask4& m, const Float4& a, const Float4& b)
+    {
+        return float4(_mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)));
+    }
+
+    inline Float4 lanes_min(const Float4& a, const Float4& b) { return float4(_mm_min_ps(a.v, b.v)); }
+    inline Float4 lanes_max(const Float4& a, const Float4& b) { return float4(_mm_max_ps(b.v, a.v)); }
+    inline Float4 lanes_sqrt(const Float4& a) { return float4(_mm_sqrt_ps(a.v)); }
+#endif
+
+    /* Lanes set in mask */
+    inline int packet_count(uint32_t mask)
+    {
+        int n = 0;
+        for (; mask; mask &= mask - 1) ++n;
+        return n;
+    }
+
+    /* Index of the lowest lane set in a mask that is not empty */
+    inline int packet_first(uint32_t mask)
+    {
+        int i = 0;
+        while (!((mask >> i) & 1)) ++i;
+        return i;
+    }
+
+    /*
+     * N rays in structure of arrays form. t is the far end of each ray and is lowered to the closest hit,
+     * prim holds the primitive hit. Only the lanes set in active hold a ray.
+     */
+    template <typename T, int N>
+    struct RayPacket
+    {
+        static_assert(N == 4 || N == 8 || N == 16, "Packets are 4, 8 or 16 rays");
+
+        alignas(16) T ox[N];
+        T oy[N];
+        T oz[N];
+        T dx[N];
+        T dy[N];
+        T dz[N];
+        T t[N];
+        uint32_t prim[N];
+        uint32_t active;
+
+        RayPacket() : ox(), oy(), oz(), dx(), dy(), dz(), t(), prim(), active(0) {}
+
+        void set(int lane, const Ray<T>& ray, T t_far)
+        {
+            ox[lane] = ray.origin.x; oy[lane] = ray.origin.y; oz[lane] = ray.origin.z;
+            dx[lane] = ray.dir.x; dy[lane] = ray.dir.y; dz[lane] = ray.dir.z;
+            t[lane] = t_far;
+            active |= 1u << lane;
+        }
+
+        Ray<T> ray(int lane) const { return Ray<T>(ptvec<T>(ox[lane], oy[lane], oz[lane]), ptvec<T>(dx[lane], dy[lane], dz[lane])); }
+    };
+
+    /*
+     * Lanes of mask whose ray enters the box in (t_min, t), with the inverse directions of the rays.
+     * Same test as BVH::entry.
+     */
+    template <typename T, int N>
+    inline uint32_t packet_box(const ptvec<T>& bmin, const ptvec<T>& bmax, const RayPacket<T, N>& p,
+                               const T* ix, const T* iy, const T* iz, T t_min, uint32_t mask)
+    {
+        typedef Lanes4<T> L;
+        uint32_t hits = 0;
+
+        for (int k = 0; k < N; k += 4)
+        {
+            if (!((mask >> k) & 15)) continue;
+
+            L inv_x = L::load(ix + k), inv_y = L::load(iy + k), inv_z = L::load(iz + k);
+            L ox = L::load(p.ox + k), oy = L::load(p.oy + k), oz = L::load(p.oz + k);
+
+            L x0 = (L::set(bmin.x) - ox) * inv_x, x1 = (L::set(bmax.x) - ox) * inv_x;
+            L y0 = (L::set(bmin.y) - oy) * inv_y, y1 = (L::set(bmax.y) - oy) * inv_y;
+            L z0 = (L::set(bmin.z) - oz) * inv_z, z1 = (L::set(bmax.z) - oz) * inv_z;
+
+            L enter = lanes_max(L::set(t_min), lanes_max(lanes_min(x0, x1), lanes_max(lanes_min(y0, y1), lanes_min(z0, z1))));
+            L leave = lanes_min(L::load(p.t + k), lanes_min(lanes_max(x0, x1), lanes_min(lanes_max(y0, y1), lanes_max(z0, z1))));
+
+            hits |= (uint32_t)(enter <= leave).toBits() << k;
+        }
+
+        return hits & mask;
+    }
+
+    /* Lowers t and sets prim to index in the lanes of hits */
+    template <typename T, int N>
+    inline void packet_record(RayPacket<T, N>& p, int k, const LaneMask4<T>& hits, const Lanes4<T>& t, uint32_t index)
+    {
+        lanes_select(hits, t, Lanes4<T>::load(p.t + k)).store(p.t + k);
+        for (int b = hits.toBits(); b; b &= b - 1) p.prim[k + packet_first((uint32_t)b)] = index;
+    }
+
+    /* Sphere::intersect_simple on the lanes of mask in (t_min, t), returns the lanes hit */
+    template <typename T, int N>
+    inline uint32_t packet_sphere(const ptvec<T>& center, T radius, RayPacket<T, N>& p, T t_min, uint32_t mask, uint32_t index)
+    {
+        typedef Lanes4<T> L;
+        uint32_t hits = 0;
+
+        for (int k = 0; k < N; k += 4)
+        {
+            if (!((mask >> k) & 15)) continue;
+
+            L dx = L::load(p.dx + k), dy = L::load(p.dy + k), dz = L::load(p.dz + k);
+            L sx = L::load(p.ox + k) - L::set(center.x);
+            L sy = L::load(p.oy + k) - L::set(center.y);
+            L sz = L::load(p.oz + k) - L::set(center.z);
+
+            L a = dx * dx + dy * dy + dz * dz;
+            L b = sx * dx + sy * dy + sz * dz;
+            L c = (sx * sx + sy * sy + sz * sz) - L::set(radius * radius);
+            L det = b * b - a * c;
+
+            L zero = L::set(0);
+            L root = lanes_sqrt(lanes_max(det, zero));
+            L t0 = (zero - b - root) / a;
+            L t1 = (zero - b + root) / a;
+            L t_far = L::load(p.t + k);
+
+            LaneMask4<T> lanes = LaneMask4<T>::fromBits((int)(mask >> k)) & (det > zero);
+            LaneMask4<T> hit0 = lanes & (t0 > L::set(t_min)) & (t0 < t_far);
+            LaneMask4<T> hit1 = lanes & (t1 > L::set(t_min)) & (t1 < t_far);
+            LaneMask4<T> hit = hit0 | hit1;
+
+            packet_record(p, k, hit, lanes_select(hit0, t0, t1), index);
+            hits |= (uint32_t)hit.toBits() << k;
+        }
+
+        return hits;
+    }
+
+    /* Triangle::intersect_simple on the lanes of mask in (t_min, t), v0 and the edges e1, e2, returns the lanes hit */
+    template <typename T, int N>
+    inline uint32_t packet_triangle(const ptvec<T>& v0, const ptvec<T>& e1, const ptvec<T>& e2,
+                                    RayPacket<T, N>& p, T t_min, uint32_t mask, uint32_t index)
+    {
+        typedef Lanes4<T> L;
+        uint32_t hits = 0;
+        L eps = L::set(std::numeric_limits<T>::epsilon());
+        L zero = L::set(0), one = L::set(1);
+
+        for (int k = 0; k < N; k += 4)
+        {
+            if (!((mask >> k) & 15)) continue;
+
+            L dx = L::load(p.dx + k), dy = L::load(p.dy + k), dz = L::load(p.dz + k);
+
+            /* p = cross(dir, e2) */
+            L px = dy * L::set(e2.z) - L::set(e2.y) * dz;
+            L py = dz * L::set(e2.x) - L::set(e2.z) * dx;
+            L pz = dx * L::set(e2.y) - L::set(e2.x) * dy;
+            L det = L::set(e1.x) * px + L::set(e1.y) * py + L::set(e1.z) * pz;
+            L inv_det = one / det;
+
+            L sx = L::load(p.ox + k) - L::set(v0.x);
+            L sy = L::load(p.oy + k) - L::set(v0.y);
+            L sz = L::load(p.oz + k) - L::set(v0.z);
+            L b1 = (sx * px + sy * py + sz * pz) * inv_det;
+
+            /* q = cross(s, e1) */
+            L qx = sy * L::set(e1.z) - L::set(e1.y) * sz;
+            L qy = sz * L::set(e1.x) - L::set(e1.z) * sx;
+            L qz = sx * L::set(e1.y) - L::set(e1.x) * sy;
+            L b2 = (dx * qx + dy * qy + dz * qz) * inv_det;
+            L t = (L::set(e2.x) * qx + L::set(e2.y) * qy + L::set(e2.z) * qz) * inv_det;
+
+            LaneMask4<T> hit = LaneMask4<T>::fromBits((int)(mask >> k))
+            & ((det <= zero - eps) | (eps <= det))
+            & (zero <= b1) & (b1 <= one) & (zero <= b2) & (b1 + b2 <= one)
+            & (t > L::set(t_min)) & (t < L::load(p.t + k));
+
+            packet_record(p, k, hit, t, index);
+            hits |= (uint32_t)hit.toBits() << k;
+        }
+
+        return hits;
+    }
+
+    /*
+     * The spheres and triangles of a PrimitiveList for packets, in the order of the leaves of its BVH, or of a BVH
+     * of its own when the list has none. The list is kept for normalAt and materialAt: a PacketList stands for it
+     * in render_frame, and must not outlive it.
+     */
+    template <int N>
+    class PacketList
+    {
+    public:
+        typedef size_t Hit;
+
+        /* Throws on primitives other than spheres and triangles */
+        explicit PacketList(const PrimitiveList<float>& _list) : list(_list)
+        {
+            bvh = list.getBVH();
+
+            if (!bvh || !bvh->covers(list.size()))
+            {
+                bvh = std::make_shared<BVH<float>>();
+                bvh->build(list);
+            }
+
+            items.reserve(bvh->indices.size());
+
+            for (uint32_t index : bvh->indices)
+            {
+                Item item;
+                item.index = index;
+
+                if (fSphereRef sphere = std::dynamic_pointer_cast<Sphere<float>>(list[index]))
+                {
+                    item.a = sphere->getCenter();
+                    item.radius = sphere->getRadius();
+                    item.triangle = false;
+                }
+                else if (fTriangleRef tri = std::dynamic_pointer_cast<Triangle<float>>(list[index]))
+                {
+                    item.a = tri->getVertex(0);
+                    item.b = tri->getEdge1();
+                    item.c = tri->getEdge2();
+                    item.radius = 0;
+                    item.triangle = true;
+                }
+                else
+                {
+                    throw "Packets only trace spheres and triangles";
+                }
+
+                items.push_back(item);
+            }
+        }
+
+        /* Closest hits of the active lanes in (t_min, t): lowers t and sets prim of the lanes hit, returns them */
+        uint32_t intersect(RayPacket<float, N>& packet, float t_min) const { return trace(packet, t_min, false); }
+
+        /* Lanes blocked anywhere in (t_min, t), for shadow rays */
+        uint32_t occluded(const RayPacket<float, N>& packet, float t_min) const
+        {
+            RayPacket<float, N> p = packet;
+            return trace(p, t_min, true);
+        }
+
+        const PrimitiveList<float>& getList() const { return list; }
+
+    private:
+        struct Item
+        {
+            ptvec<float> a;     // center or v0
+            ptvec<float> b;     // e1
+            ptvec<float> c;     // e2
+            float radius;
+            uint32_t index;     // in the list
+            bool triangle;
+        };
+
+        /* BVH::traverse for a packet: the nearer child for the first lane still in it is visited first */
+        uint32_t trace(RayPacket<float, N>& p, float t_min, bool any_hit) const
+        {
+            typedef BVH<float>::Node Node;
+
+            PT_STAGE(STAGE_INTERSECT);
+            PT_COUNT(PT_COUNTER_RAYS, packet_count(p.active));
+
+            alignas(16) float ix[N];
+            alignas(16) float iy[N];
+            alignas(16) float iz[N];
+
+            for (int i = 0; i < N; ++i)
+            {
+                ix[i] = 1.0f / p.dx[i];
+                iy[i] = 1.0f / p.dy[i];
+                iz[i] = 1.0f / p.dz[i];
+            }
+
+            const std::vector<Node>& nodes = bvh->nodes;
+            uint32_t active = p.active;
+            uint32_t hits = 0;
+
+            int stack[BVH<float>::MaxDepth];
+            int top = 0;
+            stack[top++] = 0;
+
+            while (top > 0 && active)
+            {
+                const Node& node = nodes[stack[--top]];
+                uint32_t lanes = packet_box(node.bmin, node.bmax, p, ix, iy, iz, t_min, active);
+
+                if (!lanes) continue;
+
+                if (node.count > 0)
+                {
+                    PT_COUNT(PT_COUNTER_INTERSECTION_TESTS, node.count * packet_count(lanes));
+
+                    for (int i = node.left_first; i < node.left_first + node.count && lanes; ++i)
+                    {
+                        const Item& item = items[i];
+                        uint32_t hit = item.triangle ? packet_triangle(item.a, item.b, item.c, p, t_min, lanes, item.index)
+                        : packet_sphere(item.a, item.radius, p, t_min, lanes, item.index);
+
+                        hits |= hit;
+
+                        if (any_hit)
+                        {
+                            active &= ~hit;
+                            lanes &= ~hit;
+                        }
+                    }
+
+                    continue;
+                }
+
+                int lane = packet_first(lanes);
+                ptvec<float> origin(p.ox[lane], p.oy[lane], p.oz[lane]);
+                ptvec<float> inv_dir(ix[lane], iy[lane], iz[lane]);
+
+                float enter_left = BVH<float>::entry(nodes[node.left_first], origin, inv_dir, t_min, p.t[lane]);
+                float enter_right = BVH<float>::entry(nodes[node.left_first + 1], origin, inv_dir, t_min, p.t[lane]);
+                bool left_first = enter_left >= 0 && (enter_right < 0 || enter_left <= enter_right);
+
+                stack[top++] = left_first ? node.left_first + 1 : node.left_first;
+                stack[top++] = left_first ? node.left_first : node.left_first + 1;
+            }
+
+            return hits;
+        }
+
+        const PrimitiveList<float>& list;
+        std::shared_ptr<BVH<float>> bvh;
+        std::vector<Item> items;
+    };
+}
+
+#endif /* ptPacket_h */
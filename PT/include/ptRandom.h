@@ -71,13 +71,14 @@ namespace pt
     typedef std::function<ptvec<float>(UniformRNG<float>& rng, const ptvec<float>&)> unit_sphere_samplerf;
     typedef std::function<ptvec<double>(UniformRNG<double>& rng, const ptvec<double>&)> unit_sphere_samplerd;
     
-    /* Sample unit disk */
+    /* Sample unit disk, x drawn before y as sample_unit_disk in random.cl */
     template<typename T>
     static ptvec<T> sample_unit_disk(UniformRNG<T>& rng)
     {
-        ptvec<T> p;
+        ptvec<T> p(0);
         do {
-            p = (T)2.0 * ptvec<T>(rng(), rng(), 0) - ptvec<T>(1,1,0);
+            p.x = (T)2.0 * rng() - 1;
+            p.y = (T)2.0 * rng() - 1;
         } while(glm::dot(p, p) >= 1.0);
         return p;
     }
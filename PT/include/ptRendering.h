@@ -2,19 +2,25 @@
 #ifndef ptRendering_h
 #define ptRendering_h
 
+#include <vector>
+#include <algorithm>
+#include <limits>
 #include "ptUtil.h"
 #include "ptGeometry.h"
 #include "ptRandom.h"
 #include "ptMaterial.h"
+#include "ptPacket.h"
 
 #define USE_ITERATIVE
 
 namespace pt
 {
+    /* List is a PrimitiveList<float> or an InstanceList<float>, see color_iterative */
+    template <typename List>
     void render_pixel(unsigned int x, unsigned int y, unsigned int samples,
                       unsigned int width, unsigned int height,
                       const Camera<float>& cam,
-                      const PrimitiveList<float>& list,
+                      const List& list,
                       const std::vector<fMaterialRef>& materials,
                       float* out_buffer,
                       UniformRNG<float>& rng,
@@ -50,9 +56,10 @@ namespace pt
         out_buffer[idx + 2] = c.b;
     }
     
+    template <typename List>
     void render_frame(unsigned int width, unsigned int height, unsigned int samples,
                       const Camera<float>& cam,
-                      const PrimitiveList<float>& list,
+                      const List& list,
                       const std::vector<fMaterialRef>& materials,
                       float* out_buffer,
                       UniformRNG<float>& rng,
@@ -67,6 +74,219 @@ namespace pt
             }
         }
     }
+
+    /*
+     * render_frame with the camera rays of blocks of N pixels (2x2, 4x2 or 4x4) traced as packets of packets.getList(),
+     * the rest of every path one ray at a time. Each lane draws from its own XORUniformRNG, seeded from its pixel
+     * as render_pixel seeds rng: the image is the one render_frame gives with an XORUniformRNG.
+     */
+    template <int N>
+    void render_frame(unsigned int width, unsigned int height, unsigned int samples,
+                      const Camera<float>& cam,
+                      const PacketList<N>& packets,
+                      const std::vector<fMaterialRef>& materials,
+                      float* out_buffer,
+                      Hash& hash)
+    {
+        const unsigned int block_width = N >= 8 ? 4 : 2;
+        const unsigned int block_height = N / block_width;
+        const PrimitiveList<float>& list = packets.getList();
+        float weigth = 1.0f / (float)samples;
+        
+        XORUniformRNG<float> rng[N];
+        glm::vec3 c[N];
+        pt::Ray<float> ray[N];
+        
+        for(unsigned int by = 0; by < height; by += block_height)
+        {
+            for(unsigned int bx = 0; bx < width; bx += block_width)
+            {
+                uint32_t lanes = 0;
+                
+                for(int i = 0; i < N; ++i)
+                {
+                    unsigned int x = bx + i % block_width, y = by + i / block_width;
+                    if(x >= width || y >= height) continue;
+                    
+                    lanes |= 1u << i;
+                    rng[i].seed(hash(x, y));
+                    c[i] = glm::vec3(0,0,0);
+                }
+                
+                for(unsigned int s = 0; s < samples; ++s)
+                {
+                    RayPacket<float, N> packet;
+                    
+                    for(uint32_t m = lanes; m; m &= m - 1)
+                    {
+                        int i = packet_first(m);
+                        float u = ((float)(bx + i % block_width) + rng[i]()) / (float)width;
+                        float v = ((float)(by + i / block_width) + rng[i]()) / (float)height;
+                        
+                        ray[i] = cam.getRay(u, v, rng[i]);
+                        packet.set(i, ray[i], ray_max<float>());
+                    }
+                    
+                    uint32_t hits = packets.intersect(packet, ray_min<float>());
+                    
+                    for(uint32_t m = lanes; m; m &= m - 1)
+                    {
+                        int i = packet_first(m);
+                        c[i] += weigth * color_from_hit(ray[i], ((hits >> i) & 1) != 0, packet.t[i], (size_t)packet.prim[i], list, materials, rng[i]);
+                    }
+                }
+                
+                for(uint32_t m = lanes; m; m &= m - 1)
+                {
+                    int i = packet_first(m);
+                    size_t idx = 3 * ((height - (by + i / block_width) - 1) * width + bx + i % block_width);
+                    out_buffer[idx + 0] = c[i].r;
+                    out_buffer[idx + 1] = c[i].g;
+                    out_buffer[idx + 2] = c[i].b;
+                }
+            }
+        }
+    }
+
+    /*
+     * Running mean and variance of the samples of a pixel (Welford)
+     * The variance is tracked on luminance only
+     */
+    typedef struct pixel_stats
+    {
+        glm::vec3       mean;
+        float           m2;
+        unsigned int    count;
+    } pixel_stats;
+    
+    inline float luminance(const glm::vec3& c)
+    {
+        return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+    }
+    
+    inline void pixel_stats_add(pixel_stats& stats, const glm::vec3& sample)
+    {
+        float delta = luminance(sample) - luminance(stats.mean);
+        stats.count++;
+        stats.mean += (sample - stats.mean) / (float)stats.count;
+        stats.m2 += delta * (luminance(sample) - luminance(stats.mean));
+    }
+    
+    /*
+     * Standard error of the mean luminance, same as adaptive_sampling.cl
+     * Absolute rather than relative to the mean, which is what RMSE measures
+     */
+    inline float pixel_stats_error(const pixel_stats& stats)
+    {
+        if(stats.count < 2) return std::numeric_limits<float>::infinity();
+        
+        float variance = stats.m2 / (float)(stats.count - 1);
+        return sqrtf(variance / (float)stats.count);
+    }
+    
+    /*
+     * Adds samples to the running estimate of pixel (x,y)
+     * The rng is seeded from the pixel and the samples taken so far, so passes continue the pixel's stream
+     */
+    template <typename List>
+    void render_pixel_adaptive(unsigned int x, unsigned int y, unsigned int samples,
+                               unsigned int width, unsigned int height,
+                               const Camera<float>& cam,
+                               const List& list,
+                               const std::vector<fMaterialRef>& materials,
+                               pixel_stats& stats,
+                               UniformRNG<float>& rng,
+                               Hash& hash)
+    {
+        float u, v;
+        pt::Ray<float> ray;
+        
+        rng.seed(hash(hash(x, y), stats.count));
+        
+        for(unsigned int s = 0; s < samples; ++s)
+        {
+            u = ((float)x + rng()) / (float)width;
+            v = ((float)y + rng()) / (float)height;
+            
+            ray = cam.getRay(u, v, rng);
+            
+#ifdef USE_ITERATIVE
+            pixel_stats_add(stats, color_iterative(ray, list, materials, rng));
+#else
+            pixel_stats_add(stats, color(ray, list, materials, rng, 0));
+#endif
+        }
+    }
+    
+    /*
+     * Adaptive version of render_frame, spends at most samples * width * height samples
+     * Every pixel first gets a pass of samples / 2, then passes of samples / 4 go on over the list of
+     * pixels whose error is still above threshold, which is compacted after each pass.
+     * The budget of converged pixels goes to the noisy ones. Returns the number of samples taken
+     */
+    template <typename List>
+    size_t render_frame_adaptive(unsigned int width, unsigned int height, unsigned int samples,
+                                 float threshold,
+                                 const Camera<float>& cam,
+                                 const List& list,
+                                 const std::vector<fMaterialRef>& materials,
+                                 float* out_buffer,
+                                 UniformRNG<float>& rng,
+                                 Hash& hash)
+    {
+        size_t n = (size_t)width * (size_t)height;
+        size_t budget = (size_t)samples * n;
+        size_t spent = 0;
+        unsigned int first_samples = std::max(2u, samples / 2);
+        unsigned int pass_samples = std::max(1u, samples / 4);
+        
+        pixel_stats zero = { glm::vec3(0), 0, 0 };
+        std::vector<pixel_stats> stats(n, zero);
+        
+        std::vector<unsigned int> active(n);
+        for(size_t i = 0; i < n; ++i) active[i] = (unsigned int)i;
+        
+        while(!active.empty())
+        {
+            unsigned int pass = (unsigned int)std::min((size_t)(spent ? pass_samples : first_samples), (budget - spent) / active.size());
+            if(pass == 0) break;
+            
+            for(size_t i = 0; i < active.size(); ++i)
+            {
+                unsigned int p = active[i];
+                render_pixel_adaptive(p % width, p / width, pass, width, height, cam, list, materials, stats[p], rng, hash);
+            }
+            
+            spent += (size_t)pass * active.size();
+            
+            active.erase(std::remove_if(active.begin(), active.end(), [&](unsigned int p) {
+                return pixel_stats_error(stats[p]) <= threshold;
+            }), active.end());
+            
+            /* everything converged with budget left: tighten the threshold and go on with the noisiest pixels */
+            while(active.empty() && spent + n / 16 < budget && threshold > 1e-6f)
+            {
+                threshold *= 0.5f;
+                
+                for(size_t i = 0; i < n; ++i)
+                    if(pixel_stats_error(stats[i]) > threshold) active.push_back((unsigned int)i);
+            }
+        }
+        
+        for(unsigned int y = 0; y < height; ++y)
+        {
+            for(unsigned int x = 0; x < width; ++x)
+            {
+                const glm::vec3& c = stats[y * width + x].mean;
+                size_t idx = 3 * ((height - y - 1) * width + x);
+                out_buffer[idx + 0] = c.r;
+                out_buffer[idx + 1] = c.g;
+                out_buffer[idx + 2] = c.b;
+            }
+        }
+        
+        return spent;
+    }
 }
 
 
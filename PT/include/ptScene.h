@@ -0,0 +1,988 @@
+#ifndef ptScene_h
+#define ptScene_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "ptCL.h"
+
+/*
+ * Scene files: spheres, meshes, materials, camera and sky as text, one statement per line, # starts a comment.
+ *
+ *   camera <vfov> <eye x y z> <lookat x y z> <up x y z> [<aperture> <focus distance>]
+ *   sky <bottom color> <top color>
+ *   material <name> lambertian <color>
+ *   material <name> metal <color> <fuzz>
+ *   material <name> dielectric <refraction index>
+ *   material <name> emissive <color> [<strength>]
+ *   sphere <material> <center x y z> <radius>
+ *   mesh <material> <file.obj> [<translation x y z> [<scale>]]
+ *
+ * A color is three floats or a hex string (0x730202, #730202 would be a comment), materials are declared before use,
+ * mesh paths are relative to the scene file. Meshes are the v and f lines of an OBJ file, polygons are fanned,
+ * counter clockwise faces look out (Triangle<T>).
+ *
+ * A loaded scene has two forms. The device one is the packed records of pt_types.h: spheres then triangles
+ * make one primitive index space, with a material index per primitive, the BVH nodes and the leaf order of the primitives.
+ * The CPU one is a PrimitiveList in the same order, with its BVH, and a material per primitive.
+ *
+ * The binary cache is the device form as is, a SceneCacheHeader then 16 byte aligned sections, in the byte order
+ * of the machine that wrote it. Loading it maps the file and builds the CPU form from the records,
+ * the OBJ files are not read and the BVH is not built again. scene_load keeps it next to the scene file and
+ * writes it again when the scene file or a mesh file changed (size and modification time).
+ *
+ * Instanced scenes (InstanceList) are built in code, scene_pack_instances makes their device form.
+ */
+
+typedef pt::device::Triangle cl_triangle;
+typedef pt::device::BVHNode cl_bvh_node;
+typedef pt::device::Instance cl_instance;
+
+namespace pt
+{
+    static const char SceneCacheMagic[8] = { 'P', 'T', 'S', 'C', 'E', 'N', 'E', '1' };
+    static const uint32_t SceneCacheVersion = 1;
+    static const uint32_t SceneCacheByteOrder = 0x01020304;
+
+    enum SceneSection
+    {
+        SCENE_SPHERES,
+        SCENE_TRIANGLES,
+        SCENE_MATERIALS,
+        SCENE_PRIMITIVE_MATERIALS,
+        SCENE_NODES,
+        SCENE_PRIMITIVE_INDICES,
+        SCENE_SECTION_COUNT
+    };
+
+    struct SceneCacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t source_hash;
+        float camera[12]; // vfov, eye, lookat, up, aperture, focus distance
+        float sky[6];
+        uint64_t counts[SCENE_SECTION_COUNT];
+        uint64_t offsets[SCENE_SECTION_COUNT];
+    };
+
+    /* Camera of a scene file, a pinhole one when aperture is 0 */
+    struct SceneCamera
+    {
+        SceneCamera() : vfov(60.0f), eye(0, 0, 1), lookat(0, 0, 0), up(0, 1, 0), aperture(0), focus_dist(1) {}
+
+        PinholeCamera<float> pinhole(float aspect) const { return PinholeCamera<float>(vfov, aspect, eye, lookat, up); }
+        LensCamera<float> lens(float aspect) const { return LensCamera<float>(vfov, aspect, eye, lookat, up, aperture, focus_dist); }
+
+        float vfov;
+        glm::vec3 eye;
+        glm::vec3 lookat;
+        glm::vec3 up;
+        float aperture;
+        float focus_dist;
+    };
+
+    /* Records either owned or viewed in the mapped cache */
+    template <typename R>
+    struct SceneArray
+    {
+        SceneArray() : data(NULL), size(0) {}
+
+        void own(std::vector<R>& records) { storage.swap(records); data = storage.data(); size = storage.size(); }
+        void view(const R* records, size_t n) { storage.clear(); data = records; size = n; }
+        const R& operator[](size_t i) const { return data[i]; }
+
+        const R* data;
+        size_t size;
+        std::vector<R> storage;
+    };
+
+    /* A mapped cache file, a copy in memory where there is no mmap */
+    struct SceneMapping
+    {
+        SceneMapping() : data(NULL), size(0) {}
+
+        ~SceneMapping()
+        {
+#if !defined(_WIN32)
+            if (data) munmap((void*)data, size);
+#endif
+        }
+
+        SceneMapping(const SceneMapping& other) = delete;
+        void operator=(const SceneMapping& other) = delete;
+
+        const char* data;
+        size_t size;
+#if defined(_WIN32)
+        std::vector<cl_float4> copy;
+#endif
+    };
+
+    struct SceneDescription
+    {
+        SceneDescription() : sky_bottom(1.0f, 1.0f, 1.0f), sky_top(0.5f, 0.7f, 1.0f), source_hash(0) {}
+
+        SceneDescription(const SceneDescription& other) = delete;
+        void operator=(const SceneDescription& other) = delete;
+
+        size_t primitiveCount() const { return spheres.size + triangles.size; }
+
+        /* CPU form */
+        PrimitiveList<float> list;
+        std::vector<fMaterialRef> materials;
+
+        SceneCamera camera;
+        glm::vec3 sky_bottom;
+        glm::vec3 sky_top;
+
+        /* device form */
+        SceneArray<cl_sphere> spheres;
+        SceneArray<cl_triangle> triangles;
+        SceneArray<cl_material> material_table;
+        SceneArray<cl_uint> primitive_materials;
+        SceneArray<cl_bvh_node> nodes;
+        SceneArray<cl_uint> primitive_indices;
+        SceneArray<cl_instance> instances; // scene_pack_instances only, not in the cache
+
+        uint64_t source_hash;
+        std::shared_ptr<SceneMapping> mapping;
+    };
+
+    uint64_t scene_hash(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+    {
+        const unsigned char* bytes = (const unsigned char*)data;
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+
+        return hash;
+    }
+
+    bool scene_read_file(const std::string& path, std::string& out)
+    {
+        std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+        if (!file.is_open()) return false;
+
+        std::ostringstream content;
+        content << file.rdbuf();
+        out = content.str();
+        return true;
+    }
+
+    std::string scene_resolve_path(const std::string& scene_path, const std::string& file)
+    {
+        if (file.empty() || file[0] == '/' || file[0] == '\\' || (file.size() > 1 && file[1] == ':')) return file;
+
+        size_t slash = scene_path.find_last_of("/\\");
+        return (slash == std::string::npos) ? file : scene_path.substr(0, slash + 1) + file;
+    }
+
+    /* Hash of the scene text and of the size and modification time of its mesh files, what the cache is checked against */
+    uint64_t scene_source_hash(const std::string& path, const std::string& text)
+    {
+        uint64_t hash = scene_hash(text.data(), text.size());
+        std::istringstream lines(text);
+        std::string line, keyword, material, mesh;
+
+        while (std::getline(lines, line))
+        {
+            std::istringstream tokens(line);
+            if (!(tokens >> keyword) || keyword != "mesh" || !(tokens >> material >> mesh)) continue;
+
+            struct stat info;
+            int64_t stamp[2] = { -1, -1 };
+
+            if (stat(scene_resolve_path(path, mesh).c_str(), &info) == 0)
+            {
+                stamp[0] = (int64_t)info.st_size;
+                stamp[1] = (int64_t)info.st_mtime;
+            }
+
+            hash = scene_hash(stamp, sizeof(stamp), hash);
+        }
+
+        return hash;
+    }
+
+    /*
+     * Positions and triangle indices of the v and f lines of an OBJ file, every other line is skipped.
+     * Faces take v, v/vt, v//vn and v/vt/vn vertices, negative indices count back from the last vertex.
+     */
+    bool scene_load_obj(const std::string& path, std::vector<glm::vec3>& out_positions, std::vector<uint32_t>& out_indices)
+    {
+        std::string text;
+        if (!scene_read_file(path, text)) return false;
+
+        const char* s = text.c_str();
+        std::vector<long> face;
+
+        while (*s)
+        {
+            while (*s == ' ' || *s == '\t') ++s;
+
+            if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t'))
+            {
+                char* end;
+                glm::vec3 p;
+                s += 2;
+                p.x = strtof(s, &end); s = end;
+                p.y = strtof(s, &end); s = end;
+                p.z = strtof(s, &end); s = end;
+                out_positions.push_back(p);
+            }
+            else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t'))
+            {
+                s += 2;
+                face.clear();
+
+                while (*s && *s != '\n' && *s != '\r')
+                {
+                    char* end;
+                    long i = strtol(s, &end, 10);
+                    if (end == s) { ++s; continue; }
+                    s = end;
+
+                    /* skip /vt/vn */
+                    while (*s && *s != ' ' && *s != '\t' && *s != '\n' && *s != '\r') ++s;
+
+                    long n = (long)out_positions.size();
+                    i = (i < 0) ? n + i : i - 1;
+                    if (i < 0 || i >= n) return false;
+                    face.push_back(i);
+                }
+
+                for (size_t k = 2; k < face.size(); ++k)
+                {
+                    out_indices.push_back((uint32_t)face[0]);
+                    out_indices.push_back((uint32_t)face[k - 1]);
+                    out_indices.push_back((uint32_t)face[k]);
+                }
+            }
+
+            while (*s && *s != '\n') ++s;
+            if (*s) ++s;
+        }
+
+        return true;
+    }
+
+    bool scene_read_color(std::istringstream& tokens, glm::vec3& out_color)
+    {
+        std::string first;
+        if (!(tokens >> first)) return false;
+
+        if (first.compare(0, 2, "0x") == 0)
+        {
+            out_color = ColorHex_to_RGBfloat<float>(first);
+            return true;
+        }
+
+        out_color.x = strtof(first.c_str(), NULL);
+        return (bool)(tokens >> out_color.y >> out_color.z);
+    }
+
+    bool scene_read_vec3(std::istringstream& tokens, glm::vec3& out)
+    {
+        return (bool)(tokens >> out.x >> out.y >> out.z);
+    }
+
+    cl_triangle scene_make_triangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+    {
+        cl_triangle tri = {};
+        glm::vec3 e1 = v1 - v0;
+        glm::vec3 e2 = v2 - v0;
+        memcpy(&tri.v0, glm::value_ptr(v0), 3 * sizeof(float));
+        memcpy(&tri.e1, glm::value_ptr(e1), 3 * sizeof(float));
+        memcpy(&tri.e2, glm::value_ptr(e2), 3 * sizeof(float));
+        return tri;
+    }
+
+    /* CPU material of a device record, the inverse of cl_make_material */
+    fMaterialRef scene_make_material(const cl_material& material)
+    {
+        glm::vec3 albedo(material.albedo.s[0], material.albedo.s[1], material.albedo.s[2]);
+
+        switch (material.type)
+        {
+            case MAT_LAMBERTIAN: return std::make_shared<Lambertian<float>>(albedo);
+            case MAT_METALLIC: return std::make_shared<Metallic<float>>(albedo, material.albedo.s[3]);
+            case MAT_DIALECTRIC: return std::make_shared<Dialectric<float>>(material.albedo.s[3]);
+            case MAT_EMISSIVE: return std::make_shared<Emissive<float>>(albedo);
+        }
+
+        throw "Unknown material type";
+    }
+
+    cl_bvh_node scene_pack_node(const BVH<float>::Node& node)
+    {
+        cl_bvh_node packed;
+        memcpy(packed.bmin, glm::value_ptr(node.bmin), 3 * sizeof(float));
+        memcpy(packed.bmax, glm::value_ptr(node.bmax), 3 * sizeof(float));
+        packed.left_first = node.left_first;
+        packed.count = node.count;
+        return packed;
+    }
+
+    BVH<float>::Node scene_unpack_node(const cl_bvh_node& packed)
+    {
+        BVH<float>::Node node;
+        node.bmin = glm::vec3(packed.bmin[0], packed.bmin[1], packed.bmin[2]);
+        node.bmax = glm::vec3(packed.bmax[0], packed.bmax[1], packed.bmax[2]);
+        node.left_first = packed.left_first;
+        node.count = packed.count;
+        return node;
+    }
+
+    /* The CPU primitives and materials of the device records, in the same order */
+    void scene_build_cpu(SceneDescription& scene)
+    {
+        std::vector<fMaterialRef> table(scene.material_table.size);
+        for (size_t i = 0; i < table.size(); ++i) table[i] = scene_make_material(scene.material_table[i]);
+
+        scene.list.clear();
+        scene.list.reserve(scene.primitiveCount());
+        scene.materials.resize(scene.primitiveCount());
+
+        for (size_t i = 0; i < scene.spheres.size; ++i)
+        {
+            const cl_sphere& s = scene.spheres[i];
+            scene.list.push_back(std::make_shared<Sphere<float>>(glm::vec3(s.s[0], s.s[1], s.s[2]), s.s[3]));
+        }
+
+        for (size_t i = 0; i < scene.triangles.size; ++i)
+        {
+            const cl_triangle& t = scene.triangles[i];
+            glm::vec3 v0(t.v0.s[0], t.v0.s[1], t.v0.s[2]);
+            glm::vec3 e1(t.e1.s[0], t.e1.s[1], t.e1.s[2]);
+            glm::vec3 e2(t.e2.s[0], t.e2.s[1], t.e2.s[2]);
+            scene.list.push_back(std::make_shared<Triangle<float>>(v0, v0 + e1, v0 + e2));
+        }
+
+        for (size_t i = 0; i < scene.primitiveCount(); ++i)
+        {
+            cl_uint m = scene.primitive_materials[i];
+            if (m >= table.size()) throw "Scene primitive has no material";
+            scene.materials[i] = table[m];
+        }
+    }
+
+    /* A root leaf of nothing, no ray enters it */
+    cl_bvh_node scene_empty_node()
+    {
+        BVH<float>::Node empty;
+        empty.bmin = glm::vec3(std::numeric_limits<float>::max());
+        empty.bmax = glm::vec3(-std::numeric_limits<float>::max());
+        empty.left_first = 0;
+        empty.count = 0;
+        return scene_pack_node(empty);
+    }
+
+    /* Device BVH records of the CPU BVH, a root leaf of no primitive for an empty scene */
+    void scene_pack_bvh(SceneDescription& scene)
+    {
+        const std::shared_ptr<BVH<float>>& bvh = scene.list.getBVH();
+        std::vector<cl_bvh_node> nodes;
+        std::vector<cl_uint> indices;
+
+        if (bvh && !bvh->nodes.empty())
+        {
+            nodes.reserve(bvh->nodes.size());
+            for (const BVH<float>::Node& node : bvh->nodes) nodes.push_back(scene_pack_node(node));
+            indices.assign(bvh->indices.begin(), bvh->indices.end());
+        }
+        else
+        {
+            nodes.push_back(scene_empty_node());
+        }
+
+        scene.nodes.own(nodes);
+        scene.primitive_indices.own(indices);
+    }
+
+    void scene_parse_error(const std::string& path, size_t line, const std::string& message)
+    {
+        std::cerr << path << ":" << line << ": " << message << "\n";
+        throw "Could not parse scene file";
+    }
+
+    /* Parses a scene file and builds both forms, throws when it cannot be read or parsed */
+    void scene_load_text(const std::string& path, SceneDescription& scene)
+    {
+        std::string text;
+        if (!scene_read_file(path, text)) throw "Could not read scene file";
+
+        std::vector<cl_sphere> spheres;
+        std::vector<cl_triangle> triangles;
+        std::vector<cl_material> table;
+        std::vector<std::string> names;
+        std::vector<cl_uint> sphere_materials, triangle_materials;
+
+        std::istringstream lines(text);
+        std::string line, keyword;
+        size_t number = 0;
+
+        while (std::getline(lines, line))
+        {
+            ++number;
+
+            size_t comment = line.find('#');
+            if (comment != std::string::npos) line.resize(comment);
+
+            std::istringstream tokens(line);
+            if (!(tokens >> keyword)) continue;
+
+            if (keyword == "camera")
+            {
+                SceneCamera& cam = scene.camera;
+                if (!(tokens >> cam.vfov) || !scene_read_vec3(tokens, cam.eye) || !scene_read_vec3(tokens, cam.lookat) || !scene_read_vec3(tokens, cam.up))
+                    scene_parse_error(path, number, "camera needs a field of view, eye, lookat and up");
+
+                if (!(tokens >> cam.aperture >> cam.focus_dist))
+                {
+                    cam.aperture = 0;
+                    cam.focus_dist = 1;
+                }
+            }
+            else if (keyword == "sky")
+            {
+                if (!scene_read_color(tokens, scene.sky_bottom) || !scene_read_color(tokens, scene.sky_top))
+                    scene_parse_error(path, number, "sky needs a bottom and a top color");
+            }
+            else if (keyword == "material")
+            {
+                std::string name, type;
+                glm::vec3 color(1.0f);
+                float param = 0;
+
+                if (!(tokens >> name >> type)) scene_parse_error(path, number, "material needs a name and a type");
+
+                if (type == "lambertian")
+                {
+                    if (!scene_read_color(tokens, color)) scene_parse_error(path, number, "lambertian needs a color");
+                    table.push_back(cl_make_material(color, 0, MAT_LAMBERTIAN));
+                }
+                else if (type == "metal")
+                {
+                    if (!scene_read_color(tokens, color) || !(tokens >> param)) scene_parse_error(path, number, "metal needs a color and a fuzz");
+                    table.push_back(cl_make_material(color, clamp(param), MAT_METALLIC));
+                }
+                else if (type == "dielectric")
+                {
+                    if (!(tokens >> param)) scene_parse_error(path, number, "dielectric needs a refraction index");
+                    table.push_back(cl_make_material(color, param, MAT_DIALECTRIC));
+                }
+                else if (type == "emissive")
+                {
+                    if (!scene_read_color(tokens, color)) scene_parse_error(path, number, "emissive needs a color");
+                    if (!(tokens >> param)) param = 1;
+                    table.push_back(cl_make_material(color * param, 0, MAT_EMISSIVE));
+                }
+                else
+                {
+                    scene_parse_error(path, number, "unknown material type " + type);
+                }
+
+                names.push_back(name);
+            }
+            else if (keyword == "sphere" || keyword == "mesh")
+            {
+                std::string name;
+                tokens >> name;
+
+                size_t m = std::find(names.begin(), names.end(), name) - names.begin();
+                if (m == names.size()) scene_parse_error(path, number, "unknown material " + name);
+
+                if (keyword == "sphere")
+                {
+                    glm::vec3 center;
+                    float radius;
+                    if (!scene_read_vec3(tokens, center) || !(tokens >> radius)) scene_parse_error(path, number, "sphere needs a center and a radius");
+
+                    spheres.push_back(cl_make_sphere(center, radius));
+                    sphere_materials.push_back((cl_uint)m);
+                    continue;
+                }
+
+                std::string file;
+                glm::vec3 translation(0.0f);
+                float scale = 1;
+                if (!(tokens >> file)) scene_parse_error(path, number, "mesh needs a file");
+                if (scene_read_vec3(tokens, translation)) tokens >> scale;
+
+                std::vector<glm::vec3> positions;
+                std::vector<uint32_t> indices;
+                if (!scene_load_obj(scene_resolve_path(path, file), positions, indices)) scene_parse_error(path, number, "could not load mesh " + file);
+
+                for (glm::vec3& p : positions) p = p * scale + translation;
+
+                for (size_t i = 0; i < indices.size(); i += 3)
+                {
+                    triangles.push_back(scene_make_triangle(positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]]));
+                    triangle_materials.push_back((cl_uint)m);
+                }
+            }
+            else
+            {
+                scene_parse_error(path, number, "unknown statement " + keyword);
+            }
+        }
+
+        sphere_materials.insert(sphere_materials.end(), triangle_materials.begin(), triangle_materials.end());
+
+        scene.mapping.reset();
+        scene.spheres.own(spheres);
+        scene.triangles.own(triangles);
+        scene.material_table.own(table);
+        scene.primitive_materials.own(sphere_materials);
+        scene.source_hash = scene_source_hash(path, text);
+
+        scene_build_cpu(scene);
+        scene.list.buildBVH();
+        scene_pack_bvh(scene);
+    }
+
+    uint64_t scene_align(uint64_t offset) { return (offset + 15) & ~(uint64_t)15; }
+
+    /* Writes the device form of a loaded scene, through a temporary file so a mapped previous cache stays whole */
+    bool scene_write_cache(const SceneDescription& scene, const std::string& path)
+    {
+        if (scene.instances.size > 0) return false;
+
+        SceneCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SceneCacheMagic, sizeof(header.magic));
+        header.version = SceneCacheVersion;
+        header.byte_order = SceneCacheByteOrder;
+        header.source_hash = scene.source_hash;
+
+        const SceneCamera& cam = scene.camera;
+        float camera[12] = { cam.vfov, cam.eye.x, cam.eye.y, cam.eye.z, cam.lookat.x, cam.lookat.y, cam.lookat.z,
+                             cam.up.x, cam.up.y, cam.up.z, cam.aperture, cam.focus_dist };
+        float sky[6] = { scene.sky_bottom.x, scene.sky_bottom.y, scene.sky_bottom.z, scene.sky_top.x, scene.sky_top.y, scene.sky_top.z };
+        memcpy(header.camera, camera, sizeof(camera));
+        memcpy(header.sky, sky, sizeof(sky));
+
+        const void* data[SCENE_SECTION_COUNT] = { scene.spheres.data, scene.triangles.data, scene.material_table.data,
+                                                  scene.primitive_materials.data, scene.nodes.data, scene.primitive_indices.data };
+        size_t bytes[SCENE_SECTION_COUNT] = { scene.spheres.size * sizeof(cl_sphere), scene.triangles.size * sizeof(cl_triangle),
+                                              scene.material_table.size * sizeof(cl_material), scene.primitive_materials.size * sizeof(cl_uint),
+                                              scene.nodes.size * sizeof(cl_bvh_node), scene.primitive_indices.size * sizeof(cl_uint) };
+        size_t counts[SCENE_SECTION_COUNT] = { scene.spheres.size, scene.triangles.size, scene.material_table.size,
+                                               scene.primitive_materials.size, scene.nodes.size, scene.primitive_indices.size };
+
+        uint64_t offset = scene_align(sizeof(header));
+
+        for (int i = 0; i < SCENE_SECTION_COUNT; ++i)
+        {
+            header.counts[i] = counts[i];
+            header.offsets[i] = offset;
+            offset = scene_align(offset + bytes[i]);
+        }
+
+        std::string temp = path + ".tmp";
+        std::ofstream file(temp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return false;
+
+        const char zeros[16] = {};
+        file.write((const char*)&header, sizeof(header));
+        file.write(zeros, scene_align(sizeof(header)) - sizeof(header));
+
+        for (int i = 0; i < SCENE_SECTION_COUNT; ++i)
+        {
+            if (bytes[i]) file.write((const char*)data[i], bytes[i]);
+            file.write(zeros, scene_align(bytes[i]) - bytes[i]);
+        }
+
+        file.close();
+        if (!file) { remove(temp.c_str()); return false; }
+
+        /* rename does not replace an existing file on windows */
+#if defined(_WIN32)
+        remove(path.c_str());
+#endif
+        return rename(temp.c_str(), path.c_str()) == 0;
+    }
+
+    std::shared_ptr<SceneMapping> scene_map_file(const std::string& path)
+    {
+        std::shared_ptr<SceneMapping> mapping(new SceneMapping());
+
+#if defined(_WIN32)
+        std::ifstream file(path.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+        if (!file.is_open()) return NULL;
+
+        mapping->size = (size_t)file.tellg();
+        mapping->copy.resize((mapping->size + sizeof(cl_float4) - 1) / sizeof(cl_float4));
+        file.seekg(0);
+        if (!file.read((char*)mapping->copy.data(), mapping->size)) return NULL;
+        mapping->data = (const char*)mapping->copy.data();
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return NULL;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(SceneCacheHeader)) { close(fd); return NULL; }
+
+        void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) return NULL;
+
+        mapping->data = (const char*)data;
+        mapping->size = (size_t)info.st_size;
+#endif
+
+        return mapping;
+    }
+
+    /*
+     * Whether the mapped records only refer to what the cache holds: materials of a known type (scene_make_material),
+     * primitive materials in the material table, primitive indices below the primitive count, inner nodes with both children after them and no deeper than MaxDepth,
+     * leaves within the primitive indices. An empty scene has a single empty root.
+     */
+    bool scene_valid_cache(const SceneCacheHeader& header, const char* base)
+    {
+        uint64_t primitives = header.counts[SCENE_SPHERES] + header.counts[SCENE_TRIANGLES];
+        uint64_t node_count = header.counts[SCENE_NODES];
+        uint64_t index_count = header.counts[SCENE_PRIMITIVE_INDICES];
+
+        const cl_material* table = (const cl_material*)(base + header.offsets[SCENE_MATERIALS]);
+        const cl_uint* materials = (const cl_uint*)(base + header.offsets[SCENE_PRIMITIVE_MATERIALS]);
+        const cl_uint* indices = (const cl_uint*)(base + header.offsets[SCENE_PRIMITIVE_INDICES]);
+        const cl_bvh_node* nodes = (const cl_bvh_node*)(base + header.offsets[SCENE_NODES]);
+
+        for (uint64_t i = 0; i < header.counts[SCENE_MATERIALS]; ++i)
+            if (table[i].type < MAT_LAMBERTIAN || table[i].type > MAT_EMISSIVE) return false;
+
+        for (uint64_t i = 0; i < primitives; ++i)
+            if (materials[i] >= header.counts[SCENE_MATERIALS]) return false;
+
+        if (primitives == 0) return node_count == 1 && nodes[0].count == 0 && index_count == 0;
+        if (index_count != primitives) return false;
+
+        for (uint64_t i = 0; i < index_count; ++i)
+            if (indices[i] >= primitives) return false;
+
+        std::vector<int> depth(node_count, 0);
+
+        for (uint64_t i = 0; i < node_count; ++i)
+        {
+            int64_t first = nodes[i].left_first, count = nodes[i].count;
+
+            if (count > 0)
+            {
+                if (first < 0 || (uint64_t)(first + count) > index_count) return false;
+                continue;
+            }
+
+            if (count < 0 || first <= (int64_t)i || (uint64_t)first + 1 >= node_count) return false;
+            if (depth[i] + 1 >= BVH<float>::MaxDepth) return false;
+
+            depth[first] = std::max(depth[first], depth[i] + 1);
+            depth[first + 1] = std::max(depth[first + 1], depth[i] + 1);
+        }
+
+        return true;
+    }
+
+    /*
+     * Maps a cache written by scene_write_cache and builds the CPU form around its records,
+     * false when it cannot be read, is of another version or byte order, or was not written for source_hash (any when 0),
+     * or when its records refer outside of it (scene_valid_cache)
+     */
+    bool scene_load_cache(const std::string& path, SceneDescription& scene, uint64_t source_hash = 0)
+    {
+        std::shared_ptr<SceneMapping> mapping = scene_map_file(path);
+        if (!mapping || mapping->size < sizeof(SceneCacheHeader)) return false;
+
+        SceneCacheHeader header;
+        memcpy(&header, mapping->data, sizeof(header));
+
+        if (memcmp(header.magic, SceneCacheMagic, sizeof(header.magic)) != 0
+            || header.version != SceneCacheVersion
+            || header.byte_order != SceneCacheByteOrder
+            || (source_hash && header.source_hash != source_hash)) return false;
+
+        size_t record[SCENE_SECTION_COUNT] = { sizeof(cl_sphere), sizeof(cl_triangle), sizeof(cl_material),
+                                               sizeof(cl_uint), sizeof(cl_bvh_node), sizeof(cl_uint) };
+
+        for (int i = 0; i < SCENE_SECTION_COUNT; ++i)
+        {
+            if (header.offsets[i] % 16 != 0 || header.offsets[i] > mapping->size
+                || header.counts[i] > (mapping->size - header.offsets[i]) / record[i]) return false;
+        }
+
+        uint64_t primitives = header.counts[SCENE_SPHERES] + header.counts[SCENE_TRIANGLES];
+        if (header.counts[SCENE_PRIMITIVE_MATERIALS] != primitives || header.counts[SCENE_NODES] == 0) return false;
+        if (!scene_valid_cache(header, mapping->data)) return false;
+
+        const char* base = mapping->data;
+        scene.mapping = mapping;
+        scene.spheres.view((const cl_sphere*)(base + header.offsets[SCENE_SPHERES]), header.counts[SCENE_SPHERES]);
+        scene.triangles.view((const cl_triangle*)(base + header.offsets[SCENE_TRIANGLES]), header.counts[SCENE_TRIANGLES]);
+        scene.material_table.view((const cl_material*)(base + header.offsets[SCENE_MATERIALS]), header.counts[SCENE_MATERIALS]);
+        scene.primitive_materials.view((const cl_uint*)(base + header.offsets[SCENE_PRIMITIVE_MATERIALS]), header.counts[SCENE_PRIMITIVE_MATERIALS]);
+        scene.nodes.view((const cl_bvh_node*)(base + header.offsets[SCENE_NODES]), header.counts[SCENE_NODES]);
+        scene.primitive_indices.view((const cl_uint*)(base + header.offsets[SCENE_PRIMITIVE_INDICES]), header.counts[SCENE_PRIMITIVE_INDICES]);
+        scene.source_hash = header.source_hash;
+
+        const float* c = header.camera;
+        scene.camera.vfov = c[0];
+        scene.camera.eye = glm::vec3(c[1], c[2], c[3]);
+        scene.camera.lookat = glm::vec3(c[4], c[5], c[6]);
+        scene.camera.up = glm::vec3(c[7], c[8], c[9]);
+        scene.camera.aperture = c[10];
+        scene.camera.focus_dist = c[11];
+        scene.sky_bottom = glm::vec3(header.sky[0], header.sky[1], header.sky[2]);
+        scene.sky_top = glm::vec3(header.sky[3], header.sky[4], header.sky[5]);
+
+        scene_build_cpu(scene);
+
+        /* the BVH as it was built, an empty scene keeps the linear list */
+        if (primitives > 0)
+        {
+            std::shared_ptr<BVH<float>> bvh = std::make_shared<BVH<float>>();
+            bvh->nodes.resize(scene.nodes.size);
+            for (size_t i = 0; i < scene.nodes.size; ++i) bvh->nodes[i] = scene_unpack_node(scene.nodes[i]);
+            bvh->indices.assign(scene.primitive_indices.data, scene.primitive_indices.data + scene.primitive_indices.size);
+            scene.list.setBVH(bvh);
+        }
+
+        return true;
+    }
+
+    /*
+     * Device form of an instanced scene (scene_tracing.cl with PT_INSTANCES), the CPU form and the camera are left alone.
+     * materials is the list the material indices of the geometries and instances refer to.
+     * Nodes start with the top level BVH, then every geometry is packed once however many instances it has:
+     * its primitives, their materials and its BVH with the children and leaf ranges moved to where they land.
+     */
+    void scene_pack_instances(const InstanceList<float>& list, const std::vector<fMaterialRef>& materials, SceneDescription& scene)
+    {
+        if (!list.empty() && !list.getBVH().covers(list.size())) throw "Instance list must be built before packing";
+
+        std::vector<const Geometry<float>*> geometries;
+        std::map<const Geometry<float>*, cl_uint> roots;
+        size_t sphere_total = 0;
+
+        for (const Instance<float>& instance : list)
+        {
+            if (roots.count(instance.geometry.get())) continue;
+            roots[instance.geometry.get()] = 0;
+            geometries.push_back(instance.geometry.get());
+
+            for (const std::shared_ptr<Primitive<float>>& prim : instance.geometry->primitives)
+                if (std::dynamic_pointer_cast<Sphere<float>>(prim)) ++sphere_total;
+        }
+
+        std::vector<cl_sphere> spheres;
+        std::vector<cl_triangle> triangles;
+        std::vector<cl_uint> sphere_materials, triangle_materials;
+        std::vector<cl_bvh_node> nodes;
+        std::vector<cl_uint> indices;
+        std::vector<cl_instance> instances(list.size());
+
+        if (list.empty()) nodes.push_back(scene_empty_node());
+        for (const BVH<float>::Node& node : list.getBVH().nodes) nodes.push_back(scene_pack_node(node));
+        indices.assign(list.getBVH().indices.begin(), list.getBVH().indices.end());
+
+        for (const Geometry<float>* geometry : geometries)
+        {
+            const BVH<float>& bvh = *geometry->primitives.getBVH();
+            std::vector<cl_uint> ids(geometry->primitives.size());
+
+            for (size_t i = 0; i < ids.size(); ++i)
+            {
+                const std::shared_ptr<Primitive<float>>& prim = geometry->primitives[i];
+                fSphereRef sphere = std::dynamic_pointer_cast<Sphere<float>>(prim);
+                fTriangleRef tri = std::dynamic_pointer_cast<Triangle<float>>(prim);
+
+                if (sphere)
+                {
+                    ids[i] = (cl_uint)spheres.size();
+                    spheres.push_back(cl_sphere());
+                    pack_cl_sphere(sphere, spheres.back());
+                    sphere_materials.push_back(geometry->materials[i]);
+                }
+                else if (tri)
+                {
+                    ids[i] = (cl_uint)(sphere_total + triangles.size());
+                    triangles.push_back(scene_make_triangle(tri->getVertex(0), tri->getVertex(1), tri->getVertex(2)));
+                    triangle_materials.push_back(geometry->materials[i]);
+                }
+                else throw "Only spheres and triangles have a device counterpart";
+            }
+
+            cl_int node_offset = (cl_int)nodes.size();
+            cl_int index_offset = (cl_int)indices.size();
+            roots[geometry] = (cl_uint)node_offset;
+
+            for (const BVH<float>::Node& node : bvh.nodes)
+            {
+                cl_bvh_node packed = scene_pack_node(node);
+                packed.left_first += (packed.count > 0) ? index_offset : node_offset;
+                nodes.push_back(packed);
+            }
+
+            for (uint32_t i : bvh.indices) indices.push_back(ids[i]);
+        }
+
+        for (size_t i = 0; i < list.size(); ++i)
+        {
+            const Instance<float>& instance = list[i];
+            cl_instance& packed = instances[i];
+            memset(&packed, 0, sizeof(packed));
+
+            for (int r = 0; r < 3; ++r)
+            {
+                memcpy(&packed.to_object[r], glm::value_ptr(instance.to_object.rows[r]), 3 * sizeof(float));
+                packed.to_object[r].s[3] = instance.to_object.offset[r];
+            }
+
+            packed.root = roots[instance.geometry.get()];
+            packed.material = instance.material;
+        }
+
+        std::vector<cl_material> table(materials.size());
+        for (size_t i = 0; i < materials.size(); ++i) table[i] = cl_make_material(materials[i]);
+
+        std::vector<cl_uint> primitive_materials(sphere_materials);
+        primitive_materials.insert(primitive_materials.end(), triangle_materials.begin(), triangle_materials.end());
+
+        scene.spheres.own(spheres);
+        scene.triangles.own(triangles);
+        scene.material_table.own(table);
+        scene.primitive_materials.own(primitive_materials);
+        scene.nodes.own(nodes);
+        scene.primitive_indices.own(indices);
+        scene.instances.own(instances);
+    }
+
+    /*
+     * Loads path from its cache (path + ".cache") when the cache is up to date, from the text otherwise,
+     * then writes the cache. from_cache tells which one was used.
+     */
+    void scene_load(const std::string& path, SceneDescription& scene, bool* from_cache = NULL)
+    {
+        std::string text;
+        if (!scene_read_file(path, text)) throw "Could not read scene file";
+
+        std::string cache = path + ".cache";
+        bool cached = scene_load_cache(cache, scene, scene_source_hash(path, text));
+        if (from_cache) *from_cache = cached;
+        if (cached) return;
+
+        scene_load_text(path, scene);
+
+        if (!scene_write_cache(scene, cache))
+            std::cerr << "Could not write scene cache " << cache << "\n";
+    }
+}
+
+/*
+ * Device buffers of a scene, the arguments of scene_tracing_accumulate from 1 on (scene_tracing.cl).
+ * instances has one record of zeros for a scene without instances.
+ * materials is the material table, sphere_materials the material of every sphere for the sphere only
+ * kernels (path_tracing_accumulate) which take one per primitive.
+ */
+typedef struct cl_scene_buffers
+{
+    cl::Buffer  nodes;
+    cl::Buffer  primitive_indices;
+    cl::Buffer  spheres;
+    cl::Buffer  triangles;
+    cl::Buffer  primitive_materials;
+    cl::Buffer  instances;
+    cl::Buffer  materials;
+    cl::Buffer  sphere_materials;
+    cl::Buffer  sky;
+    cl_uint     sphere_count;
+} cl_scene_buffers;
+
+/* A read only buffer with a copy of count records, one record of zeros when count is 0 */
+cl::Buffer cl_scene_buffer(cl::Context& context, const void* records, size_t count, size_t record_size, cl_int* status)
+{
+    std::vector<char> zeros;
+
+    if (count == 0)
+    {
+        zeros.resize(record_size, 0);
+        records = zeros.data();
+        count = 1;
+    }
+
+    return cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, count * record_size, const_cast<void*>(records), status);
+}
+
+/* Copies the device form of scene into new buffers, straight from the mapping for a cached scene */
+cl_int cl_upload_scene(cl::Context& context,
+                       const cl::CommandQueue& cmd_queue,
+                       const pt::SceneDescription& scene,
+                       cl_scene_buffers& out_buffers)
+{
+    cl_int clStatus;
+
+    std::vector<cl_material> sphere_materials(scene.spheres.size);
+    for (size_t i = 0; i < sphere_materials.size(); ++i) sphere_materials[i] = scene.material_table[scene.primitive_materials[i]];
+
+    out_buffers.nodes = cl_scene_buffer(context, scene.nodes.data, scene.nodes.size, sizeof(cl_bvh_node), &clStatus);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    out_buffers.primitive_indices = cl_scene_buffer(context, scene.primitive_indices.data, scene.primitive_indices.size, sizeof(cl_uint), &clStatus);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    out_buffers.spheres = cl_scene_buffer(context, scene.spheres.data, scene.spheres.size, sizeof(cl_sphere), &clStatus);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    out_buffers.triangles = cl_scene_buffer(context, scene.triangles.data, scene.triangles.size, sizeof(cl_triangle), &clStatus);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    out_buffers.primitive_materials = cl_scene_buffer(context, scene.primitive_materials.data, scene.primitive_materials.size, sizeof(cl_uint), &clStatus);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    out_buffers.instances = cl_scene_buffer(context, scene.instances.data, scene.instances.size, sizeof(cl_instance), &clStatus);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    out_buffers.materials = cl_scene_buffer(context, scene.material_table.data, scene.material_table.size, sizeof(cl_material), &clStatus);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    out_buffers.sphere_materials = cl_scene_buffer(context, sphere_materials.data(), sphere_materials.size(), sizeof(cl_material), &clStatus);
+    if (clStatus != CL_SUCCESS) return clStatus;
+    out_buffers.sky = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(cl_sky_material), NULL, &clStatus);
+    if (clStatus != CL_SUCCESS) return clStatus;
+
+    out_buffers.sphere_count = (cl_uint)scene.spheres.size;
+
+    return cl_set_skycolors(scene.sky_bottom, scene.sky_top, out_buffers.sky, cmd_queue);
+}
+
+/* Sets arguments 1 to 9 of scene_tracing_accumulate, the camera and the accumulation are left to the caller */
+cl_int cl_set_scene_args(cl::Kernel& kernel, const cl_scene_buffers& buffers)
+{
+    cl_int clStatus = kernel.setArg(1, buffers.nodes);
+    clStatus |= kernel.setArg(2, buffers.primitive_indices);
+    clStatus |= kernel.setArg(3, buffers.spheres);
+    clStatus |= kernel.setArg(4, buffers.sphere_count);
+    clStatus |= kernel.setArg(5, buffers.triangles);
+    clStatus |= kernel.setArg(6, buffers.primitive_materials);
+    clStatus |= kernel.setArg(7, buffers.instances);
+    clStatus |= kernel.setArg(8, buffers.materials);
+    clStatus |= kernel.setArg(9, buffers.sky);
+
+    return (clStatus != CL_SUCCESS) ? CL_INVALID_KERNEL_ARGS : CL_SUCCESS;
+}
+
+#endif /* ptScene_h */
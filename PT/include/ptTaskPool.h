@@ -0,0 +1,117 @@
+#ifndef ptTaskPool_h
+#define ptTaskPool_h
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed pool of threads running tasks from one queue, for work split while it runs (BVH builds).
+ * A task may queue more tasks into its group, wait(group) runs queued tasks on the calling thread
+ * until the group is done, so a pool of 0 threads runs everything in wait. Tasks must not wait themselves.
+ */
+
+namespace pt
+{
+    /* The tasks of one job, to wait for them alone */
+    struct TaskGroup
+    {
+        TaskGroup() : pending(0) {}
+
+        std::atomic<int> pending;
+    };
+
+    class TaskPool
+    {
+    public:
+        explicit TaskPool(unsigned int threads = std::thread::hardware_concurrency()) : stop(false)
+        {
+            for (unsigned int i = 0; i < threads; ++i)
+            {
+                workers.push_back(std::thread([this]() {
+                    while (runOne(true)) {}
+                }));
+            }
+        }
+
+        /* Runs what is still queued, then joins */
+        ~TaskPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+
+            wake.notify_all();
+            for (std::thread& w : workers) w.join();
+        }
+
+        TaskPool(const TaskPool& other) = delete;
+        void operator=(const TaskPool& other) = delete;
+
+        void run(TaskGroup& group, const std::function<void()>& task)
+        {
+            group.pending.fetch_add(1);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(Task(&group, task));
+            }
+
+            wake.notify_one();
+        }
+
+        void wait(TaskGroup& group)
+        {
+            while (group.pending.load() > 0)
+            {
+                if (!runOne(false)) std::this_thread::yield();
+            }
+        }
+
+        /* Worker threads, the caller of wait helps them */
+        unsigned int size() const { return (unsigned int)workers.size(); }
+
+    private:
+        typedef std::pair<TaskGroup*, std::function<void()>> Task;
+
+        /* Runs the next task, false when there is none and block is false, or when stopping with an empty queue */
+        bool runOne(bool block)
+        {
+            Task task;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                if (block) wake.wait(lock, [this]() { return stop || !queue.empty(); });
+                if (queue.empty()) return false;
+
+                task = queue.front();
+                queue.pop_front();
+            }
+
+            task.second();
+            task.first->pending.fetch_sub(1);
+            return true;
+        }
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<Task> queue;
+        std::vector<std::thread> workers;
+        bool stop;
+    };
+
+    /* Pool of one thread per core shared by the builders, made on first use */
+    inline TaskPool& task_pool()
+    {
+        static TaskPool pool;
+        return pool;
+    }
+}
+
+#endif /* ptTaskPool_h */
@@ -25,6 +25,7 @@
 
 #include "ptUtil.h"
 #include "ptCL.h"
+#include "ptCLRuntime.h"
 
 #define PT_TEST_PASS 0
 #define PT_TEST_FAIL 1
@@ -36,6 +37,9 @@ namespace pt
         
         typedef int pt_test_result;
         
+        /* Set by the test runner, programs are then built through the runtime (include resolution, cache) */
+        CLRuntime* test_runtime = nullptr;
+        
         cl_int test_util_get_program(cl::Device& device,
                                      cl::Context& context,
                                      cl::Program& program,
@@ -44,6 +48,16 @@ namespace pt
         {
             cl_int clStatus;
             
+            if (test_runtime != nullptr && test_runtime->getContext()() == context())
+            {
+                /* test paths are relative to the Xcode build directory, only the file name matters here */
+                std::string file = program_file_str;
+                size_t slash = file.find_last_of("/\\");
+                if (slash != std::string::npos) file = file.substr(slash + 1);
+                
+                return test_runtime->buildProgram(file, program_options ? program_options : "", program);
+            }
+            
             std::ifstream program_file(program_file_str);
             std::string program_str(std::istreambuf_iterator<char>(program_file), (std::istreambuf_iterator<char>()));
             cl::Program::Sources sources(1, std::make_pair(program_str.c_str(), program_str.length() + 1));
@@ -59,6 +73,126 @@ namespace pt
             return clStatus;
         }
         
+        /* The runtime's pool when the tests run through it, otherwise one pool per test binary */
+        CLBufferPool& test_util_buffer_pool(cl::Context& context)
+        {
+            if (test_runtime != nullptr && test_runtime->getContext()() == context()) return test_runtime->getBufferPool();
+            
+            static std::unique_ptr<CLBufferPool> pool;
+            static cl_context pool_context = NULL;
+            
+            if (!pool || pool_context != context())
+            {
+                pool.reset(new CLBufferPool(context));
+                pool_context = context();
+            }
+            
+            return *pool;
+        }
+        
+        /*
+         * A data file of the benches: the path in the environment variable env when it is set, else name looked up
+         * in the assets directory of the runtime (PT_CL_ASSETS or the usual relative locations), empty when not found
+         */
+        std::string test_util_find_file(const char* env, const std::string& name)
+        {
+            const char* path = getenv(env);
+            if (path) return path;
+            
+            return test_runtime != nullptr ? test_runtime->findFile(name) : "";
+        }
+        
+        /* The runtime's autotuner when the tests run through it, otherwise one in memory tuner per test binary */
+        CLAutotuner& test_util_autotuner(cl::Device& device, cl::Context& context, cl::CommandQueue& cmd_queue)
+        {
+            if (test_runtime != nullptr && test_runtime->getContext()() == context()) return test_runtime->getAutotuner();
+            
+            static std::unique_ptr<CLAutotuner> autotuner;
+            static cl_command_queue autotuner_queue = NULL;
+            
+            if (!autotuner || autotuner_queue != cmd_queue())
+            {
+                autotuner.reset(new CLAutotuner(device, cmd_queue, ""));
+                autotuner_queue = cmd_queue();
+            }
+            
+            return *autotuner;
+        }
+        
+        /*
+         * The PTWeekend spheres (lambertian and metal) and sky, returns the number of objects
+         */
+        cl_uint test_util_weekend_scene(cl::CommandQueue& cmd_queue,
+                                        cl::Buffer& primitive_buffer,
+                                        cl::Buffer& material_buffer,
+                                        cl::Buffer& sky_buffer)
+        {
+            cl_int clStatus;
+            const cl_uint sceneObjectCount = 5;
+            cl_sphere primitive_array[sceneObjectCount];
+            cl_material material_array[sceneObjectCount];
+            
+            primitive_array[0] = cl_make_sphere(glm::vec3(1, 0, -1), 0.5f);
+            material_array[0] = cl_make_material(pt::ColorHex_to_RGBfloat<float>("0x730202"), 0, MAT_LAMBERTIAN);
+            primitive_array[1] = cl_make_sphere(glm::vec3(-1, 0, -1), 0.5f);
+            material_array[1] = cl_make_material(pt::ColorHex_to_RGBfloat<float>("0xF89000"), 0, MAT_LAMBERTIAN);
+            primitive_array[2] = cl_make_sphere(glm::vec3(0, 0, 0), 0.5f);
+            material_array[2] = cl_make_material(pt::ColorHex_to_RGBfloat<float>("0x97A663"), 0.1f, MAT_METALLIC);
+            primitive_array[3] = cl_make_sphere(glm::vec3(0, 0, -2), 0.5f);
+            material_array[3] = cl_make_material(glm::vec3(0.8f, 0.6f, 0.2f), 0.3f, MAT_METALLIC);
+            primitive_array[4] = cl_make_sphere(glm::vec3(0,-100.5f, 1.0f), 100.0f);
+            material_array[4] = cl_make_material(glm::vec3(0.5f), 0, MAT_LAMBERTIAN);
+            
+            PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write primitive buffer error.", cmd_queue, primitive_buffer, CL_TRUE, 0, sceneObjectCount * sizeof(cl_sphere), primitive_array, NULL, NULL)
+            PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write material buffer error.", cmd_queue, material_buffer, CL_TRUE, 0, sceneObjectCount * sizeof(cl_material), material_array, NULL, NULL)
+            
+            clStatus = cl_set_skycolors(glm::vec3(1.0, 1.0, 1.0), glm::vec3(0.5, 0.7, 1.0), sky_buffer, cmd_queue);
+            PTCL_ASSERT(clStatus, "Could not fill sky buffer")
+            
+            return sceneObjectCount;
+        }
+        
+        /*
+         * Uploads a CPU scene of spheres (random_scene, diffuse_metal_glass_scene...) into buffers sized for it, sky as in PTWeekend.
+         * Returns the number of objects
+         */
+        cl_uint test_util_upload_scene(cl::Context& context,
+                                       cl::CommandQueue& cmd_queue,
+                                       const pt::PrimitiveList<float>& list,
+                                       const std::vector<pt::fMaterialRef>& materials,
+                                       cl::Buffer& primitive_buffer,
+                                       cl::Buffer& material_buffer,
+                                       cl::Buffer& sky_buffer)
+        {
+            cl_int clStatus;
+            std::vector<cl_sphere> primitive_array(list.size());
+            std::vector<cl_material> material_array(list.size());
+            
+            for (size_t i = 0; i < list.size(); ++i)
+            {
+                pt::fSphereRef sphere = std::dynamic_pointer_cast<pt::Sphere<float>>(list[i]);
+                if (!sphere) throw "Only spheres have a device counterpart";
+                
+                pack_cl_sphere(sphere, primitive_array[i]);
+                material_array[i] = cl_make_material(materials[i]);
+            }
+            
+            primitive_buffer = cl::Buffer(context, CL_MEM_READ_ONLY, primitive_array.size() * sizeof(cl_sphere), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create primitive buffer")
+            material_buffer = cl::Buffer(context, CL_MEM_READ_ONLY, material_array.size() * sizeof(cl_material), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create material buffer")
+            sky_buffer = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(cl_sky_material), NULL, &clStatus);
+            PTCL_ASSERT(clStatus, "Could not create sky buffer")
+            
+            PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write primitive buffer error.", cmd_queue, primitive_buffer, CL_TRUE, 0, primitive_array.size() * sizeof(cl_sphere), primitive_array.data(), NULL, NULL)
+            PTCL_SAFE_ENQUEUE_WRITE_BUFFER("Write material buffer error.", cmd_queue, material_buffer, CL_TRUE, 0, material_array.size() * sizeof(cl_material), material_array.data(), NULL, NULL)
+            
+            clStatus = cl_set_skycolors(glm::vec3(1.0, 1.0, 1.0), glm::vec3(0.5, 0.7, 1.0), sky_buffer, cmd_queue);
+            PTCL_ASSERT(clStatus, "Could not fill sky buffer")
+            
+            return (cl_uint)list.size();
+        }
+        
         bool cl_float3_equals(const cl_float3& lhs, const cl_float3& rhs)
         {
             return (fabsf(lhs.x - rhs.x) <= FLT_EPSILON
@@ -87,6 +221,23 @@ namespace pt
             return result;
         }
         
+        /* RGB error between two float4 images, clamped to [0, 1] */
+        double rmse(const std::vector<cl_float4>& a, const std::vector<cl_float4>& b)
+        {
+            double sum = 0;
+            
+            for (size_t i = 0; i < a.size(); ++i)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    double d = (double)clamp(a[i].s[c]) - (double)clamp(b[i].s[c]);
+                    sum += d * d;
+                }
+            }
+            
+            return sqrt(sum / (double)(3 * a.size()));
+        }
+        
         void print_perf_results(const std::string& name,
                                 const size_t& global_size,
                                 const size_t& local_size,
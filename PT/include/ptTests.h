@@ -103,22 +103,12 @@ namespace pt
             free(buffer);
         }
         
-        void test_lenscam_ppm(unsigned int width, unsigned int height, unsigned int samples = 8)
+        void diffuse_metal_glass_scene(PrimitiveList<float>& list,
+                                       std::vector<std::shared_ptr<Material<float>>>& materials)
         {
-            float* buffer = (float*)malloc(3 * width * height * sizeof(float));
-
-            ptvec<float> eye(3,3,2);
-            ptvec<float> lookat(0,0,-1);
-            float dist_focus = glm::length(eye - lookat);
-            float aperture = 2.0f;
-            
-            LensCamera<float> cam(20.0f, (float)width/(float)height,
-                                  eye,
-                                  lookat,
-                                  glm::vec3(0,1,0),
-                                  aperture, dist_focus);
+            list.clear();
+            materials.clear();
             
-            PrimitiveList<float> list;
             list.push_back(std::shared_ptr<Sphere<float>>(
                                                           new Sphere<float>(glm::vec3(0,0,-1.0f), 0.5f)));
             
@@ -133,14 +123,32 @@ namespace pt
             list.push_back(std::shared_ptr<Sphere<float>>(
                                                           new Sphere<float>(glm::vec3(-1,0,-1), -0.45f)));
             
-            std::vector<std::shared_ptr<Material<float>>> materials;
             materials.push_back(std::shared_ptr<Material<float>>(new Lambertian<float>(glm::vec3(0.8f, 0.3f, 0.3f))));
             materials.push_back(std::shared_ptr<Material<float>>(new Lambertian<float>(glm::vec3(0.8f, 0.8f, 0.0f))));
             
             materials.push_back(std::shared_ptr<Material<float>>(new Metallic<float>(glm::vec3(0.8f, 0.6f, 0.2f), 0.3f)));
             materials.push_back(std::shared_ptr<Material<float>>(new Dialectric<float>(1.5f)));
             materials.push_back(std::shared_ptr<Material<float>>(new Dialectric<float>(1.5f)));
+        }
+        
+        void test_lenscam_ppm(unsigned int width, unsigned int height, unsigned int samples = 8)
+        {
+            float* buffer = (float*)malloc(3 * width * height * sizeof(float));
+
+            ptvec<float> eye(3,3,2);
+            ptvec<float> lookat(0,0,-1);
+            float dist_focus = glm::length(eye - lookat);
+            float aperture = 2.0f;
+            
+            LensCamera<float> cam(20.0f, (float)width/(float)height,
+                                  eye,
+                                  lookat,
+                                  glm::vec3(0,1,0),
+                                  aperture, dist_focus);
             
+            PrimitiveList<float> list;
+            std::vector<std::shared_ptr<Material<float>>> materials;
+            diffuse_metal_glass_scene(list, materials);
             
             XORUniformRNG<float> rng;
             PcgHash hash;
@@ -165,28 +173,8 @@ namespace pt
                               glm::vec3(0,1,0));
             
             PrimitiveList<float> list;
-            list.push_back(std::shared_ptr<Sphere<float>>(
-                                                          new Sphere<float>(glm::vec3(0,0,-1.0f), 0.5f)));
-            
-            list.push_back(std::shared_ptr<Sphere<float>>(
-                                                          new Sphere<float>(glm::vec3(0,-100.5f, -1.0f), 100.0f)));
-            
-            list.push_back(std::shared_ptr<Sphere<float>>(
-                                                          new Sphere<float>(glm::vec3(1,0,-1), 0.5f)));
-            
-            list.push_back(std::shared_ptr<Sphere<float>>(
-                                                          new Sphere<float>(glm::vec3(-1,0,-1), 0.5f)));
-            list.push_back(std::shared_ptr<Sphere<float>>(
-                                                          new Sphere<float>(glm::vec3(-1,0,-1), -0.45f)));
-            
             std::vector<std::shared_ptr<Material<float>>> materials;
-            materials.push_back(std::shared_ptr<Material<float>>(new Lambertian<float>(glm::vec3(0.8f, 0.3f, 0.3f))));
-            materials.push_back(std::shared_ptr<Material<float>>(new Lambertian<float>(glm::vec3(0.8f, 0.8f, 0.0f))));
-            
-            materials.push_back(std::shared_ptr<Material<float>>(new Metallic<float>(glm::vec3(0.8f, 0.6f, 0.2f), 0.3f)));
-            materials.push_back(std::shared_ptr<Material<float>>(new Dialectric<float>(1.5f)));
-            materials.push_back(std::shared_ptr<Material<float>>(new Dialectric<float>(1.5f)));
-            
+            diffuse_metal_glass_scene(list, materials);
             
             XORUniformRNG<float> rng;
             PcgHash hash;
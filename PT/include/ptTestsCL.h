@@ -16,6 +16,7 @@
 #include "ptMaterial.h"
 #include "ptRendering.h"
 #include "ptCL.h"
+#include "ptCLBufferPool.h"
 
 namespace pt
 {
@@ -130,14 +131,14 @@ namespace pt
             cl::Kernel kernel(program, "path_tracing", &clStatus);
             assertFatal(clStatus, "Could not create kernel");
             
+            /* Scene buffers come from the pool and go back to it on return */
+            CLBufferPool pool(context);
+            CLBufferPool::Scope buffers(pool);
+            
             /* Camera */
             PinholeCamera<float> cam(glm::vec3(0,0,0), glm::vec3(-2.0f,-1.5f,-1.0f), glm::vec3(4.0f, 0, 0), glm::vec3(0, 3.0f, 0));
             
-            cl::Buffer cam_buffer(context,
-                                  CL_MEM_READ_ONLY,
-                                  sizeof(cl_pinhole_cam),
-                                  (void*)0,
-                                  &clStatus);
+            cl::Buffer cam_buffer = buffers.acquire(sizeof(cl_pinhole_cam), CL_MEM_READ_ONLY, &clStatus);
             
             assertFatal(clStatus, "Could not create camera buffer");
             
@@ -155,19 +156,11 @@ namespace pt
             materials.push_back(fLambertianRef(new Lambertian<float>(glm::vec3(0.5f))));
             materials.push_back(fLambertianRef(new Lambertian<float>(glm::vec3(0.5f))));
             
-            cl::Buffer primitive_buffer(context,
-                                        CL_MEM_READ_ONLY,
-                                        MAX_PRIMITIVES * sizeof(cl_sphere),
-                                        (void*)0,
-                                        &clStatus);
+            cl::Buffer primitive_buffer = buffers.acquire(MAX_PRIMITIVES * sizeof(cl_sphere), CL_MEM_READ_ONLY, &clStatus);
             
             assertFatal(clStatus, "Could not create primitive buffer");
             
-            cl::Buffer material_buffer(context,
-                                       CL_MEM_READ_ONLY,
-                                       MAX_PRIMITIVES * sizeof(cl_material),
-                                       (void*)0,
-                                       &clStatus);
+            cl::Buffer material_buffer = buffers.acquire(MAX_PRIMITIVES * sizeof(cl_material), CL_MEM_READ_ONLY, &clStatus);
             
             assertFatal(clStatus, "Could not create primitive buffer");
             
@@ -181,11 +174,7 @@ namespace pt
             glm::vec3 bottom_sky_color(1.0, 1.0, 1.0);
             glm::vec3 top_sky_color(0.5, 0.7, 1.0);
             
-            cl::Buffer sky_buffer(context,
-                                  CL_MEM_READ_ONLY,
-                                  sizeof(cl_sky_material),
-                                  (void*)0,
-                                  &clStatus);
+            cl::Buffer sky_buffer = buffers.acquire(sizeof(cl_sky_material), CL_MEM_READ_ONLY, &clStatus);
             
             assertFatal(clStatus, "Could not create sky buffer");
             
@@ -0,0 +1,295 @@
+#ifndef ptTrace_h
+#define ptTrace_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Timeline of spans (tiles, kernels, transfers, image loads...) written as Chrome trace JSON,
+ * open it in chrome://tracing or ui.perfetto.dev.
+ *
+ * Every thread records into its own ring buffer of TraceBufferCapacity spans without locking,
+ * the oldest spans are overwritten when it is full. A mutex is taken only when a thread records its first span
+ * and to name tracks. Buffers of finished threads are reused by new ones with their track, their spans are kept,
+ * so there are never more host tracks than threads alive at once.
+ * Nothing is recorded until trace_enable(true), a disabled TraceScope costs one atomic load.
+ *
+ * A span goes on the track of the recording thread, or on a track from trace_track() for device queues:
+ * device times are moved to the host clock with the offset between the enqueue time on the host
+ * and CL_PROFILING_COMMAND_QUEUED, see trace_device_span.
+ * Write the trace once the work it records is finished, spans being written at that time may be torn.
+ */
+
+namespace pt
+{
+    static const size_t TraceBufferCapacity = 1 << 13;
+    static const uint32_t TraceDeviceTracks = 1u << 31; // device tracks in the high range, host tracks below
+
+    struct TraceEvent
+    {
+        char name[40];
+        const char* category;
+        const char* arg_name;
+        int64_t arg;
+        double ts_us;
+        double dur_us;
+        uint32_t track;
+    };
+
+    struct TraceBuffer
+    {
+        TraceBuffer(uint32_t _track) : head(0), in_use(true), track(_track) {}
+
+        TraceEvent events[TraceBufferCapacity];
+        std::atomic<uint64_t> head;
+        std::atomic<bool> in_use;
+        uint32_t track; // host track of the threads recording here
+    };
+
+    struct TraceRegistry
+    {
+        TraceRegistry() : enabled(false), next_thread(1), next_device(TraceDeviceTracks), epoch(std::chrono::steady_clock::now()) {}
+
+        std::atomic<bool> enabled;
+        std::mutex mutex;
+        std::deque<std::unique_ptr<TraceBuffer>> buffers;
+        std::map<uint32_t, std::string> track_names;
+        uint32_t next_thread;
+        uint32_t next_device;
+        std::chrono::steady_clock::time_point epoch;
+        std::string env_path;
+    };
+
+    inline TraceRegistry& trace_registry()
+    {
+        static TraceRegistry registry;
+        return registry;
+    }
+
+    inline void trace_enable(bool enable) { trace_registry().enabled.store(enable, std::memory_order_relaxed); }
+    inline bool trace_enabled() { return trace_registry().enabled.load(std::memory_order_relaxed); }
+
+    /* Microseconds since the first use of the trace */
+    inline double trace_now_us()
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - trace_registry().epoch).count();
+    }
+
+    /* Buffer and track of the calling thread, the buffer goes back to the registry when the thread ends */
+    struct TraceThread
+    {
+        TraceThread() : buffer(NULL), track(0) {}
+        ~TraceThread() { if (buffer) buffer->in_use.store(false); }
+
+        TraceBuffer* buffer;
+        uint32_t track;
+    };
+
+    inline TraceThread& trace_thread()
+    {
+        thread_local TraceThread thread;
+
+        if (!thread.buffer)
+        {
+            TraceRegistry& registry = trace_registry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+
+            for (std::unique_ptr<TraceBuffer>& b : registry.buffers)
+            {
+                bool expected = false;
+                if (b->in_use.compare_exchange_strong(expected, true)) { thread.buffer = b.get(); break; }
+            }
+
+            if (!thread.buffer)
+            {
+                registry.buffers.push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer(registry.next_thread++)));
+                thread.buffer = registry.buffers.back().get();
+            }
+
+            thread.track = thread.buffer->track;
+        }
+
+        return thread;
+    }
+
+    inline void trace_set_track_name(uint32_t track, const std::string& name)
+    {
+        TraceRegistry& registry = trace_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.track_names[track] = name;
+    }
+
+    inline void trace_set_thread_name(const std::string& name)
+    {
+        trace_set_track_name(trace_thread().track, name);
+    }
+
+    /* A new named track for spans not recorded on the thread that ran them, e.g. a device queue */
+    inline uint32_t trace_track(const std::string& name)
+    {
+        TraceRegistry& registry = trace_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        uint32_t track = registry.next_device++;
+        registry.track_names[track] = name;
+        return track;
+    }
+
+    /* Records a span on track, the one of the calling thread when track is 0. name is copied, category and arg_name must be literals */
+    inline void trace_span(const char* name, const char* category, double start_us, double end_us,
+                           uint32_t track = 0, const char* arg_name = NULL, int64_t arg = 0)
+    {
+        if (!trace_enabled()) return;
+
+        TraceThread& thread = trace_thread();
+        TraceBuffer& buffer = *thread.buffer;
+        uint64_t i = buffer.head.load(std::memory_order_relaxed);
+        TraceEvent& e = buffer.events[i % TraceBufferCapacity];
+
+        strncpy(e.name, name, sizeof(e.name) - 1);
+        e.name[sizeof(e.name) - 1] = '\0';
+        e.category = category;
+        e.arg_name = arg_name;
+        e.arg = arg;
+        e.ts_us = start_us;
+        e.dur_us = end_us - start_us;
+        e.track = track ? track : thread.track;
+
+        buffer.head.store(i + 1, std::memory_order_release);
+    }
+
+    /*
+     * Span of a device command on track, from its profiling event times in ns.
+     * enqueue_us is trace_now_us() right after the enqueue: the command cannot have been queued later,
+     * so the device clock is moved to make CL_PROFILING_COMMAND_QUEUED land there.
+     * A second span from queued to start goes on wait_track when it is not 0.
+     */
+    inline void trace_device_span(const char* name, const char* category, double enqueue_us,
+                                  uint64_t queued_ns, uint64_t start_ns, uint64_t end_ns,
+                                  uint32_t track, uint32_t wait_track = 0)
+    {
+        double offset = enqueue_us - (double)queued_ns * 1e-3;
+
+        if (wait_track)
+            trace_span(name, "queue", offset + (double)queued_ns * 1e-3, offset + (double)start_ns * 1e-3, wait_track);
+
+        trace_span(name, category, offset + (double)start_ns * 1e-3, offset + (double)end_ns * 1e-3, track);
+    }
+
+    /* Records the span from construction to destruction on the calling thread, if tracing was enabled at construction */
+    class TraceScope
+    {
+    public:
+        TraceScope(const char* _name, const char* _category, const char* _arg_name = NULL, int64_t _arg = 0)
+        : name(_name), category(_category), arg_name(_arg_name), arg(_arg), start(trace_enabled() ? trace_now_us() : -1.0) {}
+
+        ~TraceScope()
+        {
+            if (start >= 0.0) trace_span(name, category, start, trace_now_us(), 0, arg_name, arg);
+        }
+
+        TraceScope(const TraceScope& other) = delete;
+        void operator=(const TraceScope& other) = delete;
+
+    private:
+        const char* name;
+        const char* category;
+        const char* arg_name;
+        int64_t arg;
+        double start;
+    };
+
+    inline void trace_write_string(std::ostream& out, const char* s)
+    {
+        out << '"';
+        for (; *s; ++s)
+        {
+            if (*s == '"' || *s == '\\') out << '\\';
+            if ((unsigned char)*s >= 0x20) out << *s;
+        }
+        out << '"';
+    }
+
+    /* Every span still in the buffers, as a Chrome trace JSON object */
+    inline void trace_write_chrome(std::ostream& out)
+    {
+        TraceRegistry& registry = trace_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        std::ios_base::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" << std::fixed << std::setprecision(3);
+        bool first = true;
+
+        for (const std::pair<const uint32_t, std::string>& t : registry.track_names)
+        {
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t.first << ",\"args\":{\"name\":";
+            trace_write_string(out, t.second.c_str());
+            out << "}}";
+            first = false;
+        }
+
+        for (const std::unique_ptr<TraceBuffer>& b : registry.buffers)
+        {
+            uint64_t head = b->head.load(std::memory_order_acquire);
+            uint64_t begin = (head > TraceBufferCapacity) ? head - TraceBufferCapacity : 0;
+
+            for (uint64_t i = begin; i < head; ++i)
+            {
+                const TraceEvent& e = b->events[i % TraceBufferCapacity];
+
+                out << (first ? "" : ",\n") << "{\"name\":";
+                trace_write_string(out, e.name);
+                out << ",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.track
+                << ",\"ts\":" << e.ts_us << ",\"dur\":" << e.dur_us;
+                if (e.arg_name) out << ",\"args\":{\"" << e.arg_name << "\":" << e.arg << "}";
+                out << "}";
+                first = false;
+            }
+        }
+
+        out << "\n]}\n";
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+    inline bool trace_write_chrome(const std::string& path)
+    {
+        std::ofstream file(path.c_str());
+        if (!file.is_open()) return false;
+
+        trace_write_chrome(file);
+        return file.good();
+    }
+
+    /* Enables tracing when PT_TRACE names an output file, trace_write_env() writes it */
+    inline bool trace_enable_from_env()
+    {
+        const char* path = getenv("PT_TRACE");
+        if (!path || !*path) return false;
+
+        trace_registry().env_path = path;
+        trace_enable(true);
+        return true;
+    }
+
+    inline bool trace_write_env()
+    {
+        const std::string& path = trace_registry().env_path;
+        return !path.empty() && trace_write_chrome(path);
+    }
+}
+
+#endif /* ptTrace_h */
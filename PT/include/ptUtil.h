@@ -7,6 +7,14 @@
 #include "glm/glm.hpp"
 #include <fstream>
 
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
 #ifdef __APPLE__
 #include <OpenCL/cl.h>
 #include "../include/cl.hpp"
@@ -165,6 +173,25 @@ namespace pt
         file.close();
     }
     
+    /* Peak resident set size of this process in bytes, 0 if unknown */
+    inline size_t peak_rss_bytes()
+    {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            return (size_t)counters.PeakWorkingSetSize;
+        return 0;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+        return (size_t)usage.ru_maxrss; // bytes on OS X
+#else
+        return (size_t)usage.ru_maxrss * 1024; // kilobytes on Linux
+#endif
+#endif
+    }
+    
     template<typename T>
     ptvec<T> Color_RGB8_to_RGB(unsigned char r, unsigned char g, unsigned char b)
     {
@@ -4,13 +4,7 @@
 #include <memory>
 #include <math.h>
 
-#ifdef __APPLE__
-#include <OpenCL/cl.h>
-#include "../include/cl.hpp"
-#else
-#include <CL/cl.h>
-#include <CL/cl.hpp>
-#endif
+#include "ptCLRuntime.h"
 
 void assertFatal(const cl_int& status, const std::string& errorMsg)
 {
@@ -28,37 +22,15 @@ int main(int argc, const char * argv[])
     size_t img_width = 512;
     size_t img_height = 512;
     
-    /* Obtain a platform */
-    std::vector<cl::Platform> platforms;
-    clStatus = cl::Platform::get(&platforms);
-    assertFatal(clStatus, "Could not find an OpenCL platform.");
-    
-    /* Obtain a device and determinte max local size */
-    std::vector<cl::Device> devices;
-    clStatus = platforms[0].getDevices(CL_DEVICE_TYPE_GPU, &devices);
-    assertFatal(clStatus, "Could not find a GPU device.");
-    cl::Device& device = devices[0];
-    size_t local_size = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>(); //TODO: throws
-//    size_t global_size = img_width * img_height;
-    
-    /* Create an OpenCL context for the device */
-    cl::Context context({device}, NULL, NULL, NULL, &clStatus); //TODO: add the error handling callback
-    assertFatal(clStatus, "Could not create a context for device.");
+    pt::CLRuntime runtime;
+    assertFatal(runtime.getStatus(), "Could not set up an OpenCL device");
+    cl::Context& context = runtime.getContext();
+    cl::CommandQueue& cmd_queue = runtime.getQueue();
     
     /* Load and build a program */
     cl::Program program;
-    std::ifstream program_file("../../../assets/random.cl");
-    std::string program_str(std::istreambuf_iterator<char>(program_file), (std::istreambuf_iterator<char>()));
-    cl::Program::Sources sources(1, std::make_pair(program_str.c_str(), program_str.length() + 1));
-    program = cl::Program(context, sources);
-    clStatus = program.build({device}, "-I ../../../assets/");
-    
-    if (clStatus != CL_SUCCESS)
-    {
-        std::string log = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
-        std::cerr << log << "\n";
-        exit(EXIT_FAILURE);
-    }
+    clStatus = runtime.buildProgram("random_kernel.cl", "", program);
+    assertFatal(clStatus, "Could not build program");
     
 //    cl_int num_groups = (cl_int)(img_width * img_height) / local_size;
     
@@ -73,10 +45,6 @@ int main(int argc, const char * argv[])
     
     assertFatal(clStatus, "Could not create buffer");
     
-    /* Create command queue */
-    cl::CommandQueue cmd_queue(context, device, CL_QUEUE_PROFILING_ENABLE, &clStatus);
-    assertFatal(clStatus, "Could not create command queue");
-    
     /* create kernel and set the kernel arguments */
     cl::Kernel kernel(program, "random_image", &clStatus);
     assertFatal(clStatus, "Could not create kernel");
@@ -84,26 +52,17 @@ int main(int argc, const char * argv[])
     clStatus = kernel.setArg(0, img_buffer);
     assertFatal(clStatus, "Could not set data argument");
     
-    // got to find a way to split local_size in a*b
-    size_t local_width = (size_t)pow(2, ceilf(log2f((floorf(sqrtf(local_size))))));
-    
+    /* Local size tuned for this device on the first run, read from the cache afterwards */
+    cl::NDRange global(img_height, img_width);
+    cl::NDRange local = runtime.getAutotuner().localSize(kernel, global);
     
     /* Enqueue kernel for execution */
-    cl::Event profiling_evt;
-    clStatus = cmd_queue.enqueueNDRangeKernel(kernel,
-                                              cl::NDRange(0,0),
-                                              cl::NDRange(img_height, img_width),
-                                              cl::NDRange(local_width,local_size / local_width),
-                                              NULL,
-                                              &profiling_evt);
+    clStatus = runtime.enqueueKernel(kernel, global, local);
     
     assertFatal(clStatus, "Could not enqueue the kernel");
     
     /* Wait for process to finish */
-    cmd_queue.finish();
-    cl_ulong time_start = profiling_evt.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-    cl_ulong time_end = profiling_evt.getProfilingInfo<CL_PROFILING_COMMAND_END>();
-    cl_ulong total_time = time_end - time_start;
+    runtime.finish();
     
     /* read the result */
     
@@ -133,7 +92,8 @@ int main(int argc, const char * argv[])
     
     std::cout << "Average of noise: " << (unsigned int)avg << "\n";
     
-    std::cout << "Total time: " << total_time * 0.001 << " microsec \n";
+    runtime.getAutotuner().printResults();
+    runtime.printKernelTimings();
     
     free(img);
 
@@ -2,17 +2,14 @@
 #include <assert.h>
 #include <fstream>
 #include <memory>
+#include <vector>
 #include <math.h>
 
-#ifdef __APPLE__
-#include <OpenCL/cl.h>
-#include "../include/cl.hpp"
-#else
-#include <CL/cl.h>
-#include <CL/cl.hpp>
-#endif
+#include "ptCLRuntime.h"
+#include "ptCL.h"
 
 #define ARRAY_SIZE 1048576
+#define GROUP_SIZE 256
 
 void assertFatal(const cl_int& status, const std::string& errorMsg)
 {
@@ -23,129 +20,96 @@ void assertFatal(const cl_int& status, const std::string& errorMsg)
     }
 }
 
+double event_ms(const cl::Event& evt)
+{
+    return (evt.getProfilingInfo<CL_PROFILING_COMMAND_END>() - evt.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 0.001 * 0.001;
+}
+
 int main(int argc, const char * argv[])
 {
     cl_int clStatus;
-    
-    /* Obtain a platform */
-    std::vector<cl::Platform> platforms;
-    clStatus = cl::Platform::get(&platforms);
-    assertFatal(clStatus, "Could not find an OpenCL platform.");
-    
-    /* Obtain a device and determinte max local size */
-    std::vector<cl::Device> devices;
-    clStatus = platforms[0].getDevices(CL_DEVICE_TYPE_GPU, &devices);
-    assertFatal(clStatus, "Could not find a GPU device.");
-    cl::Device& device = devices[0];
-    size_t local_size = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>(); //TODO: throws
-    size_t global_size = ARRAY_SIZE;
-    
-    /* Create an OpenCL context for the device */
-    cl::Context context({device}, NULL, NULL, NULL, &clStatus); //TODO: add the error handling callback
-    assertFatal(clStatus, "Could not create a context for device.");
-    
-    /* Load and build a program */
-    cl::Program program;
-    std::ifstream program_file("../../../assets/reduce.cl");
-    std::string program_str(std::istreambuf_iterator<char>(program_file), (std::istreambuf_iterator<char>()));
-    cl::Program::Sources sources(1, std::make_pair(program_str.c_str(), program_str.length() + 1));
-    program = cl::Program(context, sources);
-    clStatus = program.build({device});
-    
-    if (clStatus != CL_SUCCESS)
-    {
-        std::string log = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
-        std::cerr << log << "\n";
-        exit(EXIT_FAILURE);
-    }
-    
-    /* Create data buffers */
-    float data[ARRAY_SIZE];
+
+    pt::CLRuntime runtime;
+    assertFatal(runtime.getStatus(), "Could not set up an OpenCL device");
+    cl::Device& device = runtime.getDevice();
+    cl::Context& context = runtime.getContext();
+    cl::CommandQueue& cmd_queue = runtime.getQueue();
+
+    size_t group_size = GROUP_SIZE;
+    while (group_size > device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>()) group_size >>= 1;
+
+    size_t groups = 8 * (size_t)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+
+    /* Create data, on the heap */
+    std::vector<float> data(ARRAY_SIZE);
+    for(int i = 0; i < ARRAY_SIZE; ++i)
+        data[i] = (float)(i % 1000) / 1000.0f;
+
+    double expected[4] = { 0.0, 0.0, 0.999, 0.0 };
     for(int i = 0; i < ARRAY_SIZE; ++i)
-        data[i] = (float)i;
-    
-    // memory for input data
+        expected[0] += data[i];
+    expected[3] = expected[0] / ARRAY_SIZE;
+
     cl::Buffer data_buffer(context,
                            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
                            ARRAY_SIZE * sizeof(float),
-                           data,
+                           data.data(),
                            &clStatus);
-    
+
     assertFatal(clStatus, "Could not create buffer");
-    
-    cl_int num_groups = ARRAY_SIZE / local_size;
-    float* scalar_sum = (float*)malloc(num_groups * sizeof(float));
-    for(int i = 0; i < num_groups; ++i)
-        scalar_sum[i] = 0.0f;
-    
-    // memory for each workgroup intermediate result
-    cl::Buffer scalar_sum_buffer(context,
-                                 CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-                                 num_groups * sizeof(float),
-                                 scalar_sum,
-                                 &clStatus);
-    
+
+    cl::Buffer result_buffer(context, CL_MEM_READ_WRITE, sizeof(float), NULL, &clStatus);
     assertFatal(clStatus, "Could not create buffer");
-    
-    /* Create command queue */
-    cl::CommandQueue cmd_queue(context, device, CL_QUEUE_PROFILING_ENABLE, &clStatus);
+
+    cl::Buffer partials_buffer;
+
+    /* Attainable bandwidth, OpenCL does not report the theoretical one */
+    cl::Buffer copy_buffer(context, CL_MEM_READ_WRITE, ARRAY_SIZE * sizeof(float), NULL, &clStatus);
     assertFatal(clStatus, "Could not create buffer");
-    
-    /* create kernel and set the kernel arguments */
-    cl::Kernel kernel(program, "reduce", &clStatus);
-    assertFatal(clStatus, "Could not create kernel");
-    
-    clStatus = kernel.setArg(0, data_buffer);
-    assertFatal(clStatus, "Could not set data argument");
-    clStatus = kernel.setArg(1, cl::__local(local_size * sizeof(float)));
-    assertFatal(clStatus, "Could not set local buffer argument");
-    clStatus = kernel.setArg(2, scalar_sum_buffer);
-    assertFatal(clStatus, "Could not set result argument");
-    
-    /* Enqueue kernel for execution */
-    cl::Event profiling_evt;
-    clStatus = cmd_queue.enqueueNDRangeKernel(kernel,
-                                              cl::NDRange(0),
-                                              cl::NDRange(global_size),
-                                              cl::NDRange(local_size),
-                                              NULL,
-                                              &profiling_evt);
-    
-    assertFatal(clStatus, "Could not enqueue the kernel");
-    
-    /* Wait for process to finish */
-    cmd_queue.finish();
-    cl_ulong time_start = profiling_evt.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-    cl_ulong time_end = profiling_evt.getProfilingInfo<CL_PROFILING_COMMAND_END>();
-    cl_ulong total_time = time_end - time_start;
-    
-    /* read the result */
-    clStatus = cmd_queue.enqueueReadBuffer(scalar_sum_buffer,
-                                           CL_TRUE,
-                                           0,
-                                           num_groups * sizeof(float),
-                                           scalar_sum);
-    
-    assertFatal(clStatus, "Could not read the buffer");
-    
-    /* combine the result */
-    float sum = 0.0f;
-    for(int i = 0; i < num_groups; ++i)
-    {
-        sum += scalar_sum[i];
-    }
-    
-    float actual_sum = 1.0f * ARRAY_SIZE / 2.0f * (ARRAY_SIZE - 1.0f);
-    if (fabs(sum - actual_sum) > 0.01 * fabs(sum))
-    {
-        std::cerr << "Sum check fail.\n";
-    }
-    else
+
+    cl::Event copy_evt;
+    clStatus = cmd_queue.enqueueCopyBuffer(data_buffer, copy_buffer, 0, 0, ARRAY_SIZE * sizeof(float), NULL, &copy_evt);
+    assertFatal(clStatus, "Could not copy buffer");
+    copy_evt.wait();
+
+    double copy_gbs = 2.0 * ARRAY_SIZE * sizeof(float) / (event_ms(copy_evt) * 1e6);
+
+    const cl_reduce_op ops[] = { CL_REDUCE_SUM, CL_REDUCE_MIN, CL_REDUCE_MAX, CL_REDUCE_MEAN };
+    const char* names[] = { "Sum", "Min", "Max", "Mean" };
+    bool pass = true;
+
+    for (int k = 0; k < 4; ++k)
     {
-        std::cout << "Sum check pass.\n";
+        /* Load and build a program */
+        cl::Program program;
+        clStatus = runtime.buildProgram("reduce_complete.cl", cl_reduce_build_options(ops[k], group_size), program);
+        assertFatal(clStatus, "Could not build program");
+
+        cl::Kernel kernel(program, "reduce_complete", &clStatus);
+        assertFatal(clStatus, "Could not create kernel");
+
+        /* Both passes on the device, one float comes back */
+        std::vector<cl::Event> events;
+        clStatus = cl_reduce(context, cmd_queue, kernel, ops[k], data_buffer, ARRAY_SIZE, group_size, groups, partials_buffer, result_buffer, &events);
+        assertFatal(clStatus, "Could not enqueue the reduction");
+
+        float result;
+        clStatus = cmd_queue.enqueueReadBuffer(result_buffer, CL_TRUE, 0, sizeof(float), &result);
+        assertFatal(clStatus, "Could not read the buffer");
+
+        double ms = event_ms(events[0]) + event_ms(events[1]);
+        double gbs = ARRAY_SIZE * sizeof(float) / (ms * 1e6);
+
+        bool ok = fabs(result - expected[k]) <= 1e-4 * fmax(1.0, fabs(expected[k]));
+        pass &= ok;
+
+        std::cout << names[k] << " : " << result << " (expected " << expected[k] << ") "
+        << (ok ? "pass" : "FAIL") << ", "
+        << ms << " ms, " << gbs << " GB/s, "
+        << 100.0 * gbs / copy_gbs << "% of copy bandwidth (" << copy_gbs << " GB/s)\n";
     }
-    
-    std::cout << "Total time: " << total_time << "ns \n";
-    
-    return 0;
+
+    std::cout << (pass ? "Reduction check pass.\n" : "Reduction check fail.\n");
+
+    return pass ? 0 : 1;
 }
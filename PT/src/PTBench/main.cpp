@@ -0,0 +1,310 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <string>
+#include <stdlib.h>
+#include "ptCL.h"
+#include "ptCLRuntime.h"
+#include "ptTests.h"
+#include "PathTracerUnitTest.h"
+
+/*
+ * Headless benchmark of the three renderers on fixed scenes, resolutions and seeds:
+ * the smallpt PathTracer (all cores), the templated render_frame (one thread) and the
+ * OpenCL trace_pixel of path_tracing.cl (through path_tracing_accumulate) on a CPU device.
+ * PT_CL_DEVICE still picks another device when set.
+ *
+ * Results go to stdout as JSON, or to the file given as first argument, one record per run:
+ * renderer, scene, width, height, spp, wall_ms, samples_per_s, rays, mrays_per_s, peak_rss_bytes.
+ * Rays are camera rays, one per sample, unless built with PT_COUNTERS: then they are the counted rays
+ * of every bounce and the counter breakdown of each run goes to stderr. peak_rss_bytes is the peak of the whole process
+ * when the run ends, runs go from the lightest to the heaviest so it still tells them apart.
+ *
+ * With PT_TRACE set to a file name the timeline of the runs (tiles, kernels) is written there as Chrome trace JSON.
+ *
+ * The Cornell box needs emission, which only the smallpt renderer has,
+ * random_scene and diffuse_metal_glass need the sky and materials the other two have.
+ */
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+struct BenchResult
+{
+    std::string renderer;
+    std::string scene;
+    unsigned int width;
+    unsigned int height;
+    unsigned int spp;
+    double wall_ms;
+    double rays;
+    size_t peak_rss;
+};
+
+void assertFatal(const cl_int& status, const std::string& errorMsg)
+{
+    if (status != CL_SUCCESS)
+    {
+        std::cerr << errorMsg << "\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
+double ms_since(const bench_clock::time_point& start)
+{
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+BenchResult make_result(const std::string& renderer, const std::string& scene,
+                        unsigned int width, unsigned int height, unsigned int spp, double wall_ms,
+                        const pt::CounterTotals& counters)
+{
+    BenchResult r;
+    r.renderer = renderer;
+    r.scene = scene;
+    r.width = width;
+    r.height = height;
+    r.spp = spp;
+    r.wall_ms = wall_ms;
+    r.peak_rss = pt::peak_rss_bytes();
+
+    std::cerr << renderer << " " << scene << " " << width << "x" << height << " " << spp << " spp : " << wall_ms << " ms\n";
+
+#ifdef PT_COUNTERS
+    r.rays = (double)counters.count[PT_COUNTER_RAYS];
+    pt::counters_print(counters, std::cerr);
+#else
+    r.rays = (double)width * (double)height * (double)spp;
+#endif
+
+    return r;
+}
+
+BenchResult bench_path_tracer(unsigned int width, unsigned int height, unsigned int spp)
+{
+    pt::Scened scene;
+    pt::test::cornell_box_scene(scene);
+
+    pt::FrameBuffer image;
+    pt::PathTracerd tracer;
+    double seconds;
+
+    pt::counters_reset();
+
+    /* Trace takes spp over the 2x2 subpixels */
+    tracer.Trace(scene, width, height, spp, glm::dvec3(50, 52, 295.6), glm::dvec3(0, -0.042612, -1), .5135, image, &seconds);
+
+    return make_result("path_tracer", "cornell_box", width, height, 4 * std::max(1u, spp / 4), 1000.0 * seconds, pt::counters_merge());
+}
+
+void make_scene(const std::string& name, pt::PrimitiveList<float>& list, std::vector<pt::fMaterialRef>& materials)
+{
+    if (name == "random_scene") pt::test::random_scene(list, materials);
+    else pt::test::diffuse_metal_glass_scene(list, materials);
+}
+
+pt::PinholeCamera<float> make_camera(const std::string& name, unsigned int width, unsigned int height)
+{
+    if (name == "random_scene")
+        return pt::PinholeCamera<float>(60.0f, (float)width / (float)height, glm::vec3(-4,1,-5), glm::vec3(0,0,0), glm::vec3(0,1,0));
+
+    return pt::PinholeCamera<float>(60.0f, (float)width / (float)height, glm::vec3(-2,2,1), glm::vec3(0,0,-1), glm::vec3(0,1,0));
+}
+
+BenchResult bench_render_frame(const std::string& scene, unsigned int width, unsigned int height, unsigned int spp)
+{
+    pt::PrimitiveList<float> list;
+    std::vector<pt::fMaterialRef> materials;
+    make_scene(scene, list, materials);
+
+    pt::PinholeCamera<float> cam = make_camera(scene, width, height);
+    std::vector<float> image(3 * width * height);
+    pt::XORUniformRNG<float> rng;
+    pt::PcgHash hash;
+
+    pt::counters_reset();
+
+    pt::TraceScope span("render_frame", "bench", "spp", spp);
+    bench_clock::time_point start = bench_clock::now();
+    pt::render_frame(width, height, spp, cam, list, materials, image.data(), rng, hash);
+
+    return make_result("render_frame", scene, width, height, spp, ms_since(start), pt::counters_merge());
+}
+
+/* Build and upload are not timed, one frame of one sample warms the device up first */
+BenchResult bench_cl(pt::CLRuntime& runtime, const std::string& scene, unsigned int width, unsigned int height, unsigned int spp)
+{
+    const cl_uint samples_per_frame = 16;
+
+    cl_int clStatus;
+    cl::Context& context = runtime.getContext();
+    cl::CommandQueue& cmd_queue = runtime.getQueue();
+
+    pt::PrimitiveList<float> list;
+    std::vector<pt::fMaterialRef> materials;
+    make_scene(scene, list, materials);
+
+    std::ostringstream options;
+    options << "-cl-denorms-are-zero -D MAX_PRIMITIVES=" << list.size();
+#ifdef PT_COUNTERS
+    options << " -D PT_COUNTERS";
+#endif
+
+    cl::Program program;
+    clStatus = runtime.buildProgram("path_tracing.cl", options.str(), program);
+    assertFatal(clStatus, "Could not build program");
+
+    cl::Kernel kernel(program, "path_tracing_accumulate", &clStatus);
+    assertFatal(clStatus, "Could not create kernel");
+
+    cl::Buffer prim_buffer, mat_buffer, sky_buffer;
+    cl_uint object_count = pt::test::test_util_upload_scene(context, cmd_queue, list, materials, prim_buffer, mat_buffer, sky_buffer);
+
+    cl::Buffer cam_buffer(context, CL_MEM_READ_ONLY, sizeof(cl_pinhole_cam), NULL, &clStatus);
+    assertFatal(clStatus, "Could not create camera buffer");
+    clStatus = cl_set_pinhole_cam_arg(make_camera(scene, width, height), cam_buffer, cmd_queue);
+    assertFatal(clStatus, "Could not fill camera buffer");
+
+    cl_accumulation accumulation;
+    clStatus = cl_make_accumulation(context, width * height, cmd_queue, accumulation);
+    assertFatal(clStatus, "Could not create accumulation buffer");
+
+    /* arguments of path_tracing_accumulate */
+    const cl_uint samples_arg = 6, frame_arg = 9;
+
+    cl_uint w = width, h = height, one = 1, frame = 0;
+    assertFatal(kernel.setArg(0, cam_buffer), "Could not set camera argument");
+    assertFatal(kernel.setArg(1, prim_buffer), "Could not set primitive argument");
+    assertFatal(kernel.setArg(2, mat_buffer), "Could not set material argument");
+    assertFatal(kernel.setArg(3, sky_buffer), "Could not set sky argument");
+    assertFatal(kernel.setArg(4, object_count), "Could not set object count argument");
+    assertFatal(kernel.setArg(5, accumulation.buffer), "Could not set accumulation argument");
+    assertFatal(kernel.setArg(samples_arg, one), "Could not set samples argument");
+    assertFatal(kernel.setArg(7, w), "Could not set width argument");
+    assertFatal(kernel.setArg(8, h), "Could not set height argument");
+    assertFatal(kernel.setArg(frame_arg, frame), "Could not set frame argument");
+
+#ifdef PT_COUNTERS
+    cl::Buffer counter_buffer;
+    clStatus = cl_make_counters(context, cmd_queue, counter_buffer);
+    assertFatal(clStatus, "Could not create counter buffer");
+    assertFatal(kernel.setArg(10, counter_buffer), "Could not set counter argument");
+#endif
+
+    clStatus = cmd_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(width, height), cl::NullRange);
+    assertFatal(clStatus, "Could not enqueue the kernel");
+    cmd_queue.finish();
+
+    clStatus = cl_reset_accumulation(accumulation, cmd_queue);
+    assertFatal(clStatus, "Could not reset accumulation buffer");
+#ifdef PT_COUNTERS
+    clStatus = cmd_queue.enqueueFillBuffer(counter_buffer, (cl_uint)0, 0, 2 * PT_COUNTER_COUNT * sizeof(cl_uint));
+    assertFatal(clStatus, "Could not reset counter buffer");
+#endif
+    cmd_queue.finish();
+
+    pt::TraceScope span("opencl", "bench", "spp", spp);
+    bench_clock::time_point start = bench_clock::now();
+
+    assertFatal(kernel.setArg(samples_arg, samples_per_frame), "Could not set samples argument");
+
+    for (frame = 0; frame < spp / samples_per_frame; ++frame)
+    {
+        assertFatal(kernel.setArg(frame_arg, frame), "Could not set frame argument");
+        clStatus = runtime.enqueueKernel(kernel, cl::NDRange(width, height));
+        assertFatal(clStatus, "Could not enqueue the kernel");
+    }
+
+    runtime.finish();
+    double wall_ms = ms_since(start);
+
+    pt::CounterTotals counters;
+#ifdef PT_COUNTERS
+    clStatus = cl_read_counters(cmd_queue, counter_buffer, counters);
+    assertFatal(clStatus, "Could not read counter buffer");
+#endif
+
+    return make_result("opencl", scene, width, height, frame * samples_per_frame, wall_ms, counters);
+}
+
+void write_json(std::ostream& out, const std::string& device, const std::vector<BenchResult>& results)
+{
+    out << "{\n  \"device\": \"" << device << "\",\n  \"runs\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult& r = results[i];
+        double samples = (double)r.width * (double)r.height * (double)r.spp;
+        double seconds = r.wall_ms / 1000.0;
+
+        out << "    { \"renderer\": \"" << r.renderer << "\""
+        << ", \"scene\": \"" << r.scene << "\""
+        << ", \"width\": " << r.width
+        << ", \"height\": " << r.height
+        << ", \"spp\": " << r.spp
+        << ", \"wall_ms\": " << r.wall_ms
+        << ", \"samples_per_s\": " << samples / seconds
+        << ", \"rays\": " << r.rays
+        << ", \"mrays_per_s\": " << r.rays / seconds / 1e6
+        << ", \"peak_rss_bytes\": " << r.peak_rss
+        << " }" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+
+    out << "  ]\n}\n";
+}
+
+int main(int argc, const char * argv[])
+{
+    /* the OpenCL renderer is measured on a CPU device unless told otherwise */
+    if (!getenv("PT_CL_DEVICE"))
+    {
+#if defined(_WIN32)
+        _putenv_s("PT_CL_DEVICE", "cpu");
+#else
+        setenv("PT_CL_DEVICE", "cpu", 0);
+#endif
+    }
+
+    if (pt::trace_enable_from_env()) pt::trace_set_thread_name("main");
+
+    const char* scenes[] = { "diffuse_metal_glass", "random_scene" };
+    std::vector<BenchResult> results;
+
+    results.push_back(bench_path_tracer(256, 192, 16));
+
+    for (const char* scene : scenes)
+        results.push_back(bench_render_frame(scene, 200, 100, 16));
+
+    pt::CLRuntime runtime;
+
+    /* the CPU results are still worth printing without a device */
+    if (runtime.getStatus() == CL_SUCCESS)
+    {
+        for (const char* scene : scenes)
+            results.push_back(bench_cl(runtime, scene, 400, 200, 64));
+    }
+
+    if (pt::trace_enabled() && !pt::trace_write_env())
+        std::cerr << "Could not write the trace\n";
+
+    if (argc > 1)
+    {
+        std::ofstream file(argv[1]);
+
+        if (!file.is_open())
+        {
+            std::cerr << "Could not open " << argv[1] << "\n";
+            return EXIT_FAILURE;
+        }
+
+        write_json(file, runtime.getDeviceName(), results);
+    }
+    else
+    {
+        write_json(std::cout, runtime.getDeviceName(), results);
+    }
+
+    return 0;
+}
@@ -19,9 +19,30 @@
 
 #include "ptUtil.h"
 #include "ptCL.h"
+#include "ptCLRuntime.h"
 #include "ptTestUtils.h"
 #include "CamRayKernelUnitTest.h"
 #include "ScanKernelsUnitTest.h"
+#include "ReduceKernelsUnitTest.h"
+#include "ImageIOUnitTest.h"
+#include "PathTracerUnitTest.h"
+#include "AdaptiveSamplingUnitTest.h"
+#include "CLBufferPoolUnitTest.h"
+#include "FrameSchedulerUnitTest.h"
+#include "AccumulationUnitTest.h"
+#include "AutotunerUnitTest.h"
+#include "LayoutUnitTest.h"
+#include "MaterialSortUnitTest.h"
+#include "DielectricUnitTest.h"
+#include "CameraUnitTest.h"
+#include "CountersUnitTest.h"
+#include "TraceUnitTest.h"
+#include "SceneUnitTest.h"
+#include "InstanceUnitTest.h"
+#include "BVHUnitTest.h"
+#include "PacketUnitTest.h"
+#include "LightListUnitTest.h"
+#include "DistributedUnitTest.h"
 
 //#define PT_TEST_OPENGL_COMPATIBILITY
 
@@ -42,6 +63,151 @@ TEST_CASE( "Exclusive scan kernel", "[Exclusive scan kernel]" ) {
     REQUIRE( pt::test::test_hillis_steele_exc_scan_single_block(device, context, cmd_queue) == PT_TEST_PASS );
 }
 
+TEST_CASE( "Multi block scan", "[Multi block scan]" ) {
+    REQUIRE( pt::test::test_hillis_steele_scan_multi_block(device, context, cmd_queue, true, 300000) == PT_TEST_PASS );
+    REQUIRE( pt::test::test_hillis_steele_scan_multi_block(device, context, cmd_queue, false, 300000) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Complete device reduction", "[Reduction]" ) {
+    REQUIRE( pt::test::test_reduce_complete(device, context, cmd_queue, CL_REDUCE_SUM, 1000003) == PT_TEST_PASS );
+    REQUIRE( pt::test::test_reduce_complete(device, context, cmd_queue, CL_REDUCE_MIN, 1000003) == PT_TEST_PASS );
+    REQUIRE( pt::test::test_reduce_complete(device, context, cmd_queue, CL_REDUCE_MAX, 1000003) == PT_TEST_PASS );
+    REQUIRE( pt::test::test_reduce_complete(device, context, cmd_queue, CL_REDUCE_MEAN, 1000003) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Tiled EXR output", "[Tiled EXR output]" ) {
+    REQUIRE( pt::test::test_exr_tiled_writer() == PT_TEST_PASS );
+}
+
+TEST_CASE( "Frame buffer reuse and 8 bit conversion", "[Frame buffer]" ) {
+    REQUIRE( pt::test::test_frame_buffer() == PT_TEST_PASS );
+}
+
+TEST_CASE( "Tiled render peak RSS", "[.][Tiled render peak RSS]" ) {
+    pt::test::bench_tiled_trace_rss(16384, 16384, 1, true);
+}
+
+TEST_CASE( "Float and double path tracer agree", "[Path tracer float]" ) {
+    REQUIRE( pt::test::test_path_tracer_float_double() == PT_TEST_PASS );
+}
+
+TEST_CASE( "Adaptive sampling reduces error at equal samples", "[Adaptive sampling]" ) {
+    REQUIRE( pt::test::test_adaptive_sampling_rmse() == PT_TEST_PASS );
+    REQUIRE( pt::test::test_adaptive_sampling_cl(device, context, cmd_queue) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Device buffer pool reaches a steady state", "[Buffer pool]" ) {
+    REQUIRE( pt::test::test_buffer_pool(context) == PT_TEST_PASS );
+}
+
+TEST_CASE( "HDR accumulation converges and restarts on camera change", "[Accumulation]" ) {
+    REQUIRE( pt::test::test_hdr_accumulation(device, context, cmd_queue) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Frames in flight match serial rendering", "[Frame scheduler]" ) {
+    REQUIRE( pt::test::test_frame_scheduler(device, context, cmd_queue) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Work group sizes are tuned and cached", "[.][Autotune]" ) {
+    REQUIRE( pt::test::test_autotune_kernels(device, context, cmd_queue) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Host and device agree on the shared record layout", "[Layout]" ) {
+    REQUIRE( pt::test::test_device_layout(device, context, cmd_queue) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Octahedral directions and half floats round trip", "[Ray packing]" ) {
+    REQUIRE( pt::test::test_ray_packing() == PT_TEST_PASS );
+}
+
+TEST_CASE( "Packed ray streams against float3 streams", "[.][Ray layout bandwidth]" ) {
+    REQUIRE( pt::test::test_ray_layout_bandwidth(device, context, cmd_queue) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Shading sorted by material matches unsorted shading", "[Material sort]" ) {
+    REQUIRE( pt::test::test_material_sort(device, context, cmd_queue) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Device glass matches the CPU dielectric", "[Dielectric]" ) {
+    REQUIRE( pt::test::test_dielectric_cl(device, context, cmd_queue) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Device pinhole, thin lens and panoramic rays match the CPU cameras", "[Camera]" ) {
+    REQUIRE( pt::test::test_camera_rays(device, context, cmd_queue) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Render counters add up", "[Counters]" ) {
+    REQUIRE( pt::test::test_counters() == PT_TEST_PASS );
+}
+
+TEST_CASE( "Trace spans land in the Chrome trace", "[Trace]" ) {
+    REQUIRE( pt::test::test_trace() == PT_TEST_PASS );
+}
+
+TEST_CASE( "Scene files load from text and from the cache", "[Scene]" ) {
+    REQUIRE( pt::test::test_scene_cache() == PT_TEST_PASS );
+    REQUIRE( pt::test::test_scene_cl(device, context, cmd_queue) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Scene load time from text and from the cache", "[.][Scene load]" ) {
+    /* PT_DRAGON_SCENE overrides the scene of the assets directory */
+    std::string scene = pt::test::test_util_find_file("PT_DRAGON_SCENE", "scenes/dragon.scene");
+    if (scene.empty()) FAIL( "Could not find scenes/dragon.scene, set PT_CL_ASSETS or PT_DRAGON_SCENE" );
+    pt::test::bench_scene_load(scene, 5);
+}
+
+TEST_CASE( "Instances of shared geometry trace as their copies", "[Instances]" ) {
+    REQUIRE( pt::test::test_instances() == PT_TEST_PASS );
+    REQUIRE( pt::test::test_instances_cl(device, context, cmd_queue) == PT_TEST_PASS );
+}
+
+TEST_CASE( "Memory and build time of 10^4 dragon instances", "[.][Instancing]" ) {
+    /* the mesh of the light field capture next to PT, PT_DRAGON_OBJ overrides it */
+    std::string mesh = pt::test::test_util_find_file("PT_DRAGON_OBJ", "../../LightfieldAcquisitionUnity/Assets/dragon.obj");
+    if (mesh.empty()) FAIL( "Could not find dragon.obj, set PT_CL_ASSETS or PT_DRAGON_OBJ" );
+    pt::test::bench_instances(mesh, 10000);
+}
+
+TEST_CASE( "BVH builders give valid trees that hit what the list hits", "[BVH]" ) {
+    REQUIRE( pt::test::test_bvh_builders() == PT_TEST_PASS );
+}
+
+TEST_CASE( "BVH build time against primitive count and trace rate per builder", "[.][BVH build]" ) {
+    std::string mesh = pt::test::test_util_find_file("PT_DRAGON_OBJ", "../../LightfieldAcquisitionUnity/Assets/dragon.obj");
+    if (mesh.empty()) FAIL( "Could not find dragon.obj, set PT_CL_ASSETS or PT_DRAGON_OBJ" );
+    pt::test::bench_bvh_build(mesh);
+}
+
+TEST_CASE( "Ray packets hit what single rays hit", "[Packets]" ) {
+    REQUIRE( pt::test::test_packets() == PT_TEST_PASS );
+}
+
+TEST_CASE( "Primary ray rate of packets against single rays", "[.][Packet speedup]" ) {
+    pt::test::bench_packets();
+}
+
+TEST_CASE( "Shadow rays to a light list sampled by power", "[Lights]" ) {
+    REQUIRE( pt::test::test_light_list() == PT_TEST_PASS );
+}
+
+TEST_CASE( "A light tree samples a wall of lights with less noise than uniform picks", "[Lights]" ) {
+    REQUIRE( pt::test::test_light_tree() == PT_TEST_PASS );
+}
+
+TEST_CASE( "Render time against the number of lights", "[.][Light scaling]" ) {
+    pt::test::bench_light_scaling();
+}
+
+#if !defined(_WIN32)
+TEST_CASE( "Worker processes trace the image of one process and survive a lost worker", "[Distributed]" ) {
+    REQUIRE( pt::test::test_distributed_trace() == PT_TEST_PASS );
+}
+
+TEST_CASE( "Render time against the number of worker processes", "[.][Distributed bench]" ) {
+    pt::test::bench_distributed_trace(256, 192, 4);
+}
+#endif
+
 int main(int argc, const char * argv[])
 {
     /*
@@ -50,22 +216,7 @@ int main(int argc, const char * argv[])
      * Then we need to allow tester to compile program, allocate memory, write data and access results
      */
     
-    cl_int clStatus;
-    
-    /* Obtain a platform */
-    std::vector<cl::Platform> platforms;
-    clStatus = cl::Platform::get(&platforms);
-    PTCL_ASSERT(clStatus, "Could not find an OpenCL platform.");
-    
-    /* Obtain a device and determinte max local size */
-    std::vector<cl::Device> devices;
-    clStatus = platforms[0].getDevices(CL_DEVICE_TYPE_GPU, &devices);
-    PTCL_ASSERT(clStatus, "Could not find a GPU device.");
-    device = devices[0];
-    
-    cl_uint maxDeviceComputeUnits = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
-    
-    /* Create an OpenCL context for the device */
+    /* Pick a device (GPU, else CPU, PT_CL_DEVICE overrides) and create an OpenCL context for it */
 #ifdef PT_TEST_OPENGL_COMPATIBILITY
     
     CGLContextObj glContext = CGLGetCurrentContext();
@@ -77,19 +228,26 @@ int main(int argc, const char * argv[])
         0
     };
     
-    context = cl::Context({device}, properties, NULL, NULL, &clStatus);
+    pt::CLRuntime runtime(properties);
     
-#else 
+#else
     
-    context = cl::Context({device}, NULL, NULL, NULL, &clStatus);
+    pt::CLRuntime runtime;
     
 #endif
     
-    PTCL_ASSERT(clStatus, "Could not create a context for device.");
+    if (runtime.getStatus() != CL_SUCCESS)
+    {
+        std::cerr << "No usable OpenCL device, see PT_CL_DEVICE\n";
+        return EXIT_FAILURE;
+    }
+    
+    device = runtime.getDevice();
+    context = runtime.getContext();
+    cmd_queue = runtime.getQueue();
+    pt::test::test_runtime = &runtime;
     
-    /* Create command queue */
-    cmd_queue = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &clStatus);
-    PTCL_ASSERT(clStatus, "Could not create command queue");
+    std::cout << "OpenCL device: " << runtime.getDeviceName() << "\n";
     
     /*
      * Now the tests can execute, but each test needs to create a program first
@@ -5,6 +5,9 @@
 #include "ptUtil.h"
 #include "ptTests.h"
 #include "ptCL.h"
+#include "ptCLRuntime.h"
+#include "ptCLFrameScheduler.h"
+#include "ptScene.h"
 #include "ptGeometry.h"
 #include "cinder/CameraUi.h"
 
@@ -30,32 +33,29 @@ private:
     
     cl_int clStatus;
     
-    cl::Device device;
-    cl::Context context;
+    std::unique_ptr<CLRuntime> runtime;
+    std::unique_ptr<CLFrameScheduler> scheduler;
     cl::Program program;
     cl::Kernel kernel;
-    cl::CommandQueue cmd_queue;
+    cl::Kernel tonemap_kernel;
+    cl_accumulation accumulation;
     
     gl::Texture2dRef imgTex;
-    std::vector<cl::Memory> img_buffer;
-    cl::Buffer cam_buffer;
+    std::vector<unsigned char> img_pixels;
+    bool img_dirty;
     cl::Buffer primitive_buffer;
     cl::Buffer material_buffer;
     cl::Buffer sky_buffer;
     
-    size_t local_size;
-    size_t local_width;
-    size_t local_height;
     size_t img_width;
     size_t img_height;
     
-    size_t true_img_width;
-    size_t true_img_height;
-    
 };
 
 void PTWeekend::setup()
 {
+    /* PT_TRACE=<file> records the frames and writes them there on exit */
+    if (pt::trace_enable_from_env()) pt::trace_set_thread_name("main");
     
     /* Scene data */
     camera.lookAt(glm::vec3(-2,1,1), vec3(0, 0, -1.0f), vec3(0,1,0));
@@ -64,131 +64,89 @@ void PTWeekend::setup()
     
     
     
-    glm::vec3 bottom_sky_color(1.0, 1.0, 1.0);
-    glm::vec3 top_sky_color(0.5, 0.7, 1.0);
-    
     CGLContextObj glContext = CGLGetCurrentContext();
     CGLShareGroupObj shareGroup = CGLGetShareGroup(glContext);
     
-    GLuint imgTexName;
-    
-    const char* program_file_str = "../../../assets/path_tracing.cl";
-    
-    /* Obtain a platform */
-    std::vector<cl::Platform> platforms;
-    clStatus = cl::Platform::get(&platforms);
-    pt_assert(clStatus, "Could not find an OpenCL platform.");
-    
-    /* Obtain a device and determinte max local size */
-    std::vector<cl::Device> devices;
-    clStatus = platforms[0].getDevices(CL_DEVICE_TYPE_GPU, &devices);
-    pt_assert(clStatus, "Could not find a GPU device.");
-    device = devices[0];
-    
-    /* Create an OpenCL context for the device */
+    /* Create an OpenCL context sharing objects with the GL context */
     cl_context_properties properties[] = {
         CL_CONTEXT_PROPERTY_USE_CGL_SHAREGROUP_APPLE,
         (cl_context_properties)shareGroup,
         0
     };
     
-    context = cl::Context({device}, properties, NULL, NULL, &clStatus);
-    pt_assert(clStatus, "Could not create a context for device.");
-    
-    /* Load and build a program */
-    std::ifstream program_file(program_file_str);
-    std::string program_str(std::istreambuf_iterator<char>(program_file), (std::istreambuf_iterator<char>()));
-    cl::Program::Sources sources(1, std::make_pair(program_str.c_str(), program_str.length() + 1));
-    program = cl::Program(context, sources);
-    clStatus = program.build({device}, "-I ../../../assets/ -cl-denorms-are-zero");
+    runtime.reset(new CLRuntime(properties));
+    pt_assert(runtime->getStatus(), "Could not set up an OpenCL device");
     
-    if (clStatus != CL_SUCCESS)
-    {
-        std::string log = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
-        std::cerr << log << "\n";
-        exit(EXIT_FAILURE);
-    }
+    cl::Context& context = runtime->getContext();
+    cl::CommandQueue& cmd_queue = runtime->getQueue();
     
-    /* Create command queue */
-    cmd_queue = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &clStatus);
-    pt_assert(clStatus, "Could not create command queue");
+    /* Load and build a program */
+    clStatus = runtime->buildProgram("path_tracing.cl", "-cl-denorms-are-zero", program);
+    pt_assert(clStatus, "Could not build program");
     
     /* create kernel and set the kernel arguments */
-    kernel = cl::Kernel(program, "path_tracing", &clStatus);
+    kernel = cl::Kernel(program, "path_tracing_accumulate", &clStatus);
     pt_assert(clStatus, "Could not create kernel");
     
+    tonemap_kernel = cl::Kernel(program, "tonemap_buffer", &clStatus);
+    pt_assert(clStatus, "Could not create tone map kernel");
+    
     img_width = getWindowWidth();
     img_height = getWindowHeight();
     
-    true_img_width = getWindowWidth();
-    true_img_height = getWindowHeight();
-    
-    local_size = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>(); //TODO: throws
-    local_width = (size_t)pow(2, ceilf(log2f((floorf(sqrtf(local_size))))));
-    local_height = local_size / local_width;
-    
-    img_width = ceilf((float)img_width / (float)local_width) * local_width;
-    img_height = ceilf((float)img_height / (float)local_height) * local_height;
-    
+    /* Few samples per frame, they add up while the camera is still */
+    unsigned int samples = 4;
     
-    unsigned int samples = 16;
+    /* Frames come back to the host, the texture is updated from the latest one */
+    imgTex = gl::Texture2d::create(img_width, img_height, gl::Texture2d::Format().internalFormat(GL_RGBA).wrap(GL_REPEAT).minFilter(GL_LINEAR).magFilter(GL_LINEAR));
+    img_pixels.resize(4 * img_width * img_height);
+    img_dirty = false;
     
-    /* Create GL texture and CL wrapper */
-    glGenTextures(1, &imgTexName);
-    glBindTexture(GL_TEXTURE_2D, imgTexName);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img_width, img_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    imgTex = gl::Texture2d::create(GL_TEXTURE_2D, imgTexName, img_width, img_height, true);
-    glFinish();
+    /* Create all buffers, they stay with the pool for the lifetime of the app */
+    CLBufferPool& pool = runtime->getBufferPool();
     
-    img_buffer.push_back(cl::Image2DGL(context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, imgTexName, &clStatus));
-    pt_assert(clStatus, "Could not create buffer");
-    
-    /* Create all buffers */
-    cam_buffer = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(cl_pinhole_cam), NULL, &clStatus);
-    pt_assert(clStatus, "Could not create camera buffer");
-    
-    primitive_buffer = cl::Buffer (context, CL_MEM_READ_ONLY, MAX_PRIMITIVES * sizeof(cl_sphere), NULL, &clStatus);
+    primitive_buffer = pool.acquire(MAX_PRIMITIVES * sizeof(cl_sphere), CL_MEM_READ_ONLY, &clStatus);
     pt_assert(clStatus, "Could not create primitive buffer");
     
-    material_buffer = cl::Buffer (context, CL_MEM_READ_ONLY, MAX_PRIMITIVES * sizeof(cl_material), NULL, &clStatus);
+    material_buffer = pool.acquire(MAX_PRIMITIVES * sizeof(cl_material), CL_MEM_READ_ONLY, &clStatus);
     pt_assert(clStatus, "Could not create primitive buffer");
     
-    sky_buffer = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(cl_sky_material), NULL, &clStatus);
+    sky_buffer = pool.acquire(sizeof(cl_sky_material), CL_MEM_READ_ONLY, &clStatus);
     pt_assert(clStatus, "Could not create sky buffer");
     
-    /* Upload scene (static) */
+    clStatus = cl_make_accumulation(context, img_width * img_height, cmd_queue, accumulation);
+    pt_assert(clStatus, "Could not create accumulation buffer");
+    
+    clStatus = cl_set_tonemap_args(tonemap_kernel, accumulation, (cl_uint)img_width, (cl_uint)img_height, 1.0f, 2.2f, TONEMAP_ACES);
+    pt_assert(clStatus, "Could not set tone map arguments");
     
-    size_t sceneObjectCount = 5;
-    cl_sphere* primitive_array = (cl_sphere*)malloc(sceneObjectCount * sizeof(cl_sphere));
-    cl_material* material_array = (cl_material*)malloc(sceneObjectCount * sizeof(cl_material));
+    /* Upload scene (static), from the scene file or its cache */
     
-    primitive_array[0] = cl_make_sphere(glm::vec3(1, 0, -1), 0.5f);
-    material_array[0] = cl_make_material(pt::ColorHex_to_RGBfloat<float>("0x730202"), 0, MAT_LAMBERTIAN);
+    pt::SceneDescription scene;
+    pt::scene_load(runtime->findFile("scenes/weekend.scene"), scene);
     
-    primitive_array[1] = cl_make_sphere(glm::vec3(-1, 0, -1), 0.5f);
-    material_array[1] = cl_make_material(pt::ColorHex_to_RGBfloat<float>("0xF89000"), 0, MAT_LAMBERTIAN);
+    if (scene.triangles.size > 0 || scene.spheres.size > MAX_PRIMITIVES)
+    {
+        console() << "path_tracing.cl renders up to " << MAX_PRIMITIVES << " spheres" << std::endl;
+        quit();
+        return;
+    }
     
-    primitive_array[2] = cl_make_sphere(glm::vec3(0, 0, 0), 0.5f);
-    material_array[2] = cl_make_material(pt::ColorHex_to_RGBfloat<float>("0x97A663"), 0.1f, MAT_METALLIC);
+    size_t sceneObjectCount = scene.spheres.size;
+    std::vector<cl_material> material_array(sceneObjectCount);
     
-    primitive_array[3] = cl_make_sphere(glm::vec3(0, 0, -2), 0.5f);
-    material_array[3] = cl_make_material(glm::vec3(0.8f, 0.6f, 0.2f), 0.3f, MAT_METALLIC);
+    for (size_t i = 0; i < sceneObjectCount; ++i)
+        material_array[i] = scene.material_table[scene.primitive_materials[i]];
     
-    primitive_array[4] = cl_make_sphere(glm::vec3(0,-100.5f, 1.0f), 100.0f);
-    material_array[4] = cl_make_material(glm::vec3(0.5f), 0, MAT_LAMBERTIAN);
+    camera.lookAt(scene.camera.eye, scene.camera.lookat, scene.camera.up);
     
-    clStatus = cmd_queue.enqueueWriteBuffer(primitive_buffer, CL_TRUE, 0, sceneObjectCount * sizeof(cl_sphere), primitive_array, NULL, NULL);
+    clStatus = cmd_queue.enqueueWriteBuffer(primitive_buffer, CL_TRUE, 0, sceneObjectCount * sizeof(cl_sphere), scene.spheres.data, NULL, NULL);
     pt_assert(clStatus, "Could not fill primitive buffer");
     
-    clStatus = cmd_queue.enqueueWriteBuffer(material_buffer, CL_TRUE, 0, sceneObjectCount * sizeof(cl_material), material_array, NULL, NULL);
+    clStatus = cmd_queue.enqueueWriteBuffer(material_buffer, CL_TRUE, 0, sceneObjectCount * sizeof(cl_material), material_array.data(), NULL, NULL);
     pt_assert(clStatus, "Could not fill material buffer");
     
-    pt_assert(cl_set_skycolors(bottom_sky_color, top_sky_color, sky_buffer, cmd_queue),
+    pt_assert(cl_set_skycolors(scene.sky_bottom, scene.sky_top, sky_buffer, cmd_queue),
               "Could not fill sky buffer");
     
     clStatus = kernel.setArg(1, primitive_buffer);
@@ -200,17 +158,53 @@ void PTWeekend::setup()
     clStatus = kernel.setArg(3, sky_buffer);
     pt_assert(clStatus, "Could not set sky buffer argument");
     
-    clStatus = kernel.setArg(4, sceneObjectCount);
+    clStatus = kernel.setArg(4, (cl_uint)sceneObjectCount);
     pt_assert(clStatus, "Could not set primitive count count argument");
     
-    clStatus = kernel.setArg(5, img_buffer[0]);
-    pt_assert(clStatus, "Could not set img buffer argument");
-    
     clStatus = kernel.setArg(6, samples);
     pt_assert(clStatus, "Could not set samples argument");
     
-    clStatus = kernel.setArg(0, cam_buffer);
-    pt_assert(clStatus, "Could not set camera buffer argument");
+    clStatus = kernel.setArg(7, (cl_uint)img_width);
+    pt_assert(clStatus, "Could not set width argument");
+    
+    clStatus = kernel.setArg(8, (cl_uint)img_height);
+    pt_assert(clStatus, "Could not set height argument");
+    
+    /* The local size is tuned once per device and window size, with a throwaway camera, the first frame clears the accumulation */
+    cl::NDRange local;
+    {
+        CLBufferPool::Scope tuning(pool);
+        
+        cl_pinhole_cam tuning_cam = cl_make_pinhole_cam(pt::PinholeCamera<float>(45.0f, getWindowAspectRatio(), glm::vec3(-2,1,1), glm::vec3(0,0,-1), glm::vec3(0,1,0)));
+        cl::Buffer tuning_cam_buffer = tuning.acquire(sizeof(cl_pinhole_cam), CL_MEM_READ_ONLY, &clStatus);
+        pt_assert(clStatus, "Could not create camera buffer");
+        
+        clStatus = cmd_queue.enqueueWriteBuffer(tuning_cam_buffer, CL_TRUE, 0, sizeof(cl_pinhole_cam), &tuning_cam);
+        pt_assert(clStatus, "Could not fill camera buffer");
+        
+        kernel.setArg(0, tuning_cam_buffer);
+        kernel.setArg(5, accumulation.buffer);
+        kernel.setArg(9, (cl_uint)0);
+        
+        local = runtime->getAutotuner().localSize(kernel, cl::NDRange(img_width, img_height), CLAutotuner::Configure(), true);
+        runtime->getAutotuner().printResults();
+    }
+    
+    /* Camera, output and frame index are set per frame by the scheduler, uploads and readbacks go on their own queue */
+    cl_int queue_status;
+    cl::CommandQueue& transfer_queue = runtime->createQueue(CL_QUEUE_PROFILING_ENABLE, &queue_status);
+    
+    if (queue_status != CL_SUCCESS)
+        console() << "Transfers share the kernel queue" << std::endl;
+    
+    scheduler.reset(new CLFrameScheduler(context, cmd_queue, transfer_queue, kernel, tonemap_kernel, accumulation,
+                                         img_width, img_height,
+                                         local, 2));
+    
+    scheduler->setFrameCallback([this](unsigned int frame, const unsigned char* rgba) {
+        std::copy(rgba, rgba + img_pixels.size(), img_pixels.begin());
+        img_dirty = true;
+    });
 }
 
 void PTWeekend::mouseDown( MouseEvent event ) { }
@@ -242,32 +236,29 @@ void PTWeekend::draw()
     hor = 2.0f * half_width * u;
     ver = 2.0f * half_height * v;
     
-    pt_assert(cl_set_pinhole_cam_arg(origin, lower_left, hor, ver, cam_buffer, cmd_queue), "Could not fill camera buffer");
-    
-    clStatus = cmd_queue.enqueueAcquireGLObjects(&img_buffer, NULL, NULL);
-    pt_assert(clStatus, "Could not acquire gl objects");
+    /* Blocks only when the frame submitted two frames ago is not back yet */
+    scheduler->submit(cl_make_pinhole_cam(origin, lower_left, hor, ver));
+    scheduler->poll();
     
-    cl::Event profiling_evt;
-    
-    
-    
-    clStatus = cmd_queue.enqueueNDRangeKernel(kernel,
-                                              cl::NDRange(0,0),
-                                              cl::NDRange(img_width, img_height),
-                                              cl::NDRange(local_width,local_height),
-                                              NULL,
-                                              &profiling_evt);
-    profiling_evt.wait();
-    
-    pt_assert(clStatus, "Could not enqueue the kernel");
-    clStatus = cmd_queue.enqueueReleaseGLObjects(&img_buffer, NULL, NULL);
-    pt_assert(clStatus, "Could not release gl objects");
-    cmd_queue.finish();
+    if (img_dirty)
+    {
+        imgTex->update(img_pixels.data(), GL_RGBA, GL_UNSIGNED_BYTE, 0, img_width, img_height);
+        img_dirty = false;
+    }
     
-    cl_ulong time_start = profiling_evt.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-    cl_ulong time_end = profiling_evt.getProfilingInfo<CL_PROFILING_COMMAND_END>();
-    cl_ulong total_time = time_end - time_start;
-    std::cout << "Total time: " << total_time * 0.001 * 0.001 << " ms \n";
+    if (getElapsedFrames() % 60 == 0)
+    {
+        CLFrameScheduler::Timings timings = scheduler->getTimings();
+        
+        if (timings.frames > 0)
+        {
+            std::cout << "Frames : " << timings.frames
+            << " upload " << timings.upload_ms / timings.frames
+            << " kernel " << timings.kernel_ms / timings.frames
+            << " tone map " << timings.tonemap_ms / timings.frames
+            << " readback " << timings.readback_ms / timings.frames << " ms\n";
+        }
+    }
     
     /*
      * END - each frame part
@@ -278,8 +269,11 @@ void PTWeekend::draw()
 
 void PTWeekend::cleanup()
 {
-    GLuint textureName = imgTex->getId();
-    glDeleteTextures(1, &textureName);
+    scheduler.reset();
+    
+    runtime->getBufferPool().printStats();
+    
+    pt::trace_write_env();
 }
 
 CINDER_APP(PTWeekend, RendererGl, [](App::Settings* settings) {
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <algorithm>
+#include <atomic>
 #include "ptGeometry.h"
 
 using namespace pt;
@@ -194,10 +196,10 @@ bool Sphere<T>::intersect_simple(const pt::Ray<T>& ray, T& t_out, const T& t_min
     
     if(det > 0)
     {
-        t_out = (-b - sqrt(det)) / a;
+        t_out = (-b - std::sqrt(det)) / a;
         if (t_out > t_min && t_out < t_max) return true;
         
-        t_out = (-b + sqrt(det)) / a;
+        t_out = (-b + std::sqrt(det)) / a;
         if (t_out > t_min && t_out < t_max) return true;
     }
     
@@ -210,6 +212,13 @@ ptvec<T> Sphere<T>::normalAt(const ptvec<T>& point) const
     return glm::normalize((point - center) / radius);
 }
 
+template <typename T>
+void Sphere<T>::bounds(ptvec<T>& out_min, ptvec<T>& out_max) const
+{
+    out_min = center - ptvec<T>(radius);
+    out_max = center + ptvec<T>(radius);
+}
+
 template <typename T>
 ptvec<T> Sphere<T>::getCenter() const { return center; }
 
@@ -219,6 +228,414 @@ T Sphere<T>::getRadius() const { return radius; }
 template class pt::Sphere<double>;
 template class pt::Sphere<float>;
 
+/* Triangle impl */
+
+template <typename T>
+Triangle<T>::Triangle(const ptvec<T>& _v0, const ptvec<T>& v1, const ptvec<T>& v2)
+    : v0(_v0), e1(v1 - _v0), e2(v2 - _v0)
+{
+    normal = glm::normalize(glm::cross(e1, e2));
+}
+
+template <typename T>
+bool Triangle<T>::intersect_simple(const pt::Ray<T>& ray, T& t_out, const T& t_min, const T& t_max) const
+{
+    ptvec<T> p = glm::cross(ray.dir, e2);
+    T det = glm::dot(e1, p);
+    
+    if (fabs(det) < std::numeric_limits<T>::epsilon()) return false; // parallel to the plane
+    
+    T inv_det = 1 / det;
+    ptvec<T> s = ray.origin - v0;
+    T b1 = glm::dot(s, p) * inv_det;
+    if (b1 < 0 || b1 > 1) return false;
+    
+    ptvec<T> q = glm::cross(s, e1);
+    T b2 = glm::dot(ray.dir, q) * inv_det;
+    if (b2 < 0 || b1 + b2 > 1) return false;
+    
+    t_out = glm::dot(e2, q) * inv_det;
+    return (t_out > t_min && t_out < t_max);
+}
+
+template <typename T>
+T Triangle<T>::intersect(const pt::Ray<T>& ray) const
+{
+    T t;
+    return intersect_simple(ray, t, (T)PT_EPSILON) ? t : 0;
+}
+
+template <typename T>
+bool Triangle<T>::intersect_check(const pt::Ray<T>& ray) const
+{
+    T t;
+    return intersect_simple(ray, t);
+}
+
+template <typename T>
+T Triangle<T>::intersect_simple(const pt::Ray<T>& ray) const
+{
+    T t;
+    return intersect_simple(ray, t) ? t : -1;
+}
+
+template <typename T>
+ptvec<T> Triangle<T>::normalAt(const ptvec<T>& point) const { return normal; }
+
+template <typename T>
+void Triangle<T>::bounds(ptvec<T>& out_min, ptvec<T>& out_max) const
+{
+    out_min = glm::min(v0, glm::min(v0 + e1, v0 + e2));
+    out_max = glm::max(v0, glm::max(v0 + e1, v0 + e2));
+}
+
+template <typename T>
+ptvec<T> Triangle<T>::getVertex(int i) const
+{
+    return (i == 0) ? v0 : ((i == 1) ? v0 + e1 : v0 + e2);
+}
+
+template class pt::Triangle<double>;
+template class pt::Triangle<float>;
+
+/* BVH impl */
+
+/* State of one build: the boxes, the order of the indices being partitioned and the node arena */
+template <typename T>
+struct BVHBuildState
+{
+    BVHBuildState(const std::vector<ptvec<T>>& _bmin, const std::vector<ptvec<T>>& _bmax, BVH<T>& _bvh, BVHBuild _method, TaskPool& _pool)
+    : bmin(_bmin), bmax(_bmax), centroid(_bmin.size()), bvh(_bvh), method(_method), pool(_pool), next_node(1) {}
+    
+    const std::vector<ptvec<T>>& bmin;
+    const std::vector<ptvec<T>>& bmax;
+    std::vector<ptvec<T>> centroid;
+    std::vector<uint32_t> codes; // LBVH, Morton code of the centroid of indices[i]
+    BVH<T>& bvh;
+    BVHBuild method;
+    TaskPool& pool;
+    TaskGroup group;
+    std::atomic<int> next_node;
+};
+
+static const int BVHBins = 16;
+static const int BVHParallelSize = 4096; // ranges at least this large build their right child as a task
+
+template <typename T>
+static T bvh_half_area(const ptvec<T>& lo, const ptvec<T>& hi)
+{
+    ptvec<T> e = hi - lo;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+/* Split of the lowest SAH cost over BVHBins bins of the centroids on every axis, or -1 when all fall in one bin */
+template <typename T>
+static int bvh_split_sah(BVHBuildState<T>& state, int first, int count, const ptvec<T>& cmin, const ptvec<T>& cmax)
+{
+    std::vector<uint32_t>& indices = state.bvh.indices;
+    ptvec<T> extent = cmax - cmin;
+    T best_cost = std::numeric_limits<T>::max();
+    int best_axis = -1;
+    int best_bin = 0;
+    
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (extent[axis] <= 0) continue;
+        
+        int bin_count[BVHBins] = {};
+        ptvec<T> bin_min[BVHBins], bin_max[BVHBins];
+        T scale = (T)BVHBins / extent[axis];
+        
+        for (int i = first; i < first + count; ++i)
+        {
+            uint32_t p = indices[i];
+            int b = std::min(BVHBins - 1, (int)((state.centroid[p][axis] - cmin[axis]) * scale));
+            bin_min[b] = bin_count[b] ? glm::min(bin_min[b], state.bmin[p]) : state.bmin[p];
+            bin_max[b] = bin_count[b] ? glm::max(bin_max[b], state.bmax[p]) : state.bmax[p];
+            bin_count[b]++;
+        }
+        
+        /* cost of the bins right of every split, then the sweep from the left */
+        T right_area[BVHBins];
+        int right_count[BVHBins];
+        ptvec<T> lo, hi;
+        int n = 0;
+        
+        for (int b = BVHBins - 1; b > 0; --b)
+        {
+            if (bin_count[b])
+            {
+                lo = n ? glm::min(lo, bin_min[b]) : bin_min[b];
+                hi = n ? glm::max(hi, bin_max[b]) : bin_max[b];
+                n += bin_count[b];
+            }
+            
+            right_count[b] = n;
+            right_area[b] = n ? bvh_half_area(lo, hi) : 0;
+        }
+        
+        n = 0;
+        
+        for (int b = 0; b < BVHBins - 1; ++b)
+        {
+            if (bin_count[b])
+            {
+                lo = n ? glm::min(lo, bin_min[b]) : bin_min[b];
+                hi = n ? glm::max(hi, bin_max[b]) : bin_max[b];
+                n += bin_count[b];
+            }
+            
+            if (n == 0 || right_count[b + 1] == 0) continue;
+            
+            T cost = (T)n * bvh_half_area(lo, hi) + (T)right_count[b + 1] * right_area[b + 1];
+            
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+    
+    if (best_axis < 0) return -1;
+    
+    T scale = (T)BVHBins / extent[best_axis];
+    T low = cmin[best_axis];
+    
+    std::vector<uint32_t>::iterator mid = std::partition(indices.begin() + first, indices.begin() + first + count, [&](uint32_t p) {
+        return std::min(BVHBins - 1, (int)((state.centroid[p][best_axis] - low) * scale)) <= best_bin;
+    });
+    
+    return (int)(mid - indices.begin());
+}
+
+/* Median of the longest axis of the centroids */
+template <typename T>
+static int bvh_split_median(BVHBuildState<T>& state, int first, int count, const ptvec<T>& cmin, const ptvec<T>& cmax)
+{
+    std::vector<uint32_t>& indices = state.bvh.indices;
+    ptvec<T> extent = cmax - cmin;
+    int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : ((extent.y > extent.z) ? 1 : 2);
+    int mid = first + count / 2;
+    
+    std::nth_element(indices.begin() + first, indices.begin() + mid, indices.begin() + first + count,
+                     [&](uint32_t a, uint32_t b) { return state.centroid[a][axis] < state.centroid[b][axis]; });
+    
+    return mid;
+}
+
+/* Where the highest bit that differs in the sorted codes of the range flips, the middle when they are all the same */
+template <typename T>
+static int bvh_split_morton(BVHBuildState<T>& state, int first, int count)
+{
+    const std::vector<uint32_t>& codes = state.codes;
+    uint32_t a = codes[first];
+    uint32_t b = codes[first + count - 1];
+    
+    if (a == b) return first + count / 2;
+    
+    uint32_t bit = 0x80000000u;
+    while (!((a ^ b) & bit)) bit >>= 1;
+    
+    return (int)(std::lower_bound(codes.begin() + first, codes.begin() + first + count, (b & ~(bit - 1))) - codes.begin());
+}
+
+/*
+ * Fills node with the range [first, first + count) of indices and splits it. The children are taken from the arena
+ * in pairs, the right one of a large range is built by another task. LBVH bounds are left to bvh_refit.
+ */
+template <typename T>
+static void bvh_build_node(BVHBuildState<T>* state, int index, int first, int count, int depth)
+{
+    typedef typename BVH<T>::Node Node;
+    
+    const std::vector<uint32_t>& indices = state->bvh.indices;
+    Node& node = state->bvh.nodes[index];
+    node.left_first = first;
+    node.count = count;
+    
+    ptvec<T> cmin, cmax;
+    
+    if (state->method != BVH_BUILD_LBVH)
+    {
+        cmin = cmax = state->centroid[indices[first]];
+        node.bmin = state->bmin[indices[first]];
+        node.bmax = state->bmax[indices[first]];
+        
+        for (int i = first + 1; i < first + count; ++i)
+        {
+            uint32_t p = indices[i];
+            node.bmin = glm::min(node.bmin, state->bmin[p]);
+            node.bmax = glm::max(node.bmax, state->bmax[p]);
+            cmin = glm::min(cmin, state->centroid[p]);
+            cmax = glm::max(cmax, state->centroid[p]);
+        }
+    }
+    
+    /* the traversal stacks are MaxDepth deep */
+    if (count <= BVH<T>::MaxLeafSize || depth + 2 >= BVH<T>::MaxDepth) return;
+    
+    int mid;
+    
+    if (state->method == BVH_BUILD_LBVH)
+    {
+        mid = bvh_split_morton(*state, first, count);
+    }
+    else
+    {
+        if (cmin == cmax) return;
+        
+        mid = (state->method == BVH_BUILD_SAH) ? bvh_split_sah(*state, first, count, cmin, cmax) : -1;
+        if (mid <= first || mid >= first + count) mid = bvh_split_median(*state, first, count, cmin, cmax);
+    }
+    
+    int left = state->next_node.fetch_add(2);
+    node.left_first = left;
+    node.count = 0;
+    
+    if (count >= BVHParallelSize && state->pool.size() > 0)
+    {
+        state->pool.run(state->group, [=]() { bvh_build_node(state, left + 1, mid, first + count - mid, depth + 1); });
+    }
+    else
+    {
+        bvh_build_node(state, left + 1, mid, first + count - mid, depth + 1);
+    }
+    
+    bvh_build_node(state, left, first, mid - first, depth + 1);
+}
+
+/* Bounds of every node from its children, children come after their parent in the arena */
+template <typename T>
+static void bvh_refit(BVHBuildState<T>& state)
+{
+    std::vector<typename BVH<T>::Node>& nodes = state.bvh.nodes;
+    const std::vector<uint32_t>& indices = state.bvh.indices;
+    
+    for (int i = (int)nodes.size() - 1; i >= 0; --i)
+    {
+        typename BVH<T>::Node& node = nodes[i];
+        
+        if (node.count > 0)
+        {
+            node.bmin = state.bmin[indices[node.left_first]];
+            node.bmax = state.bmax[indices[node.left_first]];
+            
+            for (int k = node.left_first + 1; k < node.left_first + node.count; ++k)
+            {
+                node.bmin = glm::min(node.bmin, state.bmin[indices[k]]);
+                node.bmax = glm::max(node.bmax, state.bmax[indices[k]]);
+            }
+        }
+        else
+        {
+            node.bmin = glm::min(nodes[node.left_first].bmin, nodes[node.left_first + 1].bmin);
+            node.bmax = glm::max(nodes[node.left_first].bmax, nodes[node.left_first + 1].bmax);
+        }
+    }
+}
+
+/* 10 bits of x, y, z of a point of the unit cube interleaved */
+static uint32_t bvh_morton_code(float x, float y, float z)
+{
+    uint32_t v[3] = { (uint32_t)std::min(std::max(x * 1024.0f, 0.0f), 1023.0f),
+                      (uint32_t)std::min(std::max(y * 1024.0f, 0.0f), 1023.0f),
+                      (uint32_t)std::min(std::max(z * 1024.0f, 0.0f), 1023.0f) };
+    
+    for (int i = 0; i < 3; ++i)
+    {
+        v[i] = (v[i] * 0x00010001u) & 0xFF0000FFu;
+        v[i] = (v[i] * 0x00000101u) & 0x0F00F00Fu;
+        v[i] = (v[i] * 0x00000011u) & 0xC30C30C3u;
+        v[i] = (v[i] * 0x00000005u) & 0x49249249u;
+    }
+    
+    return (v[0] << 2) | (v[1] << 1) | v[2];
+}
+
+template <typename T>
+void BVH<T>::build(const PrimitiveList<T>& list, BVHBuild method, TaskPool& pool)
+{
+    std::vector<ptvec<T>> bmin(list.size()), bmax(list.size());
+    for (size_t i = 0; i < list.size(); ++i) list[i]->bounds(bmin[i], bmax[i]);
+    
+    build(bmin, bmax, method, pool);
+}
+
+template <typename T>
+void BVH<T>::build(const std::vector<ptvec<T>>& bmin, const std::vector<ptvec<T>>& bmax, BVHBuild method, TaskPool& pool)
+{
+    size_t n = bmin.size();
+    
+    nodes.clear();
+    indices.resize(n);
+    if (n == 0) return;
+    
+    BVHBuildState<T> state(bmin, bmax, *this, method, pool);
+    ptvec<T> cmin(std::numeric_limits<T>::max()), cmax(-std::numeric_limits<T>::max());
+    
+    for (size_t i = 0; i < n; ++i)
+    {
+        state.centroid[i] = (bmin[i] + bmax[i]) * (T)0.5;
+        cmin = glm::min(cmin, state.centroid[i]);
+        cmax = glm::max(cmax, state.centroid[i]);
+        indices[i] = (uint32_t)i;
+    }
+    
+    if (method == BVH_BUILD_LBVH)
+    {
+        ptvec<T> extent = glm::max(cmax - cmin, ptvec<T>(std::numeric_limits<T>::min()));
+        std::vector<uint64_t> keys(n);
+        
+        for (size_t i = 0; i < n; ++i)
+        {
+            ptvec<T> u = (state.centroid[i] - cmin) / extent;
+            keys[i] = ((uint64_t)bvh_morton_code((float)u.x, (float)u.y, (float)u.z) << 32) | (uint64_t)i;
+        }
+        
+        std::sort(keys.begin(), keys.end());
+        state.codes.resize(n);
+        
+        for (size_t i = 0; i < n; ++i)
+        {
+            indices[i] = (uint32_t)keys[i];
+            state.codes[i] = (uint32_t)(keys[i] >> 32);
+        }
+    }
+    
+    /* a binary tree with leaves of at least one primitive has less than 2n nodes, the arena never moves */
+    nodes.resize(2 * n);
+    
+    bvh_build_node(&state, 0, 0, (int)n, 0);
+    pool.wait(state.group);
+    
+    nodes.resize(state.next_node.load());
+    if (method == BVH_BUILD_LBVH) bvh_refit(state);
+}
+
+template <typename T>
+bool BVH<T>::intersect(const PrimitiveList<T>& list, const pt::Ray<T>& ray, T& t_out, size_t& idx_t, const T& t_min, const T& t_max) const
+{
+    T t_far = t_max;
+    T temp_t;
+    t_out = std::numeric_limits<T>::infinity();
+    
+    bool has_hit = traverse(ray, t_min, t_far, [&](uint32_t i, T& t_hit)
+    {
+        if (!list[i]->intersect_simple(ray, temp_t, t_min, t_hit)) return false;
+        idx_t = i;
+        t_hit = temp_t;
+        return true;
+    });
+    
+    if (has_hit) t_out = t_far;
+    return has_hit;
+}
+
+template class pt::BVH<double>;
+template class pt::BVH<float>;
+
 /* PrimitiveList impl */
 
 template <typename T>
@@ -228,6 +645,13 @@ bool PrimitiveList<T>::intersect_simple(const pt::Ray<T>& ray, T& t_out, size_t&
     T temp_t;
     t_out = std::numeric_limits<T>::infinity();
     
+    PT_STAGE(STAGE_INTERSECT);
+    PT_COUNT(PT_COUNTER_RAYS, 1);
+    
+    if (bvh && bvh->covers(this->size())) return bvh->intersect(*this, ray, t_out, idx_t, t_min, t_max);
+    
+    PT_COUNT(PT_COUNTER_INTERSECTION_TESTS, this->size());
+    
     for(int i = 0; i < this->size(); ++i)
     {
         if ((*this)[i]->intersect_simple(ray, temp_t, t_min, t_max))
@@ -244,7 +668,219 @@ bool PrimitiveList<T>::intersect_simple(const pt::Ray<T>& ray, T& t_out, size_t&
     return has_hit;
 }
 
+template <typename T>
+void PrimitiveList<T>::buildBVH(BVHBuild method)
+{
+    /* a new one, the previous may be shared with another list */
+    bvh = std::make_shared<BVH<T>>();
+    bvh->build(*this, method);
+}
+
 template class pt::PrimitiveList<double>;
 template class pt::PrimitiveList<float>;
 
 
+
+/* Transform impl */
+
+template <typename T>
+Transform<T>::Transform() : offset(0)
+{
+    rows[0] = ptvec<T>(1, 0, 0);
+    rows[1] = ptvec<T>(0, 1, 0);
+    rows[2] = ptvec<T>(0, 0, 1);
+}
+
+template <typename T>
+Transform<T>::Transform(const ptvec<T>& row0, const ptvec<T>& row1, const ptvec<T>& row2, const ptvec<T>& _offset) : offset(_offset)
+{
+    rows[0] = row0;
+    rows[1] = row1;
+    rows[2] = row2;
+}
+
+template <typename T>
+Transform<T> Transform<T>::translation(const ptvec<T>& t)
+{
+    Transform<T> result;
+    result.offset = t;
+    return result;
+}
+
+template <typename T>
+Transform<T> Transform<T>::scale(const T& s)
+{
+    return Transform<T>(ptvec<T>(s, 0, 0), ptvec<T>(0, s, 0), ptvec<T>(0, 0, s), ptvec<T>(0));
+}
+
+template <typename T>
+Transform<T> Transform<T>::rotationY(const T& degrees)
+{
+    T theta = degrees * M_PI / 180;
+    T c = cos(theta);
+    T s = sin(theta);
+    return Transform<T>(ptvec<T>(c, 0, s), ptvec<T>(0, 1, 0), ptvec<T>(-s, 0, c), ptvec<T>(0));
+}
+
+template <typename T>
+Transform<T> Transform<T>::operator*(const Transform<T>& other) const
+{
+    Transform<T> result;
+    
+    for (int i = 0; i < 3; ++i)
+        result.rows[i] = rows[i].x * other.rows[0] + rows[i].y * other.rows[1] + rows[i].z * other.rows[2];
+    
+    result.offset = vector(other.offset) + offset;
+    return result;
+}
+
+template <typename T>
+Transform<T> Transform<T>::inverse() const
+{
+    /* the columns of the inverse are the cross products of the rows over the determinant */
+    ptvec<T> c0 = glm::cross(rows[1], rows[2]);
+    ptvec<T> c1 = glm::cross(rows[2], rows[0]);
+    ptvec<T> c2 = glm::cross(rows[0], rows[1]);
+    T det = glm::dot(rows[0], c0);
+    
+    if (fabs(det) < std::numeric_limits<T>::epsilon()) throw "Singular transform";
+    
+    T inv_det = 1 / det;
+    Transform<T> result(ptvec<T>(c0.x, c1.x, c2.x) * inv_det,
+                        ptvec<T>(c0.y, c1.y, c2.y) * inv_det,
+                        ptvec<T>(c0.z, c1.z, c2.z) * inv_det,
+                        ptvec<T>(0));
+    
+    result.offset = -result.vector(offset);
+    return result;
+}
+
+template <typename T>
+ptvec<T> Transform<T>::point(const ptvec<T>& p) const { return vector(p) + offset; }
+
+template <typename T>
+ptvec<T> Transform<T>::vector(const ptvec<T>& v) const
+{
+    return ptvec<T>(glm::dot(rows[0], v), glm::dot(rows[1], v), glm::dot(rows[2], v));
+}
+
+template <typename T>
+ptvec<T> Transform<T>::normalFromInverse(const ptvec<T>& n) const
+{
+    return n.x * rows[0] + n.y * rows[1] + n.z * rows[2];
+}
+
+template class pt::Transform<double>;
+template class pt::Transform<float>;
+
+/* Geometry impl */
+
+template <typename T>
+void Geometry<T>::bounds(ptvec<T>& out_min, ptvec<T>& out_max) const
+{
+    if (!isBuilt()) throw "Geometry must be built before use";
+    
+    const typename BVH<T>::Node& root = primitives.getBVH()->nodes[0];
+    out_min = root.bmin;
+    out_max = root.bmax;
+}
+
+template <typename T>
+bool Geometry<T>::intersect(const pt::Ray<T>& ray, T& t_out, size_t& idx_t, const T& t_min, const T& t_max) const
+{
+    return primitives.getBVH()->intersect(primitives, ray, t_out, idx_t, t_min, t_max);
+}
+
+template class pt::Geometry<double>;
+template class pt::Geometry<float>;
+
+/* Instance impl */
+
+template <typename T>
+Instance<T>::Instance(const std::shared_ptr<const Geometry<T>>& _geometry, const Transform<T>& to_world, int _material)
+    : geometry(_geometry), to_object(to_world.inverse()), material(_material)
+{
+    ptvec<T> lo, hi;
+    geometry->bounds(lo, hi);
+    
+    bmin = ptvec<T>(std::numeric_limits<T>::max());
+    bmax = ptvec<T>(-std::numeric_limits<T>::max());
+    
+    /* box of the eight corners in world space */
+    for (int i = 0; i < 8; ++i)
+    {
+        ptvec<T> corner = to_world.point(ptvec<T>((i & 1) ? hi.x : lo.x, (i & 2) ? hi.y : lo.y, (i & 4) ? hi.z : lo.z));
+        bmin = glm::min(bmin, corner);
+        bmax = glm::max(bmax, corner);
+    }
+}
+
+template <typename T>
+bool Instance<T>::intersect(const pt::Ray<T>& ray, T& t_out, size_t& idx_t, const T& t_min, const T& t_max) const
+{
+    return geometry->intersect(Ray<T>(to_object.point(ray.origin), to_object.vector(ray.dir)), t_out, idx_t, t_min, t_max);
+}
+
+template <typename T>
+ptvec<T> Instance<T>::normalAt(size_t idx, const ptvec<T>& point) const
+{
+    ptvec<T> normal = geometry->primitives[idx]->normalAt(to_object.point(point));
+    return glm::normalize(to_object.normalFromInverse(normal));
+}
+
+template class pt::Instance<double>;
+template class pt::Instance<float>;
+
+/* InstanceList impl */
+
+template <typename T>
+void InstanceList<T>::build(BVHBuild method)
+{
+    std::vector<ptvec<T>> bmin(this->size()), bmax(this->size());
+    
+    for (size_t i = 0; i < this->size(); ++i)
+    {
+        bmin[i] = (*this)[i].bmin;
+        bmax[i] = (*this)[i].bmax;
+    }
+    
+    bvh.build(bmin, bmax, method);
+}
+
+template <typename T>
+bool InstanceList<T>::intersect_simple(const pt::Ray<T>& ray, T& t_out, Hit& hit, const T& t_min, const T& t_max) const
+{
+    T t_far = t_max;
+    T temp_t;
+    size_t prim;
+    t_out = std::numeric_limits<T>::infinity();
+    
+    PT_STAGE(STAGE_INTERSECT);
+    PT_COUNT(PT_COUNTER_RAYS, 1);
+    
+    auto test = [&](size_t i, T& t_hit)
+    {
+        if (!(*this)[i].intersect(ray, temp_t, prim, t_min, t_hit)) return false;
+        hit.instance = i;
+        hit.primitive = prim;
+        t_hit = temp_t;
+        return true;
+    };
+    
+    bool has_hit = false;
+    
+    if (bvh.covers(this->size()))
+    {
+        has_hit = bvh.traverse(ray, t_min, t_far, test);
+    }
+    else
+    {
+        for (size_t i = 0; i < this->size(); ++i) has_hit |= test(i, t_far);
+    }
+    
+    if (has_hit) t_out = t_far;
+    return has_hit;
+}
+
+template class pt::InstanceList<double>;
+template class pt::InstanceList<float>;